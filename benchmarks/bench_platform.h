@@ -0,0 +1,77 @@
+/*
+ * In-memory loopback transport of the nanoMODBUS benchmarks.
+ *
+ * The functions are static inline so that, when this header is passed to nanomodbus.c with
+ * NMBS_PLATFORM_HEADER="bench_platform.h", they are bound at compile time through NMBS_PLATFORM_READ and
+ * NMBS_PLATFORM_WRITE and inlined in the request path.
+ */
+
+#ifndef BENCH_PLATFORM_H
+#define BENCH_PLATFORM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nanomodbus.h"
+
+typedef struct loopback_t {
+    uint8_t buf[1024];
+    uint16_t idx;
+    uint16_t len;
+} loopback_t;
+
+extern loopback_t to_server;
+extern loopback_t to_client;
+
+extern nmbs_t server;
+extern nmbs_t client;
+
+
+static inline int32_t loopback_read(loopback_t* lb, uint8_t* buf, uint16_t count) {
+    uint16_t n = lb->len - lb->idx;
+    if (n > count)
+        n = count;
+
+    memcpy(buf, lb->buf + lb->idx, n);
+    lb->idx += n;
+    if (lb->idx == lb->len)
+        lb->idx = lb->len = 0;
+
+    return n;
+}
+
+
+static inline int32_t loopback_write(loopback_t* lb, const uint8_t* buf, uint16_t count) {
+    if (lb->len + count > sizeof(lb->buf))
+        return -1;
+
+    memcpy(lb->buf + lb->len, buf, count);
+    lb->len += count;
+    return count;
+}
+
+
+// The platform arg of each instance points to the instance itself
+static inline int32_t bench_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    (void) timeout_ms;
+
+    if (arg == &server)
+        return loopback_read(&to_server, buf, count);
+
+    // The request was sent, let the server handle it
+    if (to_client.len == 0 && to_server.len != 0)
+        nmbs_server_poll(&server);
+
+    return loopback_read(&to_client, buf, count);
+}
+
+
+static inline int32_t bench_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    (void) timeout_ms;
+    return loopback_write(arg == &server ? &to_client : &to_server, buf, count);
+}
+
+#define NMBS_PLATFORM_READ(buf, count, timeout_ms, arg) bench_read(buf, count, timeout_ms, arg)
+#define NMBS_PLATFORM_WRITE(buf, count, timeout_ms, arg) bench_write(buf, count, timeout_ms, arg)
+
+#endif    // BENCH_PLATFORM_H
@@ -0,0 +1,477 @@
+/*
+ * Benchmarks of the nanoMODBUS client/server request round trip, and of some of the hot paths of the library.
+ *
+ * Client and server run in the same thread, connected by an in-memory loopback transport: the server is polled from
+ * within the client read() function, when the client waits for a response. No syscalls are involved, so the results
+ * only measure the library.
+ *
+ * Usage: nanomodbus_bench [iterations]
+ *
+ * Every result is printed to stdout as a JSON object on its own line, e.g.
+ * {"name": "fc03_read_holding_registers", "config": "default", "transport": "rtu", "quantity": 125,
+ *  "iterations": 100000, "requests_per_s": 512345.6, "p50_ns": 1890, "p99_ns": 2101, "p999_ns": 4510}
+ *
+ * nanomodbus_bench_rtu_static runs the same requests with the library built for RTU only, with the loopback transport
+ * bound at compile time (config "rtu_static"). The bench_size target prints the code size of the library in each
+ * configuration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_platform.h"
+#include "nanomodbus.h"
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+// Name of the library build configuration, reported with each request result
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "default"
+#endif
+
+#define ITERATIONS_DEFAULT 100000
+#define MICRO_ITERATIONS_MULTIPLIER 10
+
+loopback_t to_server;
+loopback_t to_client;
+
+nmbs_t server;
+nmbs_t client;
+
+uint16_t server_registers[0x10000];
+nmbs_bitfield server_coils;
+
+uint64_t* latencies_ns;
+uint32_t iterations = ITERATIONS_DEFAULT;
+
+volatile uint32_t sink;
+
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+
+// Loopback transport
+
+int32_t bytes_available_client(void* arg) {
+    UNUSED_PARAM(arg);
+    return to_client.len - to_client.idx;
+}
+
+
+// Server callbacks
+
+nmbs_error read_coils(uint16_t address, uint16_t quantity, nmbs_bitfield coils_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    for (uint16_t i = 0; i < quantity; i++)
+        nmbs_bitfield_write(coils_out, i, nmbs_bitfield_read(server_coils, (address + i) % NMBS_BITFIELD_MAX));
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_single_coil(uint16_t address, bool value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    nmbs_bitfield_write(server_coils, address % NMBS_BITFIELD_MAX, value);
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_multiple_coils(uint16_t address, uint16_t quantity, const nmbs_bitfield coils, uint8_t unit_id,
+                                void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    for (uint16_t i = 0; i < quantity; i++)
+        nmbs_bitfield_write(server_coils, (address + i) % NMBS_BITFIELD_MAX, nmbs_bitfield_read(coils, i));
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    memcpy(registers_out, server_registers + address, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_single_register(uint16_t address, uint16_t value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    server_registers[address] = value;
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_multiple_registers(uint16_t address, uint16_t quantity, const uint16_t* registers, uint8_t unit_id,
+                                    void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    memcpy(server_registers + address, registers, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_file_record(uint16_t file_number, uint16_t record_number, uint16_t* registers, uint16_t count,
+                            uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(file_number);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    memcpy(registers, server_registers + record_number, count * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_file_record(uint16_t file_number, uint16_t record_number, const uint16_t* registers, uint16_t count,
+                             uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(file_number);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    memcpy(server_registers + record_number, registers, count * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_device_identification(uint8_t object_id, char buffer[NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH]) {
+    static const char* objects[] = {"nanoMODBUS", "bench", "1.0"};
+    if (object_id > 2)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    strcpy(buffer, objects[object_id]);
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_device_identification_map(nmbs_bitfield_256 map) {
+    nmbs_bitfield_set(map, 0);
+    nmbs_bitfield_set(map, 1);
+    nmbs_bitfield_set(map, 2);
+    return NMBS_ERROR_NONE;
+}
+
+
+// Requests
+
+uint16_t registers[125];
+float values_f32[62];
+nmbs_bitfield coils;
+char strings[3][NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH];
+
+nmbs_error req_read_coils(uint16_t quantity) {
+    return nmbs_read_coils(&client, 0, quantity, coils);
+}
+
+
+nmbs_error req_read_discrete_inputs(uint16_t quantity) {
+    return nmbs_read_discrete_inputs(&client, 0, quantity, coils);
+}
+
+
+nmbs_error req_read_holding_registers(uint16_t quantity) {
+    return nmbs_read_holding_registers(&client, 0, quantity, registers);
+}
+
+
+// Quantity of float values, 2 registers each
+nmbs_error req_read_holding_registers_f32(uint16_t quantity) {
+    return nmbs_read_holding_registers_typed(&client, 0, quantity, NMBS_VALUE_F32, NMBS_WORD_ORDER_CDAB, values_f32);
+}
+
+
+nmbs_error req_read_input_registers(uint16_t quantity) {
+    return nmbs_read_input_registers(&client, 0, quantity, registers);
+}
+
+
+nmbs_error req_write_single_coil(uint16_t quantity) {
+    UNUSED_PARAM(quantity);
+    return nmbs_write_single_coil(&client, 0, true);
+}
+
+
+nmbs_error req_write_single_register(uint16_t quantity) {
+    UNUSED_PARAM(quantity);
+    return nmbs_write_single_register(&client, 0, 0x1234);
+}
+
+
+nmbs_error req_write_multiple_coils(uint16_t quantity) {
+    return nmbs_write_multiple_coils(&client, 0, quantity, coils);
+}
+
+
+nmbs_error req_write_multiple_registers(uint16_t quantity) {
+    return nmbs_write_multiple_registers(&client, 0, quantity, registers);
+}
+
+
+nmbs_error req_read_file_record(uint16_t quantity) {
+    return nmbs_read_file_record(&client, 1, 0, registers, quantity);
+}
+
+
+nmbs_error req_write_file_record(uint16_t quantity) {
+    return nmbs_write_file_record(&client, 1, 0, registers, quantity);
+}
+
+
+nmbs_error req_read_write_registers(uint16_t quantity) {
+    return nmbs_read_write_registers(&client, 0, quantity, registers, 200, quantity > 121 ? 121 : quantity, registers);
+}
+
+
+nmbs_error req_read_device_identification(uint16_t quantity) {
+    UNUSED_PARAM(quantity);
+    return nmbs_read_device_identification_basic(&client, strings[0], strings[1], strings[2],
+                                                 NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH);
+}
+
+
+typedef struct bench_t {
+    const char* name;
+    nmbs_error (*request)(uint16_t quantity);
+    uint16_t quantities[3];
+} bench_t;
+
+const bench_t benches[] = {
+        {"fc01_read_coils", req_read_coils, {1, 100, 2000}},
+        {"fc02_read_discrete_inputs", req_read_discrete_inputs, {1, 100, 2000}},
+        {"fc03_read_holding_registers", req_read_holding_registers, {1, 10, 125}},
+        {"fc03_read_holding_registers_f32", req_read_holding_registers_f32, {1, 5, 62}},
+        {"fc04_read_input_registers", req_read_input_registers, {1, 10, 125}},
+        {"fc05_write_single_coil", req_write_single_coil, {1}},
+        {"fc06_write_single_register", req_write_single_register, {1}},
+        {"fc15_write_multiple_coils", req_write_multiple_coils, {1, 100, 1968}},
+        {"fc16_write_multiple_registers", req_write_multiple_registers, {1, 10, 123}},
+        {"fc20_read_file_record", req_read_file_record, {1, 10, 124}},
+        {"fc21_write_file_record", req_write_file_record, {1, 10, 122}},
+        {"fc23_read_write_registers", req_read_write_registers, {1, 10, 125}},
+        {"fc43_read_device_identification", req_read_device_identification, {1}},
+};
+
+
+int compare_u64(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+
+void create_client_and_server(nmbs_transport transport) {
+    nmbs_platform_conf server_conf;
+    nmbs_platform_conf_create(&server_conf);
+    server_conf.transport = transport;
+    server_conf.read = bench_read;
+    server_conf.write = bench_write;
+    server_conf.arg = &server;
+
+    nmbs_platform_conf client_conf = server_conf;
+    client_conf.bytes_available = bytes_available_client;
+    client_conf.arg = &client;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_coils = read_coils;
+    callbacks.read_discrete_inputs = read_coils;
+    callbacks.read_holding_registers = read_registers;
+    callbacks.read_input_registers = read_registers;
+    callbacks.write_single_coil = write_single_coil;
+    callbacks.write_single_register = write_single_register;
+    callbacks.write_multiple_coils = write_multiple_coils;
+    callbacks.write_multiple_registers = write_multiple_registers;
+    callbacks.read_file_record = read_file_record;
+    callbacks.write_file_record = write_file_record;
+    callbacks.read_device_identification = read_device_identification;
+    callbacks.read_device_identification_map = read_device_identification_map;
+
+    memset(&to_server, 0, sizeof(to_server));
+    memset(&to_client, 0, sizeof(to_client));
+
+    if (nmbs_server_create(&server, 1, &server_conf, &callbacks) != NMBS_ERROR_NONE ||
+        nmbs_client_create(&client, &client_conf) != NMBS_ERROR_NONE) {
+        fprintf(stderr, "Error creating client and server\n");
+        exit(1);
+    }
+
+    nmbs_set_destination_rtu_address(&client, 1);
+    nmbs_set_read_timeout(&client, 0);
+    nmbs_set_byte_timeout(&client, 0);
+    nmbs_set_read_timeout(&server, 0);
+    nmbs_set_byte_timeout(&server, 0);
+}
+
+
+int run_bench(const bench_t* bench, const char* transport, uint16_t quantity) {
+    // Warm up the caches and check the request works
+    for (uint32_t i = 0; i < iterations / 100 + 1; i++) {
+        const nmbs_error err = bench->request(quantity);
+        if (err != NMBS_ERROR_NONE) {
+            fprintf(stderr, "%s on %s with quantity %d failed - %s\n", bench->name, transport, quantity,
+                    nmbs_strerror(err));
+            return 1;
+        }
+    }
+
+    uint32_t errors = 0;
+    const uint64_t start = now_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        const uint64_t req_start = now_ns();
+        errors += bench->request(quantity) != NMBS_ERROR_NONE;
+        latencies_ns[i] = now_ns() - req_start;
+    }
+    const uint64_t total_ns = now_ns() - start;
+
+    if (errors != 0) {
+        fprintf(stderr, "%s on %s with quantity %d failed %u times\n", bench->name, transport, quantity, errors);
+        return 1;
+    }
+
+    qsort(latencies_ns, iterations, sizeof(uint64_t), compare_u64);
+
+    printf("{\"name\": \"%s\", \"config\": \"%s\", \"transport\": \"%s\", \"quantity\": %d, \"iterations\": %u, "
+           "\"requests_per_s\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}\n",
+           bench->name, BENCH_CONFIG, transport, quantity, iterations, (double) iterations * 1e9 / (double) total_ns,
+           (unsigned long long) latencies_ns[iterations / 2], (unsigned long long) latencies_ns[iterations * 99 / 100],
+           (unsigned long long) latencies_ns[iterations * 999 / 1000]);
+
+    return 0;
+}
+
+
+void print_micro(const char* name, uint32_t size, uint32_t count, uint64_t total_ns) {
+    printf("{\"name\": \"%s\", \"size\": %u, \"iterations\": %u, \"ns_per_op\": %.2f, \"mb_per_s\": %.1f}\n", name,
+           size, count, (double) total_ns / (double) count, (double) size * count * 1e3 / (double) total_ns);
+}
+
+
+void run_micro_benches(void) {
+    const uint32_t count = iterations * MICRO_ITERATIONS_MULTIPLIER;
+
+    uint8_t data[256];
+    for (uint16_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t) (i * 7);
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        data[0] = (uint8_t) i;
+        sink += nmbs_crc_calc(data, sizeof(data), NULL);
+    }
+    print_micro("crc_calc", sizeof(data), count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        data[0] = (uint8_t) i;
+        sink += nmbs_crc_update(NMBS_CRC_INIT, data, 8);
+    }
+    print_micro("crc_update", 8, count, now_ns() - start);
+
+    // Same conversion as the one applied to registers sent and received by the library
+    uint8_t registers_be[250];
+    for (uint16_t i = 0; i < 125; i++)
+        registers[i] = i;
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        registers[0] = (uint16_t) i;
+        nmbs_registers_to_be(registers_be, registers, 125);
+        sink += registers_be[1];
+    }
+    print_micro("registers_to_be", sizeof(registers_be), count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        registers[0] = (uint16_t) i;
+        nmbs_regs_to_f32(values_f32, registers, 62, NMBS_WORD_ORDER_CDAB);
+        sink += (uint32_t) values_f32[0];
+    }
+    print_micro("regs_to_f32", sizeof(values_f32), count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        values_f32[0] = (float) i;
+        nmbs_f32_to_regs(registers, values_f32, 62, NMBS_WORD_ORDER_CDAB);
+        sink += registers[0];
+    }
+    print_micro("f32_to_regs", sizeof(values_f32), count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint16_t b = 0; b < NMBS_BITFIELD_MAX; b++)
+            nmbs_bitfield_write(coils, b, (b ^ i) & 1);
+
+        sink += coils[0];
+    }
+    print_micro("bitfield_write", NMBS_BITFIELD_BYTES_MAX, count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        coils[0] = (uint8_t) i;
+        uint32_t set = 0;
+        for (uint16_t b = 0; b < NMBS_BITFIELD_MAX; b++)
+            set += nmbs_bitfield_read(coils, b);
+
+        sink += set;
+    }
+    print_micro("bitfield_read", NMBS_BITFIELD_BYTES_MAX, count, now_ns() - start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        coils[0] = (uint8_t) i;
+        nmbs_bitfield_copy(server_coils, 5, coils, 3, NMBS_BITFIELD_MAX - 8);
+        sink += server_coils[1];
+    }
+    print_micro("bitfield_copy_unaligned", NMBS_BITFIELD_BYTES_MAX, count, now_ns() - start);
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        iterations = (uint32_t) strtoul(argv[1], NULL, 10);
+        if (iterations == 0) {
+            fprintf(stderr, "Usage: nanomodbus_bench [iterations]\n");
+            return 1;
+        }
+    }
+
+    latencies_ns = malloc(iterations * sizeof(uint64_t));
+    if (!latencies_ns) {
+        fprintf(stderr, "Error allocating latencies buffer\n");
+        return 1;
+    }
+
+#if defined(NMBS_TRANSPORT_RTU_ONLY)
+    const nmbs_transport transports[1] = {NMBS_TRANSPORT_RTU};
+    const char* transports_str[1] = {"rtu"};
+#elif defined(NMBS_TRANSPORT_TCP_ONLY)
+    const nmbs_transport transports[1] = {NMBS_TRANSPORT_TCP};
+    const char* transports_str[1] = {"tcp"};
+#else
+    const nmbs_transport transports[2] = {NMBS_TRANSPORT_RTU, NMBS_TRANSPORT_TCP};
+    const char* transports_str[2] = {"rtu", "tcp"};
+#endif
+
+    int ret = 0;
+    for (size_t t = 0; t < sizeof(transports) / sizeof(nmbs_transport) && ret == 0; t++) {
+        create_client_and_server(transports[t]);
+
+        for (size_t b = 0; b < sizeof(benches) / sizeof(bench_t) && ret == 0; b++) {
+            for (int q = 0; q < 3 && benches[b].quantities[q] != 0 && ret == 0; q++)
+                ret = run_bench(&benches[b], transports_str[t], benches[b].quantities[q]);
+        }
+    }
+
+    if (ret == 0)
+        run_micro_benches();
+
+    free(latencies_ns);
+
+    return ret;
+}
@@ -0,0 +1,60 @@
+#include "bank_seqlock.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void) 0)
+#endif
+
+
+void bank_seqlock_attach(bank_seqlock_t* lock, nmbs_register_bank* bank) {
+    lock->seq = 0;
+
+    bank->read_begin = bank_seqlock_read_begin;
+    bank->read_end = bank_seqlock_read_end;
+    bank->write_begin = bank_seqlock_write_begin;
+    bank->write_end = bank_seqlock_write_end;
+    bank->sync_arg = lock;
+}
+
+
+uint32_t bank_seqlock_read_begin(void* arg) {
+    bank_seqlock_t* lock = arg;
+    while (true) {
+        uint32_t seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0)
+            return seq;
+
+        CPU_RELAX();
+    }
+}
+
+
+bool bank_seqlock_read_end(uint32_t token, void* arg) {
+    bank_seqlock_t* lock = arg;
+    // The values must be read before the counter is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) == token;
+}
+
+
+void bank_seqlock_write_begin(void* arg) {
+    bank_seqlock_t* lock = arg;
+    while (true) {
+        uint32_t seq = __atomic_load_n(&lock->seq, __ATOMIC_RELAXED);
+        if ((seq & 1) == 0 &&
+            __atomic_compare_exchange_n(&lock->seq, &seq, seq + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+
+        CPU_RELAX();
+    }
+
+    // The values must not be changed before readers can see the odd counter
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+void bank_seqlock_write_end(void* arg) {
+    bank_seqlock_t* lock = arg;
+    __atomic_fetch_add(&lock->seq, 1, __ATOMIC_RELEASE);
+}
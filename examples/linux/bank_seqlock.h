@@ -0,0 +1,63 @@
+/*
+ * Seqlock for register banks shared between servers running on different threads, e.g. the shards in tcp_shards.h.
+ *
+ * Readers never block writers nor each other: a response is copied from the bank, and copied again if a write
+ * happened in the meantime, so it is always a consistent snapshot of the requested range. Writers are serialized by
+ * the sequence counter itself. Application threads updating the bank use bank_seqlock_write_begin() and
+ * bank_seqlock_write_end() around their changes.
+ *
+ */
+
+#ifndef NANOMODBUS_BANK_SEQLOCK_H
+#define NANOMODBUS_BANK_SEQLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nanomodbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Seqlock instance. All struct members are to be considered private.
+ */
+typedef struct bank_seqlock_t {
+    uint32_t seq;    // Odd while a write is in progress
+} bank_seqlock_t;
+
+
+/** Initialize a seqlock and set it as the sync hooks of a register bank.
+ * @param lock pointer to the bank_seqlock_t instance
+ * @param bank pointer to the nmbs_register_bank to protect
+ */
+void bank_seqlock_attach(bank_seqlock_t* lock, nmbs_register_bank* bank);
+
+/** Wait for the write in progress, if any, and return the token to pass to bank_seqlock_read_end().
+ * @param arg pointer to the bank_seqlock_t instance
+ */
+uint32_t bank_seqlock_read_begin(void* arg);
+
+/** Return true if no write happened since bank_seqlock_read_begin() returned the token, false if the read has to be
+ * repeated.
+ * @param token token returned by bank_seqlock_read_begin()
+ * @param arg pointer to the bank_seqlock_t instance
+ */
+bool bank_seqlock_read_end(uint32_t token, void* arg);
+
+/** Wait for the other writers, and start a write.
+ * @param arg pointer to the bank_seqlock_t instance
+ */
+void bank_seqlock_write_begin(void* arg);
+
+/** End the write started by bank_seqlock_write_begin().
+ * @param arg pointer to the bank_seqlock_t instance
+ */
+void bank_seqlock_write_end(void* arg);
+
+#ifdef __cplusplus
+}    // extern "C"
+#endif
+
+#endif    // NANOMODBUS_BANK_SEQLOCK_H
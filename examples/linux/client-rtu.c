@@ -0,0 +1,85 @@
+/*
+ * This example application sends requests to the modbus RTU server with the specified address over a serial line, and
+ * prints the average duration of a transaction.
+ *
+ * The platform functions of serial_port.h receive whole RTU frames with read_frame(), so a transaction costs a few
+ * syscalls and the latency of the serial adapter, lowered with ASYNC_LOW_LATENCY when the driver supports it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nanomodbus.h"
+#include "serial_port.h"
+
+#define TRANSACTIONS 100
+
+
+static uint64_t now_us(void) {
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) (ts.tv_sec) * 1000000 + (uint64_t) (ts.tv_nsec) / 1000;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: client-rtu [serial device] [baud rate] [parity] [server address] [rs485]\n");
+        return 1;
+    }
+
+    serial_port_t serial;
+    const uint32_t baud_rate = (uint32_t) strtoul(argv[2], NULL, 10);
+    const bool rs485 = argc > 5 && strcmp(argv[5], "rs485") == 0;
+    int ret = serial_port_open(&serial, argv[1], baud_rate, argv[3][0], rs485, true);
+    if (ret != 0) {
+        fprintf(stderr, "Error opening serial device - %s\n", strerror(ret));
+        return 1;
+    }
+
+    if (!serial.low_latency)
+        printf("ASYNC_LOW_LATENCY not supported by the serial driver\n");
+
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    serial_port_platform_conf(&platform_conf, &serial, true);
+
+    // Create the modbus client
+    nmbs_t nmbs;
+    nmbs_error err = nmbs_client_create(&nmbs, &platform_conf);
+    if (err != NMBS_ERROR_NONE) {
+        fprintf(stderr, "Error creating modbus client\n");
+        return 1;
+    }
+
+    nmbs_set_destination_rtu_address(&nmbs, (uint8_t) atoi(argv[4]));
+    nmbs_set_read_timeout(&nmbs, 1000);
+    nmbs_set_baud_rate(&nmbs, baud_rate);
+
+    // Read 2 holding registers from address 26
+    uint16_t r_regs[2];
+    uint64_t elapsed_us = 0;
+    for (int i = 0; i < TRANSACTIONS; i++) {
+        const uint64_t start = now_us();
+        err = nmbs_read_holding_registers(&nmbs, 26, 2, r_regs);
+        elapsed_us += now_us() - start;
+
+        if (err != NMBS_ERROR_NONE) {
+            fprintf(stderr, "Error reading 2 holding registers at address 26 - %s\n", nmbs_strerror(err));
+            serial_port_close(&serial);
+            return 1;
+        }
+    }
+
+    printf("Register at address 26: %d\n", r_regs[0]);
+    printf("Register at address 27: %d\n", r_regs[1]);
+    printf("Average transaction time: %llu us\n", (unsigned long long) (elapsed_us / TRANSACTIONS));
+
+    serial_port_close(&serial);
+
+    // No need to destroy the nmbs instance, bye bye
+    return 0;
+}
@@ -29,7 +29,10 @@ int main(int argc, char* argv[]) {
     nmbs_platform_conf_create(&platform_conf);
     platform_conf.transport = NMBS_TRANSPORT_TCP;
     platform_conf.read = read_fd_linux;
+    platform_conf.read_frame = read_frame_fd_linux;
     platform_conf.write = write_fd_linux;
+    platform_conf.writev = writev_fd_linux;
+    platform_conf.bytes_available = bytes_available_fd_linux;
     platform_conf.arg = conn;    // Passing our TCP connection handle to the read/write functions
 
     // Create the modbus client
@@ -0,0 +1,126 @@
+/*
+ * This example application forwards the requests of Modbus TCP clients connected to the specified address and port to
+ * the RTU servers on a serial line, using nmbs_gateway and the epoll-based engine in tcp_engine.h
+ *
+ * Unit IDs 1 to 247 are routed to the RTU server with the same address. Requests of concurrent TCP clients are queued,
+ * and sent on the serial line back to back, one client at a time.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nanomodbus.h"
+#include "serial_port.h"
+#include "tcp_engine.h"
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+#define CONNECTIONS_MAX 256
+#define IDLE_TIMEOUT_MS 60000
+#define REQUESTS_MAX 64
+#define RESPONSE_TIMEOUT_MS 500
+
+volatile sig_atomic_t terminate = 0;
+
+static tcp_engine_conn_t connections[CONNECTIONS_MAX];
+static nmbs_gateway_req requests[REQUESTS_MAX];
+static nmbs_gateway_route routes[247];
+
+
+void sighandler(int s) {
+    UNUSED_PARAM(s);
+    terminate = 1;
+}
+
+
+uint32_t time_ms(void* arg) {
+    UNUSED_PARAM(arg);
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) (ts.tv_sec) * 1000 + (uint64_t) (ts.tv_nsec) / 1000000);
+}
+
+
+int main(int argc, char* argv[]) {
+    signal(SIGTERM, sighandler);
+    signal(SIGINT, sighandler);
+    signal(SIGQUIT, sighandler);
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: gateway-tcp-rtu [address] [port] [serial device] [baud rate] [parity]\n");
+        return 1;
+    }
+
+    uint32_t baud_rate = argc > 4 ? (uint32_t) strtoul(argv[4], NULL, 10) : 19200;
+    char parity = argc > 5 ? argv[5][0] : 'E';
+
+    serial_port_t serial;
+    int ret = serial_port_open(&serial, argv[3], baud_rate, parity, false, true);
+    if (ret != 0) {
+        fprintf(stderr, "Error opening serial device - %s\n", strerror(ret));
+        return 1;
+    }
+
+    // The gateway polls the line without blocking, so responses are received with read() as bytes arrive
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    serial_port_platform_conf(&platform_conf, &serial, false);
+    platform_conf.time_ms = time_ms;
+
+    nmbs_t line_client;
+    nmbs_error err = nmbs_client_create(&line_client, &platform_conf);
+    if (err != NMBS_ERROR_NONE) {
+        fprintf(stderr, "Error creating modbus client\n");
+        return 1;
+    }
+
+    nmbs_set_read_timeout(&line_client, RESPONSE_TIMEOUT_MS);
+    nmbs_set_byte_timeout(&line_client, 100);
+
+    for (uint8_t i = 0; i < 247; i++) {
+        routes[i].unit_id = i + 1;
+        routes[i].line = 0;
+        routes[i].address_rtu = i + 1;
+    }
+
+    tcp_engine_t engine;
+    ret = tcp_engine_create(&engine, argv[1], argv[2], connections, CONNECTIONS_MAX, NULL, IDLE_TIMEOUT_MS);
+    if (ret != 0) {
+        fprintf(stderr, "Error creating TCP server - %s\n", strerror(ret));
+        return 1;
+    }
+
+    nmbs_gateway_line line;
+    nmbs_gateway_line_create(&line, &line_client);
+
+    nmbs_gateway gateway;
+    err = nmbs_gateway_create(&gateway, &line, 1, routes, 247, requests, REQUESTS_MAX, tcp_engine_gateway_callback,
+                              &engine);
+    if (err != NMBS_ERROR_NONE) {
+        fprintf(stderr, "Error creating gateway\n");
+        return 1;
+    }
+
+    tcp_engine_set_gateway(&engine, &gateway);
+
+    printf("Modbus TCP to RTU gateway started on port %d\n", tcp_engine_port(&engine));
+
+    while (!terminate) {
+        // Wake up periodically to check for termination. The engine wakes up more often while requests are in progress
+        ret = tcp_engine_run_once(&engine, 1000);
+        if (ret != 0) {
+            fprintf(stderr, "Error serving connections - %s\n", strerror(ret));
+            break;
+        }
+    }
+
+    tcp_engine_destroy(&engine);
+    serial_port_close(&serial);
+    printf("Gateway closed\n");
+
+    return 0;
+}
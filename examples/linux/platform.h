@@ -8,8 +8,10 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "nanomodbus.h"
@@ -194,7 +196,7 @@ int32_t read_fd_linux(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* ar
         }
 
         if (ret == 1) {
-            ssize_t r = read(fd, buf + total, 1);
+            ssize_t r = read(fd, buf + total, count - total);
             if (r == 0) {
                 disconnect(arg);
                 return 0;
@@ -213,6 +215,33 @@ int32_t read_fd_linux(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* ar
 }
 
 
+// Reads the MBAP header, then the rest of the message at once using the length field of the header
+int32_t read_frame_fd_linux(uint8_t* buf, uint16_t max_count, int32_t timeout_ms, void* arg) {
+    if (max_count < 8)
+        return -1;
+
+    // Nothing received within the timeout
+    int32_t ret = read_fd_linux(buf, 7, timeout_ms, arg);
+    if (ret <= 0)
+        return ret;
+
+    // A frame cut short is not passed on, its truncated length would look like a whole frame
+    if (ret < 7)
+        return -1;
+
+    // The length field counts the unit ID, already read, and the PDU
+    const uint16_t length = (uint16_t) ((buf[4] << 8) | buf[5]);
+    if (length < 2 || length + 6 > max_count)
+        return -1;
+
+    ret = read_fd_linux(buf + 7, length - 1, timeout_ms, arg);
+    if (ret != length - 1)
+        return -1;
+
+    return 6 + length;
+}
+
+
 int32_t write_fd_linux(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
     int fd = *(int*) arg;
 
@@ -253,3 +282,53 @@ int32_t write_fd_linux(const uint8_t* buf, uint16_t count, int32_t timeout_ms, v
 
     return total;
 }
+
+
+// Sends all the buffers in a single syscall, so they end up in the same TCP segment
+int32_t writev_fd_linux(const nmbs_iovec* iov, uint8_t iov_count, int32_t timeout_ms, void* arg) {
+    struct iovec vec[3];
+    uint16_t count = 0;
+    if (iov_count > 3)
+        return -1;
+
+    for (uint8_t i = 0; i < iov_count; i++) {
+        vec[i].iov_base = (void*) (uintptr_t) iov[i].data;
+        vec[i].iov_len = iov[i].length;
+        count += iov[i].length;
+    }
+
+    int fd = *(int*) arg;
+    ssize_t w = writev(fd, vec, iov_count);
+    if (w < 0)
+        return -1;
+
+    // Short writes are unlikely on a blocking socket, send the rest one buffer at a time
+    uint16_t total = (uint16_t) w;
+    uint16_t offset = 0;
+    for (uint8_t i = 0; i < iov_count && total < count; i++) {
+        if (total < offset + iov[i].length) {
+            const uint16_t skip = total - offset;
+            int32_t ret = write_fd_linux(iov[i].data + skip, iov[i].length - skip, timeout_ms, arg);
+            if (ret < 0)
+                return ret;
+
+            total += ret;
+            if (ret < iov[i].length - skip)
+                return total;
+        }
+
+        offset += iov[i].length;
+    }
+
+    return total;
+}
+
+
+int32_t bytes_available_fd_linux(void* arg) {
+    int fd = *(int*) arg;
+    int available = 0;
+    if (ioctl(fd, FIONREAD, &available) != 0)
+        return -1;
+
+    return available;
+}
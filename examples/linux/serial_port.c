@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+
+#include "serial_port.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+
+static const struct {
+    uint32_t baud_rate;
+    speed_t speed;
+} speeds[] = {
+        {1200, B1200},     {2400, B2400},     {4800, B4800},     {9600, B9600},     {19200, B19200},
+        {38400, B38400},   {57600, B57600},   {115200, B115200}, {230400, B230400}, {460800, B460800},
+        {921600, B921600},
+};
+
+
+// Wait for received bytes for up to timeout_us, forever if < 0. Returns > 0 when bytes are available, 0 on timeout
+static int wait_readable(int fd, int64_t timeout_us) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    struct timespec ts = {(time_t) (timeout_us / 1000000), (long) (timeout_us % 1000000) * 1000};
+
+    int ret;
+    do {
+        ret = ppoll(&pfd, 1, timeout_us < 0 ? NULL : &ts, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0 && !(pfd.revents & POLLIN))
+        return -1;
+
+    return ret;
+}
+
+
+// Applies the Modbus character framing and the driver options to an open port. Returns 0 or an errno value
+static int configure(int fd, speed_t speed, char parity, bool rs485, bool* low_latency) {
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0)
+        return errno;
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tty.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    tty.c_cflag |= CLOCAL | CREAD | CS8;
+    if (parity == 'N')
+        tty.c_cflag |= CSTOPB;
+    else
+        tty.c_cflag |= parity == 'O' ? PARENB | PARODD : PARENB;
+
+    // Reads never block, waiting is done with ppoll() and a timeout in microseconds
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0)
+        return errno;
+
+    // Not supported by all drivers, the port still works with the default latency
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        *low_latency = ioctl(fd, TIOCSSERIAL, &serial) == 0;
+    }
+
+    if (rs485) {
+        struct serial_rs485 rs485_conf;
+        memset(&rs485_conf, 0, sizeof(rs485_conf));
+        rs485_conf.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+        if (ioctl(fd, TIOCSRS485, &rs485_conf) != 0)
+            return errno;
+    }
+
+    tcflush(fd, TCIOFLUSH);
+    return 0;
+}
+
+
+int serial_port_open(serial_port_t* port, const char* path, uint32_t baud_rate, char parity, bool rs485,
+                     bool responses) {
+    memset(port, 0, sizeof(serial_port_t));
+    port->fd = -1;
+
+    speed_t speed = B0;
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if (speeds[i].baud_rate == baud_rate)
+            speed = speeds[i].speed;
+    }
+
+    if (speed == B0 || (parity != 'N' && parity != 'E' && parity != 'O'))
+        return EINVAL;
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+
+    int err = configure(fd, speed, parity, rs485, &port->low_latency);
+    if (err != 0) {
+        close(fd);
+        return err;
+    }
+
+    uint32_t t15_us = 0;
+    nmbs_rtu_char_timings(baud_rate, &t15_us, &port->frame_gap_us);
+
+    port->fd = fd;
+    port->baud_rate = baud_rate;
+    port->responses = responses;
+    return 0;
+}
+
+
+void serial_port_close(serial_port_t* port) {
+    if (port->fd >= 0)
+        close(port->fd);
+
+    port->fd = -1;
+}
+
+
+void serial_port_platform_conf(nmbs_platform_conf* platform_conf, serial_port_t* port, bool read_frame) {
+    platform_conf->transport = NMBS_TRANSPORT_RTU;
+    platform_conf->read = serial_port_read;
+    platform_conf->write = serial_port_write;
+    platform_conf->bytes_available = serial_port_bytes_available;
+    platform_conf->drain = serial_port_drain;
+    platform_conf->read_frame = read_frame ? serial_port_read_frame : NULL;
+    platform_conf->arg = port;
+}
+
+
+int32_t serial_port_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    serial_port_t* port = arg;
+
+    uint16_t total = 0;
+    while (total != count) {
+        int ret = wait_readable(port->fd, timeout_ms < 0 ? -1 : (int64_t) timeout_ms * 1000);
+        if (ret == 0)
+            return total;
+
+        if (ret < 0)
+            return -1;
+
+        ssize_t r = read(port->fd, buf + total, count - total);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        total += (uint16_t) r;
+    }
+
+    return total;
+}
+
+
+// Reads bytes until the line stays silent for the frame gap. Returns the length of the frame, or < 0 on error
+static int32_t read_until_gap(serial_port_t* port, uint8_t* buf, uint16_t total, uint16_t max_count) {
+    while (total < max_count) {
+        ssize_t r = read(port->fd, buf + total, max_count - total);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        total += (uint16_t) r;
+        if (total < max_count) {
+            int ret = wait_readable(port->fd, port->frame_gap_us);
+            if (ret == 0)
+                break;
+
+            if (ret < 0)
+                return -1;
+        }
+    }
+
+    return total;
+}
+
+
+int32_t serial_port_read_frame(uint8_t* buf, uint16_t max_count, int32_t timeout_ms, void* arg) {
+    serial_port_t* port = arg;
+
+    int ret = wait_readable(port->fd, timeout_ms < 0 ? -1 : (int64_t) timeout_ms * 1000);
+    if (ret <= 0)
+        return ret;
+
+    const bool response = port->responses || port->next_response;
+    port->next_response = false;
+
+    uint16_t total = 0;
+    while (true) {
+        // Bytes needed to complete the frame or to tell its length. Frames of unknown length end with a silent interval
+        uint16_t needed = nmbs_rtu_frame_length(buf, total, response);
+        if (needed == 0 || needed > max_count)
+            return read_until_gap(port, buf, total, max_count);
+
+        // The running CRC of a whole frame, CRC included, is 0
+        if (total >= needed) {
+            if (total < 4 || nmbs_crc_update(NMBS_CRC_INIT, buf, total) != 0)
+                break;
+
+            // A server that doesn't answer a request lets the addressed unit respond. Broadcasts have no response
+            port->next_response = !port->responses && !response && buf[0] != 0;
+            return total;
+        }
+
+        ssize_t r = read(port->fd, buf + total, needed - total);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        total += (uint16_t) r;
+        if (total < needed) {
+            ret = wait_readable(port->fd, port->frame_gap_us);
+            if (ret == 0)
+                return total;
+
+            if (ret < 0)
+                return -1;
+        }
+    }
+
+    // Wrong prediction, e.g. a request received before the response expected by a server. Wait for the end of the frame
+    return read_until_gap(port, buf, total, max_count);
+}
+
+
+int32_t serial_port_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    serial_port_t* port = arg;
+
+    // A server answering a request, the next frame is a request
+    port->next_response = false;
+
+    uint16_t total = 0;
+    while (total != count) {
+        ssize_t w = write(port->fd, buf + total, count - total);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        total += (uint16_t) w;
+    }
+
+    return total;
+}
+
+
+int32_t serial_port_bytes_available(void* arg) {
+    serial_port_t* port = arg;
+
+    int pending = 0;
+    if (ioctl(port->fd, FIONREAD, &pending) != 0)
+        return -1;
+
+    return pending;
+}
+
+
+void serial_port_drain(void* arg) {
+    serial_port_t* port = arg;
+    tcflush(port->fd, TCIFLUSH);
+}
@@ -0,0 +1,97 @@
+/*
+ * Modbus RTU serial transport for Linux, on top of termios.
+ *
+ * The port is set to raw mode with the Modbus character framing: 8 data bits, 2 stop bits without parity or 1 with.
+ * The ASYNC_LOW_LATENCY flag is requested from the driver, which for USB adapters lowers the latency timer that
+ * otherwise holds received bytes for up to 16 ms. RS-485 transceivers can have their direction switched by the kernel
+ * driver with TIOCSRS485.
+ *
+ * serial_port_read_frame() receives a whole RTU frame in a few syscalls. Once the function code of the frame is known,
+ * the rest of the frame is read in a single call, and the 3.5 characters silent interval is only waited for when the
+ * length of the frame can't be told from its header, or when the frame doesn't end with a valid CRC at that length.
+ *
+ * On a server port, frames are requests, except after a request addressed to another unit, which is followed by the
+ * response of that unit on a multi-drop line. A request is considered addressed to another unit when nothing is sent
+ * before the next frame is read.
+ *
+ */
+
+#ifndef NANOMODBUS_SERIAL_PORT_H
+#define NANOMODBUS_SERIAL_PORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nanomodbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Serial port instance, passed as platform arg to the platform functions below.
+ * Members can be read, and frame_gap_us can be raised after serial_port_open().
+ */
+typedef struct serial_port_t {
+    int fd;
+    uint32_t baud_rate;
+    uint32_t frame_gap_us; /*!< Silent interval that ends a frame of unknown length, t3.5 by default */
+    bool responses;        /*!< Received frames are responses, set for clients */
+    bool low_latency;      /*!< The driver accepted ASYNC_LOW_LATENCY */
+    bool next_response;    /*!< Private, the next frame received by a server port is expected to be a response */
+} serial_port_t;
+
+
+/** Open and configure a serial port.
+ * @param port pointer to the serial_port_t instance
+ * @param path path of the serial device, e.g. /dev/ttyUSB0
+ * @param baud_rate baud rate, one of the standard rates from 1200 to 921600
+ * @param parity 'N', 'E' or 'O'
+ * @param rs485 true to have the driver switch the direction of an RS-485 transceiver with RTS
+ * @param responses true if the port is used by a client, to read responses, false for a server. Server ports also
+ * receive the responses of the other units on the line, see above
+ *
+ * @return 0 if successful, an errno value otherwise. EINVAL for an unsupported baud rate or parity
+ */
+int serial_port_open(serial_port_t* port, const char* path, uint32_t baud_rate, char parity, bool rs485,
+                     bool responses);
+
+/** Close a serial port.
+ * @param port pointer to the serial_port_t instance
+ */
+void serial_port_close(serial_port_t* port);
+
+/** Set the platform functions of a nmbs_platform_conf to the ones of a serial port, and the transport to RTU.
+ * read_frame is set as well, unless the instance is to be used by the nmbs_client_begin_*() or nmbs_gateway functions,
+ * that poll the transport without blocking.
+ * @param platform_conf pointer to the nmbs_platform_conf instance
+ * @param port pointer to the serial_port_t instance
+ * @param read_frame true to receive whole frames with serial_port_read_frame()
+ */
+void serial_port_platform_conf(nmbs_platform_conf* platform_conf, serial_port_t* port, bool read_frame);
+
+/** read platform function. Waits for the first byte for up to timeout_ms, then reads the bytes available at once.
+ */
+int32_t serial_port_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg);
+
+/** read_frame platform function. Waits for the first byte of a frame for up to timeout_ms, then receives the frame.
+ */
+int32_t serial_port_read_frame(uint8_t* buf, uint16_t max_count, int32_t timeout_ms, void* arg);
+
+/** write platform function.
+ */
+int32_t serial_port_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg);
+
+/** bytes_available platform function.
+ */
+int32_t serial_port_bytes_available(void* arg);
+
+/** drain platform function, discards the received bytes not read yet.
+ */
+void serial_port_drain(void* arg);
+
+#ifdef __cplusplus
+}    // extern "C"
+#endif
+
+#endif    // NANOMODBUS_SERIAL_PORT_H
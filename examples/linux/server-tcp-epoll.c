@@ -0,0 +1,136 @@
+/*
+ * This example application sets up a TCP server at the specified address and port, and serves modbus requests from
+ * thousands of concurrent modbus clients from a single thread, using the epoll-based engine in tcp_engine.h
+ *
+ * Each client connection gets its own nmbs_t instance, so a slow or misbehaving client never delays the others.
+ * All the connections share the same data model.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nanomodbus.h"
+#include "tcp_engine.h"
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+// The data model of this sever will support coils addresses 0 to 100 and registers addresses from 0 to 32
+#define COILS_ADDR_MAX 100
+#define REGS_ADDR_MAX 32
+
+// Max number of concurrent client connections, and their idle timeout
+#define CONNECTIONS_MAX 4096
+#define IDLE_TIMEOUT_MS 60000
+
+volatile sig_atomic_t terminate = 0;
+nmbs_bitfield server_coils = {0};
+uint16_t server_registers[REGS_ADDR_MAX + 1] = {0};
+
+// About 2.5 KB per connection
+static tcp_engine_conn_t connections[CONNECTIONS_MAX];
+
+
+void sighandler(int s) {
+    UNUSED_PARAM(s);
+    terminate = 1;
+}
+
+
+nmbs_error handle_read_coils(uint16_t address, uint16_t quantity, nmbs_bitfield coils_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(arg);
+    UNUSED_PARAM(unit_id);
+
+    if (address + quantity > COILS_ADDR_MAX + 1)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    nmbs_bitfield_copy(coils_out, 0, server_coils, address, quantity);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error handle_write_multiple_coils(uint16_t address, uint16_t quantity, const nmbs_bitfield coils, uint8_t unit_id,
+                                       void* arg) {
+    UNUSED_PARAM(arg);
+    UNUSED_PARAM(unit_id);
+
+    if (address + quantity > COILS_ADDR_MAX + 1)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    nmbs_bitfield_copy(server_coils, address, coils, 0, quantity);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+// Registers are copied straight from our register image to the response, swapping their bytes on the way
+nmbs_error handler_read_holding_registers(uint16_t address, uint16_t quantity, uint8_t* registers_be_out,
+                                          uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(arg);
+    UNUSED_PARAM(unit_id);
+
+    if (address + quantity > REGS_ADDR_MAX + 1)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    nmbs_registers_to_be(registers_be_out, server_registers + address, quantity);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error handle_write_multiple_registers(uint16_t address, uint16_t quantity, const uint16_t* registers,
+                                           uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(arg);
+    UNUSED_PARAM(unit_id);
+
+    if (address + quantity > REGS_ADDR_MAX + 1)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(server_registers + address, registers, quantity * sizeof(uint16_t));
+
+    return NMBS_ERROR_NONE;
+}
+
+
+int main(int argc, char* argv[]) {
+    signal(SIGTERM, sighandler);
+    signal(SIGINT, sighandler);
+    signal(SIGQUIT, sighandler);
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: server-tcp-epoll [address] [port]\n");
+        return 1;
+    }
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_coils = handle_read_coils;
+    callbacks.write_multiple_coils = handle_write_multiple_coils;
+    callbacks.read_holding_registers_be = handler_read_holding_registers;
+    callbacks.write_multiple_registers = handle_write_multiple_registers;
+
+    tcp_engine_t engine;
+    int ret = tcp_engine_create(&engine, argv[1], argv[2], connections, CONNECTIONS_MAX, &callbacks, IDLE_TIMEOUT_MS);
+    if (ret != 0) {
+        fprintf(stderr, "Error creating TCP server - %s\n", strerror(ret));
+        return 1;
+    }
+
+    printf("Modbus TCP server started on port %d\n", tcp_engine_port(&engine));
+
+    while (!terminate) {
+        // Wake up periodically to check for termination
+        ret = tcp_engine_run_once(&engine, 1000);
+        if (ret != 0) {
+            fprintf(stderr, "Error serving connections - %s\n", strerror(ret));
+            break;
+        }
+    }
+
+    tcp_engine_destroy(&engine);
+    printf("Server closed\n");
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * This example application sets up a TCP server at the specified address and port, and serves modbus requests on
+ * every core of the machine, using the SO_REUSEPORT shards in tcp_shards.h
+ *
+ * The data model is a register bank shared by all the shards, protected by the seqlock in bank_seqlock.h, so every
+ * read response is a consistent snapshot even while other clients write multi-register values.
+ * A counter in holding register 0 is incremented by the main thread once per second.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bank_seqlock.h"
+#include "nanomodbus.h"
+#include "tcp_shards.h"
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+// The data model of this sever will support coils addresses 0 to 100 and registers addresses from 0 to 32
+#define COILS_ADDR_MAX 100
+#define REGS_ADDR_MAX 32
+
+#define SHARDS_MAX 64
+#define CONNECTIONS_PER_SHARD 1024
+#define IDLE_TIMEOUT_MS 60000
+
+volatile sig_atomic_t terminate = 0;
+nmbs_bitfield server_coils = {0};
+uint16_t server_registers[REGS_ADDR_MAX + 1] = {0};
+
+static tcp_shard_t shard_slots[SHARDS_MAX];
+
+
+void sighandler(int s) {
+    UNUSED_PARAM(s);
+    terminate = 1;
+}
+
+
+int main(int argc, char* argv[]) {
+    signal(SIGTERM, sighandler);
+    signal(SIGINT, sighandler);
+    signal(SIGQUIT, sighandler);
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: server-tcp-sharded [address] [port]\n");
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t shards_count = cores < 1 ? 1 : cores > SHARDS_MAX ? SHARDS_MAX : (uint32_t) cores;
+
+    static tcp_engine_conn_t connections[SHARDS_MAX * CONNECTIONS_PER_SHARD];
+
+    nmbs_register_bank bank;
+    memset(&bank, 0, sizeof(bank));
+    bank.coils = (nmbs_bank_table) {server_coils, 0, COILS_ADDR_MAX + 1};
+    bank.holding_registers = (nmbs_bank_table) {server_registers, 0, REGS_ADDR_MAX + 1};
+
+    bank_seqlock_t lock;
+    bank_seqlock_attach(&lock, &bank);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.register_bank = &bank;
+
+    tcp_shards_t shards;
+    int ret = tcp_shards_create(&shards, shard_slots, shards_count, argv[1], argv[2], connections,
+                                CONNECTIONS_PER_SHARD, &callbacks, IDLE_TIMEOUT_MS);
+    if (ret != 0) {
+        fprintf(stderr, "Error creating TCP server - %s\n", strerror(ret));
+        return 1;
+    }
+
+    printf("Modbus TCP server started on port %d with %u shards\n", tcp_shards_port(&shards), shards_count);
+
+    while (!terminate) {
+        sleep(1);
+
+        ret = tcp_shards_error(&shards);
+        if (ret != 0) {
+            fprintf(stderr, "Error serving connections - %s\n", strerror(ret));
+            break;
+        }
+
+        // The application updates the bank with the same seqlock as the servers
+        bank_seqlock_write_begin(&lock);
+        server_registers[0]++;
+        bank_seqlock_write_end(&lock);
+    }
+
+    tcp_shards_destroy(&shards);
+    printf("Server closed\n");
+
+    return 0;
+}
@@ -0,0 +1,586 @@
+#define _GNU_SOURCE
+
+#include "tcp_engine.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+// Max length of a Modbus TCP ADU
+#define ADU_MAX_SIZE 260
+
+#define EVENTS_BATCH 256
+
+
+static uint64_t now_ms(void) {
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) (ts.tv_sec) * 1000 + (uint64_t) (ts.tv_nsec) / 1000000;
+}
+
+
+// Requests are fed to the server instance, nothing is ever read through the platform functions
+static int32_t conn_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return 0;
+}
+
+
+// Responses are queued, they will be sent when the socket is writable
+static int32_t conn_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    tcp_engine_conn_t* conn = arg;
+
+    if (conn->out_off > 0) {
+        memmove(conn->out, conn->out + conn->out_off, conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+
+    if (conn->out_len + count > sizeof(conn->out))
+        return -1;
+
+    memcpy(conn->out + conn->out_len, buf, count);
+    conn->out_len += count;
+    return count;
+}
+
+
+static uint16_t conn_out_space(const tcp_engine_conn_t* conn) {
+    return (uint16_t) (sizeof(conn->out) - (conn->out_len - conn->out_off));
+}
+
+
+static void lru_unlink(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        engine->lru_head = conn->next;
+
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    else
+        engine->lru_tail = conn->prev;
+
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+
+static void lru_append(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    conn->prev = engine->lru_tail;
+    conn->next = NULL;
+
+    if (engine->lru_tail)
+        engine->lru_tail->next = conn;
+    else
+        engine->lru_head = conn;
+
+    engine->lru_tail = conn;
+}
+
+
+static void conn_touch(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    conn->last_activity_ms = now_ms();
+    if (engine->lru_tail != conn) {
+        lru_unlink(engine, conn);
+        lru_append(engine, conn);
+    }
+}
+
+
+#ifdef NMBS_GATEWAY
+// Process the connection again after the next gateway poll
+static void conn_resume(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    if (conn->resume)
+        return;
+
+    conn->resume = true;
+    conn->resume_next = engine->resume_list;
+    engine->resume_list = conn;
+}
+#endif
+
+
+static void conn_close(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    // Also removes the socket from the epoll set
+    close(conn->fd);
+    conn->fd = -1;
+
+#ifdef NMBS_GATEWAY
+    if (engine->gateway)
+        nmbs_gateway_cancel(engine->gateway, conn);
+#endif
+
+    lru_unlink(engine, conn);
+
+    conn->next = engine->free_list;
+    engine->free_list = conn;
+    engine->conns_active--;
+}
+
+
+#ifdef NMBS_GATEWAY
+// Submit the whole requests received to the gateway, as long as there is room reserved for their responses
+static bool conn_forward(tcp_engine_t* engine, tcp_engine_conn_t* conn, uint16_t* off) {
+    while (conn->in_len - *off >= 6 && conn_out_space(conn) >= (conn->gateway_pending + 1) * ADU_MAX_SIZE) {
+        const uint8_t* frame = conn->in + *off;
+        const uint16_t length = 6 + ((uint16_t) (frame[4] << 8) | (uint16_t) frame[5]);
+        if (length > ADU_MAX_SIZE)
+            return false;
+
+        if (conn->in_len - *off < length)
+            break;
+
+        // The response can be passed to the callback before this call returns
+        conn->gateway_pending++;
+        nmbs_error err = nmbs_gateway_submit(engine->gateway, conn, frame, length);
+        if (err == NMBS_ERROR_WINDOW_FULL) {
+            conn->gateway_pending--;
+            conn_resume(engine, conn);
+            break;
+        }
+
+        if (err != NMBS_ERROR_NONE)
+            return false;
+
+        *off += length;
+    }
+
+    return true;
+}
+#endif
+
+
+// Feed the received data to the server or the gateway, as long as there is room for the responses
+static bool conn_process(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    uint16_t off = 0;
+#ifdef NMBS_GATEWAY
+    if (engine->gateway) {
+        if (!conn_forward(engine, conn, &off))
+            return false;
+    }
+    else
+#else
+    UNUSED_PARAM(engine);
+#endif
+    {
+        while (off < conn->in_len && conn_out_space(conn) >= ADU_MAX_SIZE) {
+            uint16_t consumed = 0;
+            nmbs_feed_status status =
+                    nmbs_server_feed(&conn->nmbs, conn->in + off, conn->in_len - off, &consumed, NULL);
+            off += consumed;
+
+            // The stream is out of sync, there's no way to recover on TCP
+            if (status == NMBS_FEED_ERROR)
+                return false;
+        }
+    }
+
+    if (off > 0) {
+        memmove(conn->in, conn->in + off, conn->in_len - off);
+        conn->in_len -= off;
+    }
+
+    return true;
+}
+
+
+static bool conn_flush(tcp_engine_conn_t* conn) {
+    while (conn->out_off < conn->out_len) {
+        ssize_t w =
+                send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            return false;
+        }
+
+        conn->out_off += (uint16_t) w;
+    }
+
+    if (conn->out_off == conn->out_len) {
+        conn->out_off = 0;
+        conn->out_len = 0;
+    }
+
+    return true;
+}
+
+
+// Stop reading from clients that don't read their responses, wait for writability only when there's pending data
+static bool conn_update_events(tcp_engine_t* engine, tcp_engine_conn_t* conn) {
+    uint32_t events = 0;
+    if (conn->in_len < sizeof(conn->in))
+        events |= EPOLLIN;
+
+    if (conn->out_len > conn->out_off)
+        events |= EPOLLOUT;
+
+    if (events == conn->events)
+        return true;
+
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = conn;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) != 0)
+        return false;
+
+    conn->events = events;
+    return true;
+}
+
+
+static bool conn_serve(tcp_engine_t* engine, tcp_engine_conn_t* conn, uint32_t events) {
+    if (events & EPOLLERR)
+        return false;
+
+    if (events & EPOLLOUT) {
+        if (!conn_flush(conn))
+            return false;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP)) && conn->in_len < sizeof(conn->in)) {
+        // A single read per wakeup, so that a busy client can't starve the others
+        ssize_t r = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, MSG_DONTWAIT);
+        if (r == 0)
+            return false;
+
+        if (r < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return false;
+        }
+        else {
+            conn->in_len += (uint16_t) r;
+            conn_touch(engine, conn);
+        }
+    }
+
+    while (true) {
+        const uint16_t in_len = conn->in_len;
+        if (!conn_process(engine, conn))
+            return false;
+
+        if (!conn_flush(conn))
+            return false;
+
+        // Requests left in the input buffer are waiting for room in the output one, or for the gateway
+        if (conn->in_len == 0 || conn->in_len == in_len || conn->out_len > conn->out_off)
+            break;
+    }
+
+    return conn_update_events(engine, conn);
+}
+
+
+static void accept_batch(tcp_engine_t* engine) {
+    for (int i = 0; i < TCP_ENGINE_ACCEPT_BATCH; i++) {
+        int fd = accept4(engine->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            // EAGAIN, or out of file descriptors
+            return;
+        }
+
+        tcp_engine_conn_t* conn = engine->free_list;
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int) {1}, sizeof(int));
+
+        conn->fd = fd;
+        conn->in_len = 0;
+        conn->out_len = 0;
+        conn->out_off = 0;
+        conn->events = EPOLLIN;
+#ifdef NMBS_GATEWAY
+        conn->gateway_pending = 0;
+#endif
+
+        struct epoll_event ev = {0};
+        ev.events = conn->events;
+        ev.data.ptr = conn;
+        if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            conn->fd = -1;
+            continue;
+        }
+
+        nmbs_server_create(&conn->nmbs, 0, &engine->platform_conf, &engine->callbacks);
+        nmbs_set_platform_arg(&conn->nmbs, conn);
+
+        engine->free_list = conn->next;
+        engine->conns_active++;
+        conn->last_activity_ms = now_ms();
+        lru_append(engine, conn);
+    }
+}
+
+
+static int next_timeout_ms(const tcp_engine_t* engine, int32_t timeout_ms) {
+#ifdef NMBS_GATEWAY
+    if (engine->gateway && nmbs_gateway_pending(engine->gateway) > 0) {
+        if (timeout_ms < 0 || timeout_ms > TCP_ENGINE_GATEWAY_POLL_MS)
+            timeout_ms = TCP_ENGINE_GATEWAY_POLL_MS;
+    }
+#endif
+
+    if (engine->idle_timeout_ms < 0 || !engine->lru_head)
+        return timeout_ms;
+
+    uint64_t expiry = engine->lru_head->last_activity_ms + (uint64_t) engine->idle_timeout_ms;
+    uint64_t now = now_ms();
+    int32_t until_expiry = expiry > now ? (int32_t) (expiry - now) : 0;
+
+    if (timeout_ms < 0 || until_expiry < timeout_ms)
+        return until_expiry;
+
+    return timeout_ms;
+}
+
+
+#ifdef NMBS_GATEWAY
+// Poll the gateway, then process the connections that received responses or are waiting for a request slot
+static void gateway_serve(tcp_engine_t* engine) {
+    nmbs_gateway_poll(engine->gateway);
+
+    // Connections resumed while processing these ones wait for the next run
+    tcp_engine_conn_t* conn = engine->resume_list;
+    engine->resume_list = NULL;
+
+    while (conn) {
+        tcp_engine_conn_t* next = conn->resume_next;
+        conn->resume = false;
+        conn->resume_next = NULL;
+
+        if (conn->fd >= 0 && !conn_serve(engine, conn, 0))
+            conn_close(engine, conn);
+
+        conn = next;
+    }
+}
+#endif
+
+
+static void evict_idle(tcp_engine_t* engine) {
+    if (engine->idle_timeout_ms < 0)
+        return;
+
+    uint64_t now = now_ms();
+    while (engine->lru_head && now - engine->lru_head->last_activity_ms >= (uint64_t) engine->idle_timeout_ms)
+        conn_close(engine, engine->lru_head);
+}
+
+
+static int engine_create(tcp_engine_t* engine, const char* address, const char* port, tcp_engine_conn_t* conns,
+                         uint32_t conns_count, const nmbs_callbacks* callbacks, int32_t idle_timeout_ms,
+                         bool reuse_port) {
+    if (!engine || !conns || conns_count == 0)
+        return EINVAL;
+
+    memset(engine, 0, sizeof(tcp_engine_t));
+    engine->epoll_fd = -1;
+    engine->listen_fd = -1;
+    engine->conns = conns;
+    engine->conns_count = conns_count;
+    engine->idle_timeout_ms = idle_timeout_ms;
+    if (callbacks)
+        engine->callbacks = *callbacks;
+    else
+        nmbs_callbacks_create(&engine->callbacks);
+
+    nmbs_platform_conf_create(&engine->platform_conf);
+    engine->platform_conf.transport = NMBS_TRANSPORT_TCP;
+    engine->platform_conf.read = conn_read;
+    engine->platform_conf.write = conn_write;
+
+    for (uint32_t i = 0; i < conns_count; i++) {
+        conns[i].fd = -1;
+#ifdef NMBS_GATEWAY
+        conns[i].resume = false;
+        conns[i].resume_next = NULL;
+#endif
+        conns[i].prev = NULL;
+        conns[i].next = i + 1 < conns_count ? &conns[i + 1] : NULL;
+    }
+    engine->free_list = &conns[0];
+
+    struct addrinfo ainfo = {0};
+    struct addrinfo* results;
+    struct addrinfo* rp;
+    int fd = -1;
+
+    ainfo.ai_family = AF_INET;
+    ainfo.ai_socktype = SOCK_STREAM;
+    ainfo.ai_flags = AI_PASSIVE;
+    int ret = getaddrinfo(address, port, &ainfo, &results);
+    if (ret != 0)
+        return EINVAL;
+
+    for (rp = results; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int));
+        if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int) {1}, sizeof(int)) != 0) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(results);
+
+    if (fd < 0)
+        return errno ? errno : EADDRNOTAVAIL;
+
+    engine->listen_fd = fd;
+
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (engine->epoll_fd < 0) {
+        ret = errno;
+        tcp_engine_destroy(engine);
+        return ret;
+    }
+
+    // The listening socket is the only one registered with no connection
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->listen_fd, &ev) != 0) {
+        ret = errno;
+        tcp_engine_destroy(engine);
+        return ret;
+    }
+
+    return 0;
+}
+
+
+int tcp_engine_create(tcp_engine_t* engine, const char* address, const char* port, tcp_engine_conn_t* conns,
+                      uint32_t conns_count, const nmbs_callbacks* callbacks, int32_t idle_timeout_ms) {
+    return engine_create(engine, address, port, conns, conns_count, callbacks, idle_timeout_ms, false);
+}
+
+
+int tcp_engine_create_shared(tcp_engine_t* engine, const char* address, const char* port, tcp_engine_conn_t* conns,
+                             uint32_t conns_count, const nmbs_callbacks* callbacks, int32_t idle_timeout_ms) {
+    return engine_create(engine, address, port, conns, conns_count, callbacks, idle_timeout_ms, true);
+}
+
+
+#ifdef NMBS_GATEWAY
+void tcp_engine_set_gateway(tcp_engine_t* engine, nmbs_gateway* gateway) {
+    engine->gateway = gateway;
+}
+
+
+void tcp_engine_gateway_callback(void* source, const uint8_t* frame, uint16_t length, void* arg) {
+    tcp_engine_t* engine = arg;
+    tcp_engine_conn_t* conn = source;
+
+    // Room for the response was reserved when the request was submitted
+    conn->gateway_pending--;
+    if (length > 0)
+        conn_write(frame, length, 0, conn);
+
+    conn_resume(engine, conn);
+}
+#endif
+
+
+int tcp_engine_run_once(tcp_engine_t* engine, int32_t timeout_ms) {
+    struct epoll_event events[EVENTS_BATCH];
+
+    int n = epoll_wait(engine->epoll_fd, events, EVENTS_BATCH, next_timeout_ms(engine, timeout_ms));
+    if (n < 0)
+        return errno == EINTR ? 0 : errno;
+
+    bool accept_pending = false;
+    for (int i = 0; i < n; i++) {
+        tcp_engine_conn_t* conn = events[i].data.ptr;
+        if (!conn) {
+            accept_pending = true;
+            continue;
+        }
+
+        // Closed earlier in this batch
+        if (conn->fd < 0)
+            continue;
+
+        if (!conn_serve(engine, conn, events[i].events))
+            conn_close(engine, conn);
+    }
+
+#ifdef NMBS_GATEWAY
+    if (engine->gateway)
+        gateway_serve(engine);
+#endif
+
+    // Accepting last, a slot freed in this batch can't receive stale events of its previous connection
+    if (accept_pending)
+        accept_batch(engine);
+
+    evict_idle(engine);
+
+    return 0;
+}
+
+
+uint16_t tcp_engine_port(const tcp_engine_t* engine) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(engine->listen_fd, (struct sockaddr*) &addr, &addr_len) != 0)
+        return 0;
+
+    return ntohs(addr.sin_port);
+}
+
+
+uint32_t tcp_engine_connections(const tcp_engine_t* engine) {
+    return engine->conns_active;
+}
+
+
+void tcp_engine_destroy(tcp_engine_t* engine) {
+    for (uint32_t i = 0; i < engine->conns_count; i++) {
+        if (engine->conns[i].fd >= 0)
+            conn_close(engine, &engine->conns[i]);
+    }
+
+    if (engine->listen_fd >= 0)
+        close(engine->listen_fd);
+
+    if (engine->epoll_fd >= 0)
+        close(engine->epoll_fd);
+
+    engine->listen_fd = -1;
+    engine->epoll_fd = -1;
+}
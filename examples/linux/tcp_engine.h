@@ -0,0 +1,170 @@
+/*
+ * Modbus TCP server engine for Linux, serving thousands of concurrent client connections from a single thread.
+ *
+ * Connections are multiplexed with epoll and each one gets its own nmbs_t instance, taken from a fixed pool provided
+ * by the caller. Received data is passed to nmbs_server_feed(), so a client sending a partial request never blocks the
+ * others. Responses are queued in a per-connection output buffer and sent when the socket is writable.
+ * Connections that stay idle for longer than the configured timeout are closed, least recently active first.
+ *
+ * When built with NMBS_GATEWAY, requests can be forwarded to an nmbs_gateway instead with tcp_engine_set_gateway(), and
+ * the engine polls it.
+ *
+ */
+
+#ifndef NANOMODBUS_TCP_ENGINE_H
+#define NANOMODBUS_TCP_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nanomodbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TCP_ENGINE_IN_BUF_SIZE
+#define TCP_ENGINE_IN_BUF_SIZE 1024
+#endif
+
+// Should be able to hold a few maximum-length responses
+#ifndef TCP_ENGINE_OUT_BUF_SIZE
+#define TCP_ENGINE_OUT_BUF_SIZE 1280
+#endif
+
+// Max number of connections accepted on each wakeup of the listening socket
+#ifndef TCP_ENGINE_ACCEPT_BATCH
+#define TCP_ENGINE_ACCEPT_BATCH 64
+#endif
+
+// Max time between gateway polls, while requests are in progress on the serial lines
+#ifndef TCP_ENGINE_GATEWAY_POLL_MS
+#define TCP_ENGINE_GATEWAY_POLL_MS 1
+#endif
+
+/**
+ * Client connection slot. All struct members are to be considered private.
+ */
+typedef struct tcp_engine_conn_t {
+    int fd;
+    nmbs_t nmbs;
+
+    uint8_t in[TCP_ENGINE_IN_BUF_SIZE];
+    uint16_t in_len;
+
+    uint8_t out[TCP_ENGINE_OUT_BUF_SIZE];
+    uint16_t out_len;
+    uint16_t out_off;
+
+    uint32_t events;
+    uint64_t last_activity_ms;
+
+#ifdef NMBS_GATEWAY
+    // Requests forwarded to the gateway, each one has room reserved in the output buffer
+    uint16_t gateway_pending;
+    bool resume;
+    struct tcp_engine_conn_t* resume_next;
+#endif
+
+    // Least recently active connections come first
+    struct tcp_engine_conn_t* prev;
+    struct tcp_engine_conn_t* next;
+} tcp_engine_conn_t;
+
+
+/**
+ * Server engine instance. All struct members are to be considered private.
+ */
+typedef struct tcp_engine_t {
+    int epoll_fd;
+    int listen_fd;
+
+    tcp_engine_conn_t* conns;
+    uint32_t conns_count;
+    uint32_t conns_active;
+    tcp_engine_conn_t* free_list;
+
+    tcp_engine_conn_t* lru_head;
+    tcp_engine_conn_t* lru_tail;
+
+    int32_t idle_timeout_ms;
+
+    nmbs_platform_conf platform_conf;
+    nmbs_callbacks callbacks;
+
+#ifdef NMBS_GATEWAY
+    nmbs_gateway* gateway;
+    tcp_engine_conn_t* resume_list;
+#endif
+} tcp_engine_t;
+
+
+/** Create a TCP server engine listening on the specified address and port.
+ * @param engine pointer to the tcp_engine_t instance
+ * @param address address to listen on
+ * @param port port to listen on. "0" picks a free port, see tcp_engine_port()
+ * @param conns pool of connection slots. Their count is the max number of concurrent connections
+ * @param conns_count number of connection slots in the pool
+ * @param callbacks server request callbacks. The callbacks arg is passed to every callback, regardless of the
+ * connection the request was received from. Can be NULL if the requests are forwarded to a gateway
+ * @param idle_timeout_ms connections with no activity for this long are closed. If < 0, they are never closed
+ *
+ * @return 0 if successful, an errno value otherwise
+ */
+int tcp_engine_create(tcp_engine_t* engine, const char* address, const char* port, tcp_engine_conn_t* conns,
+                      uint32_t conns_count, const nmbs_callbacks* callbacks, int32_t idle_timeout_ms);
+
+/** Create a TCP server engine listening on a port shared with other engines, with SO_REUSEPORT.
+ * The kernel spreads the incoming connections among all the engines listening on the same address and port, which
+ * can then be run on different threads, see tcp_shards.h. Parameters are the same as tcp_engine_create()
+ *
+ * @return 0 if successful, an errno value otherwise
+ */
+int tcp_engine_create_shared(tcp_engine_t* engine, const char* address, const char* port, tcp_engine_conn_t* conns,
+                             uint32_t conns_count, const nmbs_callbacks* callbacks, int32_t idle_timeout_ms);
+
+#ifdef NMBS_GATEWAY
+/** Forward the requests of all the connections to a gateway, instead of serving them with the callbacks.
+ * The gateway must be created with tcp_engine_gateway_callback() as response callback, and the engine as its arg.
+ * It is polled by tcp_engine_run_once(), at least every TCP_ENGINE_GATEWAY_POLL_MS while requests are in progress.
+ * Requests of closed connections are cancelled.
+ * @param engine pointer to the tcp_engine_t instance
+ * @param gateway pointer to the nmbs_gateway instance
+ */
+void tcp_engine_set_gateway(tcp_engine_t* engine, nmbs_gateway* gateway);
+
+/** Gateway response callback, to be passed to nmbs_gateway_create() with the engine as arg.
+ * Queues the response on the connection the request was received from.
+ */
+void tcp_engine_gateway_callback(void* source, const uint8_t* frame, uint16_t length, void* arg);
+#endif
+
+/** Wait for socket events and serve them.
+ * This function should be called in a loop.
+ * @param engine pointer to the tcp_engine_t instance
+ * @param timeout_ms max time to wait for socket events. If < 0, waits until an event occurs or a connection expires
+ *
+ * @return 0 if successful, an errno value otherwise
+ */
+int tcp_engine_run_once(tcp_engine_t* engine, int32_t timeout_ms);
+
+/** Return the port the engine is listening on.
+ * @param engine pointer to the tcp_engine_t instance
+ */
+uint16_t tcp_engine_port(const tcp_engine_t* engine);
+
+/** Return the number of open client connections.
+ * @param engine pointer to the tcp_engine_t instance
+ */
+uint32_t tcp_engine_connections(const tcp_engine_t* engine);
+
+/** Close all the connections and the listening socket.
+ * @param engine pointer to the tcp_engine_t instance
+ */
+void tcp_engine_destroy(tcp_engine_t* engine);
+
+#ifdef __cplusplus
+}    // extern "C"
+#endif
+
+#endif    // NANOMODBUS_TCP_ENGINE_H
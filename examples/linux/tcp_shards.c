@@ -0,0 +1,97 @@
+#include "tcp_shards.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+
+static void* shard_run(void* arg) {
+    tcp_shard_t* shard = arg;
+
+    while (!__atomic_load_n(&shard->shards->stop, __ATOMIC_ACQUIRE)) {
+        int ret = tcp_engine_run_once(&shard->engine, TCP_SHARDS_STOP_POLL_MS);
+        if (ret != 0) {
+            __atomic_store_n(&shard->error, ret, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+int tcp_shards_create(tcp_shards_t* shards, tcp_shard_t* shard_slots, uint32_t shards_count, const char* address,
+                      const char* port, tcp_engine_conn_t* conns, uint32_t conns_per_shard,
+                      const nmbs_callbacks* callbacks, int32_t idle_timeout_ms) {
+    if (!shards || !shard_slots || shards_count == 0 || !conns || conns_per_shard == 0)
+        return EINVAL;
+
+    memset(shards, 0, sizeof(tcp_shards_t));
+    shards->shards = shard_slots;
+
+    // With port "0", the other shards bind to the port picked for the first one
+    char shared_port[8];
+    for (uint32_t i = 0; i < shards_count; i++) {
+        tcp_shard_t* shard = &shard_slots[i];
+        shard->running = false;
+        shard->error = 0;
+        shard->shards = shards;
+
+        int ret = tcp_engine_create_shared(&shard->engine, address, i == 0 ? port : shared_port,
+                                           conns + i * conns_per_shard, conns_per_shard, callbacks, idle_timeout_ms);
+        if (ret != 0) {
+            tcp_shards_destroy(shards);
+            return ret;
+        }
+
+        shards->shards_count = i + 1;
+
+        if (i == 0)
+            snprintf(shared_port, sizeof(shared_port), "%u", tcp_engine_port(&shard->engine));
+    }
+
+    for (uint32_t i = 0; i < shards_count; i++) {
+        int ret = pthread_create(&shard_slots[i].thread, NULL, shard_run, &shard_slots[i]);
+        if (ret != 0) {
+            tcp_shards_destroy(shards);
+            return ret;
+        }
+
+        shard_slots[i].running = true;
+    }
+
+    return 0;
+}
+
+
+uint16_t tcp_shards_port(const tcp_shards_t* shards) {
+    return tcp_engine_port(&shards->shards[0].engine);
+}
+
+
+int tcp_shards_error(const tcp_shards_t* shards) {
+    for (uint32_t i = 0; i < shards->shards_count; i++) {
+        int error = __atomic_load_n(&shards->shards[i].error, __ATOMIC_ACQUIRE);
+        if (error != 0)
+            return error;
+    }
+
+    return 0;
+}
+
+
+void tcp_shards_destroy(tcp_shards_t* shards) {
+    __atomic_store_n(&shards->stop, 1, __ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i < shards->shards_count; i++) {
+        tcp_shard_t* shard = &shards->shards[i];
+        if (shard->running) {
+            pthread_join(shard->thread, NULL);
+            shard->running = false;
+        }
+
+        tcp_engine_destroy(&shard->engine);
+    }
+
+    shards->shards_count = 0;
+}
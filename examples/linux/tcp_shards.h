@@ -0,0 +1,87 @@
+/*
+ * Multi-threaded Modbus TCP server for Linux, made of tcp_engine.h engines running on their own threads.
+ *
+ * All the shards listen on the same address and port with SO_REUSEPORT, and the kernel spreads the incoming
+ * connections among them. Each connection is served by a single shard for its whole life, so the nmbs_t instances are
+ * never shared between threads. The callbacks are shared by all the shards, and must be thread-safe: a register bank
+ * protected by a bank_seqlock.h seqlock serves consistent snapshots with no global lock.
+ *
+ */
+
+#ifndef NANOMODBUS_TCP_SHARDS_H
+#define NANOMODBUS_TCP_SHARDS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tcp_engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Max time a shard takes to notice tcp_shards_destroy()
+#ifndef TCP_SHARDS_STOP_POLL_MS
+#define TCP_SHARDS_STOP_POLL_MS 100
+#endif
+
+/**
+ * Shard slot. All struct members are to be considered private.
+ */
+typedef struct tcp_shard_t {
+    tcp_engine_t engine;
+    pthread_t thread;
+    bool running;
+    int error;
+    struct tcp_shards_t* shards;
+} tcp_shard_t;
+
+
+/**
+ * Sharded server instance. All struct members are to be considered private.
+ */
+typedef struct tcp_shards_t {
+    tcp_shard_t* shards;
+    uint32_t shards_count;
+    int stop;
+} tcp_shards_t;
+
+
+/** Create the shards of a TCP server listening on the specified address and port, and start their threads.
+ * @param shards pointer to the tcp_shards_t instance
+ * @param shard_slots array of shards_count shard slots
+ * @param shards_count number of shards, usually the number of cores available for serving requests
+ * @param address address to listen on
+ * @param port port to listen on. "0" picks a free port, see tcp_shards_port()
+ * @param conns pool of shards_count * conns_per_shard connection slots
+ * @param conns_per_shard max number of concurrent connections served by each shard
+ * @param callbacks server request callbacks, called from all the shard threads
+ * @param idle_timeout_ms connections with no activity for this long are closed. If < 0, they are never closed
+ *
+ * @return 0 if successful, an errno value otherwise
+ */
+int tcp_shards_create(tcp_shards_t* shards, tcp_shard_t* shard_slots, uint32_t shards_count, const char* address,
+                      const char* port, tcp_engine_conn_t* conns, uint32_t conns_per_shard,
+                      const nmbs_callbacks* callbacks, int32_t idle_timeout_ms);
+
+/** Return the port the shards are listening on.
+ * @param shards pointer to the tcp_shards_t instance
+ */
+uint16_t tcp_shards_port(const tcp_shards_t* shards);
+
+/** Return the first error a shard stopped on, 0 if they are all running.
+ * @param shards pointer to the tcp_shards_t instance
+ */
+int tcp_shards_error(const tcp_shards_t* shards);
+
+/** Stop the shard threads, then close all the connections and the listening sockets.
+ * @param shards pointer to the tcp_shards_t instance
+ */
+void tcp_shards_destroy(tcp_shards_t* shards);
+
+#ifdef __cplusplus
+}    // extern "C"
+#endif
+
+#endif    // NANOMODBUS_TCP_SHARDS_H
@@ -27,6 +27,7 @@
 void onError();
 int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg);
 int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg);
+uint32_t time_ms(void* arg);
 
 void onError() {
     // Make the LED blink on error
@@ -46,11 +47,15 @@ int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void*
     int32_t bytes_read = 0;
     uint64_t timeout_us = (uint64_t) byte_timeout_ms * 1000;
 
-    while (time_us_64() - start_time < timeout_us && bytes_read < count) {
+    // With a zero timeout, only the bytes already received are read
+    while (bytes_read < count) {
         if (uart_is_readable(UART_ID)) {
             buf[bytes_read++] = uart_getc(UART_ID);
             start_time = time_us_64();    // Reset start time after a successful read
         }
+        else if (time_us_64() - start_time >= timeout_us) {
+            break;
+        }
     }
 
     return bytes_read;
@@ -61,6 +66,10 @@ int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms
     return count;
 }
 
+uint32_t time_ms(void* arg) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
 void pico_setup() {
     printf("Initializing UART...\n");
     // Initialize the UART
@@ -101,6 +110,7 @@ int main() {
     platform_conf.transport = NMBS_TRANSPORT_RTU;
     platform_conf.read = read_serial;
     platform_conf.write = write_serial;
+    platform_conf.time_ms = time_ms;    // Needed by the non-blocking client API
 
     printf("Creating Modbus client...\n");
     nmbs_t nmbs;
@@ -151,11 +161,36 @@ int main() {
         onError();
     }
 
-    // On success, keep the LED on
+    printf("Modbus operations completed successfully.\n");
+
+    // Keep polling the holding registers without blocking the main loop, e.g. to run control tasks at the same time.
+    // The LED blinks on its own schedule, whatever the state of the Modbus requests
     const uint LED_PIN = PICO_LED_PIN;
-    gpio_put(LED_PIN, 1);
+    bool led = false;
+    uint32_t led_toggle_ms = time_ms(NULL);
+    uint32_t next_poll_ms = time_ms(NULL);
 
-    printf("Modbus operations completed successfully.\n");
+    while (true) {
+        const uint32_t now = time_ms(NULL);
+
+        const nmbs_client_status status = nmbs_client_step(&nmbs, &err);
+        if (status == NMBS_CLIENT_DONE && err != NMBS_ERROR_NONE)
+            printf("Error reading holding registers: %d\n", err);
+
+        if (status != NMBS_CLIENT_IN_PROGRESS && (int32_t) (now - next_poll_ms) >= 0) {
+            err = nmbs_client_begin_read_holding_registers(&nmbs, 26, 2, r_regs);
+            if (err != NMBS_ERROR_NONE)
+                printf("Error sending read holding registers request: %d\n", err);
+
+            next_poll_ms = now + 100;
+        }
+
+        if ((int32_t) (now - led_toggle_ms) >= 0) {
+            led = !led;
+            gpio_put(LED_PIN, led);
+            led_toggle_ms = now + 500;
+        }
+    }
 
     return 0;
 }
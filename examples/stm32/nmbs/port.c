@@ -11,9 +11,19 @@ static int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms
 static int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg);
 
 #if MB_UART_DMA
-#include "queue.h"
-xQueueHandle rtu_rx_q;
-uint8_t rtu_rx_b[MB_RX_BUF_SIZE];
+#include "task.h"
+static void rtu_rx_init(void);
+static bool rtu_rx_wait(int32_t timeout_ms, void* arg);
+static void rtu_rx_notify(void* arg);
+
+// Circular DMA reception, each half, full and idle line event pushes the received chunk to the ring with a single
+// index update, and the modbus task consumes it in bulk
+static uint8_t rtu_rx_dma_b[MB_RX_DMA_SIZE];
+static uint8_t rtu_rx_ring_b[MB_RX_BUF_SIZE];
+static nmbs_ring rtu_rx_ring;
+static nmbs_ring_dma rtu_rx_dma;
+static nmbs_ring_port rtu_port = {&rtu_rx_ring, NULL, NULL, NULL};
+static TaskHandle_t rtu_rx_task;
 #endif
 
 #endif
@@ -45,6 +55,13 @@ nmbs_error nmbs_server_init(nmbs_t* nmbs, nmbs_server_t* _server) {
     conf.transport = NMBS_TRANSPORT_RTU;
     conf.read = read_serial;
     conf.write = write_serial;
+#if MB_UART_DMA
+    conf.read = nmbs_ring_read;
+    conf.bytes_available = nmbs_ring_bytes_available;
+    conf.drain = nmbs_ring_drain;
+    conf.arg = &rtu_port;
+    rtu_rx_init();
+#endif
 #endif
 
     server = _server;
@@ -57,11 +74,6 @@ nmbs_error nmbs_server_init(nmbs_t* nmbs, nmbs_server_t* _server) {
     cb.write_single_register = server_write_single_register;
     cb.write_multiple_registers = server_write_multiple_registers;
 
-#if MB_UART_DMA
-    rtu_rx_q = xQueueCreate(MB_RX_BUF_SIZE, sizeof(uint8_t));
-    HAL_UARTEx_ReceiveToIdle_DMA(&MB_UART, rtu_rx_b, MB_RX_BUF_SIZE);
-#endif
-
     nmbs_error status = nmbs_server_create(nmbs, server->id, &conf, &cb);
     if (status != NMBS_ERROR_NONE) {
         return status;
@@ -86,6 +98,13 @@ nmbs_error nmbs_client_init(nmbs_t* nmbs) {
     conf.transport = NMBS_TRANSPORT_RTU;
     conf.read = read_serial;
     conf.write = write_serial;
+#if MB_UART_DMA
+    conf.read = nmbs_ring_read;
+    conf.bytes_available = nmbs_ring_bytes_available;
+    conf.drain = nmbs_ring_drain;
+    conf.arg = &rtu_port;
+    rtu_rx_init();
+#endif
 #endif
 
     nmbs_error status = nmbs_client_create(nmbs, &conf);
@@ -194,18 +213,6 @@ int32_t write_socket(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms
 
 #ifdef NMBS_RTU
 static int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg) {
-#if MB_UART_DMA
-    uint32_t tick_start = HAL_GetTick();
-    while (uxQueueMessagesWaiting(rtu_rx_q) < count) {
-        if (HAL_GetTick() - tick_start >= (uint32_t) byte_timeout_ms) {
-            return 0;
-        }
-    }
-    for (int i = 0; i < count; i++) {
-        xQueueReceive(rtu_rx_q, buf + i, 1);
-    }
-    return count;
-#else
     HAL_StatusTypeDef status = HAL_UART_Receive(&MB_UART, buf, count, byte_timeout_ms);
     if (status == HAL_OK) {
         return count;
@@ -213,7 +220,6 @@ static int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms
     else {
         return 0;
     }
-#endif
 }
 static int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg) {
 #if MB_UART_DMA
@@ -231,14 +237,39 @@ static int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_tim
 
 
 #if MB_UART_DMA
+static void rtu_rx_init(void) {
+    if (rtu_rx_task) {
+        return;
+    }
+
+    // Called from the modbus task, the one waiting for the received bytes
+    rtu_rx_task = xTaskGetCurrentTaskHandle();
+    nmbs_ring_create(&rtu_rx_ring, rtu_rx_ring_b, MB_RX_BUF_SIZE);
+    nmbs_ring_set_hooks(&rtu_rx_ring, rtu_rx_wait, rtu_rx_notify, NULL);
+    nmbs_ring_dma_create(&rtu_rx_dma, &rtu_rx_ring, rtu_rx_dma_b, MB_RX_DMA_SIZE);
+
+    // The DMA stream must be in circular mode
+    HAL_UARTEx_ReceiveToIdle_DMA(&MB_UART, rtu_rx_dma_b, MB_RX_DMA_SIZE);
+}
+
+static bool rtu_rx_wait(int32_t timeout_ms, void* arg) {
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    return ulTaskNotifyTake(pdTRUE, ticks) != 0;
+}
+
+static void rtu_rx_notify(void* arg) {
+    // Also called by the modbus task itself when it takes bytes out of the ring
+    if (xPortIsInsideInterrupt()) {
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(rtu_rx_task, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+}
+
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t Size) {
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     if (huart == &MB_UART) {
-        for (int i = 0; i < Size; i++) {
-            xQueueSendFromISR(rtu_rx_q, rtu_rx_b + i, &xHigherPriorityTaskWoken);
-        }
-        HAL_UARTEx_ReceiveToIdle_DMA(huart, rtu_rx_b, MB_RX_BUF_SIZE);
-        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        // Size is the position of the DMA in its buffer, on half transfer, transfer complete and idle line events
+        nmbs_ring_dma_update(&rtu_rx_dma, Size);
     }
     // You may add your additional uart handler below
 }
@@ -23,7 +23,8 @@ extern "C" {
 // modbus rtu
 #define MB_UART huart1
 #define MB_UART_DMA 1
-#define MB_RX_BUF_SIZE 256
+#define MB_RX_BUF_SIZE 512 // nmbs_ring size, a power of 2
+#define MB_RX_DMA_SIZE 64  // Circular DMA buffer size
 extern UART_HandleTypeDef MB_UART;
 #endif
 
@@ -0,0 +1,211 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "comm.h"
+#include "comm_overlapped.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#define COMPLETIONS_BATCH 16
+
+
+// Keep a read pending at all times. With a completion port, its result is always delivered by PollCommCompletions()
+static bool StartRead(OverlappedCommPort* port) {
+    memset(&port->read_ov, 0, sizeof(port->read_ov));
+    if (!ReadFile(port->handle, port->read_buf, sizeof(port->read_buf), NULL, &port->read_ov) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        printf("ReadFile() failed with error %lu.\n", GetLastError());
+        return false;
+    }
+
+    return true;
+}
+
+
+// tx_start hook of the tx ring, sends the queued bytes unless a write is already pending
+static void StartWrite(void* arg) {
+    OverlappedCommPort* port = arg;
+    if (port->write_pending)
+        return;
+
+    const uint32_t count = nmbs_ring_pop(&port->tx, port->write_buf, sizeof(port->write_buf));
+    if (count == 0)
+        return;
+
+    memset(&port->write_ov, 0, sizeof(port->write_ov));
+    if (!WriteFile(port->handle, port->write_buf, count, NULL, &port->write_ov) && GetLastError() != ERROR_IO_PENDING) {
+        printf("WriteFile() failed with error %lu.\n", GetLastError());
+        return;
+    }
+
+    port->write_pending = true;
+}
+
+
+static bool StartPort(OverlappedCommPort* port, HANDLE iocp) {
+    if (!CreateIoCompletionPort(port->handle, iocp, (ULONG_PTR) port, 0))
+        return false;
+
+    nmbs_ring_create(&port->rx, port->rx_buf, sizeof(port->rx_buf));
+    nmbs_ring_create(&port->tx, port->tx_buf, sizeof(port->tx_buf));
+    port->ring_port.rx = &port->rx;
+    port->ring_port.tx = &port->tx;
+    port->ring_port.tx_start = StartWrite;
+    port->ring_port.arg = port;
+    port->write_pending = false;
+
+    return StartRead(port);
+}
+
+
+HANDLE CreateCommCompletionPort(void) {
+    return CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+}
+
+
+bool InitOverlappedCommPort(OverlappedCommPort* port, HANDLE iocp, int PortNumber, DWORD baudrate) {
+    char commName[50] = {0};
+
+    memset(port, 0, sizeof(OverlappedCommPort));
+    sprintf_s(commName, sizeof(commName), "\\\\.\\COM%d", PortNumber);
+
+    port->handle = CreateFileA(commName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED,
+                               NULL);
+    if (port->handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    if (!SetLocalBaudRate(port->handle, baudrate)) {
+        CloseOverlappedCommPort(port);
+        return false;
+    }
+
+    // A read completes when the line stays idle for t3.5 after a byte, so a completion usually holds a whole frame.
+    // Frames split by the adapter are put back together in the rx ring
+    uint32_t t15_us = 0;
+    uint32_t t35_us = 0;
+    nmbs_rtu_char_timings(baudrate, &t15_us, &t35_us);
+
+    COMMTIMEOUTS timeouts = {0};
+    timeouts.ReadIntervalTimeout = (t35_us + 999) / 1000;
+    timeouts.ReadTotalTimeoutMultiplier = 0;
+    timeouts.ReadTotalTimeoutConstant = 0;
+
+    // Twice the duration of a character of 11 bits, plus some slack for the driver
+    timeouts.WriteTotalTimeoutMultiplier = (2 * 11 * 1000 + baudrate - 1) / baudrate;
+    timeouts.WriteTotalTimeoutConstant = 100;
+
+    if (!SetCommTimeouts(port->handle, &timeouts) || !PurgeComm(port->handle, PURGE_RXCLEAR | PURGE_TXCLEAR) ||
+        !StartPort(port, iocp)) {
+        CloseOverlappedCommPort(port);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ConnectOverlappedTcp(OverlappedCommPort* port, HANDLE iocp, const char* address, const char* service) {
+    WSADATA wsa_data;
+    struct addrinfo hints = {0};
+    struct addrinfo* results;
+
+    memset(port, 0, sizeof(OverlappedCommPort));
+    port->handle = INVALID_HANDLE_VALUE;
+    port->socket = true;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return false;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo(address, service, &hints, &results) != 0)
+        return false;
+
+    for (struct addrinfo* rp = results; rp != NULL; rp = rp->ai_next) {
+        // Sockets created by socket() support overlapped ReadFile() and WriteFile()
+        SOCKET s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (s == INVALID_SOCKET)
+            continue;
+
+        if (connect(s, rp->ai_addr, (int) rp->ai_addrlen) == 0) {
+            BOOL nodelay = TRUE;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*) &nodelay, sizeof(nodelay));
+            port->handle = (HANDLE) s;
+            break;
+        }
+
+        closesocket(s);
+    }
+
+    freeaddrinfo(results);
+
+    if (port->handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    if (!StartPort(port, iocp)) {
+        CloseOverlappedCommPort(port);
+        return false;
+    }
+
+    return true;
+}
+
+
+void CloseOverlappedCommPort(OverlappedCommPort* port) {
+    if (port->handle == INVALID_HANDLE_VALUE)
+        return;
+
+    if (port->socket)
+        closesocket((SOCKET) port->handle);
+    else
+        CloseHandle(port->handle);
+
+    port->handle = INVALID_HANDLE_VALUE;
+}
+
+
+void OverlappedPlatformConf(nmbs_platform_conf* platform_conf, OverlappedCommPort* port) {
+    platform_conf->transport = port->socket ? NMBS_TRANSPORT_TCP : NMBS_TRANSPORT_RTU;
+    platform_conf->read = nmbs_ring_read;
+    platform_conf->write = nmbs_ring_write;
+    platform_conf->bytes_available = nmbs_ring_bytes_available;
+    platform_conf->drain = nmbs_ring_drain;
+    platform_conf->arg = &port->ring_port;
+}
+
+
+int PollCommCompletions(HANDLE iocp, DWORD timeout_ms) {
+    OVERLAPPED_ENTRY entries[COMPLETIONS_BATCH];
+    ULONG removed = 0;
+
+    if (!GetQueuedCompletionStatusEx(iocp, entries, COMPLETIONS_BATCH, &removed, timeout_ms, FALSE))
+        return GetLastError() == WAIT_TIMEOUT ? 0 : -1;
+
+    for (ULONG i = 0; i < removed; i++) {
+        OverlappedCommPort* port = (OverlappedCommPort*) entries[i].lpCompletionKey;
+        DWORD transferred = 0;
+        const bool ok = GetOverlappedResult(port->handle, entries[i].lpOverlapped, &transferred, FALSE);
+
+        if (entries[i].lpOverlapped == &port->read_ov) {
+            nmbs_ring_push(&port->rx, port->read_buf, transferred);
+
+            // A failed read, or an empty one on a socket, means the port was closed or disconnected. The requests in
+            // progress on the port will time out
+            if (ok && (transferred > 0 || !port->socket))
+                StartRead(port);
+        }
+        else if (entries[i].lpOverlapped == &port->write_ov) {
+            port->write_pending = false;
+            StartWrite(port);
+        }
+    }
+
+    return (int) removed;
+}
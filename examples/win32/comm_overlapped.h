@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * Overlapped I/O transport for the non-blocking client, serving many COM ports and TCP connections from one thread.
+ *
+ * Every port is associated with a single I/O completion port. A read is always pending on each port, and its completed
+ * chunks are pushed to the rx nmbs_ring of the port. Writes are queued to the tx nmbs_ring and sent by an overlapped
+ * WriteFile(). PollCommCompletions() processes the completions, then nmbs_client_step() can be called for each port,
+ * with the nmbs_ring platform functions never blocking.
+ *
+ * Ports must be closed after the last call to PollCommCompletions(), since their completions refer to them.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "..\..\nanomodbus.h"
+
+#define OVERLAPPED_PORT_BUF_SIZE 512
+
+typedef struct OverlappedCommPort {
+    HANDLE handle;
+    bool socket;
+    OVERLAPPED read_ov;
+    OVERLAPPED write_ov;
+    bool write_pending;
+    uint8_t read_buf[256];     // destination of the pending ReadFile()
+    uint8_t write_buf[256];    // source of the pending WriteFile()
+    uint8_t rx_buf[OVERLAPPED_PORT_BUF_SIZE];
+    uint8_t tx_buf[OVERLAPPED_PORT_BUF_SIZE];
+    nmbs_ring rx;
+    nmbs_ring tx;
+    nmbs_ring_port ring_port;
+} OverlappedCommPort;
+
+// function prototypes
+HANDLE CreateCommCompletionPort(void);
+bool InitOverlappedCommPort(OverlappedCommPort* port, HANDLE iocp, int PortNumber, DWORD baudrate);
+bool ConnectOverlappedTcp(OverlappedCommPort* port, HANDLE iocp, const char* address, const char* service);
+void CloseOverlappedCommPort(OverlappedCommPort* port);
+void OverlappedPlatformConf(nmbs_platform_conf* platform_conf, OverlappedCommPort* port);
+int PollCommCompletions(HANDLE iocp, DWORD timeout_ms);
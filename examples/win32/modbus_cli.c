@@ -1,18 +1,27 @@
 /*
  * This example application uses the win32 API to read a single modbus
  * register from a server. 
+ *
+ * In scan mode, it reads a register from a range of unit IDs on many COM ports and TCP gateways at once, from a single
+ * thread, and reports the round-trip time of each device that answers. Requests on different ports run in parallel
+ * with the non-blocking client and the overlapped I/O transport of comm_overlapped.h.
  */
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 
 #include "..\..\nanomodbus.h"
 #include "comm.h"
+#include "comm_overlapped.h"
 
 #define NMBS_DEBUG 1
 #define RTU_SERVER_ADDRESS 1
+#define SCAN_TARGETS_MAX 16
+#define SCAN_TIMEOUT_MS 200
 
 HANDLE hComm;
 int reg_to_read;
@@ -44,6 +53,121 @@ void onError(nmbs_error err) {
     exit(0);
 }
 
+typedef struct ScanTarget {
+    const char* name;
+    OverlappedCommPort port;
+    nmbs_t nmbs;
+    int unit_id;
+    LARGE_INTEGER start;
+    uint16_t value;
+} ScanTarget;
+
+ScanTarget targets[SCAN_TARGETS_MAX];
+LARGE_INTEGER counter_frequency;
+
+uint32_t time_ms(void* arg) {
+    return GetTickCount();
+}
+
+// Sends the request to the next unit ID of the target, returns false when the target was fully scanned
+bool ScanNext(ScanTarget* target, uint16_t reg, int last_unit_id) {
+    while (target->unit_id <= last_unit_id) {
+        nmbs_set_destination_rtu_address(&target->nmbs, (uint8_t) target->unit_id);
+        QueryPerformanceCounter(&target->start);
+
+        nmbs_error err = nmbs_client_begin_read_holding_registers(&target->nmbs, reg, 1, &target->value);
+        if (err == NMBS_ERROR_NONE)
+            return true;
+
+        printf("%s unit %d: error %s\n", target->name, target->unit_id, nmbs_strerror(err));
+        target->unit_id++;
+    }
+
+    return false;
+}
+
+// Target arguments are either COM port numbers or address:port of TCP gateways
+void Scan(HANDLE iocp, int argc, char** argv) {
+    DWORD baudrate = atoi(argv[2]);
+    uint16_t reg = (uint16_t) atoi(argv[3]);
+    int first_unit_id = atoi(argv[4]);
+    int last_unit_id = atoi(argv[5]);
+    int targets_count = 0;
+    int scanning = 0;
+
+    QueryPerformanceFrequency(&counter_frequency);
+
+    for (int i = 6; i < argc && targets_count < SCAN_TARGETS_MAX; i++) {
+        ScanTarget* target = &targets[targets_count];
+        char address[256] = {0};
+        char* colon = strrchr(argv[i], ':');
+        bool ok;
+
+        target->name = argv[i];
+        if (colon) {
+            strncpy_s(address, sizeof(address), argv[i], colon - argv[i]);
+            ok = ConnectOverlappedTcp(&target->port, iocp, address, colon + 1);
+        }
+        else
+            ok = InitOverlappedCommPort(&target->port, iocp, atoi(argv[i]), baudrate);
+
+        if (!ok) {
+            printf("error opening %s\n", argv[i]);
+            continue;
+        }
+
+        nmbs_platform_conf platform_conf;
+        nmbs_platform_conf_create(&platform_conf);
+        OverlappedPlatformConf(&platform_conf, &target->port);
+        platform_conf.time_ms = time_ms;
+
+        nmbs_error err = nmbs_client_create(&target->nmbs, &platform_conf);
+        if (err != NMBS_ERROR_NONE)
+            onError(err);
+
+        nmbs_set_read_timeout(&target->nmbs, SCAN_TIMEOUT_MS);
+        if (platform_conf.transport == NMBS_TRANSPORT_RTU)
+            nmbs_set_baud_rate(&target->nmbs, baudrate);
+
+        target->unit_id = first_unit_id;
+        if (ScanNext(target, reg, last_unit_id))
+            scanning++;
+
+        targets_count++;
+    }
+
+    while (scanning > 0) {
+        // Wake up regularly to expire the requests of the devices that don't answer
+        if (PollCommCompletions(iocp, 10) < 0)
+            onError(NMBS_ERROR_TRANSPORT);
+
+        for (int i = 0; i < targets_count; i++) {
+            ScanTarget* target = &targets[i];
+            nmbs_error err;
+            if (nmbs_client_step(&target->nmbs, &err) != NMBS_CLIENT_DONE)
+                continue;
+
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            double rtt_ms = (double) (end.QuadPart - target->start.QuadPart) * 1000.0 / counter_frequency.QuadPart;
+
+            if (err == NMBS_ERROR_NONE)
+                printf("%s unit %d: register %d is set to: %d, round trip %.2f ms\n", target->name, target->unit_id,
+                       reg, target->value, rtt_ms);
+            else if (err != NMBS_ERROR_TIMEOUT)
+                printf("%s unit %d: %s, round trip %.2f ms\n", target->name, target->unit_id, nmbs_strerror(err),
+                       rtt_ms);
+
+            target->unit_id++;
+            if (!ScanNext(target, reg, last_unit_id))
+                scanning--;
+        }
+    }
+
+    for (int i = 0; i < targets_count; i++)
+        CloseOverlappedCommPort(&targets[i].port);
+}
+
 void ReadRegister(uint16_t reg) {
 
     nmbs_platform_conf platform_conf;
@@ -73,7 +197,20 @@ void ReadRegister(uint16_t reg) {
 int main(int argc, char** argv) {
 
     printf("modbus_cli - CLI to read modbus registers\n");
-    printf("Usage: modbus_cli comport register\n\n");
+    printf("Usage: modbus_cli comport register\n");
+    printf("       modbus_cli scan baudrate register first_unit last_unit comport|address:port...\n\n");
+
+    if (argc > 6 && strcmp(argv[1], "scan") == 0) {
+        HANDLE iocp = CreateCommCompletionPort();
+        if (!iocp) {
+            printf("error creating completion port\n");
+            exit(0);
+        }
+
+        Scan(iocp, argc, argv);
+        CloseHandle(iocp);
+        return 0;
+    }
 
     parseCmdLine(argc, argv);
 
@@ -23,10 +23,7 @@ bool modbus_get_digital_outputs_from_server(uint8_t outputs[], const uint16_t ad
         return false;
     }
 
-    for (uint16_t i = 0; i < quantity; i++) {
-        bool value = nmbs_bitfield_read(coils_out, address + i);
-        nmbs_bitfield_write(outputs, i, value);
-    }
+    nmbs_bitfield_copy(outputs, 0, coils_out, 0, quantity);
 
     return true;
 }
@@ -38,10 +35,7 @@ bool modbus_get_digital_inputs_from_server(uint8_t inputs[], const uint16_t addr
         return false;
     }
 
-    for (uint16_t i = 0; i < quantity; i++) {
-        bool value = nmbs_bitfield_read(inputs_out, address + i);
-        nmbs_bitfield_write(inputs, i, value);
-    }
+    nmbs_bitfield_copy(inputs, 0, inputs_out, 0, quantity);
 
     return true;
 }
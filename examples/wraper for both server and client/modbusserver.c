@@ -110,9 +110,7 @@ nmbs_error handle_write_multiple_coils(uint16_t address, uint16_t quantity, cons
         return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
     }
 
-    for (uint16_t i = 0; i < quantity; i++) {
-        nmbs_bitfield_write(server_coils, address + i, nmbs_bitfield_read(coils, i));
-    }
+    nmbs_bitfield_copy(server_coils, address, coils, 0, quantity);
 
     return NMBS_ERROR_NONE;
 }
@@ -171,10 +169,7 @@ nmbs_error handle_read_discrete_inputs(uint16_t address, uint16_t quantity, nmbs
         return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
     }
 
-    for (uint16_t i = 0; i < quantity; i++) {
-        bool value = nmbs_bitfield_read(server_inputs, address + i);
-        nmbs_bitfield_write(inputs_out, i, value);
-    }
+    nmbs_bitfield_copy(inputs_out, 0, server_inputs, address, quantity);
 
     return NMBS_ERROR_NONE;
 }
@@ -185,10 +180,7 @@ nmbs_error handle_read_coils(uint16_t address, uint16_t quantity, nmbs_bitfield
         return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
     }
 
-    for (uint16_t i = 0; i < quantity; i++) {
-        bool value = nmbs_bitfield_read(server_coils, address + i);
-        nmbs_bitfield_write(coils_out, i, value);
-    }
+    nmbs_bitfield_copy(coils_out, 0, server_coils, address, quantity);
 
     return NMBS_ERROR_NONE;
 }
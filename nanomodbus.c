@@ -39,6 +39,51 @@
 #define NMBS_DEBUG_PRINT(...) (void) (0)
 #endif
 
+#if defined(NMBS_TRANSPORT_RTU_ONLY) && defined(NMBS_TRANSPORT_TCP_ONLY)
+#error "NMBS_TRANSPORT_RTU_ONLY and NMBS_TRANSPORT_TCP_ONLY are mutually exclusive"
+#endif
+
+#if defined(NMBS_LOW_STACK) && NMBS_SCRATCH_SIZE < 280
+#error "NMBS_SCRATCH_SIZE must be at least 280 bytes"
+#endif
+
+// With a single transport compiled in, the branches on the transport are resolved at compile time
+#if defined(NMBS_TRANSPORT_RTU_ONLY)
+#define NMBS_IS_RTU(nmbs) (true)
+#define NMBS_IS_TCP(nmbs) (false)
+#elif defined(NMBS_TRANSPORT_TCP_ONLY)
+#define NMBS_IS_RTU(nmbs) (false)
+#define NMBS_IS_TCP(nmbs) (true)
+#else
+#define NMBS_IS_RTU(nmbs) ((nmbs)->platform.transport == NMBS_TRANSPORT_RTU)
+#define NMBS_IS_TCP(nmbs) ((nmbs)->platform.transport == NMBS_TRANSPORT_TCP)
+#endif
+
+// Platform functions bound at compile time are called directly, so they can be inlined
+#ifdef NMBS_PLATFORM_HEADER
+#include NMBS_PLATFORM_HEADER
+#endif
+
+#ifdef NMBS_PLATFORM_READ
+#define NMBS_READ(nmbs, buf, count, timeout_ms) NMBS_PLATFORM_READ(buf, count, timeout_ms, (nmbs)->platform.arg)
+#else
+#define NMBS_READ(nmbs, buf, count, timeout_ms) (nmbs)->platform.read(buf, count, timeout_ms, (nmbs)->platform.arg)
+#endif
+
+#ifdef NMBS_PLATFORM_WRITE
+#define NMBS_WRITE(nmbs, buf, count, timeout_ms) NMBS_PLATFORM_WRITE(buf, count, timeout_ms, (nmbs)->platform.arg)
+#else
+#define NMBS_WRITE(nmbs, buf, count, timeout_ms) (nmbs)->platform.write(buf, count, timeout_ms, (nmbs)->platform.arg)
+#endif
+
+#ifdef NMBS_PLATFORM_CRC_CALC
+#define NMBS_CRC_CALC(nmbs, data, length) NMBS_PLATFORM_CRC_CALC(data, length, (nmbs)->platform.arg)
+#define NMBS_CRC_IS_DEFAULT(nmbs) (false)
+#else
+#define NMBS_CRC_CALC(nmbs, data, length) (nmbs)->platform.crc_calc(data, length, (nmbs)->platform.arg)
+#define NMBS_CRC_IS_DEFAULT(nmbs) ((nmbs)->platform.crc_calc == nmbs_crc_calc)
+#endif
+
 
 static uint8_t get_1(nmbs_t* nmbs) {
     uint8_t result = nmbs->msg.buf[nmbs->msg.buf_idx];
@@ -138,22 +183,246 @@ static void put_regs(nmbs_t* nmbs, const uint16_t* data, uint16_t n) {
 
 
 static void swap_regs(uint16_t* data, uint16_t n) {
-    while (n--) {
-        data[n] = (data[n] << 8) | ((data[n] >> 8) & 0xFF);
+    // Simple enough for compilers to vectorize
+    for (uint16_t i = 0; i < n; i++)
+        data[i] = (uint16_t) (data[i] << 8 | data[i] >> 8);
+}
+
+
+// Full hardware and compiler fence, ordering the plain accesses around the volatile indexes shared with other threads
+#if (defined(NMBS_STATS) || defined(NMBS_TRACE) || defined(NMBS_RING)) && !defined(NMBS_MEMORY_BARRIER)
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define NMBS_MEMORY_BARRIER() atomic_thread_fence(memory_order_seq_cst)
+#elif defined(__GNUC__) || defined(__clang__)
+#define NMBS_MEMORY_BARRIER() __sync_synchronize()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#if defined(_M_ARM64)
+#define NMBS_MEMORY_BARRIER() __dmb(_ARM64_BARRIER_ISH)
+#elif defined(_M_ARM)
+#define NMBS_MEMORY_BARRIER() __dmb(_ARM_BARRIER_ISH)
+#else
+#define NMBS_MEMORY_BARRIER()                                                                                          \
+    do {                                                                                                               \
+        _ReadWriteBarrier();                                                                                           \
+        _mm_mfence();                                                                                                  \
+    } while (0)
+#endif
+#else
+#error "No memory barrier known for this compiler, define NMBS_MEMORY_BARRIER()"
+#endif
+#endif
+
+
+#ifdef NMBS_STATS
+// Counters are updated under a sequence counter, odd while an update is in progress, see nmbs_stats_snapshot()
+static nmbs_stats* stats_begin(nmbs_t* nmbs) {
+    nmbs->stats_seq++;
+    NMBS_MEMORY_BARRIER();
+
+    if (nmbs->stats_reset) {
+        memset(nmbs->stats, 0, sizeof(nmbs_stats));
+        nmbs->stats_reset = false;
+    }
+
+    return nmbs->stats;
+}
+
+
+static void stats_end(nmbs_t* nmbs) {
+    NMBS_MEMORY_BARRIER();
+    nmbs->stats_seq++;
+}
+
+
+static uint8_t stats_fc_index(uint8_t fc) {
+    fc &= 0x7F;
+    return fc < NMBS_STATS_FCS ? fc : 0;
+}
+
+
+static void stats_bytes_in(nmbs_t* nmbs, int32_t count) {
+    if (!nmbs->stats || count <= 0)
+        return;
+
+    stats_begin(nmbs)->bytes_in += (uint32_t) count;
+    stats_end(nmbs);
+}
+
+
+static void stats_msg_in(nmbs_t* nmbs) {
+    if (!nmbs->stats)
+        return;
+
+    stats_begin(nmbs)->fc_in[stats_fc_index(nmbs->msg.fc)]++;
+    stats_end(nmbs);
+}
+
+
+static void stats_msg_out(nmbs_t* nmbs, uint16_t count) {
+    if (!nmbs->stats)
+        return;
+
+    nmbs_stats* stats = stats_begin(nmbs);
+    stats->fc_out[stats_fc_index(nmbs->msg.fc)]++;
+    stats->bytes_out += count;
+    stats_end(nmbs);
+}
+
+
+static void stats_result(nmbs_t* nmbs, nmbs_error err) {
+    if (!nmbs->stats)
+        return;
+
+    nmbs_stats* stats = stats_begin(nmbs);
+    if (err <= 0 && -err < NMBS_STATS_CODES)
+        stats->errors[-err]++;
+    else if (err > 0 && err < NMBS_STATS_CODES)
+        stats->exceptions[err]++;
+    stats_end(nmbs);
+}
+
+
+// Start measuring a transaction
+static void stats_start(nmbs_t* nmbs) {
+    if (!nmbs->stats)
+        return;
+
+    nmbs->stats_pending = true;
+    if (nmbs->stats_clock)
+        nmbs->stats_start = nmbs->stats_clock(nmbs->platform.arg);
+}
+
+
+#ifndef NMBS_SERVER_DISABLED
+// The current transaction was a frame addressed to another server
+static void stats_ignored(nmbs_t* nmbs) {
+    if (!nmbs->stats)
+        return;
+
+    nmbs->stats_pending = false;
+    stats_begin(nmbs)->ignored_frames++;
+    stats_end(nmbs);
+}
+#endif
+
+
+#ifndef NMBS_CLIENT_DISABLED
+// The current transaction is an asynchronous request, completed by nmbs_async_poll()
+static void stats_detach(nmbs_t* nmbs) {
+    nmbs->stats_pending = false;
+}
+#endif
+
+
+// End the current transaction, if any, and pass its result through
+static nmbs_error stats_done(nmbs_t* nmbs, nmbs_error err) {
+    if (!nmbs->stats || !nmbs->stats_pending)
+        return err;
+
+    nmbs->stats_pending = false;
+
+    uint8_t bucket = 0;
+    if (nmbs->stats_clock) {
+        uint32_t latency = nmbs->stats_clock(nmbs->platform.arg) - nmbs->stats_start;
+        while (latency && bucket < NMBS_STATS_LATENCY_BUCKETS - 1) {
+            latency >>= 1;
+            bucket++;
+        }
+    }
+
+    stats_result(nmbs, err);
+    if (nmbs->stats_clock) {
+        stats_begin(nmbs)->latency[bucket]++;
+        stats_end(nmbs);
+    }
+
+    return err;
+}
+#else
+#define stats_bytes_in(nmbs, count) (void) (0)
+#define stats_msg_in(nmbs) (void) (0)
+#define stats_msg_out(nmbs, count) (void) (0)
+#define stats_result(nmbs, err) (void) (0)
+#define stats_start(nmbs) (void) (0)
+#define stats_ignored(nmbs) (void) (0)
+#define stats_detach(nmbs) (void) (0)
+#define stats_done(nmbs, err) (err)
+#endif
+
+
+#ifdef NMBS_TRACE
+// Add a record of the ADU made of head followed by tail. Only the instance thread writes the ring head
+static void trace_msg(nmbs_t* nmbs, nmbs_trace_direction direction, const uint8_t* head, uint16_t head_len,
+                      const uint8_t* tail, uint16_t tail_len, nmbs_error result) {
+    nmbs_trace* trace = nmbs->trace;
+    if (!trace)
+        return;
+
+    if (trace->head - trace->tail > trace->mask) {
+        trace->dropped++;
+        return;
+    }
+
+    nmbs_trace_record* r = &trace->records[trace->head & trace->mask];
+    r->timestamp = nmbs->trace_clock ? nmbs->trace_clock(nmbs->platform.arg) : 0;
+    r->direction = (uint8_t) direction;
+    r->unit_id = nmbs->msg.unit_id;
+    r->fc = nmbs->msg.fc;
+    r->result = (int8_t) result;
+    r->length = head_len + tail_len;
+
+    uint16_t n = head_len < NMBS_TRACE_ADU_SLICE ? head_len : NMBS_TRACE_ADU_SLICE;
+    memcpy(r->adu, head, n);
+    if (n < NMBS_TRACE_ADU_SLICE && tail_len > 0) {
+        const uint16_t m = tail_len < NMBS_TRACE_ADU_SLICE - n ? tail_len : NMBS_TRACE_ADU_SLICE - n;
+        memcpy(r->adu + n, tail, m);
+        n += m;
     }
+    memset(r->adu + n, 0, NMBS_TRACE_ADU_SLICE - n);
+
+    // The two 16-bit fields following the function code
+    const uint8_t pdu = NMBS_IS_RTU(nmbs) ? 1 : 7;
+    r->address = n >= pdu + 3 ? (uint16_t) (r->adu[pdu + 1] << 8) | (uint16_t) r->adu[pdu + 2] : 0;
+    r->quantity = n >= pdu + 5 ? (uint16_t) (r->adu[pdu + 3] << 8) | (uint16_t) r->adu[pdu + 4] : 0;
+
+    NMBS_MEMORY_BARRIER();
+    trace->head++;
+}
+
+
+// Trace the message received in msg.buf
+static nmbs_error trace_rx(nmbs_t* nmbs, nmbs_error result) {
+    const uint16_t len = nmbs->msg.complete ? nmbs->msg.frame_len : nmbs->msg.buf_idx;
+    trace_msg(nmbs, NMBS_TRACE_RX, nmbs->msg.buf, len, NULL, 0, result);
+    return result;
 }
+#else
+#define trace_msg(nmbs, direction, head, head_len, tail, tail_len, result) (void) (0)
+#define trace_rx(nmbs, result) (result)
+#endif
 
 
 static nmbs_error recv(nmbs_t* nmbs, uint16_t count) {
     if (nmbs->msg.complete) {
+        // The frame ended before the expected data, as if the byte timeout expired
+        if (nmbs->msg.buf_idx + count > nmbs->msg.frame_len)
+            return NMBS_ERROR_TIMEOUT;
+
         return NMBS_ERROR_NONE;
     }
 
-    const int32_t ret =
-            nmbs->platform.read(nmbs->msg.buf + nmbs->msg.buf_idx, count, nmbs->byte_timeout_ms, nmbs->platform.arg);
+    const int32_t ret = NMBS_READ(nmbs, nmbs->msg.buf + nmbs->msg.buf_idx, count, nmbs->byte_timeout_ms);
+    stats_bytes_in(nmbs, ret);
+
+    if (ret == count) {
+        // Fold the received bytes into the running CRC, so we don't need a second pass over the buffer
+        if (NMBS_IS_RTU(nmbs) && NMBS_CRC_IS_DEFAULT(nmbs))
+            nmbs->msg.crc = nmbs_crc_update(nmbs->msg.crc, nmbs->msg.buf + nmbs->msg.buf_idx, count);
 
-    if (ret == count)
         return NMBS_ERROR_NONE;
+    }
 
     if (ret < count) {
         if (ret < 0)
@@ -166,9 +435,7 @@ static nmbs_error recv(nmbs_t* nmbs, uint16_t count) {
 }
 
 
-static nmbs_error send(const nmbs_t* nmbs, uint16_t count) {
-    const int32_t ret = nmbs->platform.write(nmbs->msg.buf, count, nmbs->byte_timeout_ms, nmbs->platform.arg);
-
+static nmbs_error write_result(int32_t ret, uint16_t count) {
     if (ret == count)
         return NMBS_ERROR_NONE;
 
@@ -183,8 +450,27 @@ static nmbs_error send(const nmbs_t* nmbs, uint16_t count) {
 }
 
 
+static nmbs_error send(const nmbs_t* nmbs, uint16_t count) {
+    const int32_t ret = NMBS_WRITE(nmbs, nmbs->msg.buf, count, nmbs->byte_timeout_ms);
+    return write_result(ret, count);
+}
+
+
 static void flush(nmbs_t* nmbs) {
-    nmbs->platform.read(nmbs->msg.buf, sizeof(nmbs->msg.buf), 0, nmbs->platform.arg);
+    // Frames handed to the instance by the caller don't come from the line, there's nothing to flush.
+    // Stream transports with read_frame() can still hold the rest of a truncated frame, or a late response
+    if (nmbs->msg.external)
+        return;
+
+    if (nmbs->platform.bytes_available && nmbs->platform.bytes_available(nmbs->platform.arg) == 0)
+        return;
+
+    if (nmbs->platform.drain) {
+        nmbs->platform.drain(nmbs->platform.arg);
+        return;
+    }
+
+    NMBS_READ(nmbs, nmbs->msg.buf, sizeof(nmbs->msg.buf), 0);
 }
 
 
@@ -201,26 +487,153 @@ static void msg_state_reset(nmbs_t* nmbs) {
     nmbs->msg.broadcast = false;
     nmbs->msg.ignored = false;
     nmbs->msg.complete = false;
+    nmbs->msg.framed = false;
+    nmbs->msg.external = false;
+    nmbs->msg.frame_len = 0;
+    nmbs->msg.preloaded = false;
+    nmbs->msg.crc = NMBS_CRC_INIT;
 }
 
 
 #ifndef NMBS_CLIENT_DISABLED
-static void msg_state_req(nmbs_t* nmbs, uint8_t fc) {
-    if (nmbs->current_tid == UINT16_MAX)
-        nmbs->current_tid = 1;
-    else
-        nmbs->current_tid++;
+static bool async_tid_in_flight(const nmbs_t* nmbs, uint16_t tid) {
+    for (uint16_t i = 0; i < nmbs->async->reqs_count; i++) {
+        if (nmbs->async->reqs[i].in_flight && nmbs->async->reqs[i].tid == tid)
+            return true;
+    }
+
+    return false;
+}
+
 
-    // Flush the remaining data on the line before sending the request
-    flush(nmbs);
+static void msg_state_req(nmbs_t* nmbs, uint8_t fc) {
+    do {
+        if (nmbs->current_tid == UINT16_MAX)
+            nmbs->current_tid = 1;
+        else
+            nmbs->current_tid++;
+    } while (nmbs->async && async_tid_in_flight(nmbs, nmbs->current_tid));
+
+    // Flush the remaining data on the line before sending the request.
+    // Asynchronous TCP responses are matched by transaction ID, and the ones still in flight must not be discarded.
+    if (!nmbs->async || NMBS_IS_RTU(nmbs)) {
+        flush(nmbs);
+        if (nmbs->async)
+            nmbs->async->rx_len = 0;
+    }
 
     msg_state_reset(nmbs);
     nmbs->msg.unit_id = nmbs->dest_address_rtu;
     nmbs->msg.fc = fc;
     nmbs->msg.transaction_id = nmbs->current_tid;
-    if (nmbs->msg.unit_id == NMBS_BROADCAST_ADDRESS && nmbs->platform.transport == NMBS_TRANSPORT_RTU)
+    if (nmbs->msg.unit_id == NMBS_BROADCAST_ADDRESS && NMBS_IS_RTU(nmbs))
         nmbs->msg.broadcast = true;
+
+#ifdef NMBS_UNIT_TRACKING
+    nmbs->unit = NULL;
+    if (nmbs->units && !nmbs->async && !nmbs->msg.broadcast && nmbs->msg.unit_id < nmbs->units_count)
+        nmbs->unit = &nmbs->units[nmbs->msg.unit_id];
+#endif
+
+    stats_start(nmbs);
+}
+#endif
+
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_UNIT_TRACKING)
+static int32_t unit_timeout(const nmbs_t* nmbs, const nmbs_unit_health* unit) {
+    const int32_t read_timeout_ms = nmbs->read_timeout_ms;
+    if (unit->samples == 0)
+        return read_timeout_ms;
+
+    uint32_t timeout_ms = (unit->srtt8 >> 3) + unit->rttvar4 + (nmbs->t35_us + 999) / 1000;
+    if (timeout_ms == 0)
+        timeout_ms = 1;
+
+    timeout_ms <<= unit->lost < 16 ? unit->lost : 16;
+
+    if ((int32_t) timeout_ms < nmbs->units_min_timeout_ms)
+        timeout_ms = (uint32_t) nmbs->units_min_timeout_ms;
+
+    if (read_timeout_ms >= 0 && timeout_ms > (uint32_t) read_timeout_ms)
+        return read_timeout_ms;
+
+    return (int32_t) timeout_ms;
+}
+
+
+// Whether the request being sent has to be skipped, because its unit is in backoff and it's not the time for a probe
+static bool unit_skip(nmbs_t* nmbs) {
+    nmbs_unit_health* unit = nmbs->unit;
+    if (!unit || unit->backoff_ms == 0)
+        return false;
+
+    const uint32_t now = nmbs->platform.time_ms(nmbs->platform.arg);
+    if ((int32_t) (now - unit->next_probe_ms) >= 0) {
+        unit->next_probe_ms = now + unit->backoff_ms;
+        return false;
+    }
+
+    unit->skipped++;
+    nmbs->unit = NULL;
+    return true;
+}
+
+
+static void unit_sent(nmbs_t* nmbs, nmbs_error err) {
+    if (!nmbs->unit)
+        return;
+
+    if (err == NMBS_ERROR_NONE)
+        nmbs->unit_sent_ms = nmbs->platform.time_ms(nmbs->platform.arg);
+    else
+        nmbs->unit = NULL;
+}
+
+
+// Update the response time estimate of a unit (RFC 6298, in fixed point), or its backoff state after a timeout
+static void unit_update(nmbs_t* nmbs, nmbs_unit_health* unit, bool responded, nmbs_error err) {
+    const uint32_t now = nmbs->platform.time_ms(nmbs->platform.arg);
+
+    if (responded) {
+        const uint32_t rtt = now - nmbs->unit_sent_ms;
+        if (unit->samples == 0) {
+            unit->srtt8 = rtt << 3;
+            unit->rttvar4 = rtt << 1;
+        }
+        else {
+            int32_t delta = (int32_t) rtt - (int32_t) (unit->srtt8 >> 3);
+            unit->srtt8 = (uint32_t) ((int32_t) unit->srtt8 + delta);
+            if (delta < 0)
+                delta = -delta;
+
+            unit->rttvar4 = unit->rttvar4 + (uint32_t) delta - (unit->rttvar4 >> 2);
+        }
+
+        unit->samples++;
+        unit->lost = 0;
+        unit->backoff_ms = 0;
+    }
+    else if (err == NMBS_ERROR_TIMEOUT) {
+        unit->timeouts++;
+        if (unit->lost < UINT16_MAX)
+            unit->lost++;
+
+        if (nmbs->units_dead_after > 0 && unit->lost >= nmbs->units_dead_after) {
+            if (unit->backoff_ms == 0)
+                unit->backoff_ms = nmbs->units_backoff_min_ms;
+            else if (unit->backoff_ms < nmbs->units_backoff_max_ms / 2)
+                unit->backoff_ms *= 2;
+            else
+                unit->backoff_ms = nmbs->units_backoff_max_ms;
+
+            unit->next_probe_ms = now + unit->backoff_ms;
+        }
+    }
 }
+#else
+#define unit_skip(nmbs) false
+#define unit_sent(nmbs, err) (void) (0)
 #endif
 
 
@@ -236,14 +649,32 @@ nmbs_error nmbs_create(nmbs_t* nmbs, const nmbs_platform_conf* platform_conf) {
     if (!platform_conf || platform_conf->initialized != 0xFFFFDEBE)
         return NMBS_ERROR_INVALID_ARGUMENT;
 
+#if defined(NMBS_TRANSPORT_RTU_ONLY)
+    if (platform_conf->transport != NMBS_TRANSPORT_RTU)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+#elif defined(NMBS_TRANSPORT_TCP_ONLY)
+    if (platform_conf->transport != NMBS_TRANSPORT_TCP)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+#else
     if (platform_conf->transport != NMBS_TRANSPORT_RTU && platform_conf->transport != NMBS_TRANSPORT_TCP)
         return NMBS_ERROR_INVALID_ARGUMENT;
+#endif
+
+#ifndef NMBS_PLATFORM_READ
+    if (!platform_conf->read)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+#endif
 
-    if (!platform_conf->read || !platform_conf->write)
+#ifndef NMBS_PLATFORM_WRITE
+    if (!platform_conf->write)
         return NMBS_ERROR_INVALID_ARGUMENT;
+#endif
 
     nmbs->platform = *platform_conf;
 
+    if (!nmbs->platform.crc_calc)
+        nmbs->platform.crc_calc = nmbs_crc_calc;
+
     return NMBS_ERROR_NONE;
 }
 
@@ -258,6 +689,36 @@ void nmbs_set_byte_timeout(nmbs_t* nmbs, int32_t timeout_ms) {
 }
 
 
+void nmbs_rtu_char_timings(uint32_t baud_rate, uint32_t* t15_us, uint32_t* t35_us) {
+    if (baud_rate == 0 || baud_rate > 19200) {
+        *t15_us = 750;
+        *t35_us = 1750;
+        return;
+    }
+
+    // 1.5 and 3.5 characters of 11 bits, rounded up
+    *t15_us = (16500000 + baud_rate - 1) / baud_rate;
+    *t35_us = (38500000 + baud_rate - 1) / baud_rate;
+}
+
+
+nmbs_error nmbs_set_baud_rate(nmbs_t* nmbs, uint32_t baud_rate) {
+    if (baud_rate == 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    uint32_t t15_us = 0;
+    uint32_t t35_us = 0;
+    nmbs_rtu_char_timings(baud_rate, &t15_us, &t35_us);
+    nmbs->byte_timeout_ms = (int32_t) ((t35_us + 999) / 1000);
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_UNIT_TRACKING)
+    nmbs->t35_us = t35_us;
+#endif
+
+    return NMBS_ERROR_NONE;
+}
+
+
 void nmbs_platform_conf_create(nmbs_platform_conf* platform_conf) {
     memset(platform_conf, 0, sizeof(nmbs_platform_conf));
     platform_conf->crc_calc = nmbs_crc_calc;
@@ -276,2141 +737,6330 @@ void nmbs_set_platform_arg(nmbs_t* nmbs, void* arg) {
 }
 
 
-uint16_t nmbs_crc_calc(const uint8_t* data, uint32_t length, void* arg) {
-    NMBS_UNUSED_PARAM(arg);
-    uint16_t crc = 0xFFFF;
-    for (uint32_t i = 0; i < length; i++) {
-        crc ^= (uint16_t) data[i];
-        for (int j = 8; j != 0; j--) {
-            if ((crc & 0x0001) != 0) {
-                crc >>= 1;
-                crc ^= 0xA001;
-            }
-            else
-                crc >>= 1;
-        }
-    }
+#ifdef NMBS_STATS
+nmbs_error nmbs_stats_enable(nmbs_t* nmbs, nmbs_stats* stats, nmbs_stats_clock clock) {
+    if (!nmbs || !stats)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    return (uint16_t) (crc << 8) | (uint16_t) (crc >> 8);
+    memset(stats, 0, sizeof(nmbs_stats));
+    nmbs->stats_clock = clock;
+    nmbs->stats_pending = false;
+    nmbs->stats_reset = false;
+    nmbs->stats = stats;
+
+    return NMBS_ERROR_NONE;
 }
 
-static nmbs_error recv_msg_footer(nmbs_t* nmbs) {
-    NMBS_DEBUG_PRINT("\n");
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        const uint16_t crc = nmbs->platform.crc_calc(nmbs->msg.buf, nmbs->msg.buf_idx, nmbs->platform.arg);
+nmbs_error nmbs_stats_snapshot(const nmbs_t* nmbs, nmbs_stats* stats_out) {
+    if (!nmbs || !nmbs->stats || !stats_out)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-        const nmbs_error err = recv(nmbs, 2);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    uint32_t seq;
+    do {
+        seq = nmbs->stats_seq;
+        NMBS_MEMORY_BARRIER();
 
-        const uint16_t recv_crc = get_2(nmbs);
-        if (recv_crc != crc)
-            return NMBS_ERROR_CRC;
-    }
+        // A pending reset is applied before the next update
+        if (nmbs->stats_reset)
+            memset(stats_out, 0, sizeof(nmbs_stats));
+        else
+            memcpy(stats_out, nmbs->stats, sizeof(nmbs_stats));
+
+        NMBS_MEMORY_BARRIER();
+    } while ((seq & 1) || seq != nmbs->stats_seq);
 
     return NMBS_ERROR_NONE;
 }
 
 
-static nmbs_error recv_msg_header(nmbs_t* nmbs, bool* first_byte_received) {
-    // We wait for the read timeout here, just for the first message byte
-    int32_t old_byte_timeout = nmbs->byte_timeout_ms;
-    nmbs->byte_timeout_ms = nmbs->read_timeout_ms;
-
-    msg_state_reset(nmbs);
+void nmbs_stats_reset(nmbs_t* nmbs) {
+    nmbs->stats_reset = true;
+}
+#endif
 
-    *first_byte_received = false;
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        nmbs_error err = recv(nmbs, 1);
+#ifdef NMBS_TRACE
+nmbs_error nmbs_trace_create(nmbs_trace* trace, nmbs_trace_record* records, uint32_t count) {
+    if (!trace || !records || count == 0 || (count & (count - 1)) != 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-        nmbs->byte_timeout_ms = old_byte_timeout;
+    trace->records = records;
+    trace->mask = count - 1;
+    trace->head = 0;
+    trace->tail = 0;
+    trace->dropped = 0;
 
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    return NMBS_ERROR_NONE;
+}
 
-        *first_byte_received = true;
 
-        nmbs->msg.unit_id = get_1(nmbs);
+void nmbs_trace_enable(nmbs_t* nmbs, nmbs_trace* trace, nmbs_trace_clock clock) {
+    nmbs->trace_clock = clock;
+    nmbs->trace = trace;
+}
 
-        err = recv(nmbs, 1);
-        if (err != NMBS_ERROR_NONE)
-            return err;
 
-        nmbs->msg.fc = get_1(nmbs);
+uint32_t nmbs_trace_read(nmbs_trace* trace, nmbs_trace_record* records_out, uint32_t count) {
+    uint32_t read = 0;
+    while (read < count && trace->tail != trace->head) {
+        NMBS_MEMORY_BARRIER();
+        records_out[read++] = trace->records[trace->tail & trace->mask];
+        NMBS_MEMORY_BARRIER();
+        trace->tail++;
     }
-    else if (nmbs->platform.transport == NMBS_TRANSPORT_TCP) {
-        nmbs_error err = recv(nmbs, 1);
 
-        nmbs->byte_timeout_ms = old_byte_timeout;
+    return read;
+}
 
-        if (err != NMBS_ERROR_NONE)
-            return err;
 
-        *first_byte_received = true;
+uint32_t nmbs_trace_dropped(const nmbs_trace* trace) {
+    return trace->dropped;
+}
+#endif
 
-        // Advance buf_idx
-        discard_1(nmbs);
 
-        err = recv(nmbs, 7);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+// Up to 32 bits of a bitfield starting at any bit offset. Bytes are assembled with shifts, so the result doesn't
+// depend on the endianness, and no byte past the range is read
+static uint32_t bitfield_get(const uint8_t* bf, uint32_t offset, uint8_t n) {
+    const uint8_t* p = bf + (offset >> 3);
+    const uint8_t shift = offset & 7;
+    const uint8_t bytes = (uint8_t) ((shift + n + 7) / 8);
 
-        // Starting over
-        msg_buf_reset(nmbs);
+    uint64_t v = 0;
+    for (uint8_t i = 0; i < bytes; i++)
+        v |= (uint64_t) p[i] << (8 * i);
 
-        nmbs->msg.transaction_id = get_2(nmbs);
-        const uint16_t protocol_id = get_2(nmbs);
-        const uint16_t length = get_2(nmbs);
-        nmbs->msg.unit_id = get_1(nmbs);
-        nmbs->msg.fc = get_1(nmbs);
+    return (uint32_t) ((v >> shift) & ((1ULL << n) - 1));
+}
 
-        if (length < 2 || length > 255)
-            return NMBS_ERROR_INVALID_TCP_MBAP;
 
-        // Receive the rest of the message
-        err = recv(nmbs, length - 2);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+// Write up to 32 bits to a bitfield at any bit offset, leaving the bits around them as they are
+static void bitfield_put(uint8_t* bf, uint32_t offset, uint8_t n, uint32_t value) {
+    uint8_t* p = bf + (offset >> 3);
+    const uint8_t shift = offset & 7;
+    const uint8_t bytes = (uint8_t) ((shift + n + 7) / 8);
+    const uint64_t mask = ((1ULL << n) - 1) << shift;
+    const uint64_t v = ((uint64_t) value << shift) & mask;
 
-        if (protocol_id != 0)
-            return NMBS_ERROR_INVALID_TCP_MBAP;
+    for (uint8_t i = 0; i < bytes; i++)
+        p[i] = (uint8_t) ((p[i] & ~(uint8_t) (mask >> (8 * i))) | (uint8_t) (v >> (8 * i)));
+}
 
-        nmbs->msg.complete = true;
+
+// Index of the lowest bit set, x must not be 0
+static uint8_t bitfield_lowest(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint8_t) __builtin_ctz(x);
+#else
+    uint8_t i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
     }
 
-    return NMBS_ERROR_NONE;
+    return i;
+#endif
 }
 
 
-static void put_msg_header(nmbs_t* nmbs, uint16_t data_length) {
-    msg_buf_reset(nmbs);
+// Index of the first bit of the ranges that differs, or that is equal if differ is false, count if there is none
+static uint16_t bitfield_scan(const uint8_t* a, uint32_t a_offset, const uint8_t* b, uint32_t b_offset, uint16_t count,
+                              bool differ) {
+    for (uint16_t i = 0; i < count;) {
+        const uint8_t n = count - i < 32 ? (uint8_t) (count - i) : 32;
+        uint32_t x = bitfield_get(a, a_offset + i, n) ^ bitfield_get(b, b_offset + i, n);
+        if (!differ)
+            x = ~x & (uint32_t) ((1ULL << n) - 1);
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        put_1(nmbs, nmbs->msg.unit_id);
-    }
-    else if (nmbs->platform.transport == NMBS_TRANSPORT_TCP) {
-        put_2(nmbs, nmbs->msg.transaction_id);
-        put_2(nmbs, 0);
-        put_2(nmbs, (uint16_t) (1 + 1 + data_length));
-        put_1(nmbs, nmbs->msg.unit_id);
+        if (x)
+            return (uint16_t) (i + bitfield_lowest(x));
+
+        i += n;
     }
 
-    put_1(nmbs, nmbs->msg.fc);
+    return count;
 }
 
 
-#ifndef NMBS_SERVER_DISABLED
-#if !defined(NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED)
-static void set_msg_header_size(nmbs_t* nmbs, uint16_t data_length) {
-    if (nmbs->platform.transport == NMBS_TRANSPORT_TCP) {
-        data_length += 2;
-        set_2(nmbs, data_length, 4);
-    }
-}
-#endif
-#endif
+void nmbs_bitfield_copy(uint8_t* dst, uint16_t dst_offset, const uint8_t* src, uint16_t src_offset, uint16_t count) {
+    uint32_t d = dst_offset;
+    uint32_t s = src_offset;
+    uint16_t left = count;
 
+    // Bits up to the first byte boundary of the destination
+    const uint8_t head = (uint8_t) ((8 - (d & 7)) & 7);
+    if (head) {
+        const uint8_t n = left < head ? (uint8_t) left : head;
+        bitfield_put(dst, d, n, bitfield_get(src, s, n));
+        d += n;
+        s += n;
+        left -= n;
+    }
 
-static nmbs_error send_msg(nmbs_t* nmbs) {
-    NMBS_DEBUG_PRINT("\n");
+    uint8_t* p = dst + (d >> 3);
+    if ((s & 7) == 0) {
+        memcpy(p, src + (s >> 3), left / 8);
+        p += left / 8;
+        s += left & ~7U;
+        left &= 7;
+    }
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        const uint16_t crc = nmbs->platform.crc_calc(nmbs->msg.buf, nmbs->msg.buf_idx, nmbs->platform.arg);
-        put_2(nmbs, crc);
+    while (left >= 32) {
+        const uint32_t v = bitfield_get(src, s, 32);
+        p[0] = (uint8_t) v;
+        p[1] = (uint8_t) (v >> 8);
+        p[2] = (uint8_t) (v >> 16);
+        p[3] = (uint8_t) (v >> 24);
+        p += 4;
+        s += 32;
+        left -= 32;
     }
 
-    const nmbs_error err = send(nmbs, nmbs->msg.buf_idx);
+    while (left >= 8) {
+        *p++ = (uint8_t) bitfield_get(src, s, 8);
+        s += 8;
+        left -= 8;
+    }
 
-    return err;
+    if (left)
+        bitfield_put(p, 0, (uint8_t) left, bitfield_get(src, s, (uint8_t) left));
 }
 
 
-#ifndef NMBS_SERVER_DISABLED
-static nmbs_error recv_req_header(nmbs_t* nmbs, bool* first_byte_received) {
-    const nmbs_error err = recv_msg_header(nmbs, first_byte_received);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_bitfield_fill(uint8_t* bf, uint16_t offset, uint16_t count, bool value) {
+    const uint32_t ones = value ? 0xFFFFFFFFU : 0;
+    uint32_t o = offset;
+    uint16_t left = count;
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        // Check if request is for us
-        if (nmbs->msg.unit_id == NMBS_BROADCAST_ADDRESS)
-            nmbs->msg.broadcast = true;
-        else if (nmbs->msg.unit_id != nmbs->address_rtu)
-            nmbs->msg.ignored = true;
-        else
-            nmbs->msg.ignored = false;
+    const uint8_t head = (uint8_t) ((8 - (o & 7)) & 7);
+    if (head) {
+        const uint8_t n = left < head ? (uint8_t) left : head;
+        bitfield_put(bf, o, n, ones);
+        o += n;
+        left -= n;
     }
 
-    return NMBS_ERROR_NONE;
+    memset(bf + (o >> 3), (int) (ones & 0xFF), left / 8);
+    o += left & ~7U;
+    left &= 7;
+
+    if (left)
+        bitfield_put(bf, o, (uint8_t) left, ones);
 }
 
 
-static void put_res_header(nmbs_t* nmbs, uint16_t data_length) {
-    put_msg_header(nmbs, data_length);
-    NMBS_DEBUG_PRINT("%d NMBS res -> address_rtu %d\tfc %d\t", nmbs->address_rtu, nmbs->address_rtu, nmbs->msg.fc);
+uint16_t nmbs_bitfield_compare(const uint8_t* a, uint16_t a_offset, const uint8_t* b, uint16_t b_offset,
+                               uint16_t count) {
+    return bitfield_scan(a, a_offset, b, b_offset, count, true);
 }
 
 
-static nmbs_error send_exception_msg(nmbs_t* nmbs, uint8_t exception) {
-    if (nmbs->msg.broadcast) {
-        return NMBS_ERROR_NONE;
+void nmbs_bitfield_from_bools(uint8_t* bf, uint16_t offset, const bool* values, uint16_t count) {
+    for (uint16_t i = 0; i < count;) {
+        const uint8_t n = count - i < 32 ? (uint8_t) (count - i) : 32;
+        uint32_t v = 0;
+        for (uint8_t j = 0; j < n; j++)
+            v |= (uint32_t) (values[i + j] ? 1 : 0) << j;
+
+        bitfield_put(bf, (uint32_t) offset + i, n, v);
+        i += n;
     }
+}
 
-    nmbs->msg.fc += 0x80;
-    put_msg_header(nmbs, 1);
-    put_1(nmbs, exception);
 
-    NMBS_DEBUG_PRINT("%d NMBS res -> address_rtu %d\texception %d", nmbs->address_rtu, nmbs->address_rtu, exception);
+void nmbs_bitfield_to_bools(bool* values_out, const uint8_t* bf, uint16_t offset, uint16_t count) {
+    for (uint16_t i = 0; i < count;) {
+        const uint8_t n = count - i < 32 ? (uint8_t) (count - i) : 32;
+        const uint32_t v = bitfield_get(bf, (uint32_t) offset + i, n);
+        for (uint8_t j = 0; j < n; j++)
+            values_out[i + j] = (bool) ((v >> j) & 1);
 
-    return send_msg(nmbs);
+        i += n;
+    }
 }
-#endif
 
 
-static nmbs_error recv_res_header(nmbs_t* nmbs) {
-    const uint16_t req_transaction_id = nmbs->msg.transaction_id;
-    const uint8_t req_unit_id = nmbs->msg.unit_id;
-    const uint8_t req_fc = nmbs->msg.fc;
-
-    bool first_byte_received = false;
-    nmbs_error err = recv_msg_header(nmbs, &first_byte_received);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_bitfield_from_bytes(uint8_t* bf, uint16_t offset, const uint8_t* values, uint16_t count) {
+    for (uint16_t i = 0; i < count;) {
+        const uint8_t n = count - i < 32 ? (uint8_t) (count - i) : 32;
+        uint32_t v = 0;
+        for (uint8_t j = 0; j < n; j++)
+            v |= (uint32_t) (values[i + j] ? 1 : 0) << j;
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_TCP) {
-        if (nmbs->msg.transaction_id != req_transaction_id)
-            return NMBS_ERROR_INVALID_TCP_MBAP;
+        bitfield_put(bf, (uint32_t) offset + i, n, v);
+        i += n;
     }
+}
 
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU && nmbs->msg.unit_id != req_unit_id)
-        return NMBS_ERROR_INVALID_UNIT_ID;
-
-    if (nmbs->msg.fc != req_fc) {
-        if (nmbs->msg.fc - 0x80 == req_fc) {
-            err = recv(nmbs, 1);
-            if (err != NMBS_ERROR_NONE)
-                return err;
 
-            const uint8_t exception = get_1(nmbs);
-            err = recv_msg_footer(nmbs);
-            if (err != NMBS_ERROR_NONE)
-                return err;
+void nmbs_bitfield_to_bytes(uint8_t* values_out, const uint8_t* bf, uint16_t offset, uint16_t count) {
+    for (uint16_t i = 0; i < count;) {
+        const uint8_t n = count - i < 32 ? (uint8_t) (count - i) : 32;
+        const uint32_t v = bitfield_get(bf, (uint32_t) offset + i, n);
+        for (uint8_t j = 0; j < n; j++)
+            values_out[i + j] = (uint8_t) ((v >> j) & 1);
 
-            if (exception < 1 || exception > 4)
-                return NMBS_ERROR_INVALID_RESPONSE;
+        i += n;
+    }
+}
 
-            NMBS_DEBUG_PRINT("%d NMBS res <- address_rtu %d\texception %d\n", nmbs->address_rtu, nmbs->msg.unit_id,
-                             exception);
-            return (nmbs_error) exception;
-        }
 
-        return NMBS_ERROR_INVALID_RESPONSE;
+void nmbs_registers_to_be(uint8_t* registers_be_out, const uint16_t* registers, uint16_t quantity) {
+    // Simple enough for compilers to vectorize
+    for (uint16_t i = 0; i < quantity; i++) {
+        registers_be_out[2 * i] = (uint8_t) (registers[i] >> 8);
+        registers_be_out[2 * i + 1] = (uint8_t) registers[i];
     }
+}
 
-    NMBS_DEBUG_PRINT("%d NMBS res <- address_rtu %d\tfc %d\t", nmbs->address_rtu, nmbs->msg.unit_id, nmbs->msg.fc);
 
-    return NMBS_ERROR_NONE;
+// Swap the bytes of each 16-bit word of a value, all the words at once
+static uint32_t swap_bytes_32(uint32_t v) {
+    return ((v & 0x00FF00FFU) << 8) | ((v >> 8) & 0x00FF00FFU);
 }
 
 
-#ifndef NMBS_CLIENT_DISABLED
-static void put_req_header(nmbs_t* nmbs, uint16_t data_length) {
-    put_msg_header(nmbs, data_length);
-#ifdef NMBS_DEBUG
-    printf("%d ", nmbs->address_rtu);
-    printf("NMBS req -> ");
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        if (nmbs->msg.broadcast)
-            printf("broadcast\t");
-        else
-            printf("address_rtu %d\t", nmbs->dest_address_rtu);
-    }
+static uint64_t swap_bytes_64(uint64_t v) {
+    return ((v & 0x00FF00FF00FF00FFULL) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+}
 
-    printf("fc %d\t", nmbs->msg.fc);
-#endif
+
+static bool word_order_swaps_words(nmbs_word_order order) {
+    return order == NMBS_WORD_ORDER_CDAB || order == NMBS_WORD_ORDER_DCBA;
 }
-#endif
 
 
-#if !defined(NMBS_CLIENT_DISABLED) ||                                                                                  \
-        (!defined(NMBS_SERVER_DISABLED) &&                                                                             \
-         (!defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)))
-static nmbs_error recv_read_discrete_res(nmbs_t* nmbs, nmbs_bitfield values) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+static bool word_order_swaps_bytes(nmbs_word_order order) {
+    return order == NMBS_WORD_ORDER_BADC || order == NMBS_WORD_ORDER_DCBA;
+}
 
-    err = recv(nmbs, 1);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    const uint8_t coils_bytes = get_1(nmbs);
-    NMBS_DEBUG_PRINT("b %d\t", coils_bytes);
+// Values are converted through their bit patterns, copied with memcpy() to stay clear of aliasing issues.
+// Swaps are loop-invariant, so that compilers can unswitch and vectorize the loops
+static void regs_to_32(void* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    const uint8_t first = word_order_swaps_words(order) ? 1 : 0;
+    const bool swap_bytes = word_order_swaps_bytes(order);
+    uint8_t* out = values_out;
 
-    if (coils_bytes > NMBS_BITFIELD_BYTES_MAX) {
-        return NMBS_ERROR_INVALID_RESPONSE;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint16_t* r = registers + 2 * i;
+        uint32_t v = (uint32_t) r[first] << 16 | (uint32_t) r[first ^ 1];
+        if (swap_bytes)
+            v = swap_bytes_32(v);
+
+        memcpy(out + 4 * i, &v, 4);
     }
+}
 
-    err = recv(nmbs, coils_bytes);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    NMBS_DEBUG_PRINT("coils ");
-    for (int i = 0; i < coils_bytes; i++) {
-        const uint8_t coil = get_1(nmbs);
-        if (values)
-            values[i] = coil;
-        NMBS_DEBUG_PRINT("%d ", coil);
-    }
+static void regs_to_64(void* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    const uint8_t first = word_order_swaps_words(order) ? 3 : 0;
+    const bool swap_bytes = word_order_swaps_bytes(order);
+    uint8_t* out = values_out;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint16_t* r = registers + 4 * i;
+        uint64_t v = (uint64_t) r[first] << 48 | (uint64_t) r[first ^ 1] << 32 | (uint64_t) r[first ^ 2] << 16 |
+                     (uint64_t) r[first ^ 3];
+        if (swap_bytes)
+            v = swap_bytes_64(v);
 
-    return NMBS_ERROR_NONE;
+        memcpy(out + 8 * i, &v, 8);
+    }
 }
-#endif
 
 
-#if !defined(NMBS_CLIENT_DISABLED) ||                                                                                  \
-        (!defined(NMBS_SERVER_DISABLED) && (!defined(NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED) ||                   \
-                                            !defined(NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED)))
-static nmbs_error recv_read_registers_res(nmbs_t* nmbs, uint16_t quantity, uint16_t* registers) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+static void values_to_regs_32(uint16_t* registers_out, const void* values, uint16_t count, nmbs_word_order order) {
+    const uint8_t first = word_order_swaps_words(order) ? 1 : 0;
+    const bool swap_bytes = word_order_swaps_bytes(order);
+    const uint8_t* in = values;
 
-    err = recv(nmbs, 1);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t v;
+        memcpy(&v, in + 4 * i, 4);
+        if (swap_bytes)
+            v = swap_bytes_32(v);
 
-    const uint8_t registers_bytes = get_1(nmbs);
-    NMBS_DEBUG_PRINT("b %d\t", registers_bytes);
+        uint16_t* r = registers_out + 2 * i;
+        r[first] = (uint16_t) (v >> 16);
+        r[first ^ 1] = (uint16_t) v;
+    }
+}
 
-    if (registers_bytes > 250)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    err = recv(nmbs, registers_bytes);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+static void values_to_regs_64(uint16_t* registers_out, const void* values, uint16_t count, nmbs_word_order order) {
+    const uint8_t first = word_order_swaps_words(order) ? 3 : 0;
+    const bool swap_bytes = word_order_swaps_bytes(order);
+    const uint8_t* in = values;
 
-    NMBS_DEBUG_PRINT("regs ");
-    for (int i = 0; i < registers_bytes / 2; i++) {
-        uint16_t reg = get_2(nmbs);
-        if (registers)
-            registers[i] = reg;
-        NMBS_DEBUG_PRINT("%d ", reg);
-    }
+    for (uint16_t i = 0; i < count; i++) {
+        uint64_t v;
+        memcpy(&v, in + 8 * i, 8);
+        if (swap_bytes)
+            v = swap_bytes_64(v);
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        uint16_t* r = registers_out + 4 * i;
+        r[first] = (uint16_t) (v >> 48);
+        r[first ^ 1] = (uint16_t) (v >> 32);
+        r[first ^ 2] = (uint16_t) (v >> 16);
+        r[first ^ 3] = (uint16_t) v;
+    }
+}
 
-    if (registers_bytes != quantity * 2)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    return NMBS_ERROR_NONE;
+void nmbs_regs_to_u32(uint32_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_32(values_out, registers, count, order);
 }
-#endif
 
 
-nmbs_error recv_write_single_coil_res(nmbs_t* nmbs, uint16_t address, uint16_t value_req) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
-
-    err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_regs_to_i32(int32_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_32(values_out, registers, count, order);
+}
 
-    const uint16_t address_res = get_2(nmbs);
-    const uint16_t value_res = get_2(nmbs);
 
-    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value_res);
+void nmbs_regs_to_f32(float* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_32(values_out, registers, count, order);
+}
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    if (address_res != address)
-        return NMBS_ERROR_INVALID_RESPONSE;
+void nmbs_regs_to_u64(uint64_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_64(values_out, registers, count, order);
+}
 
-    if (value_res != value_req)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    return NMBS_ERROR_NONE;
+void nmbs_regs_to_i64(int64_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_64(values_out, registers, count, order);
 }
 
 
-nmbs_error recv_write_single_register_res(nmbs_t* nmbs, uint16_t address, uint16_t value_req) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_regs_to_f64(double* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order) {
+    regs_to_64(values_out, registers, count, order);
+}
 
-    err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    const uint16_t address_res = get_2(nmbs);
-    const uint16_t value_res = get_2(nmbs);
-    NMBS_DEBUG_PRINT("a %d\tvalue %d ", address, value_res);
+void nmbs_u32_to_regs(uint16_t* registers_out, const uint32_t* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_32(registers_out, values, count, order);
+}
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    if (address_res != address)
-        return NMBS_ERROR_INVALID_RESPONSE;
+void nmbs_i32_to_regs(uint16_t* registers_out, const int32_t* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_32(registers_out, values, count, order);
+}
 
-    if (value_res != value_req)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    return NMBS_ERROR_NONE;
+void nmbs_f32_to_regs(uint16_t* registers_out, const float* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_32(registers_out, values, count, order);
 }
 
 
-nmbs_error recv_write_multiple_coils_res(nmbs_t* nmbs, uint16_t address, uint16_t quantity) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_u64_to_regs(uint16_t* registers_out, const uint64_t* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_64(registers_out, values, count, order);
+}
 
-    err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    const uint16_t address_res = get_2(nmbs);
-    const uint16_t quantity_res = get_2(nmbs);
-    NMBS_DEBUG_PRINT("a %d\tq %d", address_res, quantity_res);
+void nmbs_i64_to_regs(uint16_t* registers_out, const int64_t* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_64(registers_out, values, count, order);
+}
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    if (address_res != address)
-        return NMBS_ERROR_INVALID_RESPONSE;
+void nmbs_f64_to_regs(uint16_t* registers_out, const double* values, uint16_t count, nmbs_word_order order) {
+    values_to_regs_64(registers_out, values, count, order);
+}
 
-    if (quantity_res != quantity)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    return NMBS_ERROR_NONE;
-}
+#if defined(NMBS_CRC_SLICE_BY_4)
+#define NMBS_CRC_TABLES_COUNT 4
+#elif defined(NMBS_CRC_TABLE)
+#define NMBS_CRC_TABLES_COUNT 1
+#endif
 
+#ifdef NMBS_CRC_TABLES_COUNT
+// crc_table[k][i] is the CRC register update for byte i followed by k zero bytes
+static const uint16_t crc_table[NMBS_CRC_TABLES_COUNT][256] = {
+    {
+        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+        0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+        0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+        0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+        0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+        0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+        0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+        0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+        0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+        0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+        0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+        0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+        0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+        0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+        0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+        0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+        0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+        0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+        0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+        0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+        0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+        0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+        0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+        0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+        0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+        0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+        0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+        0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+        0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+        0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+        0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+        0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+    },
+#if NMBS_CRC_TABLES_COUNT > 1
+    {
+        0x0000, 0x9001, 0x6001, 0xF000, 0xC002, 0x5003, 0xA003, 0x3002,
+        0xC007, 0x5006, 0xA006, 0x3007, 0x0005, 0x9004, 0x6004, 0xF005,
+        0xC00D, 0x500C, 0xA00C, 0x300D, 0x000F, 0x900E, 0x600E, 0xF00F,
+        0x000A, 0x900B, 0x600B, 0xF00A, 0xC008, 0x5009, 0xA009, 0x3008,
+        0xC019, 0x5018, 0xA018, 0x3019, 0x001B, 0x901A, 0x601A, 0xF01B,
+        0x001E, 0x901F, 0x601F, 0xF01E, 0xC01C, 0x501D, 0xA01D, 0x301C,
+        0x0014, 0x9015, 0x6015, 0xF014, 0xC016, 0x5017, 0xA017, 0x3016,
+        0xC013, 0x5012, 0xA012, 0x3013, 0x0011, 0x9010, 0x6010, 0xF011,
+        0xC031, 0x5030, 0xA030, 0x3031, 0x0033, 0x9032, 0x6032, 0xF033,
+        0x0036, 0x9037, 0x6037, 0xF036, 0xC034, 0x5035, 0xA035, 0x3034,
+        0x003C, 0x903D, 0x603D, 0xF03C, 0xC03E, 0x503F, 0xA03F, 0x303E,
+        0xC03B, 0x503A, 0xA03A, 0x303B, 0x0039, 0x9038, 0x6038, 0xF039,
+        0x0028, 0x9029, 0x6029, 0xF028, 0xC02A, 0x502B, 0xA02B, 0x302A,
+        0xC02F, 0x502E, 0xA02E, 0x302F, 0x002D, 0x902C, 0x602C, 0xF02D,
+        0xC025, 0x5024, 0xA024, 0x3025, 0x0027, 0x9026, 0x6026, 0xF027,
+        0x0022, 0x9023, 0x6023, 0xF022, 0xC020, 0x5021, 0xA021, 0x3020,
+        0xC061, 0x5060, 0xA060, 0x3061, 0x0063, 0x9062, 0x6062, 0xF063,
+        0x0066, 0x9067, 0x6067, 0xF066, 0xC064, 0x5065, 0xA065, 0x3064,
+        0x006C, 0x906D, 0x606D, 0xF06C, 0xC06E, 0x506F, 0xA06F, 0x306E,
+        0xC06B, 0x506A, 0xA06A, 0x306B, 0x0069, 0x9068, 0x6068, 0xF069,
+        0x0078, 0x9079, 0x6079, 0xF078, 0xC07A, 0x507B, 0xA07B, 0x307A,
+        0xC07F, 0x507E, 0xA07E, 0x307F, 0x007D, 0x907C, 0x607C, 0xF07D,
+        0xC075, 0x5074, 0xA074, 0x3075, 0x0077, 0x9076, 0x6076, 0xF077,
+        0x0072, 0x9073, 0x6073, 0xF072, 0xC070, 0x5071, 0xA071, 0x3070,
+        0x0050, 0x9051, 0x6051, 0xF050, 0xC052, 0x5053, 0xA053, 0x3052,
+        0xC057, 0x5056, 0xA056, 0x3057, 0x0055, 0x9054, 0x6054, 0xF055,
+        0xC05D, 0x505C, 0xA05C, 0x305D, 0x005F, 0x905E, 0x605E, 0xF05F,
+        0x005A, 0x905B, 0x605B, 0xF05A, 0xC058, 0x5059, 0xA059, 0x3058,
+        0xC049, 0x5048, 0xA048, 0x3049, 0x004B, 0x904A, 0x604A, 0xF04B,
+        0x004E, 0x904F, 0x604F, 0xF04E, 0xC04C, 0x504D, 0xA04D, 0x304C,
+        0x0044, 0x9045, 0x6045, 0xF044, 0xC046, 0x5047, 0xA047, 0x3046,
+        0xC043, 0x5042, 0xA042, 0x3043, 0x0041, 0x9040, 0x6040, 0xF041,
+    },
+    {
+        0x0000, 0xC051, 0xC0A1, 0x00F0, 0xC141, 0x0110, 0x01E0, 0xC1B1,
+        0xC281, 0x02D0, 0x0220, 0xC271, 0x03C0, 0xC391, 0xC361, 0x0330,
+        0xC501, 0x0550, 0x05A0, 0xC5F1, 0x0440, 0xC411, 0xC4E1, 0x04B0,
+        0x0780, 0xC7D1, 0xC721, 0x0770, 0xC6C1, 0x0690, 0x0660, 0xC631,
+        0xCA01, 0x0A50, 0x0AA0, 0xCAF1, 0x0B40, 0xCB11, 0xCBE1, 0x0BB0,
+        0x0880, 0xC8D1, 0xC821, 0x0870, 0xC9C1, 0x0990, 0x0960, 0xC931,
+        0x0F00, 0xCF51, 0xCFA1, 0x0FF0, 0xCE41, 0x0E10, 0x0EE0, 0xCEB1,
+        0xCD81, 0x0DD0, 0x0D20, 0xCD71, 0x0CC0, 0xCC91, 0xCC61, 0x0C30,
+        0xD401, 0x1450, 0x14A0, 0xD4F1, 0x1540, 0xD511, 0xD5E1, 0x15B0,
+        0x1680, 0xD6D1, 0xD621, 0x1670, 0xD7C1, 0x1790, 0x1760, 0xD731,
+        0x1100, 0xD151, 0xD1A1, 0x11F0, 0xD041, 0x1010, 0x10E0, 0xD0B1,
+        0xD381, 0x13D0, 0x1320, 0xD371, 0x12C0, 0xD291, 0xD261, 0x1230,
+        0x1E00, 0xDE51, 0xDEA1, 0x1EF0, 0xDF41, 0x1F10, 0x1FE0, 0xDFB1,
+        0xDC81, 0x1CD0, 0x1C20, 0xDC71, 0x1DC0, 0xDD91, 0xDD61, 0x1D30,
+        0xDB01, 0x1B50, 0x1BA0, 0xDBF1, 0x1A40, 0xDA11, 0xDAE1, 0x1AB0,
+        0x1980, 0xD9D1, 0xD921, 0x1970, 0xD8C1, 0x1890, 0x1860, 0xD831,
+        0xE801, 0x2850, 0x28A0, 0xE8F1, 0x2940, 0xE911, 0xE9E1, 0x29B0,
+        0x2A80, 0xEAD1, 0xEA21, 0x2A70, 0xEBC1, 0x2B90, 0x2B60, 0xEB31,
+        0x2D00, 0xED51, 0xEDA1, 0x2DF0, 0xEC41, 0x2C10, 0x2CE0, 0xECB1,
+        0xEF81, 0x2FD0, 0x2F20, 0xEF71, 0x2EC0, 0xEE91, 0xEE61, 0x2E30,
+        0x2200, 0xE251, 0xE2A1, 0x22F0, 0xE341, 0x2310, 0x23E0, 0xE3B1,
+        0xE081, 0x20D0, 0x2020, 0xE071, 0x21C0, 0xE191, 0xE161, 0x2130,
+        0xE701, 0x2750, 0x27A0, 0xE7F1, 0x2640, 0xE611, 0xE6E1, 0x26B0,
+        0x2580, 0xE5D1, 0xE521, 0x2570, 0xE4C1, 0x2490, 0x2460, 0xE431,
+        0x3C00, 0xFC51, 0xFCA1, 0x3CF0, 0xFD41, 0x3D10, 0x3DE0, 0xFDB1,
+        0xFE81, 0x3ED0, 0x3E20, 0xFE71, 0x3FC0, 0xFF91, 0xFF61, 0x3F30,
+        0xF901, 0x3950, 0x39A0, 0xF9F1, 0x3840, 0xF811, 0xF8E1, 0x38B0,
+        0x3B80, 0xFBD1, 0xFB21, 0x3B70, 0xFAC1, 0x3A90, 0x3A60, 0xFA31,
+        0xF601, 0x3650, 0x36A0, 0xF6F1, 0x3740, 0xF711, 0xF7E1, 0x37B0,
+        0x3480, 0xF4D1, 0xF421, 0x3470, 0xF5C1, 0x3590, 0x3560, 0xF531,
+        0x3300, 0xF351, 0xF3A1, 0x33F0, 0xF241, 0x3210, 0x32E0, 0xF2B1,
+        0xF181, 0x31D0, 0x3120, 0xF171, 0x30C0, 0xF091, 0xF061, 0x3030,
+    },
+    {
+        0x0000, 0xFC01, 0xB801, 0x4400, 0x3001, 0xCC00, 0x8800, 0x7401,
+        0x6002, 0x9C03, 0xD803, 0x2402, 0x5003, 0xAC02, 0xE802, 0x1403,
+        0xC004, 0x3C05, 0x7805, 0x8404, 0xF005, 0x0C04, 0x4804, 0xB405,
+        0xA006, 0x5C07, 0x1807, 0xE406, 0x9007, 0x6C06, 0x2806, 0xD407,
+        0xC00B, 0x3C0A, 0x780A, 0x840B, 0xF00A, 0x0C0B, 0x480B, 0xB40A,
+        0xA009, 0x5C08, 0x1808, 0xE409, 0x9008, 0x6C09, 0x2809, 0xD408,
+        0x000F, 0xFC0E, 0xB80E, 0x440F, 0x300E, 0xCC0F, 0x880F, 0x740E,
+        0x600D, 0x9C0C, 0xD80C, 0x240D, 0x500C, 0xAC0D, 0xE80D, 0x140C,
+        0xC015, 0x3C14, 0x7814, 0x8415, 0xF014, 0x0C15, 0x4815, 0xB414,
+        0xA017, 0x5C16, 0x1816, 0xE417, 0x9016, 0x6C17, 0x2817, 0xD416,
+        0x0011, 0xFC10, 0xB810, 0x4411, 0x3010, 0xCC11, 0x8811, 0x7410,
+        0x6013, 0x9C12, 0xD812, 0x2413, 0x5012, 0xAC13, 0xE813, 0x1412,
+        0x001E, 0xFC1F, 0xB81F, 0x441E, 0x301F, 0xCC1E, 0x881E, 0x741F,
+        0x601C, 0x9C1D, 0xD81D, 0x241C, 0x501D, 0xAC1C, 0xE81C, 0x141D,
+        0xC01A, 0x3C1B, 0x781B, 0x841A, 0xF01B, 0x0C1A, 0x481A, 0xB41B,
+        0xA018, 0x5C19, 0x1819, 0xE418, 0x9019, 0x6C18, 0x2818, 0xD419,
+        0xC029, 0x3C28, 0x7828, 0x8429, 0xF028, 0x0C29, 0x4829, 0xB428,
+        0xA02B, 0x5C2A, 0x182A, 0xE42B, 0x902A, 0x6C2B, 0x282B, 0xD42A,
+        0x002D, 0xFC2C, 0xB82C, 0x442D, 0x302C, 0xCC2D, 0x882D, 0x742C,
+        0x602F, 0x9C2E, 0xD82E, 0x242F, 0x502E, 0xAC2F, 0xE82F, 0x142E,
+        0x0022, 0xFC23, 0xB823, 0x4422, 0x3023, 0xCC22, 0x8822, 0x7423,
+        0x6020, 0x9C21, 0xD821, 0x2420, 0x5021, 0xAC20, 0xE820, 0x1421,
+        0xC026, 0x3C27, 0x7827, 0x8426, 0xF027, 0x0C26, 0x4826, 0xB427,
+        0xA024, 0x5C25, 0x1825, 0xE424, 0x9025, 0x6C24, 0x2824, 0xD425,
+        0x003C, 0xFC3D, 0xB83D, 0x443C, 0x303D, 0xCC3C, 0x883C, 0x743D,
+        0x603E, 0x9C3F, 0xD83F, 0x243E, 0x503F, 0xAC3E, 0xE83E, 0x143F,
+        0xC038, 0x3C39, 0x7839, 0x8438, 0xF039, 0x0C38, 0x4838, 0xB439,
+        0xA03A, 0x5C3B, 0x183B, 0xE43A, 0x903B, 0x6C3A, 0x283A, 0xD43B,
+        0xC037, 0x3C36, 0x7836, 0x8437, 0xF036, 0x0C37, 0x4837, 0xB436,
+        0xA035, 0x5C34, 0x1834, 0xE435, 0x9034, 0x6C35, 0x2835, 0xD434,
+        0x0033, 0xFC32, 0xB832, 0x4433, 0x3032, 0xCC33, 0x8833, 0x7432,
+        0x6031, 0x9C30, 0xD830, 0x2431, 0x5030, 0xAC31, 0xE831, 0x1430,
+    },
+#endif
+};
+#endif
 
-nmbs_error recv_write_multiple_registers_res(nmbs_t* nmbs, uint16_t address, uint16_t quantity) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+uint16_t nmbs_crc_update(uint16_t crc, const uint8_t* data, uint32_t length) {
+    uint32_t i = 0;
 
-    const uint16_t address_res = get_2(nmbs);
-    const uint16_t quantity_res = get_2(nmbs);
-    NMBS_DEBUG_PRINT("a %d\tq %d", address_res, quantity_res);
+#if defined(NMBS_CRC_SLICE_BY_4)
+    for (; i + 4 <= length; i += 4) {
+        const uint16_t lo = (uint16_t) (crc ^ ((uint16_t) data[i] | (uint16_t) (data[i + 1] << 8)));
+        crc = crc_table[3][lo & 0xFF] ^ crc_table[2][lo >> 8] ^ crc_table[1][data[i + 2]] ^ crc_table[0][data[i + 3]];
+    }
+#endif
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+#ifdef NMBS_CRC_TABLES_COUNT
+    for (; i < length; i++)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ data[i]) & 0xFF];
+#else
+    for (; i < length; i++) {
+        crc ^= (uint16_t) data[i];
+        for (int j = 8; j != 0; j--) {
+            if ((crc & 0x0001) != 0) {
+                crc >>= 1;
+                crc ^= 0xA001;
+            }
+            else
+                crc >>= 1;
+        }
+    }
+#endif
 
-    if (address_res != address)
-        return NMBS_ERROR_INVALID_RESPONSE;
+    return crc;
+}
 
-    if (quantity_res != quantity)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    return NMBS_ERROR_NONE;
+uint16_t nmbs_crc_calc(const uint8_t* data, uint32_t length, void* arg) {
+    NMBS_UNUSED_PARAM(arg);
+    const uint16_t crc = nmbs_crc_update(NMBS_CRC_INIT, data, length);
+    return (uint16_t) (crc << 8) | (uint16_t) (crc >> 8);
 }
 
+static nmbs_error recv_msg_footer(nmbs_t* nmbs) {
+    NMBS_DEBUG_PRINT("\n");
 
-nmbs_error recv_read_file_record_res(nmbs_t* nmbs, uint16_t* registers, uint16_t count) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (NMBS_IS_RTU(nmbs)) {
+        uint16_t crc;
+        if (!nmbs->msg.complete && NMBS_CRC_IS_DEFAULT(nmbs))
+            crc = (uint16_t) (nmbs->msg.crc << 8) | (uint16_t) (nmbs->msg.crc >> 8);
+        else
+            crc = NMBS_CRC_CALC(nmbs, nmbs->msg.buf, nmbs->msg.buf_idx);
 
-    err = recv(nmbs, 1);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        const nmbs_error err = recv(nmbs, 2);
+        if (err != NMBS_ERROR_NONE)
+            return trace_rx(nmbs, err);
 
-    const uint8_t response_size = get_1(nmbs);
-    if (response_size > 250) {
-        return NMBS_ERROR_INVALID_RESPONSE;
+        const uint16_t recv_crc = get_2(nmbs);
+        if (recv_crc != crc)
+            return trace_rx(nmbs, NMBS_ERROR_CRC);
     }
 
-    err = recv(nmbs, response_size);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    stats_msg_in(nmbs);
 
-    const uint8_t subreq_data_size = get_1(nmbs) - 1;
-    const uint8_t subreq_reference_type = get_1(nmbs);
-    uint16_t* subreq_record_data = (uint16_t*) get_n(nmbs, subreq_data_size);
+    return trace_rx(nmbs, NMBS_ERROR_NONE);
+}
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    if (registers) {
-        if (subreq_reference_type != 6)
-            return NMBS_ERROR_INVALID_RESPONSE;
+// Parse the header of a whole frame of the given length, already stored in msg.buf
+static nmbs_error get_frame_header(nmbs_t* nmbs, uint16_t length) {
+    msg_buf_reset(nmbs);
+    nmbs->msg.complete = true;
+    nmbs->msg.framed = true;
+    nmbs->msg.frame_len = length;
 
-        if (count != (subreq_data_size / 2))
-            return NMBS_ERROR_INVALID_RESPONSE;
+    if (NMBS_IS_RTU(nmbs)) {
+        // Unit ID, function code and CRC
+        if (length < 4)
+            return NMBS_ERROR_TIMEOUT;
 
-        swap_regs(subreq_record_data, subreq_data_size / 2);
-        memcpy(registers, subreq_record_data, subreq_data_size);
+        nmbs->msg.unit_id = get_1(nmbs);
+        nmbs->msg.fc = get_1(nmbs);
     }
+    else if (NMBS_IS_TCP(nmbs)) {
+        if (length < 8)
+            return NMBS_ERROR_TIMEOUT;
 
-    return NMBS_ERROR_NONE;
-}
-
+        nmbs->msg.transaction_id = get_2(nmbs);
+        const uint16_t protocol_id = get_2(nmbs);
+        const uint16_t mbap_length = get_2(nmbs);
+        nmbs->msg.unit_id = get_1(nmbs);
+        nmbs->msg.fc = get_1(nmbs);
 
-nmbs_error recv_write_file_record_res(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number,
-                                      const uint16_t* registers, uint16_t count) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if (mbap_length < 2 || mbap_length > 255)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
 
-    err = recv(nmbs, 1);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if (6 + mbap_length > length)
+            return NMBS_ERROR_TIMEOUT;
 
-    const uint8_t response_size = get_1(nmbs);
-    if (response_size > 251)
-        return NMBS_ERROR_INVALID_RESPONSE;
+        if (protocol_id != 0)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
 
-    err = recv(nmbs, response_size);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        // Ignore anything after the end of the message
+        nmbs->msg.frame_len = 6 + mbap_length;
+    }
 
-    const uint8_t subreq_reference_type = get_1(nmbs);
-    const uint16_t subreq_file_number = get_2(nmbs);
-    const uint16_t subreq_record_number = get_2(nmbs);
-    const uint16_t subreq_record_length = get_2(nmbs);
-    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", subreq_file_number, subreq_record_number, subreq_record_length);
+    return NMBS_ERROR_NONE;
+}
 
-    uint16_t subreq_data_size = subreq_record_length * 2;
-    uint16_t* subreq_record_data = (uint16_t*) get_n(nmbs, subreq_data_size);
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+uint16_t nmbs_rtu_frame_length(const uint8_t* buf, uint16_t count, bool response) {
+    if (count < 2)
+        return 2;
+
+    const uint8_t fc = buf[1];
+    if (response) {
+        if (fc & 0x80)
+            return 5;
+
+        switch (fc) {
+            case 1:
+            case 2:
+            case 3:
+            case 4:
+            case 12:
+            case 17:
+            case 20:
+            case 21:
+            case 23:
+                return count < 3 ? 3 : 5 + buf[2];
+            case 5:
+            case 6:
+            case 8:
+            case 11:
+            case 15:
+            case 16:
+                return 8;
+            case 7:
+                return 5;
+            case 22:
+                return 10;
+            case 24:
+                return count < 4 ? 4 : 6 + ((uint16_t) (buf[2] << 8) | (uint16_t) buf[3]);
+            case 43: {
+                // Fixed fields are followed by the number of objects, each object has an id, a length and a value
+                uint16_t len = 8;
+                if (count < len)
+                    return len;
+
+                for (uint8_t i = 0; i < buf[7]; i++) {
+                    if (count < len + 2)
+                        return len + 2;
+
+                    len += 2 + buf[len + 1];
+                }
 
-    if (registers) {
-        if (subreq_reference_type != 6)
-            return NMBS_ERROR_INVALID_RESPONSE;
+                return len + 2;
+            }
+            default:
+                return 0;
+        }
+    }
 
-        if (subreq_file_number != file_number)
-            return NMBS_ERROR_INVALID_RESPONSE;
+    switch (fc) {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+        case 6:
+        case 8:
+            return 8;
+        case 7:
+        case 11:
+        case 12:
+        case 17:
+            return 4;
+        case 22:
+            return 10;
+        case 24:
+            return 6;
+        case 15:
+        case 16:
+            return count < 7 ? 7 : 9 + buf[6];
+        case 20:
+        case 21:
+            return count < 3 ? 3 : 5 + buf[2];
+        case 23:
+            return count < 11 ? 11 : 13 + buf[10];
+        case 43:
+            return 7;
+        default:
+            return 0;
+    }
+}
 
-        if (subreq_record_number != record_number)
-            return NMBS_ERROR_INVALID_RESPONSE;
 
-        if (subreq_record_length != count)
-            return NMBS_ERROR_INVALID_RESPONSE;
+#ifdef NMBS_RING
+nmbs_error nmbs_ring_create(nmbs_ring* ring, uint8_t* buf, uint32_t size) {
+    if (!ring || !buf || size == 0 || (size & (size - 1)) != 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-        swap_regs(subreq_record_data, subreq_record_length);
-        if (memcmp(registers, subreq_record_data, subreq_data_size) != 0)
-            return NMBS_ERROR_INVALID_RESPONSE;
-    }
+    memset(ring, 0, sizeof(nmbs_ring));
+    ring->buf = buf;
+    ring->mask = size - 1;
 
     return NMBS_ERROR_NONE;
 }
 
-nmbs_error recv_read_device_identification_res(nmbs_t* nmbs, uint8_t buffers_count, char** buffers_out,
-                                               uint8_t buffers_length, const uint8_t* order, uint8_t* ids_out,
-                                               uint8_t* next_object_id_out, uint8_t* objects_count_out) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    err = recv(nmbs, 6);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_ring_set_hooks(nmbs_ring* ring, bool (*wait)(int32_t timeout_ms, void* arg), void (*notify)(void* arg),
+                         void* arg) {
+    ring->wait = wait;
+    ring->notify = notify;
+    ring->arg = arg;
+}
 
-    const uint8_t mei_type = get_1(nmbs);
-    if (mei_type != 0x0E)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    const uint8_t read_device_id_code = get_1(nmbs);
-    if (read_device_id_code < 1 || read_device_id_code > 4)
-        return NMBS_ERROR_INVALID_RESPONSE;
+static void ring_copy_in(nmbs_ring* ring, uint32_t index, const uint8_t* data, uint32_t count) {
+    if (count == 0)
+        return;
 
-    const uint8_t conformity_level = get_1(nmbs);
-    if (conformity_level < 1 || (conformity_level > 3 && conformity_level < 0x81) || conformity_level > 0x83)
-        return NMBS_ERROR_INVALID_RESPONSE;
+    const uint32_t start = index & ring->mask;
+    const uint32_t first = count < ring->mask + 1 - start ? count : ring->mask + 1 - start;
+    memcpy(ring->buf + start, data, first);
+    memcpy(ring->buf, data + first, count - first);
+}
 
-    const uint8_t more_follows = get_1(nmbs);
-    if (more_follows != 0 && more_follows != 0xFF)
-        return NMBS_ERROR_INVALID_RESPONSE;
 
-    uint8_t next_object_id = get_1(nmbs);
+// Add two chunks with a single update of the head
+static uint32_t ring_push(nmbs_ring* ring, const uint8_t* a, uint32_t a_count, const uint8_t* b, uint32_t b_count) {
+    const uint32_t head = ring->head;
+    uint32_t room = ring->mask + 1 - (head - ring->tail_cached);
+    if (a_count + b_count > room) {
+        // The consumer cache line is only read when the ring looks full
+        ring->tail_cached = ring->tail;
+        NMBS_MEMORY_BARRIER();
+        room = ring->mask + 1 - (head - ring->tail_cached);
+    }
 
-    const uint8_t objects_count = get_1(nmbs);
-    if (objects_count_out)
-        *objects_count_out = objects_count;
+    if (a_count > room)
+        a_count = room;
 
-    if (buffers_count == 0) {
-        buffers_out = NULL;
-    }
-    else if (objects_count > buffers_count)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    if (b_count > room - a_count)
+        b_count = room - a_count;
 
-    if (more_follows == 0)
-        next_object_id = 0x7F;    // This value is reserved in the spec, we use it to signal stream is finished
+    const uint32_t count = a_count + b_count;
+    if (count == 0)
+        return 0;
 
-    if (next_object_id_out)
-        *next_object_id_out = next_object_id;
+    ring_copy_in(ring, head, a, a_count);
+    ring_copy_in(ring, head + a_count, b, b_count);
 
-    uint8_t res_size_left = 253 - 7;
-    for (int i = 0; i < objects_count; i++) {
-        err = recv(nmbs, 2);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    NMBS_MEMORY_BARRIER();
+    ring->head = head + count;
 
-        const uint8_t object_id = get_1(nmbs);
-        const uint8_t object_length = get_1(nmbs);
-        res_size_left -= 2;
+    if (ring->notify)
+        ring->notify(ring->arg);
 
-        if (object_length > res_size_left)
-            return NMBS_ERROR_INVALID_RESPONSE;
+    return count;
+}
 
-        err = recv(nmbs, object_length);
-        if (err != NMBS_ERROR_NONE)
-            return err;
 
-        const char* str = (const char*) get_n(nmbs, object_length);
+uint32_t nmbs_ring_push(nmbs_ring* ring, const uint8_t* data, uint32_t count) {
+    const uint32_t pushed = ring_push(ring, data, count, NULL, 0);
+    if (pushed < count)
+        ring->dropped += count - pushed;
 
-        if (ids_out)
-            ids_out[i] = object_id;
+    return pushed;
+}
 
-        uint8_t buf_index = i;
-        if (order)
-            buf_index = order[object_id];
-        if (buffers_out) {
-#ifndef WIN32
-            strncpy(buffers_out[buf_index], str, buffers_length);
-#else
-            strncpy_s(buffers_out[buf_index], buffers_length, str, object_length);
-#endif
-            buffers_out[buf_index][object_length] = 0;
-        }
+
+uint32_t nmbs_ring_pop(nmbs_ring* ring, uint8_t* buf, uint32_t count) {
+    const uint32_t tail = ring->tail;
+    uint32_t available = ring->head_cached - tail;
+    if (count > available) {
+        // The producer cache line is only read when the ring looks empty
+        ring->head_cached = ring->head;
+        NMBS_MEMORY_BARRIER();
+        available = ring->head_cached - tail;
     }
 
-    return recv_msg_footer(nmbs);
-}
+    if (count > available)
+        count = available;
 
+    if (count == 0)
+        return 0;
 
-#ifndef NMBS_SERVER_DISABLED
-#if !defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)
-static nmbs_error handle_read_discrete(nmbs_t* nmbs,
-                                       nmbs_error (*callback)(uint16_t, uint16_t, nmbs_bitfield, uint8_t, void*)) {
-    nmbs_error err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    const uint32_t start = tail & ring->mask;
+    const uint32_t first = count < ring->mask + 1 - start ? count : ring->mask + 1 - start;
+    memcpy(buf, ring->buf + start, first);
+    memcpy(buf + first, ring->buf, count - first);
 
-    const uint16_t address = get_2(nmbs);
-    const uint16_t quantity = get_2(nmbs);
+    NMBS_MEMORY_BARRIER();
+    ring->tail = tail + count;
 
-    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+    if (ring->notify)
+        ring->notify(ring->arg);
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    return count;
+}
 
-    if (!nmbs->msg.ignored) {
-        if (quantity < 1 || quantity > 2000)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
 
-        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+uint32_t nmbs_ring_count(const nmbs_ring* ring) {
+    return ring->head - ring->tail;
+}
 
-        if (callback) {
-            nmbs_bitfield bitfield = {0};
-            err = callback(address, quantity, bitfield, nmbs->msg.unit_id, nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+uint32_t nmbs_ring_dropped(const nmbs_ring* ring) {
+    return ring->dropped;
+}
 
-            if (!nmbs->msg.broadcast) {
-                uint8_t discrete_bytes = (quantity + 7) / 8;
-                put_res_header(nmbs, 1 + discrete_bytes);
 
-                put_1(nmbs, discrete_bytes);
+void nmbs_ring_flush(nmbs_ring* ring) {
+    ring->head_cached = ring->head;
+    NMBS_MEMORY_BARRIER();
+    ring->tail = ring->head_cached;
+}
 
-                NMBS_DEBUG_PRINT("b %d\t", discrete_bytes);
 
-                NMBS_DEBUG_PRINT("coils ");
-                for (int i = 0; i < discrete_bytes; i++) {
-                    put_1(nmbs, bitfield[i]);
-                    NMBS_DEBUG_PRINT("%d ", bitfield[i]);
-                }
+int32_t nmbs_ring_read(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg) {
+    nmbs_ring* ring = ((nmbs_ring_port*) arg)->rx;
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
-        }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-        }
-    }
-    else {
-        return recv_read_discrete_res(nmbs, NULL);
-    }
+    uint16_t total = 0;
+    while (true) {
+        total += (uint16_t) nmbs_ring_pop(ring, buf + total, count - total);
+        if (total == count || byte_timeout_ms == 0 || !ring->wait)
+            return total;
 
-    return NMBS_ERROR_NONE;
+        if (!ring->wait(byte_timeout_ms, ring->arg))
+            return total;
+    }
 }
-#endif
 
 
-#if !defined(NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED) || !defined(NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED)
-static nmbs_error handle_read_registers(nmbs_t* nmbs,
-                                        nmbs_error (*callback)(uint16_t, uint16_t, uint16_t*, uint8_t, void*)) {
-    nmbs_error err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+int32_t nmbs_ring_write(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg) {
+    const nmbs_ring_port* port = arg;
+    nmbs_ring* ring = port->tx;
 
-    const uint16_t address = get_2(nmbs);
-    const uint16_t quantity = get_2(nmbs);
+    uint16_t total = 0;
+    while (true) {
+        const uint32_t room = ring->mask + 1 - nmbs_ring_count(ring);
+        const uint32_t left = (uint32_t) (count - total);
+        const uint32_t n = left < room ? left : room;
+        if (n > 0) {
+            total += (uint16_t) ring_push(ring, buf + total, n, NULL, 0);
+            if (port->tx_start)
+                port->tx_start(port->arg);
+        }
 
-    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+        if (total == count || byte_timeout_ms == 0 || !ring->wait)
+            return total;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if (!ring->wait(byte_timeout_ms, ring->arg))
+            return total;
+    }
+}
 
-    if (!nmbs->msg.ignored) {
-        if (quantity < 1 || quantity > 125)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
 
-        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+int32_t nmbs_ring_bytes_available(void* arg) {
+    return (int32_t) nmbs_ring_count(((const nmbs_ring_port*) arg)->rx);
+}
 
-        if (callback) {
-            uint16_t regs[125] = {0};
-            err = callback(address, quantity, regs, nmbs->msg.unit_id, nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+void nmbs_ring_drain(void* arg) {
+    nmbs_ring_flush(((nmbs_ring_port*) arg)->rx);
+}
 
-            // TODO check all these read request broadcast use cases
-            if (!nmbs->msg.broadcast) {
-                const uint8_t regs_bytes = quantity * 2;
-                put_res_header(nmbs, 1 + regs_bytes);
 
-                put_1(nmbs, regs_bytes);
+void nmbs_ring_dma_create(nmbs_ring_dma* dma, nmbs_ring* ring, const uint8_t* buf, uint32_t size) {
+    dma->ring = ring;
+    dma->buf = buf;
+    dma->size = size;
+    dma->pos = 0;
+}
 
-                NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
 
-                NMBS_DEBUG_PRINT("regs ");
-                for (int i = 0; i < quantity; i++) {
-                    put_2(nmbs, regs[i]);
-                    NMBS_DEBUG_PRINT("%d ", regs[i]);
-                }
+uint32_t nmbs_ring_dma_update(nmbs_ring_dma* dma, uint32_t pos) {
+    if (pos > dma->size || pos == dma->pos)
+        return 0;
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
-        }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-        }
-    }
-    else {
-        return recv_read_registers_res(nmbs, quantity, NULL);
-    }
+    // The bytes from the previous position, wrapping around the end of the DMA buffer
+    const uint32_t count = pos > dma->pos ? pos - dma->pos : dma->size - dma->pos + pos;
+    const uint32_t a_count = pos > dma->pos ? count : dma->size - dma->pos;
+    const uint32_t pushed = ring_push(dma->ring, dma->buf + dma->pos, a_count, dma->buf, count - a_count);
+    if (pushed < count)
+        dma->ring->dropped += count - pushed;
 
-    return NMBS_ERROR_NONE;
+    dma->pos = pos == dma->size ? 0 : pos;
+    return pushed;
 }
-#endif
 
 
-#ifndef NMBS_SERVER_READ_COILS_DISABLED
-static nmbs_error handle_read_coils(nmbs_t* nmbs) {
-    return handle_read_discrete(nmbs, nmbs->callbacks.read_coils);
+uint32_t nmbs_ring_dma_half_complete(nmbs_ring_dma* dma) {
+    return nmbs_ring_dma_update(dma, dma->size / 2);
 }
-#endif
 
 
-#ifndef NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED
-static nmbs_error handle_read_discrete_inputs(nmbs_t* nmbs) {
-    return handle_read_discrete(nmbs, nmbs->callbacks.read_discrete_inputs);
+uint32_t nmbs_ring_dma_complete(nmbs_ring_dma* dma) {
+    return nmbs_ring_dma_update(dma, dma->size);
 }
 #endif
 
 
-#ifndef NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED
-static nmbs_error handle_read_holding_registers(nmbs_t* nmbs) {
-    return handle_read_registers(nmbs, nmbs->callbacks.read_holding_registers);
+#ifdef NMBS_MONITOR
+void nmbs_monitor_create(nmbs_monitor* monitor, nmbs_monitor_callback callback, void* arg) {
+    memset(monitor, 0, sizeof(nmbs_monitor));
+    monitor->callback = callback;
+    monitor->arg = arg;
 }
-#endif
 
 
-#ifndef NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED
-static nmbs_error handle_read_input_registers(nmbs_t* nmbs) {
-    return handle_read_registers(nmbs, nmbs->callbacks.read_input_registers);
+static void monitor_consume(nmbs_monitor* monitor, uint16_t count) {
+    monitor->buf_len -= count;
+    memmove(monitor->buf, monitor->buf + count, monitor->buf_len);
 }
-#endif
 
 
-#ifndef NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED
-static nmbs_error handle_write_single_coil(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
-
-    const uint16_t address = get_2(nmbs);
-    const uint16_t value = get_2(nmbs);
-
-    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+void nmbs_monitor_feed(nmbs_monitor* monitor, const uint8_t* data, uint16_t length) {
+    uint16_t fed = 0;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    while (true) {
+        const uint16_t len = nmbs_rtu_frame_length(monitor->buf, monitor->buf_len, monitor->response);
+        bool valid = len != 0 && len <= sizeof(monitor->buf);
 
-    if (!nmbs->msg.ignored) {
-        if (nmbs->callbacks.write_single_coil) {
-            if (value != 0 && value != 0xFF00)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        if (valid && monitor->buf_len < len) {
+            if (fed == length)
+                break;
 
-            err = nmbs->callbacks.write_single_coil(address, value == 0 ? false : true, nmbs->msg.unit_id,
-                                                    nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+            uint16_t n = len - monitor->buf_len;
+            if (n > length - fed)
+                n = length - fed;
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+            memcpy(monitor->buf + monitor->buf_len, data + fed, n);
+            monitor->buf_len += n;
+            fed += n;
+            continue;
+        }
 
-            if (!nmbs->msg.broadcast) {
-                put_res_header(nmbs, 4);
+        if (valid)
+            valid = nmbs_crc_update(NMBS_CRC_INIT, monitor->buf, len) == 0;
 
-                put_2(nmbs, address);
-                put_2(nmbs, value);
-                NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+        if (valid) {
+            if (monitor->callback)
+                monitor->callback(monitor->buf, len, monitor->response, monitor->arg);
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
+            // Broadcast requests are not followed by a response
+            monitor->response = !monitor->response && monitor->buf[0] != NMBS_BROADCAST_ADDRESS;
+            monitor->retried = false;
+            monitor->synced = true;
+            monitor_consume(monitor, len);
+        }
+        else if (!monitor->retried) {
+            // We may have lost track of the direction, e.g. after a missed response
+            monitor->response = !monitor->response;
+            monitor->retried = true;
         }
         else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+            monitor->response = !monitor->response;
+            monitor->retried = false;
+
+            // In sync with the line, the frame was most likely corrupted and can be dropped whole. Otherwise we look
+            // for the start of the next frame
+            uint16_t drop = 1;
+            if (monitor->synced) {
+                const uint16_t frame_len = nmbs_rtu_frame_length(monitor->buf, monitor->buf_len, monitor->response);
+                if (frame_len != 0 && frame_len <= monitor->buf_len) {
+                    drop = frame_len;
+                    monitor->response = !monitor->response && monitor->buf[0] != NMBS_BROADCAST_ADDRESS;
+                }
+            }
+
+            monitor->synced = false;
+            monitor_consume(monitor, drop);
         }
     }
-    else {
-        return recv_write_single_coil_res(nmbs, address, value);
-    }
+}
 
-    return NMBS_ERROR_NONE;
+
+void nmbs_monitor_reset(nmbs_monitor* monitor) {
+    monitor->buf_len = 0;
+    monitor->retried = false;
+    monitor->synced = true;
 }
 #endif
 
 
-#ifndef NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED
-static nmbs_error handle_write_single_register(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 4);
-    if (err != NMBS_ERROR_NONE)
-        return err;
-
-    const uint16_t address = get_2(nmbs);
-    const uint16_t value = get_2(nmbs);
+static nmbs_error recv_frame_header(nmbs_t* nmbs, bool* first_byte_received) {
+    msg_state_reset(nmbs);
 
-    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+    *first_byte_received = false;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    const int32_t ret = nmbs->platform.read_frame(nmbs->msg.buf, sizeof(nmbs->msg.buf), nmbs->read_timeout_ms,
+                                                  nmbs->platform.arg);
+    stats_bytes_in(nmbs, ret);
+    if (ret == 0)
+        return NMBS_ERROR_TIMEOUT;
 
-    if (!nmbs->msg.ignored) {
-        if (nmbs->callbacks.write_single_register) {
-            err = nmbs->callbacks.write_single_register(address, value, nmbs->msg.unit_id, nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+    if (ret < 0 || ret > (int32_t) sizeof(nmbs->msg.buf))
+        return NMBS_ERROR_TRANSPORT;
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+    *first_byte_received = true;
 
-            if (!nmbs->msg.broadcast) {
-                put_res_header(nmbs, 4);
+    return get_frame_header(nmbs, (uint16_t) ret);
+}
 
-                put_2(nmbs, address);
-                put_2(nmbs, value);
-                NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
-        }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-        }
-    }
-    else {
-        return recv_write_single_register_res(nmbs, address, value);
+static nmbs_error recv_msg_header(nmbs_t* nmbs, bool* first_byte_received) {
+    // The whole response was already received by nmbs_async_poll()
+    if (nmbs->msg.preloaded) {
+        nmbs->msg.preloaded = false;
+        *first_byte_received = true;
+        return get_frame_header(nmbs, nmbs->msg.frame_len);
     }
 
-    return NMBS_ERROR_NONE;
-}
-#endif
+    if (nmbs->platform.read_frame)
+        return recv_frame_header(nmbs, first_byte_received);
 
+    // We wait for the read timeout here, just for the first message byte
+    int32_t old_byte_timeout = nmbs->byte_timeout_ms;
+    nmbs->byte_timeout_ms = nmbs->read_timeout_ms;
 
-#ifndef NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED
-static nmbs_error handle_write_multiple_coils(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 5);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    msg_state_reset(nmbs);
 
-    const uint16_t address = get_2(nmbs);
-    const uint16_t quantity = get_2(nmbs);
-    uint8_t coils_bytes = get_1(nmbs);
+    *first_byte_received = false;
 
-    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\tcoils ", address, quantity, coils_bytes);
+    if (NMBS_IS_RTU(nmbs)) {
+        nmbs_error err = recv(nmbs, 1);
 
-    if (coils_bytes > 246)
-        return NMBS_ERROR_INVALID_REQUEST;
+        nmbs->byte_timeout_ms = old_byte_timeout;
 
-    err = recv(nmbs, coils_bytes);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-    nmbs_bitfield coils = {0};
-    for (int i = 0; i < coils_bytes; i++) {
-        coils[i] = get_1(nmbs);
-        NMBS_DEBUG_PRINT("%d ", coils[i]);
+        *first_byte_received = true;
+
+        nmbs->msg.unit_id = get_1(nmbs);
+
+        err = recv(nmbs, 1);
+        if (err != NMBS_ERROR_NONE)
+            return err;
+
+        nmbs->msg.fc = get_1(nmbs);
     }
+    else if (NMBS_IS_TCP(nmbs)) {
+        nmbs_error err = recv(nmbs, 1);
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        nmbs->byte_timeout_ms = old_byte_timeout;
 
-    if (!nmbs->msg.ignored) {
-        if (quantity < 1 || quantity > 0x07B0)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        *first_byte_received = true;
 
-        if (coils_bytes == 0)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        // Advance buf_idx
+        discard_1(nmbs);
 
-        if ((quantity + 7) / 8 != coils_bytes)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+        err = recv(nmbs, 7);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-        if (nmbs->callbacks.write_multiple_coils) {
-            err = nmbs->callbacks.write_multiple_coils(address, quantity, coils, nmbs->msg.unit_id,
-                                                       nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+        // Starting over
+        msg_buf_reset(nmbs);
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+        nmbs->msg.transaction_id = get_2(nmbs);
+        const uint16_t protocol_id = get_2(nmbs);
+        const uint16_t length = get_2(nmbs);
+        nmbs->msg.unit_id = get_1(nmbs);
+        nmbs->msg.fc = get_1(nmbs);
 
-            if (!nmbs->msg.broadcast) {
-                put_res_header(nmbs, 4);
+        if (length < 2 || length > 255)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
 
-                put_2(nmbs, address);
-                put_2(nmbs, quantity);
-                NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+        // Receive the rest of the message
+        err = recv(nmbs, length - 2);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
-        }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-        }
-    }
-    else {
-        return recv_write_multiple_coils_res(nmbs, address, quantity);
+        if (protocol_id != 0)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
+
+        nmbs->msg.complete = true;
+        nmbs->msg.frame_len = 6 + length;
     }
 
     return NMBS_ERROR_NONE;
 }
-#endif
 
 
-#ifndef NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED
-static nmbs_error handle_write_multiple_registers(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 5);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+static void put_msg_header(nmbs_t* nmbs, uint16_t data_length) {
+    msg_buf_reset(nmbs);
 
-    const uint16_t address = get_2(nmbs);
-    const uint16_t quantity = get_2(nmbs);
-    const uint8_t registers_bytes = get_1(nmbs);
+    if (NMBS_IS_RTU(nmbs)) {
+        put_1(nmbs, nmbs->msg.unit_id);
+    }
+    else if (NMBS_IS_TCP(nmbs)) {
+        put_2(nmbs, nmbs->msg.transaction_id);
+        put_2(nmbs, 0);
+        put_2(nmbs, (uint16_t) (1 + 1 + data_length));
+        put_1(nmbs, nmbs->msg.unit_id);
+    }
 
-    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\tregs ", address, quantity, registers_bytes);
+    put_1(nmbs, nmbs->msg.fc);
+}
 
-    err = recv(nmbs, registers_bytes);
+
+#ifndef NMBS_SERVER_DISABLED
+#if !defined(NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED)
+static void set_msg_header_size(nmbs_t* nmbs, uint16_t data_length) {
+    if (NMBS_IS_TCP(nmbs)) {
+        data_length += 2;
+        set_2(nmbs, data_length, 4);
+    }
+}
+#endif
+#endif
+
+
+static nmbs_error send_msg(nmbs_t* nmbs) {
+    NMBS_DEBUG_PRINT("\n");
+
+    if (unit_skip(nmbs))
+        return NMBS_ERROR_UNIT_BACKOFF;
+
+    if (NMBS_IS_RTU(nmbs)) {
+        const uint16_t crc = NMBS_CRC_CALC(nmbs, nmbs->msg.buf, nmbs->msg.buf_idx);
+        put_2(nmbs, crc);
+    }
+
+    const nmbs_error err = send(nmbs, nmbs->msg.buf_idx);
+    if (err == NMBS_ERROR_NONE)
+        stats_msg_out(nmbs, nmbs->msg.buf_idx);
+
+    unit_sent(nmbs, err);
+
+    trace_msg(nmbs, NMBS_TRACE_TX, nmbs->msg.buf, nmbs->msg.buf_idx, NULL, 0, err);
+
+    return err;
+}
+
+
+#ifndef NMBS_CLIENT_DISABLED
+// Send the message in msg.buf followed by some data. With writev(), the data is not copied to msg.buf
+static nmbs_error send_msg_gather(nmbs_t* nmbs, const uint8_t* data, uint16_t data_len) {
+    const bool rtu = NMBS_IS_RTU(nmbs);
+    if (data_len > sizeof(nmbs->msg.buf) - nmbs->msg.buf_idx - (rtu ? 2 : 0))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if (!nmbs->platform.writev || (rtu && !NMBS_CRC_IS_DEFAULT(nmbs))) {
+        memcpy(nmbs->msg.buf + nmbs->msg.buf_idx, data, data_len);
+        nmbs->msg.buf_idx += data_len;
+        return send_msg(nmbs);
+    }
+
+    NMBS_DEBUG_PRINT("\n");
+
+    if (unit_skip(nmbs))
+        return NMBS_ERROR_UNIT_BACKOFF;
+
+    uint8_t crc_buf[2];
+    nmbs_iovec iov[3] = {{nmbs->msg.buf, nmbs->msg.buf_idx}, {data, data_len}, {crc_buf, 2}};
+    if (rtu) {
+        const uint16_t crc = nmbs_crc_update(nmbs_crc_update(NMBS_CRC_INIT, nmbs->msg.buf, nmbs->msg.buf_idx), data,
+                                             data_len);
+        crc_buf[0] = (uint8_t) crc;
+        crc_buf[1] = (uint8_t) (crc >> 8);
+    }
+
+    const uint8_t iov_count = rtu ? 3 : 2;
+    const uint16_t count = nmbs->msg.buf_idx + data_len + (rtu ? 2 : 0);
+    const int32_t ret = nmbs->platform.writev(iov, iov_count, nmbs->byte_timeout_ms, nmbs->platform.arg);
+
+    const nmbs_error err = write_result(ret, count);
+    if (err == NMBS_ERROR_NONE)
+        stats_msg_out(nmbs, count);
+
+    unit_sent(nmbs, err);
+
+    trace_msg(nmbs, NMBS_TRACE_TX, nmbs->msg.buf, nmbs->msg.buf_idx, data, data_len, err);
+
+    return err;
+}
+#endif
+
+
+#ifndef NMBS_SERVER_DISABLED
+static void check_req_unit_id(nmbs_t* nmbs) {
+    if (NMBS_IS_RTU(nmbs)) {
+        // Check if request is for us
+        if (nmbs->msg.unit_id == NMBS_BROADCAST_ADDRESS)
+            nmbs->msg.broadcast = true;
+        else if (!nmbs_bitfield_read(nmbs->addresses_rtu, nmbs->msg.unit_id))
+            nmbs->msg.ignored = true;
+        else
+            nmbs->msg.ignored = false;
+    }
+}
+
+
+static nmbs_error recv_req_header(nmbs_t* nmbs, bool* first_byte_received) {
+    const nmbs_error err = recv_msg_header(nmbs, first_byte_received);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    if (registers_bytes > 246)
-        return NMBS_ERROR_INVALID_REQUEST;
+    check_req_unit_id(nmbs);
 
-    uint16_t registers[0x007B];
-    for (int i = 0; i < registers_bytes / 2; i++) {
-        registers[i] = get_2(nmbs);
-        NMBS_DEBUG_PRINT("%d ", registers[i]);
+    return NMBS_ERROR_NONE;
+}
+
+
+static void put_res_header(nmbs_t* nmbs, uint16_t data_length) {
+    put_msg_header(nmbs, data_length);
+    NMBS_DEBUG_PRINT("%d NMBS res -> address_rtu %d\tfc %d\t", nmbs->address_rtu, nmbs->msg.unit_id, nmbs->msg.fc);
+}
+
+
+static nmbs_error send_exception_msg(nmbs_t* nmbs, uint8_t exception) {
+    if (nmbs->msg.broadcast) {
+        return NMBS_ERROR_NONE;
+    }
+
+    nmbs->msg.fc += 0x80;
+    put_msg_header(nmbs, 1);
+    put_1(nmbs, exception);
+
+    NMBS_DEBUG_PRINT("%d NMBS res -> address_rtu %d\texception %d", nmbs->address_rtu, nmbs->msg.unit_id, exception);
+
+    stats_result(nmbs, (nmbs_error) exception);
+
+    return send_msg(nmbs);
+}
+#endif
+
+
+static nmbs_error recv_res_header(nmbs_t* nmbs) {
+    const uint16_t req_transaction_id = nmbs->msg.transaction_id;
+    const uint8_t req_unit_id = nmbs->msg.unit_id;
+    const uint8_t req_fc = nmbs->msg.fc;
+
+    bool first_byte_received = false;
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_UNIT_TRACKING)
+    // Responses received by the non-blocking API don't update the unit state
+    nmbs_unit_health* unit = nmbs->msg.preloaded ? NULL : nmbs->unit;
+    nmbs->unit = NULL;
+
+    nmbs_error err;
+    if (unit) {
+        const int32_t read_timeout_ms = nmbs->read_timeout_ms;
+        nmbs->read_timeout_ms = unit_timeout(nmbs, unit);
+        err = recv_msg_header(nmbs, &first_byte_received);
+        nmbs->read_timeout_ms = read_timeout_ms;
+        unit_update(nmbs, unit, first_byte_received, err);
+    }
+    else {
+        err = recv_msg_header(nmbs, &first_byte_received);
+    }
+#else
+    nmbs_error err = recv_msg_header(nmbs, &first_byte_received);
+#endif
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (NMBS_IS_TCP(nmbs)) {
+        if (nmbs->msg.transaction_id != req_transaction_id)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
+    }
+
+    if (NMBS_IS_RTU(nmbs) && nmbs->msg.unit_id != req_unit_id)
+        return NMBS_ERROR_INVALID_UNIT_ID;
+
+    if (nmbs->msg.fc != req_fc) {
+        if (nmbs->msg.fc - 0x80 == req_fc) {
+            err = recv(nmbs, 1);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+
+            const uint8_t exception = get_1(nmbs);
+            err = recv_msg_footer(nmbs);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+
+            if (!nmbs_error_is_exception(exception))
+                return NMBS_ERROR_INVALID_RESPONSE;
+
+            NMBS_DEBUG_PRINT("%d NMBS res <- address_rtu %d\texception %d\n", nmbs->address_rtu, nmbs->msg.unit_id,
+                             exception);
+            return (nmbs_error) exception;
+        }
+
+        return NMBS_ERROR_INVALID_RESPONSE;
+    }
+
+    NMBS_DEBUG_PRINT("%d NMBS res <- address_rtu %d\tfc %d\t", nmbs->address_rtu, nmbs->msg.unit_id, nmbs->msg.fc);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+#ifndef NMBS_CLIENT_DISABLED
+static void put_req_header(nmbs_t* nmbs, uint16_t data_length) {
+    put_msg_header(nmbs, data_length);
+#ifdef NMBS_DEBUG
+    printf("%d ", nmbs->address_rtu);
+    printf("NMBS req -> ");
+    if (NMBS_IS_RTU(nmbs)) {
+        if (nmbs->msg.broadcast)
+            printf("broadcast\t");
+        else
+            printf("address_rtu %d\t", nmbs->dest_address_rtu);
+    }
+
+    printf("fc %d\t", nmbs->msg.fc);
+#endif
+}
+#endif
+
+
+#if !defined(NMBS_CLIENT_DISABLED) ||                                                                                  \
+        (!defined(NMBS_SERVER_DISABLED) &&                                                                             \
+         (!defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)))
+static nmbs_error recv_read_discrete_res(nmbs_t* nmbs, nmbs_bitfield values) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t coils_bytes = get_1(nmbs);
+    NMBS_DEBUG_PRINT("b %d\t", coils_bytes);
+
+    if (coils_bytes > NMBS_BITFIELD_BYTES_MAX) {
+        return NMBS_ERROR_INVALID_RESPONSE;
+    }
+
+    err = recv(nmbs, coils_bytes);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    NMBS_DEBUG_PRINT("coils ");
+    for (int i = 0; i < coils_bytes; i++) {
+        const uint8_t coil = get_1(nmbs);
+        if (values)
+            values[i] = coil;
+        NMBS_DEBUG_PRINT("%d ", coil);
     }
 
     err = recv_msg_footer(nmbs);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    if (!nmbs->msg.ignored) {
-        if (quantity < 1 || quantity > 0x007B)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    return NMBS_ERROR_NONE;
+}
+#endif
 
-        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
 
-        if (registers_bytes == 0)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+#if !defined(NMBS_CLIENT_DISABLED) ||                                                                                  \
+        (!defined(NMBS_SERVER_DISABLED) && (!defined(NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED) ||                   \
+                                            !defined(NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED)))
+static nmbs_error recv_read_registers_res_be(nmbs_t* nmbs, uint16_t quantity, const uint8_t** registers_be_out) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-        if (registers_bytes != quantity * 2)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-        if (nmbs->callbacks.write_multiple_registers) {
-            err = nmbs->callbacks.write_multiple_registers(address, quantity, registers, nmbs->msg.unit_id,
-                                                           nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+    const uint8_t registers_bytes = get_1(nmbs);
+    NMBS_DEBUG_PRINT("b %d\t", registers_bytes);
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+    if (registers_bytes > 250)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    err = recv(nmbs, registers_bytes);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t* registers_be = get_n(nmbs, registers_bytes);
+
+    NMBS_DEBUG_PRINT("regs ");
+    for (int i = 0; i < registers_bytes / 2; i++)
+        NMBS_DEBUG_PRINT("%d ", nmbs_be16_read(registers_be, i));
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (registers_bytes != quantity * 2)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    *registers_be_out = registers_be;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error recv_read_registers_res(nmbs_t* nmbs, uint16_t quantity, uint16_t* registers) {
+    const uint8_t* registers_be;
+    const nmbs_error err = recv_read_registers_res_be(nmbs, quantity, &registers_be);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (registers) {
+        for (uint16_t i = 0; i < quantity; i++)
+            registers[i] = nmbs_be16_read(registers_be, i);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+nmbs_error recv_write_single_coil_res(nmbs_t* nmbs, uint16_t address, uint16_t value_req) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address_res = get_2(nmbs);
+    const uint16_t value_res = get_2(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value_res);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (address_res != address)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    if (value_res != value_req)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error recv_write_single_register_res(nmbs_t* nmbs, uint16_t address, uint16_t value_req) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address_res = get_2(nmbs);
+    const uint16_t value_res = get_2(nmbs);
+    NMBS_DEBUG_PRINT("a %d\tvalue %d ", address, value_res);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (address_res != address)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    if (value_res != value_req)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error recv_write_multiple_coils_res(nmbs_t* nmbs, uint16_t address, uint16_t quantity) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address_res = get_2(nmbs);
+    const uint16_t quantity_res = get_2(nmbs);
+    NMBS_DEBUG_PRINT("a %d\tq %d", address_res, quantity_res);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (address_res != address)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    if (quantity_res != quantity)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error recv_write_multiple_registers_res(nmbs_t* nmbs, uint16_t address, uint16_t quantity) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address_res = get_2(nmbs);
+    const uint16_t quantity_res = get_2(nmbs);
+    NMBS_DEBUG_PRINT("a %d\tq %d", address_res, quantity_res);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (address_res != address)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    if (quantity_res != quantity)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error recv_read_file_record_res(nmbs_t* nmbs, uint16_t* registers, uint16_t count) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t response_size = get_1(nmbs);
+    if (response_size > 250) {
+        return NMBS_ERROR_INVALID_RESPONSE;
+    }
+
+    err = recv(nmbs, response_size);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t subreq_data_size = get_1(nmbs) - 1;
+    const uint8_t subreq_reference_type = get_1(nmbs);
+    uint16_t* subreq_record_data = (uint16_t*) get_n(nmbs, subreq_data_size);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (registers) {
+        if (subreq_reference_type != 6)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        if (count != (subreq_data_size / 2))
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        swap_regs(subreq_record_data, subreq_data_size / 2);
+        memcpy(registers, subreq_record_data, subreq_data_size);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error recv_write_file_record_res(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number,
+                                      const uint16_t* registers, uint16_t count) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t response_size = get_1(nmbs);
+    if (response_size > 251)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    err = recv(nmbs, response_size);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t subreq_reference_type = get_1(nmbs);
+    const uint16_t subreq_file_number = get_2(nmbs);
+    const uint16_t subreq_record_number = get_2(nmbs);
+    const uint16_t subreq_record_length = get_2(nmbs);
+    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", subreq_file_number, subreq_record_number, subreq_record_length);
+
+    uint16_t subreq_data_size = subreq_record_length * 2;
+    uint16_t* subreq_record_data = (uint16_t*) get_n(nmbs, subreq_data_size);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (registers) {
+        if (subreq_reference_type != 6)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        if (subreq_file_number != file_number)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        if (subreq_record_number != record_number)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        if (subreq_record_length != count)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        swap_regs(subreq_record_data, subreq_record_length);
+        if (memcmp(registers, subreq_record_data, subreq_data_size) != 0)
+            return NMBS_ERROR_INVALID_RESPONSE;
+    }
+
+    return NMBS_ERROR_NONE;
+}
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_FILE_STREAM)
+// Bytes of a file sub-request in a FC 21 request, or of a file sub-response in a FC 20 response
+static uint16_t file_subreq_size(uint8_t fc, uint16_t length) {
+    return (fc == 20 ? 2 : 7) + length * 2;
+}
+
+
+// Records of a sub-request of a file records range, split at the end of each file
+static uint16_t file_subreq_length(uint16_t record_number, uint32_t count) {
+    return count < 10000u - record_number ? (uint16_t) count : (uint16_t) (10000u - record_number);
+}
+
+
+// Records of a file records range that fit in a single FC 20 response or FC 21 request, max 251 bytes of sub-requests
+static uint16_t file_records_length(uint8_t fc, uint16_t record_number, uint32_t count) {
+    uint16_t size_left = 251;
+    uint16_t total = 0;
+    while (total < count && size_left >= file_subreq_size(fc, 1)) {
+        uint16_t length = file_subreq_length(record_number, count - total);
+        const uint16_t length_max = (size_left - file_subreq_size(fc, 0)) / 2;
+        if (length > length_max)
+            length = length_max;
+
+        total += length;
+        size_left -= file_subreq_size(fc, length);
+        record_number = 0;
+    }
+
+    return total;
+}
+
+
+static nmbs_error send_file_records_req(nmbs_t* nmbs, uint8_t fc, uint16_t file_number, uint16_t record_number,
+                                        const uint16_t* registers, uint16_t count) {
+    uint16_t request_size = 0;
+    uint16_t record = record_number;
+    for (uint16_t left = count; left > 0; record = 0) {
+        const uint16_t length = file_subreq_length(record, left);
+        request_size += fc == 20 ? 7 : file_subreq_size(fc, length);
+        left -= length;
+    }
+
+    msg_state_req(nmbs, fc);
+    put_req_header(nmbs, 1 + request_size);
+    put_1(nmbs, (uint8_t) request_size);
+
+    record = record_number;
+    for (uint16_t left = count; left > 0; file_number++, record = 0) {
+        const uint16_t length = file_subreq_length(record, left);
+        put_1(nmbs, 6);    // add Reference Type const
+        put_2(nmbs, file_number);
+        put_2(nmbs, record);
+        put_2(nmbs, length);
+        NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t ", file_number, record, length);
+
+        if (fc == 21) {
+            put_regs(nmbs, registers, length);
+            registers += length;
+        }
+
+        left -= length;
+    }
+
+    return send_msg(nmbs);
+}
+
+
+// Response to a request of send_file_records_req(), the records are stored in registers_out for FC 20, and compared
+// to the written registers for FC 21
+static nmbs_error recv_file_records_res(nmbs_t* nmbs, uint8_t fc, uint16_t file_number, uint16_t record_number,
+                                        uint16_t* registers_out, const uint16_t* registers, uint16_t count) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    uint16_t response_size = 0;
+    uint16_t record = record_number;
+    for (uint16_t left = count; left > 0; record = 0) {
+        const uint16_t length = file_subreq_length(record, left);
+        response_size += file_subreq_size(fc, length);
+        left -= length;
+    }
+
+    if (get_1(nmbs) != response_size)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    err = recv(nmbs, response_size);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t data_idx = nmbs->msg.buf_idx;
+
+    record = record_number;
+    for (uint16_t left = count; left > 0; file_number++, record = 0) {
+        const uint16_t length = file_subreq_length(record, left);
+        if (fc == 20) {
+            if (get_1(nmbs) != 1 + length * 2 || get_1(nmbs) != 6)
+                return NMBS_ERROR_INVALID_RESPONSE;
+
+            get_n(nmbs, length * 2);
+        }
+        else {
+            if (get_1(nmbs) != 6 || get_2(nmbs) != file_number || get_2(nmbs) != record || get_2(nmbs) != length)
+                return NMBS_ERROR_INVALID_RESPONSE;
+
+            for (uint16_t i = 0; i < length; i++) {
+                if (get_2(nmbs) != *registers++)
+                    return NMBS_ERROR_INVALID_RESPONSE;
+            }
+        }
+
+        left -= length;
+    }
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    // The records are only stored once the whole response is checked
+    if (fc == 20) {
+        nmbs->msg.buf_idx = data_idx;
+        record = record_number;
+        for (uint16_t left = count; left > 0; record = 0) {
+            const uint16_t length = file_subreq_length(record, left);
+            get_n(nmbs, 2);
+            for (uint16_t i = 0; i < length; i++)
+                *registers_out++ = get_2(nmbs);
+
+            left -= length;
+        }
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+nmbs_error recv_read_device_identification_res(nmbs_t* nmbs, uint8_t buffers_count, char** buffers_out,
+                                               uint8_t buffers_length, const uint8_t* order, uint8_t* ids_out,
+                                               uint8_t* next_object_id_out, uint8_t* objects_count_out) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = recv(nmbs, 6);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t mei_type = get_1(nmbs);
+    if (mei_type != 0x0E)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    const uint8_t read_device_id_code = get_1(nmbs);
+    if (read_device_id_code < 1 || read_device_id_code > 4)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    const uint8_t conformity_level = get_1(nmbs);
+    if (conformity_level < 1 || (conformity_level > 3 && conformity_level < 0x81) || conformity_level > 0x83)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    const uint8_t more_follows = get_1(nmbs);
+    if (more_follows != 0 && more_follows != 0xFF)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    uint8_t next_object_id = get_1(nmbs);
+
+    const uint8_t objects_count = get_1(nmbs);
+    if (objects_count_out)
+        *objects_count_out = objects_count;
+
+    if (buffers_count == 0) {
+        buffers_out = NULL;
+    }
+    else if (objects_count > buffers_count)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if (more_follows == 0)
+        next_object_id = 0x7F;    // This value is reserved in the spec, we use it to signal stream is finished
+
+    if (next_object_id_out)
+        *next_object_id_out = next_object_id;
+
+    uint8_t res_size_left = 253 - 7;
+    for (int i = 0; i < objects_count; i++) {
+        err = recv(nmbs, 2);
+        if (err != NMBS_ERROR_NONE)
+            return err;
+
+        const uint8_t object_id = get_1(nmbs);
+        const uint8_t object_length = get_1(nmbs);
+        res_size_left -= 2;
+
+        if (object_length > res_size_left)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
+        err = recv(nmbs, object_length);
+        if (err != NMBS_ERROR_NONE)
+            return err;
+
+        const char* str = (const char*) get_n(nmbs, object_length);
+
+        if (ids_out)
+            ids_out[i] = object_id;
+
+        uint8_t buf_index = i;
+        if (order)
+            buf_index = order[object_id];
+        if (buffers_out) {
+#ifndef WIN32
+            strncpy(buffers_out[buf_index], str, buffers_length);
+#else
+            strncpy_s(buffers_out[buf_index], buffers_length, str, object_length);
+#endif
+            buffers_out[buf_index][object_length] = 0;
+        }
+    }
+
+    return recv_msg_footer(nmbs);
+}
+
+
+#ifndef NMBS_SERVER_DISABLED
+// Register bank table serving the requests to the given table, NULL if they're served by the callbacks
+static const nmbs_bank_table* bank_table(const nmbs_t* nmbs, nmbs_table table) {
+    const nmbs_register_bank* bank = nmbs->callbacks.register_bank;
+    if (!bank)
+        return NULL;
+
+    const nmbs_bank_table* t = NULL;
+    switch (table) {
+        case NMBS_TABLE_COILS:
+            t = &bank->coils;
+            break;
+        case NMBS_TABLE_DISCRETE_INPUTS:
+            t = &bank->discrete_inputs;
+            break;
+        case NMBS_TABLE_HOLDING_REGISTERS:
+            t = &bank->holding_registers;
+            break;
+        case NMBS_TABLE_INPUT_REGISTERS:
+            t = &bank->input_registers;
+            break;
+    }
+
+    return t->data ? t : NULL;
+}
+
+
+static bool bank_in_range(const nmbs_bank_table* t, uint16_t address, uint16_t quantity) {
+    return address >= t->address && (uint32_t) address + (uint32_t) quantity <= (uint32_t) t->address + t->count;
+}
+
+
+#if !defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED) ||               \
+        !defined(NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED) || !defined(NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED)
+// Sync hooks of banks shared between threads. Without them, reads always succeed at the first attempt
+static uint32_t bank_read_begin(const nmbs_t* nmbs) {
+    const nmbs_register_bank* bank = nmbs->callbacks.register_bank;
+    return bank->read_begin ? bank->read_begin(bank->sync_arg) : 0;
+}
+
+
+static bool bank_read_end(const nmbs_t* nmbs, uint32_t token) {
+    const nmbs_register_bank* bank = nmbs->callbacks.register_bank;
+    return bank->read_end ? bank->read_end(token, bank->sync_arg) : true;
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED) || !defined(NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED) ||         \
+        !defined(NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED) ||                                                        \
+        !defined(NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED) || !defined(NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED)
+static void bank_write_begin(const nmbs_t* nmbs) {
+    const nmbs_register_bank* bank = nmbs->callbacks.register_bank;
+    if (bank->write_begin)
+        bank->write_begin(bank->sync_arg);
+}
+
+
+static void bank_write_end(const nmbs_t* nmbs) {
+    const nmbs_register_bank* bank = nmbs->callbacks.register_bank;
+    if (bank->write_end)
+        bank->write_end(bank->sync_arg);
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)
+// Copy quantity bits starting at bit offset of src to the start of dst
+static void bank_read_bits(uint8_t* dst, const uint8_t* src, uint16_t offset, uint16_t quantity) {
+    nmbs_bitfield_copy(dst, 0, src, offset, quantity);
+
+    // The unused bits of the last byte are zero
+    if (quantity & 7)
+        dst[quantity / 8] &= (uint8_t) ((1 << (quantity & 7)) - 1);
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED) || !defined(NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED)
+static nmbs_error bank_write_bits(nmbs_t* nmbs, const nmbs_bank_table* t, uint16_t address, uint16_t quantity,
+                                  const uint8_t* bits) {
+    if (!bank_in_range(t, address, quantity))
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    uint8_t* data = t->data;
+    const uint16_t offset = address - t->address;
+
+    bank_write_begin(nmbs);
+    const uint16_t first_changed = nmbs_bitfield_compare(data, offset, bits, 0, quantity);
+    uint16_t last_changed = first_changed;
+    for (uint16_t i = first_changed; i < quantity;) {
+        last_changed = i;
+        i += 1 + nmbs_bitfield_compare(data, offset + i + 1, bits, i + 1, quantity - i - 1);
+    }
+
+    if (first_changed < quantity)
+        nmbs_bitfield_copy(data, offset + first_changed, bits, first_changed, last_changed - first_changed + 1);
+    bank_write_end(nmbs);
+
+    if (first_changed < quantity && nmbs->callbacks.register_bank->coils_written)
+        nmbs->callbacks.register_bank->coils_written(address + first_changed, last_changed - first_changed + 1,
+                                                     nmbs->msg.unit_id, nmbs->callbacks.arg);
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED) ||                                                            \
+        !defined(NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED) || !defined(NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED)
+// If read_be is not NULL, read_quantity registers starting at read_address are copied to it after the write, in the
+// same write section
+static nmbs_error bank_write_registers(nmbs_t* nmbs, const nmbs_bank_table* t, uint16_t address, uint16_t quantity,
+                                       const uint16_t* registers, uint8_t* read_be, uint16_t read_address,
+                                       uint16_t read_quantity) {
+    if (!bank_in_range(t, address, quantity))
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    uint16_t* data = (uint16_t*) t->data + (address - t->address);
+    int32_t first_changed = -1;
+    int32_t last_changed = -1;
+
+    bank_write_begin(nmbs);
+    for (uint16_t i = 0; i < quantity; i++) {
+        if (data[i] != registers[i]) {
+            data[i] = registers[i];
+            if (first_changed < 0)
+                first_changed = i;
+
+            last_changed = i;
+        }
+    }
+
+    if (read_be)
+        nmbs_registers_to_be(read_be, (const uint16_t*) t->data + (read_address - t->address), read_quantity);
+    bank_write_end(nmbs);
+
+    if (first_changed >= 0 && nmbs->callbacks.register_bank->holding_registers_written)
+        nmbs->callbacks.register_bank->holding_registers_written((uint16_t) (address + first_changed),
+                                                                 (uint16_t) (last_changed - first_changed + 1),
+                                                                 nmbs->msg.unit_id, nmbs->callbacks.arg);
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)
+static nmbs_error handle_read_discrete(nmbs_t* nmbs,
+                                       nmbs_error (*callback)(uint16_t, uint16_t, nmbs_bitfield, uint8_t, void*),
+                                       const nmbs_bank_table* bank) {
+    nmbs_error err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t quantity = get_2(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (quantity < 1 || quantity > 2000)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if (bank || callback) {
+            uint8_t discrete_bytes = (quantity + 7) / 8;
+            put_res_header(nmbs, 1 + discrete_bytes);
+
+            put_1(nmbs, discrete_bytes);
+
+            // The bitfield layout is the same as on the wire, so the callback fills the response in place, as long as a
+            // whole nmbs_bitfield fits in the message buffer after the 9 bytes of the TCP response header.
+            // Larger bitfields are filled on the stack and copied
+#if NMBS_BITFIELD_BYTES_MAX <= 260 - 9
+            uint8_t* bitfield = nmbs->msg.buf + nmbs->msg.buf_idx;
+#else
+            nmbs_bitfield bitfield_buf;
+            uint8_t* bitfield = bitfield_buf;
+#endif
+            if (bank) {
+                err = NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+                if (bank_in_range(bank, address, quantity)) {
+                    uint32_t token;
+                    do {
+                        token = bank_read_begin(nmbs);
+                        bank_read_bits(bitfield, bank->data, address - bank->address, quantity);
+                    } while (!bank_read_end(nmbs, token));
+
+                    err = NMBS_ERROR_NONE;
+                }
+            }
+            else {
+                memset(bitfield, 0, discrete_bytes);
+                err = callback(address, quantity, bitfield, nmbs->msg.unit_id, nmbs->callbacks.arg);
+            }
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                NMBS_DEBUG_PRINT("b %d\t", discrete_bytes);
+
+                NMBS_DEBUG_PRINT("coils ");
+                for (int i = 0; i < discrete_bytes; i++) {
+                    NMBS_DEBUG_PRINT("%d ", bitfield[i]);
+                }
+
+#if NMBS_BITFIELD_BYTES_MAX > 260 - 9
+                memcpy(nmbs->msg.buf + nmbs->msg.buf_idx, bitfield, discrete_bytes);
+#endif
+                nmbs->msg.buf_idx += discrete_bytes;
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_read_discrete_res(nmbs, NULL);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#if !defined(NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED) || !defined(NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED)
+static nmbs_error handle_read_registers(nmbs_t* nmbs,
+                                        nmbs_error (*callback)(uint16_t, uint16_t, uint16_t*, uint8_t, void*),
+                                        nmbs_error (*callback_be)(uint16_t, uint16_t, uint8_t*, uint8_t, void*),
+                                        const nmbs_bank_table* bank) {
+    nmbs_error err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t quantity = get_2(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (quantity < 1 || quantity > 125)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if (bank || callback_be) {
+            const uint8_t regs_bytes = quantity * 2;
+            put_res_header(nmbs, 1 + regs_bytes);
+
+            put_1(nmbs, regs_bytes);
+
+            // The big-endian registers are stored right into the response
+            uint8_t* regs_be = nmbs->msg.buf + nmbs->msg.buf_idx;
+            if (bank) {
+                err = NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+                if (bank_in_range(bank, address, quantity)) {
+                    uint32_t token;
+                    do {
+                        token = bank_read_begin(nmbs);
+                        nmbs_registers_to_be(regs_be, (const uint16_t*) bank->data + (address - bank->address),
+                                             quantity);
+                    } while (!bank_read_end(nmbs, token));
+
+                    err = NMBS_ERROR_NONE;
+                }
+            }
+            else {
+                err = callback_be(address, quantity, regs_be, nmbs->msg.unit_id, nmbs->callbacks.arg);
+            }
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
+
+                NMBS_DEBUG_PRINT("regs ");
+                for (int i = 0; i < quantity; i++) {
+                    NMBS_DEBUG_PRINT("%d ", nmbs_be16_read(regs_be, i));
+                }
+
+                nmbs->msg.buf_idx += regs_bytes;
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else if (callback) {
+#ifdef NMBS_LOW_STACK
+            uint16_t* regs = nmbs->scratch->registers;
+            memset(regs, 0, sizeof(nmbs->scratch->registers));
+#else
+            uint16_t regs[125] = {0};
+#endif
+            err = callback(address, quantity, regs, nmbs->msg.unit_id, nmbs->callbacks.arg);
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            // TODO check all these read request broadcast use cases
+            if (!nmbs->msg.broadcast) {
+                const uint8_t regs_bytes = quantity * 2;
+                put_res_header(nmbs, 1 + regs_bytes);
+
+                put_1(nmbs, regs_bytes);
+
+                NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
+
+                NMBS_DEBUG_PRINT("regs ");
+                for (int i = 0; i < quantity; i++) {
+                    put_2(nmbs, regs[i]);
+                    NMBS_DEBUG_PRINT("%d ", regs[i]);
+                }
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_read_registers_res(nmbs, quantity, NULL);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#ifndef NMBS_SERVER_READ_COILS_DISABLED
+static nmbs_error handle_read_coils(nmbs_t* nmbs) {
+    return handle_read_discrete(nmbs, nmbs->callbacks.read_coils, bank_table(nmbs, NMBS_TABLE_COILS));
+}
+#endif
+
+
+#ifndef NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED
+static nmbs_error handle_read_discrete_inputs(nmbs_t* nmbs) {
+    return handle_read_discrete(nmbs, nmbs->callbacks.read_discrete_inputs,
+                                bank_table(nmbs, NMBS_TABLE_DISCRETE_INPUTS));
+}
+#endif
+
+
+#ifndef NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED
+static nmbs_error handle_read_holding_registers(nmbs_t* nmbs) {
+    return handle_read_registers(nmbs, nmbs->callbacks.read_holding_registers,
+                                 nmbs->callbacks.read_holding_registers_be,
+                                 bank_table(nmbs, NMBS_TABLE_HOLDING_REGISTERS));
+}
+#endif
+
+
+#ifndef NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED
+static nmbs_error handle_read_input_registers(nmbs_t* nmbs) {
+    return handle_read_registers(nmbs, nmbs->callbacks.read_input_registers, nmbs->callbacks.read_input_registers_be,
+                                 bank_table(nmbs, NMBS_TABLE_INPUT_REGISTERS));
+}
+#endif
+
+
+#ifndef NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED
+static nmbs_error handle_write_single_coil(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t value = get_2(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        const nmbs_bank_table* bank = bank_table(nmbs, NMBS_TABLE_COILS);
+        if (bank || nmbs->callbacks.write_single_coil) {
+            if (value != 0 && value != 0xFF00)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+            if (bank) {
+                const uint8_t bits = value == 0 ? 0 : 1;
+                err = bank_write_bits(nmbs, bank, address, 1, &bits);
+            }
+            else {
+                err = nmbs->callbacks.write_single_coil(address, value == 0 ? false : true, nmbs->msg.unit_id,
+                                                        nmbs->callbacks.arg);
+            }
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                put_res_header(nmbs, 4);
+
+                put_2(nmbs, address);
+                put_2(nmbs, value);
+                NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_write_single_coil_res(nmbs, address, value);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#ifndef NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED
+static nmbs_error handle_write_single_register(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 4);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t value = get_2(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        const nmbs_bank_table* bank = bank_table(nmbs, NMBS_TABLE_HOLDING_REGISTERS);
+        if (bank || nmbs->callbacks.write_single_register) {
+            if (bank)
+                err = bank_write_registers(nmbs, bank, address, 1, &value, NULL, 0, 0);
+            else
+                err = nmbs->callbacks.write_single_register(address, value, nmbs->msg.unit_id, nmbs->callbacks.arg);
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                put_res_header(nmbs, 4);
+
+                put_2(nmbs, address);
+                put_2(nmbs, value);
+                NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_write_single_register_res(nmbs, address, value);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#ifndef NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED
+static nmbs_error handle_write_multiple_coils(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 5);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t quantity = get_2(nmbs);
+    uint8_t coils_bytes = get_1(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\tcoils ", address, quantity, coils_bytes);
+
+    if (coils_bytes > 246)
+        return NMBS_ERROR_INVALID_REQUEST;
+
+    err = recv(nmbs, coils_bytes);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+#ifdef NMBS_LOW_STACK
+    uint8_t* coils = nmbs->scratch->bits;
+    memset(coils, 0, sizeof(nmbs->scratch->bits));
+#else
+    nmbs_bitfield coils = {0};
+#endif
+    for (int i = 0; i < coils_bytes; i++) {
+        coils[i] = get_1(nmbs);
+        NMBS_DEBUG_PRINT("%d ", coils[i]);
+    }
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (quantity < 1 || quantity > 0x07B0)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if (coils_bytes == 0)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((quantity + 7) / 8 != coils_bytes)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        const nmbs_bank_table* bank = bank_table(nmbs, NMBS_TABLE_COILS);
+        if (bank || nmbs->callbacks.write_multiple_coils) {
+            if (bank)
+                err = bank_write_bits(nmbs, bank, address, quantity, coils);
+            else
+                err = nmbs->callbacks.write_multiple_coils(address, quantity, coils, nmbs->msg.unit_id,
+                                                           nmbs->callbacks.arg);
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                put_res_header(nmbs, 4);
+
+                put_2(nmbs, address);
+                put_2(nmbs, quantity);
+                NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_write_multiple_coils_res(nmbs, address, quantity);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+#ifndef NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED
+static nmbs_error handle_write_multiple_registers(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 5);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t address = get_2(nmbs);
+    const uint16_t quantity = get_2(nmbs);
+    const uint8_t registers_bytes = get_1(nmbs);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\tregs ", address, quantity, registers_bytes);
+
+    err = recv(nmbs, registers_bytes);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (registers_bytes > 246)
+        return NMBS_ERROR_INVALID_REQUEST;
+
+#ifdef NMBS_LOW_STACK
+    uint16_t* registers = nmbs->scratch->registers;
+#else
+    uint16_t registers[0x007B];
+#endif
+    for (int i = 0; i < registers_bytes / 2; i++) {
+        registers[i] = get_2(nmbs);
+        NMBS_DEBUG_PRINT("%d ", registers[i]);
+    }
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (quantity < 1 || quantity > 0x007B)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if (registers_bytes == 0)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if (registers_bytes != quantity * 2)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        const nmbs_bank_table* bank = bank_table(nmbs, NMBS_TABLE_HOLDING_REGISTERS);
+        if (bank || nmbs->callbacks.write_multiple_registers) {
+            if (bank)
+                err = bank_write_registers(nmbs, bank, address, quantity, registers, NULL, 0, 0);
+            else
+                err = nmbs->callbacks.write_multiple_registers(address, quantity, registers, nmbs->msg.unit_id,
+                                                               nmbs->callbacks.arg);
+
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            if (!nmbs->msg.broadcast) {
+                put_res_header(nmbs, 4);
+
+                put_2(nmbs, address);
+                put_2(nmbs, quantity);
+                NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+
+                err = send_msg(nmbs);
+                if (err != NMBS_ERROR_NONE)
+                    return err;
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+    }
+    else {
+        return recv_write_multiple_registers_res(nmbs, address, quantity);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+#ifndef NMBS_SERVER_READ_FILE_RECORD_DISABLED
+static nmbs_error handle_read_file_record(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t request_size = get_1(nmbs);
+    if (request_size > 245)
+        return NMBS_ERROR_INVALID_REQUEST;
+
+    err = recv(nmbs, request_size);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t subreq_header_size = 7;
+    const uint8_t subreq_count = request_size / subreq_header_size;
+
+    struct file_subreq {
+        uint8_t reference_type;
+        uint16_t file_number;
+        uint16_t record_number;
+        uint16_t record_length;
+    };
+#if defined(NMBS_LOW_STACK)
+    struct file_subreq* subreq = (struct file_subreq*) nmbs->scratch->bytes;
+#elif defined(__STDC_NO_VLA__) || defined(_MSC_VER)
+    struct file_subreq subreq[35];    // 245 / subreq_header_size
+#else
+    struct file_subreq subreq[subreq_count];
+#endif
+
+    uint16_t response_data_size = 0;
+
+    for (uint8_t i = 0; i < subreq_count; i++) {
+        subreq[i].reference_type = get_1(nmbs);
+        subreq[i].file_number = get_2(nmbs);
+        subreq[i].record_number = get_2(nmbs);
+        subreq[i].record_length = get_2(nmbs);
+
+        response_data_size += 2 + subreq[i].record_length * 2;
+    }
+
+    discard_n(nmbs, request_size % subreq_header_size);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (request_size % subreq_header_size)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if (request_size < 0x07 || request_size > 0xF5)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        for (uint8_t i = 0; i < subreq_count; i++) {
+            if (subreq[i].reference_type != 0x06)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq[i].file_number == 0x0000)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq[i].record_number > 0x270F)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq[i].record_length > 124)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fread ", subreq[i].file_number, subreq[i].record_number,
+                             subreq[i].record_length);
+        }
+
+        // The sub-responses must fit in a PDU along with the function code and the response data length
+        if (response_data_size > 251)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        put_res_header(nmbs, 1 + response_data_size);
+        put_1(nmbs, (uint8_t) response_data_size);
+
+        if (nmbs->callbacks.read_file_record) {
+            for (uint8_t i = 0; i < subreq_count; i++) {
+                uint16_t subreq_data_size = subreq[i].record_length * 2;
+                put_1(nmbs, subreq_data_size + 1);
+                put_1(nmbs, 0x06);    // add Reference Type const
+                uint16_t* subreq_data = (uint16_t*) get_n(nmbs, subreq_data_size);
+
+                err = nmbs->callbacks.read_file_record(subreq[i].file_number, subreq[i].record_number, subreq_data,
+                                                       subreq[i].record_length, nmbs->msg.unit_id, nmbs->callbacks.arg);
+                if (err != NMBS_ERROR_NONE) {
+                    if (nmbs_error_is_exception(err))
+                        return send_exception_msg(nmbs, err);
+
+                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+                }
+
+                swap_regs(subreq_data, subreq[i].record_length);
+            }
+        }
+        else {
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        }
+
+        if (!nmbs->msg.broadcast) {
+            err = send_msg(nmbs);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+        }
+    }
+    else {
+        return recv_read_file_record_res(nmbs, NULL, 0);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+#ifndef NMBS_SERVER_WRITE_FILE_RECORD_DISABLED
+static nmbs_error handle_write_file_record(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 1);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t request_size = get_1(nmbs);
+    if (request_size > 251) {
+        return NMBS_ERROR_INVALID_REQUEST;
+    }
+
+    err = recv(nmbs, request_size);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    // We can save msg.buf index and use it later for context recovery.
+    const uint16_t msg_buf_idx = nmbs->msg.buf_idx;
+    discard_n(nmbs, request_size);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        const uint8_t subreq_header_size = 7;
+        uint16_t size = request_size;
+        nmbs->msg.buf_idx = msg_buf_idx;    // restore context
+
+        if (request_size < 7)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        do {
+            const uint8_t subreq_reference_type = get_1(nmbs);
+            const uint16_t subreq_file_number_c = get_2(nmbs);
+            const uint16_t subreq_record_number_c = get_2(nmbs);
+            const uint16_t subreq_record_length_c = get_2(nmbs);
+            discard_n(nmbs, subreq_record_length_c * 2);
+
+            if (subreq_reference_type != 0x06)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq_file_number_c == 0x0000)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq_record_number_c > 0x270F)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            if (subreq_record_length_c > 122)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+            NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", subreq_file_number_c, subreq_record_number_c,
+                             subreq_record_length_c);
+            size -= (subreq_header_size + subreq_record_length_c * 2);
+        } while (size >= subreq_header_size);
+
+        if (size)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        // checks completed
+
+        size = request_size;
+        nmbs->msg.buf_idx = msg_buf_idx;    // restore context
+
+        do {
+            discard_1(nmbs);
+            const uint16_t subreq_file_number = get_2(nmbs);
+            const uint16_t subreq_record_number = get_2(nmbs);
+            const uint16_t subreq_record_length = get_2(nmbs);
+            uint16_t* subreq_data = get_regs(nmbs, subreq_record_length);
+
+            if (nmbs->callbacks.write_file_record) {
+                err = nmbs->callbacks.write_file_record(subreq_file_number, subreq_record_number, subreq_data,
+                                                        subreq_record_length, nmbs->msg.unit_id, nmbs->callbacks.arg);
+                if (err != NMBS_ERROR_NONE) {
+                    if (nmbs_error_is_exception(err))
+                        return send_exception_msg(nmbs, err);
+
+                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+                }
+
+                swap_regs(subreq_data, subreq_record_length);    // restore swapping
+            }
+            else {
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+            }
+
+            size -= (subreq_header_size + subreq_record_length * 2);
+        } while (size >= subreq_header_size);
+
+        if (!nmbs->msg.broadcast) {
+            // The normal response to 'Write File' is an echo of the request.
+            // We can restore buffer index and response msg.
+            nmbs->msg.buf_idx = msg_buf_idx;
+            discard_n(nmbs, request_size);
+
+            err = send_msg(nmbs);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+        }
+    }
+    else {
+        return recv_write_file_record_res(nmbs, 0, 0, NULL, 0);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+#ifndef NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED
+static nmbs_error handle_read_write_registers(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 9);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t read_address = get_2(nmbs);
+    const uint16_t read_quantity = get_2(nmbs);
+    const uint16_t write_address = get_2(nmbs);
+    const uint16_t write_quantity = get_2(nmbs);
+
+    const uint8_t byte_count_write = get_1(nmbs);
+
+    NMBS_DEBUG_PRINT("ra %d\trq %d\t wa %d\t wq %d\t b %d\tregs ", read_address, read_quantity, write_address,
+                     write_quantity, byte_count_write);
+
+    if (byte_count_write > 242)
+        return NMBS_ERROR_INVALID_REQUEST;
+
+    err = recv(nmbs, byte_count_write);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+#if defined(NMBS_LOW_STACK)
+    uint16_t* registers = nmbs->scratch->registers;
+#elif defined(__STDC_NO_VLA__) || defined(_MSC_VER)
+    uint16_t registers[0x007B];
+#else
+    uint16_t registers[byte_count_write / 2];
+#endif
+    for (int i = 0; i < byte_count_write / 2; i++) {
+        registers[i] = get_2(nmbs);
+        NMBS_DEBUG_PRINT("%d ", registers[i]);
+    }
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        if (read_quantity < 1 || read_quantity > 0x007D)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if (write_quantity < 1 || write_quantity > 0x007B)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if (byte_count_write != write_quantity * 2)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if ((uint32_t) read_address + (uint32_t) read_quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if ((uint32_t) write_address + (uint32_t) write_quantity > ((uint32_t) 0xFFFF) + 1)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        const nmbs_bank_table* bank = bank_table(nmbs, NMBS_TABLE_HOLDING_REGISTERS);
+        if (!bank && (!nmbs->callbacks.write_multiple_registers || !nmbs->callbacks.read_holding_registers))
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+
+        if (bank) {
+            // The read registers are copied right into the response
+            put_res_header(nmbs, 1 + read_quantity * 2);
+            put_1(nmbs, (uint8_t) (read_quantity * 2));
+
+            // Don't write anything if the read would fail
+            err = NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            if (bank_in_range(bank, read_address, read_quantity))
+                err = bank_write_registers(nmbs, bank, write_address, write_quantity, registers,
+                                           nmbs->msg.buf + nmbs->msg.buf_idx, read_address, read_quantity);
+        }
+        else {
+            err = nmbs->callbacks.write_multiple_registers(write_address, write_quantity, registers,
+                                                           nmbs->msg.unit_id, nmbs->callbacks.arg);
+        }
+
+        if (err != NMBS_ERROR_NONE) {
+            if (nmbs_error_is_exception(err))
+                return send_exception_msg(nmbs, err);
+
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+        }
+
+        if (!nmbs->msg.broadcast && bank) {
+            const uint8_t regs_bytes = read_quantity * 2;
+
+            NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
+
+            nmbs->msg.buf_idx += regs_bytes;
+
+            err = send_msg(nmbs);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+        }
+        else if (!nmbs->msg.broadcast) {
+#if defined(NMBS_LOW_STACK)
+            // The written registers are not needed anymore
+            uint16_t* regs = nmbs->scratch->registers;
+#elif defined(__STDC_NO_VLA__) || defined(_MSC_VER)
+            uint16_t regs[125];
+#else
+            uint16_t regs[read_quantity];
+#endif
+            err = nmbs->callbacks.read_holding_registers(read_address, read_quantity, regs, nmbs->msg.unit_id,
+                                                         nmbs->callbacks.arg);
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            const uint8_t regs_bytes = read_quantity * 2;
+            put_res_header(nmbs, 1 + regs_bytes);
+
+            put_1(nmbs, regs_bytes);
+
+            NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
+
+            NMBS_DEBUG_PRINT("regs ");
+            for (int i = 0; i < read_quantity; i++) {
+                put_2(nmbs, regs[i]);
+                NMBS_DEBUG_PRINT("%d ", regs[i]);
+            }
+
+            err = send_msg(nmbs);
+            if (err != NMBS_ERROR_NONE)
+                return err;
+        }
+    }
+    else {
+        return recv_write_multiple_registers_res(nmbs, write_address, write_quantity);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
+// Answer with a range of the pre-serialized objects, see nmbs_device_id_create()
+static nmbs_error send_static_device_identification(nmbs_t* nmbs, const nmbs_device_id* dev, uint8_t read_device_id_code,
+                                                    uint8_t object_id) {
+    uint8_t last_id = object_id;
+    switch (read_device_id_code) {
+        case 1:
+            if (object_id > 0x02)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+            last_id = 0x02;
+            break;
+        case 2:
+            if (object_id < 0x03 || object_id > 0x06)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+            last_id = 0x06;
+            break;
+        case 3:
+            if (object_id < 0x80)
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+            last_id = 0xFF;
+            break;
+        default:
+            break;
+    }
+
+    // The objects of the stream from object_id, and the end of the response they start
+    uint8_t first = 0;
+    while (first < dev->count && dev->ids[first] < object_id)
+        first++;
+
+    uint8_t end = first;
+    while (end < dev->count && dev->ids[end] <= last_id)
+        end++;
+
+    if (read_device_id_code == 4 && (first == end || dev->ids[first] != object_id))
+        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    uint8_t more_follows = 0;
+    uint8_t next_object_id = 0;
+    if (first < end && dev->page_end[first] < end) {
+        end = dev->page_end[first];
+        more_follows = 0xFF;
+        next_object_id = dev->ids[end];
+    }
+
+    const uint8_t objects_len = (uint8_t) (dev->offsets[end] - dev->offsets[first]);
+
+    put_res_header(nmbs, 0);
+    put_1(nmbs, 0x0E);
+    put_1(nmbs, read_device_id_code);
+    put_1(nmbs, 0x83);
+    put_1(nmbs, more_follows);
+    put_1(nmbs, next_object_id);
+    put_1(nmbs, end - first);
+    put_n(nmbs, dev->records + dev->offsets[first], objects_len);
+
+    set_msg_header_size(nmbs, 6 + objects_len);
+
+    return send_msg(nmbs);
+}
+
+
+static nmbs_error handle_read_device_identification(nmbs_t* nmbs) {
+    nmbs_error err = recv(nmbs, 3);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t mei_type = get_1(nmbs);
+    const uint8_t read_device_id_code = get_1(nmbs);
+    const uint8_t object_id = get_1(nmbs);
+
+    NMBS_DEBUG_PRINT("c %d\to %d", read_device_id_code, object_id);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    if (!nmbs->msg.ignored) {
+        const nmbs_device_id* dev = nmbs->callbacks.device_id;
+        if (!dev && (!nmbs->callbacks.read_device_identification_map || !nmbs->callbacks.read_device_identification))
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+
+        if (mei_type != 0x0E)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+
+        if (read_device_id_code < 1 || read_device_id_code > 4)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+        if (object_id > 6 && object_id < 0x80)
+            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+        if (!nmbs->msg.broadcast && dev)
+            return send_static_device_identification(nmbs, dev, read_device_id_code, object_id);
+
+        if (!nmbs->msg.broadcast) {
+#ifdef NMBS_LOW_STACK
+            char* str = (char*) nmbs->scratch->bytes;
+#else
+            char str[NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH];
+#endif
+
+            nmbs_bitfield_256 map;
+            nmbs_bitfield_reset(map);
+
+            err = nmbs->callbacks.read_device_identification_map(map);
+            if (err != NMBS_ERROR_NONE) {
+                if (nmbs_error_is_exception(err))
+                    return send_exception_msg(nmbs, err);
+
+                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+            }
+
+            put_res_header(nmbs, 0);    // Length will be set later
+            put_1(nmbs, 0x0E);
+            put_1(nmbs, read_device_id_code);
+            put_1(nmbs, 0x83);
+
+            if (read_device_id_code == 4) {
+                if (!nmbs_bitfield_read(map, object_id))
+                    return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+                put_1(nmbs, 0);    // More follows
+                put_1(nmbs, 0);    // Next Object Id
+                put_1(nmbs, 1);    // Number of objects
+
+                str[0] = 0;
+                err = nmbs->callbacks.read_device_identification(object_id, str);
+                if (err != NMBS_ERROR_NONE) {
+                    if (nmbs_error_is_exception(err))
+                        return send_exception_msg(nmbs, err);
+
+                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+                }
+
+                const size_t str_len = strlen(str);
+
+                put_1(nmbs, object_id);    // Object id
+                put_1(nmbs, str_len);      // Object length
+                put_n(nmbs, (uint8_t*) str, str_len);
+
+                set_msg_header_size(nmbs, 6 + 2 + str_len);
+
+                return send_msg(nmbs);
+            }
+
+            const uint8_t more_follows_idx = nmbs->msg.buf_idx;
+            put_1(nmbs, 0);
+            const uint8_t next_object_id_idx = nmbs->msg.buf_idx;
+            put_1(nmbs, 0);
+            const uint8_t number_of_objects_idx = nmbs->msg.buf_idx;
+            put_1(nmbs, 0);
+
+            int16_t res_size_left = 253 - 7;
+
+            uint8_t last_id = 0;
+            uint8_t msg_size = 6;
+            uint8_t res_more_follows = 0;
+            uint8_t res_next_object_id = 0;
+            uint8_t res_number_of_objects = 0;
+
+            switch (read_device_id_code) {
+                case 1:
+                    if (object_id > 0x02)
+                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+                    last_id = 0x02;
+                    break;
+                case 2:
+                    if (object_id < 0x03 || object_id > 0x06)
+                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+                    last_id = 0x06;
+                    break;
+                case 3:
+                    if (object_id < 0x80)
+                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+                    last_id = 0xFF;
+                    break;
+                default:
+                    // Unreachable
+                    break;
+            }
+
+            for (uint16_t id = object_id; id <= last_id; id++) {
+                if (!nmbs_bitfield_read(map, id)) {
+                    if (id < 0x03)
+                        return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+                    continue;
+                }
+
+                str[0] = 0;
+                err = nmbs->callbacks.read_device_identification((uint8_t) id, str);
+                if (err != NMBS_ERROR_NONE) {
+                    if (nmbs_error_is_exception(err))
+                        return send_exception_msg(nmbs, err);
+
+                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+                }
+
+                const int16_t str_len = (int16_t) strlen(str);
+
+                res_size_left = (int16_t) (res_size_left - 2 - str_len);
+                if (res_size_left < 0) {
+                    res_more_follows = 0xFF;
+                    res_next_object_id = id;
+                    break;
+                }
+
+                put_1(nmbs, (uint8_t) id);    // Object id
+                put_1(nmbs, str_len);         // Object length
+                put_n(nmbs, (uint8_t*) str, str_len);
+
+                msg_size += (2 + str_len);
+
+                res_number_of_objects++;
+            }
+
+            set_1(nmbs, res_more_follows, more_follows_idx);
+            set_1(nmbs, res_next_object_id, next_object_id_idx);
+            set_1(nmbs, res_number_of_objects, number_of_objects_idx);
+
+            set_msg_header_size(nmbs, msg_size);
+
+            return send_msg(nmbs);
+        }
+    }
+    else {
+        return recv_read_device_identification_res(nmbs, 0, NULL, 0, NULL, NULL, NULL, NULL);
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+static nmbs_error handle_req_fc(nmbs_t* nmbs) {
+    NMBS_DEBUG_PRINT("fc %d\t", nmbs->msg.fc);
+
+#ifdef NMBS_LOW_STACK
+    if (!nmbs->scratch)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+#endif
+
+    nmbs_error err = NMBS_ERROR_NONE;
+    switch (nmbs->msg.fc) {
+#ifndef NMBS_SERVER_READ_COILS_DISABLED
+        case 1:
+            err = handle_read_coils(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED
+        case 2:
+            err = handle_read_discrete_inputs(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED
+        case 3:
+            err = handle_read_holding_registers(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED
+        case 4:
+            err = handle_read_input_registers(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED
+        case 5:
+            err = handle_write_single_coil(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED
+        case 6:
+            err = handle_write_single_register(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED
+        case 15:
+            err = handle_write_multiple_coils(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED
+        case 16:
+            err = handle_write_multiple_registers(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_FILE_RECORD_DISABLED
+        case 20:
+            err = handle_read_file_record(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_WRITE_FILE_RECORD_DISABLED
+        case 21:
+            err = handle_write_file_record(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED
+        case 23:
+            err = handle_read_write_registers(nmbs);
+            break;
+#endif
+
+#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
+        case 43:
+            err = handle_read_device_identification(nmbs);
+            break;
+#endif
+        default:
+            flush(nmbs);
+            if (!nmbs->msg.ignored)
+                err = send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+    }
+
+    return err;
+}
+
+
+void nmbs_callbacks_create(nmbs_callbacks* callbacks) {
+    memset(callbacks, 0, sizeof(nmbs_callbacks));
+    callbacks->initialized = 0xFFFFDEBE;
+}
+
+
+nmbs_error nmbs_server_create(nmbs_t* nmbs, uint8_t address_rtu, const nmbs_platform_conf* platform_conf,
+                              const nmbs_callbacks* callbacks) {
+    if (platform_conf->transport == NMBS_TRANSPORT_RTU && address_rtu == 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if (!callbacks || callbacks->initialized != 0xFFFFDEBE)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    nmbs_error ret = nmbs_create(nmbs, platform_conf);
+    if (ret != NMBS_ERROR_NONE)
+        return ret;
+
+    nmbs->address_rtu = address_rtu;
+    nmbs_bitfield_set(nmbs->addresses_rtu, address_rtu);
+    nmbs->callbacks = *callbacks;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error nmbs_server_set_rtu_addresses(nmbs_t* nmbs, const nmbs_bitfield_256 addresses) {
+    if (!addresses || nmbs_bitfield_read(addresses, NMBS_BROADCAST_ADDRESS))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    uint8_t any = 0;
+    for (uint8_t i = 0; i < sizeof(nmbs_bitfield_256); i++)
+        any |= addresses[i];
+
+    if (!any)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    memcpy(nmbs->addresses_rtu, addresses, sizeof(nmbs_bitfield_256));
+
+    return NMBS_ERROR_NONE;
+}
+
+
+#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
+nmbs_error nmbs_device_id_create(nmbs_device_id* dev, const nmbs_device_id_object* objects, uint16_t objects_count,
+                                 uint8_t* buf, uint16_t buf_size) {
+    if (!dev || !objects || !buf || objects_count > NMBS_DEVICE_ID_OBJECTS_MAX)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    nmbs_bitfield_256 map;
+    nmbs_bitfield_reset(map);
+
+    for (uint16_t i = 0; i < objects_count; i++) {
+        const nmbs_device_id_object* o = &objects[i];
+        if ((o->id > 0x06 && o->id < 0x80) || !o->value || strlen(o->value) > 244 || nmbs_bitfield_read(map, o->id))
+            return NMBS_ERROR_INVALID_ARGUMENT;
+
+        nmbs_bitfield_set(map, o->id);
+    }
+
+    for (uint8_t id = 0; id <= 0x02; id++) {
+        if (!nmbs_bitfield_read(map, id))
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Records as they are sent, object ID, length and value, sorted by object ID
+    uint16_t offset = 0;
+    uint8_t count = 0;
+    for (uint16_t id = 0; id < 256; id++) {
+        if (!nmbs_bitfield_read(map, id))
+            continue;
+
+        const nmbs_device_id_object* o = objects;
+        while (o->id != id)
+            o++;
+
+        const uint8_t len = (uint8_t) strlen(o->value);
+        if (offset + 2 + len > buf_size)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+
+        buf[offset] = (uint8_t) id;
+        buf[offset + 1] = len;
+        memcpy(buf + offset + 2, o->value, len);
+
+        dev->ids[count] = (uint8_t) id;
+        dev->offsets[count] = offset;
+        offset += 2 + len;
+        count++;
+    }
+
+    dev->offsets[count] = offset;
+    dev->count = count;
+    dev->records = buf;
+
+    // Objects that fit in a response starting with each of them, 246 bytes at most
+    uint8_t end = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        while (end < count && dev->offsets[end + 1] - dev->offsets[i] <= 246)
+            end++;
+
+        dev->page_end[i] = end;
+    }
+
+    return NMBS_ERROR_NONE;
+}
+#endif
+
+
+// Consume the rest of an RTU frame addressed to another server with bulk reads, without checking its CRC
+static nmbs_error skip_rtu_frame(nmbs_t* nmbs, bool response) {
+    uint16_t len = nmbs_rtu_frame_length(nmbs->msg.buf, nmbs->msg.buf_idx, response);
+    while (len > nmbs->msg.buf_idx) {
+        if (len > sizeof(nmbs->msg.buf))
+            return response ? NMBS_ERROR_INVALID_RESPONSE : NMBS_ERROR_INVALID_REQUEST;
+
+        const uint16_t count = len - nmbs->msg.buf_idx;
+        const int32_t ret = NMBS_READ(nmbs, nmbs->msg.buf + nmbs->msg.buf_idx, count, nmbs->byte_timeout_ms);
+        stats_bytes_in(nmbs, ret);
+        if (ret < 0 || ret > count)
+            return NMBS_ERROR_TRANSPORT;
+
+        // The frame is shorter than predicted
+        if (ret < count)
+            return NMBS_ERROR_TIMEOUT;
+
+        nmbs->msg.buf_idx += count;
+        len = nmbs_rtu_frame_length(nmbs->msg.buf, nmbs->msg.buf_idx, response);
+    }
+
+    if (len == 0)
+        return response ? NMBS_ERROR_INVALID_RESPONSE : NMBS_ERROR_INVALID_REQUEST;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+// Skip a request addressed to another server and its response, if any
+static nmbs_error skip_rtu_exchange(nmbs_t* nmbs, bool* request_follows) {
+    nmbs_error err = skip_rtu_frame(nmbs, false);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint8_t unit_id = nmbs->msg.unit_id;
+
+    bool first_byte_received = false;
+    err = recv_msg_header(nmbs, &first_byte_received);
+    if (err != NMBS_ERROR_NONE) {
+        // The other server didn't respond
+        if (!first_byte_received && err == NMBS_ERROR_TIMEOUT)
+            return NMBS_ERROR_NONE;
+
+        return err;
+    }
+
+    if (nmbs->msg.unit_id != unit_id) {
+        check_req_unit_id(nmbs);
+        *request_follows = true;
+        return NMBS_ERROR_NONE;
+    }
+
+    return skip_rtu_frame(nmbs, true);
+}
+
+
+static nmbs_error server_poll(nmbs_t* nmbs) {
+    msg_state_reset(nmbs);
+
+    bool first_byte_received = false;
+    nmbs_error err = recv_req_header(nmbs, &first_byte_received);
+    if (first_byte_received)
+        stats_start(nmbs);
+
+    if (err != NMBS_ERROR_NONE) {
+        if (!first_byte_received && err == NMBS_ERROR_TIMEOUT)
+            return NMBS_ERROR_NONE;
+
+        return err;
+    }
+
+#ifdef NMBS_DEBUG
+    printf("%d ", nmbs->address_rtu);
+    printf("NMBS req <- ");
+    if (NMBS_IS_RTU(nmbs)) {
+        if (nmbs->msg.broadcast)
+            printf("broadcast\t");
+        else
+            printf("address_rtu %d\t", nmbs->msg.unit_id);
+    }
+#endif
+
+    // A whole frame addressed to another server can be discarded without parsing it, the response to it will be
+    // received as a separate frame
+    if (nmbs->msg.ignored && nmbs->msg.framed) {
+        stats_ignored(nmbs);
+        return NMBS_ERROR_NONE;
+    }
+
+    // Otherwise the frame and the response to it are consumed by their predicted length. A request received in place
+    // of the response is handled as usual
+    while (nmbs->msg.ignored && nmbs_rtu_frame_length(nmbs->msg.buf, nmbs->msg.buf_idx, false) != 0) {
+        bool request_follows = false;
+        err = skip_rtu_exchange(nmbs, &request_follows);
+        if (err != NMBS_ERROR_NONE) {
+            if (err != NMBS_ERROR_TIMEOUT)
+                flush(nmbs);
+
+            return err;
+        }
+
+        stats_ignored(nmbs);
+        if (!request_follows)
+            return NMBS_ERROR_NONE;
+
+        stats_start(nmbs);
+    }
+
+    err = handle_req_fc(nmbs);
+    if (err != NMBS_ERROR_NONE) {
+        if (err != NMBS_ERROR_TIMEOUT)
+            flush(nmbs);
+
+        return err;
+    }
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error nmbs_server_poll(nmbs_t* nmbs) {
+    return stats_done(nmbs, server_poll(nmbs));
+}
+
+
+static nmbs_error handle_req_frame(nmbs_t* nmbs, uint16_t length) {
+    stats_start(nmbs);
+    nmbs->msg.external = true;
+
+    nmbs_error err = get_frame_header(nmbs, length);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    check_req_unit_id(nmbs);
+    if (nmbs->msg.ignored) {
+        stats_ignored(nmbs);
+        return NMBS_ERROR_NONE;
+    }
+
+    return stats_done(nmbs, handle_req_fc(nmbs));
+}
+
+
+nmbs_error nmbs_server_process_frame(nmbs_t* nmbs, const uint8_t* frame, uint16_t length) {
+    if (!frame || length > sizeof(nmbs->msg.buf))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    msg_state_reset(nmbs);
+    memcpy(nmbs->msg.buf, frame, length);
+    stats_bytes_in(nmbs, length);
+
+    return handle_req_frame(nmbs, length);
+}
+
+
+// Whether the frame buffered by nmbs_server_feed() is predicted to be the response of another server
+static bool feed_response(const nmbs_t* nmbs) {
+    if (nmbs->msg.feed_res_unit == 0)
+        return false;
+
+    return nmbs->msg.feed_idx == 0 || nmbs->msg.buf[0] == nmbs->msg.feed_res_unit;
+}
+
+
+// Length of the frame buffered by nmbs_server_feed(), or the number of bytes needed to infer it
+static nmbs_error feed_frame_len(const nmbs_t* nmbs, uint16_t remaining, uint16_t* len_out) {
+    const uint16_t buffered = nmbs->msg.feed_idx;
+    uint16_t len = 6;
+
+    if (NMBS_IS_RTU(nmbs)) {
+        const bool response = feed_response(nmbs);
+        len = nmbs_rtu_frame_length(nmbs->msg.buf, buffered, response);
+
+        // Unknown function code, assume the frame ends with the received data
+        if (len == 0) {
+            len = buffered + remaining;
+            if (len < 4)
+                len = 4;
+            else if (len > sizeof(nmbs->msg.buf))
+                len = sizeof(nmbs->msg.buf);
+        }
+
+        if (len > sizeof(nmbs->msg.buf))
+            return response ? NMBS_ERROR_INVALID_RESPONSE : NMBS_ERROR_INVALID_REQUEST;
+    }
+    else if (buffered >= 6) {
+        const uint16_t mbap_length = (uint16_t) (nmbs->msg.buf[4] << 8) | (uint16_t) nmbs->msg.buf[5];
+        if (mbap_length < 2 || mbap_length > sizeof(nmbs->msg.buf) - 6)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
+
+        len = 6 + mbap_length;
+    }
+
+    *len_out = len;
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_feed_status nmbs_server_feed(nmbs_t* nmbs, const uint8_t* data, uint16_t length, uint16_t* consumed_out,
+                                  nmbs_error* error_out) {
+    nmbs_feed_status status = NMBS_FEED_NEED_MORE;
+    nmbs_error err = NMBS_ERROR_NONE;
+    uint16_t consumed = 0;
+
+    if (!data && length > 0) {
+        err = NMBS_ERROR_INVALID_ARGUMENT;
+        status = NMBS_FEED_ERROR;
+    }
+
+    while (status == NMBS_FEED_NEED_MORE) {
+        uint16_t frame_len = 0;
+        err = feed_frame_len(nmbs, length - consumed, &frame_len);
+        if (err != NMBS_ERROR_NONE) {
+            status = NMBS_FEED_ERROR;
+            break;
+        }
+
+        if (nmbs->msg.feed_idx < frame_len) {
+            if (consumed == length)
+                break;
+
+            uint16_t n = frame_len - nmbs->msg.feed_idx;
+            if (n > length - consumed)
+                n = length - consumed;
+
+            memcpy(nmbs->msg.buf + nmbs->msg.feed_idx, data + consumed, n);
+            nmbs->msg.feed_idx += n;
+            consumed += n;
+            continue;
+        }
+
+        // More bytes than the frame were buffered for a mispredicted response. Those received by this call are left to
+        // the next frame, earlier ones are lost
+        if (nmbs->msg.feed_idx > frame_len) {
+            uint16_t extra = nmbs->msg.feed_idx - frame_len;
+            if (extra > consumed)
+                extra = consumed;
+
+            consumed -= extra;
+        }
+
+        // A whole frame is buffered. Responses of other servers are not parsed
+        if (feed_response(nmbs)) {
+            const bool valid = nmbs_crc_update(NMBS_CRC_INIT, nmbs->msg.buf, frame_len) == 0;
+            nmbs->msg.feed_res_unit = 0;
+            if (valid)
+                nmbs->msg.feed_idx = 0;
+
+            // Otherwise the other server didn't respond, the frame is a request
+            continue;
+        }
+
+        nmbs->msg.feed_idx = 0;
+        msg_state_reset(nmbs);
+        err = handle_req_frame(nmbs, frame_len);
+        if (err != NMBS_ERROR_NONE) {
+            status = NMBS_FEED_ERROR;
+            break;
+        }
+
+        if (nmbs->msg.ignored && !nmbs->msg.broadcast)
+            nmbs->msg.feed_res_unit = nmbs->msg.unit_id;
+        else if (!nmbs->msg.ignored && !nmbs->msg.broadcast)
+            status = NMBS_FEED_RESPONSE_READY;
+    }
+
+    if (status == NMBS_FEED_ERROR) {
+        nmbs_server_feed_reset(nmbs);
+        nmbs->msg.feed_res_unit = 0;
+    }
+
+    stats_bytes_in(nmbs, consumed);
+
+    if (consumed_out)
+        *consumed_out = consumed;
+
+    if (error_out)
+        *error_out = err;
+
+    return status;
+}
+
+
+void nmbs_server_feed_reset(nmbs_t* nmbs) {
+    nmbs->msg.feed_idx = 0;
+}
+
+
+void nmbs_set_callbacks_arg(nmbs_t* nmbs, void* arg) {
+    nmbs->callbacks.arg = arg;
+}
+
+
+#ifdef NMBS_LOW_STACK
+void nmbs_set_scratch(nmbs_t* nmbs, nmbs_scratch* scratch) {
+    nmbs->scratch = scratch;
+}
+#endif
+#endif
+
+
+#ifndef NMBS_CLIENT_DISABLED
+nmbs_error nmbs_client_create(nmbs_t* nmbs, const nmbs_platform_conf* platform_conf) {
+    return nmbs_create(nmbs, platform_conf);
+}
+
+
+#ifdef NMBS_UNIT_TRACKING
+nmbs_error nmbs_set_unit_tracking(nmbs_t* nmbs, nmbs_unit_health* units, uint16_t units_count, int32_t min_timeout_ms) {
+    if (!nmbs || (!units && units_count > 0) || !nmbs->platform.time_ms)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if (units)
+        memset(units, 0, units_count * sizeof(nmbs_unit_health));
+
+    nmbs->units = units;
+    nmbs->units_count = units_count;
+    nmbs->units_min_timeout_ms = min_timeout_ms;
+    nmbs->unit = NULL;
+
+    if (nmbs->units_backoff_max_ms == 0)
+        nmbs_set_unit_backoff(nmbs, 3, 1000, 60000);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+void nmbs_set_unit_backoff(nmbs_t* nmbs, uint16_t dead_after, uint32_t min_interval_ms, uint32_t max_interval_ms) {
+    nmbs->units_dead_after = dead_after;
+    nmbs->units_backoff_min_ms = min_interval_ms;
+    nmbs->units_backoff_max_ms = max_interval_ms > min_interval_ms ? max_interval_ms : min_interval_ms;
+}
+
+
+int32_t nmbs_unit_timeout(const nmbs_t* nmbs, uint8_t unit_id) {
+    if (!nmbs->units || unit_id >= nmbs->units_count)
+        return nmbs->read_timeout_ms;
+
+    return unit_timeout(nmbs, &nmbs->units[unit_id]);
+}
+#endif
+
+
+static nmbs_error send_read_discrete_req(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity) {
+    if (quantity < 1 || quantity > NMBS_BITFIELD_MAX)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    msg_state_req(nmbs, fc);
+    put_req_header(nmbs, 4);
+
+    put_2(nmbs, address);
+    put_2(nmbs, quantity);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+
+    return send_msg(nmbs);
+}
+
+
+static nmbs_error read_discrete(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity, nmbs_bitfield values) {
+    const nmbs_error err = send_read_discrete_req(nmbs, fc, address, quantity);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return stats_done(nmbs, recv_read_discrete_res(nmbs, values));
+}
+
+
+nmbs_error nmbs_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out) {
+    return read_discrete(nmbs, 1, address, quantity, coils_out);
+}
+
+
+nmbs_error nmbs_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield inputs_out) {
+    return read_discrete(nmbs, 2, address, quantity, inputs_out);
+}
+
+static nmbs_error send_read_registers_req(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity) {
+    if (quantity < 1 || quantity > 125)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    msg_state_req(nmbs, fc);
+    put_req_header(nmbs, 4);
+
+    put_2(nmbs, address);
+    put_2(nmbs, quantity);
+
+    NMBS_DEBUG_PRINT("a %d\tq %d ", address, quantity);
+
+    return send_msg(nmbs);
+}
+
+
+static nmbs_error read_registers(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity, uint16_t* registers) {
+    const nmbs_error err = send_read_registers_req(nmbs, fc, address, quantity);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return stats_done(nmbs, recv_read_registers_res(nmbs, quantity, registers));
+}
+
+
+nmbs_error nmbs_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out) {
+    return read_registers(nmbs, 3, address, quantity, registers_out);
+}
+
+
+nmbs_error nmbs_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out) {
+    return read_registers(nmbs, 4, address, quantity, registers_out);
+}
+
+
+// Byte j of a value, from the most significant one, is byte j ^ swap of the value in the registers
+static void be_to_values(void* values_out, const uint8_t* registers_be, uint16_t count, uint8_t size,
+                         nmbs_word_order order) {
+    const uint8_t swap = (uint8_t) ((word_order_swaps_words(order) ? size - 2 : 0) |
+                                    (word_order_swaps_bytes(order) ? 1 : 0));
+    uint8_t* out = values_out;
+
+    if (size == 4) {
+        for (uint16_t i = 0; i < count; i++) {
+            const uint8_t* b = registers_be + 4 * i;
+            const uint32_t v = (uint32_t) b[swap] << 24 | (uint32_t) b[1 ^ swap] << 16 | (uint32_t) b[2 ^ swap] << 8 |
+                               (uint32_t) b[3 ^ swap];
+            memcpy(out + 4 * i, &v, 4);
+        }
+    }
+    else {
+        for (uint16_t i = 0; i < count; i++) {
+            const uint8_t* b = registers_be + 8 * i;
+            uint64_t v = 0;
+            for (uint8_t j = 0; j < 8; j++)
+                v = v << 8 | b[j ^ swap];
+
+            memcpy(out + 8 * i, &v, 8);
+        }
+    }
+}
+
+
+static nmbs_error read_registers_typed(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t count,
+                                       nmbs_value_type type, nmbs_word_order order, void* values_out) {
+    if (type > NMBS_VALUE_F64 || order > NMBS_WORD_ORDER_DCBA || !values_out)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    const uint8_t size = type >= NMBS_VALUE_U64 ? 8 : 4;
+    if (count > 125 / (size / 2))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    const uint16_t quantity = count * (size / 2);
+    nmbs_error err = send_read_registers_req(nmbs, fc, address, quantity);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    const uint8_t* registers_be;
+    err = recv_read_registers_res_be(nmbs, quantity, &registers_be);
+    if (err == NMBS_ERROR_NONE)
+        be_to_values(values_out, registers_be, count, size, order);
+
+    return stats_done(nmbs, err);
+}
+
+
+nmbs_error nmbs_read_holding_registers_typed(nmbs_t* nmbs, uint16_t address, uint16_t count, nmbs_value_type type,
+                                             nmbs_word_order order, void* values_out) {
+    return read_registers_typed(nmbs, 3, address, count, type, order, values_out);
+}
+
+
+nmbs_error nmbs_read_input_registers_typed(nmbs_t* nmbs, uint16_t address, uint16_t count, nmbs_value_type type,
+                                           nmbs_word_order order, void* values_out) {
+    return read_registers_typed(nmbs, 4, address, count, type, order, values_out);
+}
+
+
+static nmbs_error send_write_single_coil_req(nmbs_t* nmbs, uint16_t address, uint16_t value_req) {
+    msg_state_req(nmbs, 5);
+    put_req_header(nmbs, 4);
+
+    put_2(nmbs, address);
+    put_2(nmbs, value_req);
+
+    NMBS_DEBUG_PRINT("a %d\tvalue %d ", address, value_req);
+
+    return send_msg(nmbs);
+}
+
+
+nmbs_error nmbs_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value) {
+    const uint16_t value_req = value ? 0xFF00 : 0;
+
+    const nmbs_error err = send_write_single_coil_req(nmbs, address, value_req);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (!nmbs->msg.broadcast)
+        return stats_done(nmbs, recv_write_single_coil_res(nmbs, address, value_req));
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+static nmbs_error send_write_single_register_req(nmbs_t* nmbs, uint16_t address, uint16_t value) {
+    msg_state_req(nmbs, 6);
+    put_req_header(nmbs, 4);
+
+    put_2(nmbs, address);
+    put_2(nmbs, value);
+
+    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
+
+    return send_msg(nmbs);
+}
+
+
+nmbs_error nmbs_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value) {
+    const nmbs_error err = send_write_single_register_req(nmbs, address, value);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (!nmbs->msg.broadcast)
+        return stats_done(nmbs, recv_write_single_register_res(nmbs, address, value));
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+static nmbs_error send_write_multiple_coils_req(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                const nmbs_bitfield coils) {
+    if (quantity < 1 || quantity > 0x07B0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    uint8_t coils_bytes = (quantity + 7) / 8;
+
+    msg_state_req(nmbs, 15);
+    put_req_header(nmbs, 5 + coils_bytes);
+
+    put_2(nmbs, address);
+    put_2(nmbs, quantity);
+    put_1(nmbs, coils_bytes);
+    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\t", address, quantity, coils_bytes);
+
+    NMBS_DEBUG_PRINT("coils ");
+    for (int i = 0; i < coils_bytes; i++) {
+        NMBS_DEBUG_PRINT("%d ", coils[i]);
+    }
+
+    // The bitfield layout is the same as on the wire
+    return send_msg_gather(nmbs, coils, coils_bytes);
+}
+
+
+nmbs_error nmbs_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, const nmbs_bitfield coils) {
+    const nmbs_error err = send_write_multiple_coils_req(nmbs, address, quantity, coils);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (!nmbs->msg.broadcast)
+        return stats_done(nmbs, recv_write_multiple_coils_res(nmbs, address, quantity));
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+static nmbs_error send_write_multiple_registers_req(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                    const uint16_t* registers) {
+    if (quantity < 1 || quantity > 0x007B)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    const uint8_t registers_bytes = quantity * 2;
+
+    msg_state_req(nmbs, 16);
+    put_req_header(nmbs, 5 + registers_bytes);
+
+    put_2(nmbs, address);
+    put_2(nmbs, quantity);
+    put_1(nmbs, registers_bytes);
+    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\t", address, quantity, registers_bytes);
+
+    NMBS_DEBUG_PRINT("regs ");
+    for (int i = 0; i < quantity; i++) {
+        put_2(nmbs, registers[i]);
+        NMBS_DEBUG_PRINT("%d ", registers[i]);
+    }
+
+    return send_msg(nmbs);
+}
+
+
+nmbs_error nmbs_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, const uint16_t* registers) {
+    const nmbs_error err = send_write_multiple_registers_req(nmbs, address, quantity, registers);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (!nmbs->msg.broadcast)
+        return stats_done(nmbs, recv_write_multiple_registers_res(nmbs, address, quantity));
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+nmbs_error nmbs_read_file_record(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number, uint16_t* registers,
+                                 uint16_t count) {
+    if (file_number == 0x0000)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if (record_number > 0x270F)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    // In expected response: max PDU length = 253, assuming a single file request, (253 - 1 - 1 - 1 - 1) / 2 = 124
+    if (count > 124)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    msg_state_req(nmbs, 20);
+    put_req_header(nmbs, 8);
+
+    put_1(nmbs, 7);    // add Byte Count
+    put_1(nmbs, 6);    // add Reference Type const
+    put_2(nmbs, file_number);
+    put_2(nmbs, record_number);
+    put_2(nmbs, count);
+    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fread ", file_number, record_number, count);
+
+    const nmbs_error err = send_msg(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return stats_done(nmbs, recv_read_file_record_res(nmbs, registers, count));
+}
+
+
+nmbs_error nmbs_write_file_record(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number, const uint16_t* registers,
+                                  uint16_t count) {
+    if (file_number == 0x0000)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if (record_number > 0x270F)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if (count > 122)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    const uint16_t data_size = count * 2;
+
+    msg_state_req(nmbs, 21);
+    put_req_header(nmbs, 8 + data_size);
+
+    put_1(nmbs, 7 + data_size);    // add Byte Count
+    put_1(nmbs, 6);                // add Reference Type const
+    put_2(nmbs, file_number);
+    put_2(nmbs, record_number);
+    put_2(nmbs, count);
+    put_regs(nmbs, registers, count);
+    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", file_number, record_number, count);
+
+    const nmbs_error err = send_msg(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (!nmbs->msg.broadcast)
+        return stats_done(nmbs, recv_write_file_record_res(nmbs, file_number, record_number, registers, count));
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+nmbs_error nmbs_read_write_registers(nmbs_t* nmbs, uint16_t read_address, uint16_t read_quantity,
+                                     uint16_t* registers_out, uint16_t write_address, uint16_t write_quantity,
+                                     const uint16_t* registers) {
+    if (read_quantity < 1 || read_quantity > 0x007D)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if ((uint32_t) read_address + (uint32_t) read_quantity > ((uint32_t) 0xFFFF) + 1)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if (write_quantity < 1 || write_quantity > 0x0079)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    if ((uint32_t) write_address + (uint32_t) write_quantity > ((uint32_t) 0xFFFF) + 1)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    const uint8_t registers_bytes = write_quantity * 2;
+
+    msg_state_req(nmbs, 23);
+    put_req_header(nmbs, 9 + registers_bytes);
+
+    put_2(nmbs, read_address);
+    put_2(nmbs, read_quantity);
+    put_2(nmbs, write_address);
+    put_2(nmbs, write_quantity);
+    put_1(nmbs, registers_bytes);
+
+    NMBS_DEBUG_PRINT("read a %d\tq %d ", read_address, read_quantity);
+    NMBS_DEBUG_PRINT("write a %d\tq %d\tb %d\t", write_address, write_quantity, registers_bytes);
+
+    NMBS_DEBUG_PRINT("regs ");
+    for (int i = 0; i < write_quantity; i++) {
+        put_2(nmbs, registers[i]);
+        NMBS_DEBUG_PRINT("%d ", registers[i]);
+    }
+
+    const nmbs_error err = send_msg(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return stats_done(nmbs, recv_read_registers_res(nmbs, read_quantity, registers_out));
+}
+
+
+nmbs_error nmbs_read_device_identification_basic(nmbs_t* nmbs, char* vendor_name, char* product_code,
+                                                 char* major_minor_revision, uint8_t buffers_length) {
+    const uint8_t order[3] = {0, 1, 2};
+    char* buffers[3] = {vendor_name, product_code, major_minor_revision};
+    uint8_t total_received = 0;
+    uint8_t next_object_id = 0x00;
+
+    while (next_object_id != 0x7F) {
+        msg_state_req(nmbs, 43);
+        put_msg_header(nmbs, 3);
+        put_1(nmbs, 0x0E);
+        put_1(nmbs, 1);
+        put_1(nmbs, next_object_id);
+
+        nmbs_error err = send_msg(nmbs);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        uint8_t objects_received = 0;
+        err = recv_read_device_identification_res(nmbs, 3, buffers, buffers_length, order, NULL, &next_object_id,
+                                                  &objects_received);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        total_received += objects_received;
+        if (total_received > 3)
+            return stats_done(nmbs, NMBS_ERROR_INVALID_RESPONSE);
+
+        if (objects_received == 0)
+            return stats_done(nmbs, NMBS_ERROR_INVALID_RESPONSE);
+    }
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+nmbs_error nmbs_read_device_identification_regular(nmbs_t* nmbs, char* vendor_url, char* product_name, char* model_name,
+                                                   char* user_application_name, uint8_t buffers_length) {
+    const uint8_t order[7] = {0, 0, 0, 0, 1, 2, 3};
+    char* buffers[4] = {vendor_url, product_name, model_name, user_application_name};
+    uint8_t total_received = 0;
+    uint8_t next_object_id = 0x03;
+
+    while (next_object_id != 0x7F) {
+        msg_state_req(nmbs, 43);
+        put_req_header(nmbs, 3);
+        put_1(nmbs, 0x0E);
+        put_1(nmbs, 2);
+        put_1(nmbs, next_object_id);
+
+        nmbs_error err = send_msg(nmbs);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        uint8_t objects_received = 0;
+        err = recv_read_device_identification_res(nmbs, 4, buffers, buffers_length, order, NULL, &next_object_id,
+                                                  &objects_received);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        total_received += objects_received;
+        if (total_received > 4)
+            return stats_done(nmbs, NMBS_ERROR_INVALID_RESPONSE);
+
+        if (objects_received == 0)
+            return stats_done(nmbs, NMBS_ERROR_INVALID_RESPONSE);
+    }
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+nmbs_error nmbs_read_device_identification_extended(nmbs_t* nmbs, uint8_t object_id_start, uint8_t* ids, char** buffers,
+                                                    uint8_t ids_length, uint8_t buffer_length,
+                                                    uint8_t* objects_count_out) {
+    if (object_id_start < 0x80)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    uint8_t total_received = 0;
+    uint8_t next_object_id = object_id_start;
+
+    while (next_object_id != 0x7F) {
+        msg_state_req(nmbs, 43);
+        put_req_header(nmbs, 3);
+        put_1(nmbs, 0x0E);
+        put_1(nmbs, 3);
+        put_1(nmbs, next_object_id);
+
+        nmbs_error err = send_msg(nmbs);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        uint8_t objects_received = 0;
+        err = recv_read_device_identification_res(nmbs, ids_length - total_received, &buffers[total_received],
+                                                  buffer_length, NULL, &ids[total_received], &next_object_id,
+                                                  &objects_received);
+        if (err != NMBS_ERROR_NONE)
+            return stats_done(nmbs, err);
+
+        total_received += objects_received;
+    }
+
+    *objects_count_out = total_received;
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+nmbs_error nmbs_read_device_identification(nmbs_t* nmbs, uint8_t object_id, char* buffer, uint8_t buffer_length) {
+    if (object_id > 0x06 && object_id < 0x80)
+        return stats_done(nmbs, NMBS_ERROR_INVALID_ARGUMENT);
+
+    msg_state_req(nmbs, 43);
+    put_req_header(nmbs, 3);
+    put_1(nmbs, 0x0E);
+    put_1(nmbs, 4);
+    put_1(nmbs, object_id);
+
+    const nmbs_error err = send_msg(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    char* buf[1] = {buffer};
+    return stats_done(nmbs, recv_read_device_identification_res(nmbs, 1, buf, buffer_length, NULL, NULL, NULL, NULL));
+}
+
+
+nmbs_error nmbs_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len) {
+    msg_state_req(nmbs, fc);
+    put_msg_header(nmbs, data_len);
+
+    NMBS_DEBUG_PRINT("raw ");
+    for (uint16_t i = 0; i < data_len; i++) {
+        NMBS_DEBUG_PRINT("%d ", data[i]);
+    }
+
+    // The transaction ends with nmbs_receive_raw_pdu_response()
+    const nmbs_error err = send_msg_gather(nmbs, data, data_len);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error nmbs_receive_raw_pdu_response(nmbs_t* nmbs, uint8_t* data_out, uint8_t data_out_len) {
+    nmbs_error err = recv_res_header(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    err = recv(nmbs, data_out_len);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    if (data_out) {
+        for (uint16_t i = 0; i < data_out_len; i++)
+            data_out[i] = get_1(nmbs);
+    }
+    else {
+        for (uint16_t i = 0; i < data_out_len; i++)
+            get_1(nmbs);
+    }
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
+
+    return stats_done(nmbs, NMBS_ERROR_NONE);
+}
+
+
+static bool read_tag_before(const nmbs_read_tag* a, const nmbs_read_tag* b) {
+    if (a->unit_id != b->unit_id)
+        return a->unit_id < b->unit_id;
+
+    if (a->table != b->table)
+        return a->table < b->table;
+
+    return a->address < b->address;
+}
+
+
+nmbs_error nmbs_read_plan_create(nmbs_read_plan* plan, nmbs_read_tag* tags, uint16_t tags_count,
+                                 nmbs_read_block* blocks, uint16_t blocks_max, uint16_t registers_gap,
+                                 uint16_t coils_gap) {
+    if (!plan || (!tags && tags_count > 0) || (!blocks && blocks_max > 0))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    memset(plan, 0, sizeof(nmbs_read_plan));
+
+    for (uint16_t i = 0; i < tags_count; i++) {
+        const nmbs_read_tag* tag = &tags[i];
+        uint16_t quantity_max = 0;
+        if (tag->table == NMBS_TABLE_COILS || tag->table == NMBS_TABLE_DISCRETE_INPUTS)
+            quantity_max = NMBS_BITFIELD_MAX;
+        else if (tag->table == NMBS_TABLE_HOLDING_REGISTERS || tag->table == NMBS_TABLE_INPUT_REGISTERS)
+            quantity_max = 125;
+
+        if (tag->quantity < 1 || tag->quantity > quantity_max)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+
+        if ((uint32_t) tag->address + (uint32_t) tag->quantity > ((uint32_t) 0xFFFF) + 1)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Insertion sort, tag lists are short and often already sorted
+    for (uint16_t i = 1; i < tags_count; i++) {
+        const nmbs_read_tag tag = tags[i];
+        uint16_t j = i;
+        while (j > 0 && read_tag_before(&tag, &tags[j - 1])) {
+            tags[j] = tags[j - 1];
+            j--;
+        }
+
+        tags[j] = tag;
+    }
+
+    nmbs_read_block* block = NULL;
+    uint16_t blocks_count = 0;
+
+    for (uint16_t i = 0; i < tags_count; i++) {
+        const nmbs_read_tag* tag = &tags[i];
+        const uint32_t tag_end = (uint32_t) tag->address + (uint32_t) tag->quantity;
+
+        if (block && block->unit_id == tag->unit_id && block->fc == (uint8_t) tag->table) {
+            const bool registers =
+                    tag->table == NMBS_TABLE_HOLDING_REGISTERS || tag->table == NMBS_TABLE_INPUT_REGISTERS;
+            const uint32_t quantity_max = registers ? 125 : NMBS_BITFIELD_MAX;
+            const uint32_t gap = registers ? registers_gap : coils_gap;
+            const uint32_t block_end = (uint32_t) block->address + (uint32_t) block->quantity;
+            const uint32_t end = tag_end > block_end ? tag_end : block_end;
+
+            if (tag->address <= block_end + gap && end - block->address <= quantity_max) {
+                block->quantity = (uint16_t) (end - block->address);
+                block->tags_count++;
+                continue;
+            }
+        }
+
+        if (blocks_count == blocks_max)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+
+        block = &blocks[blocks_count++];
+        block->unit_id = tag->unit_id;
+        block->fc = (uint8_t) tag->table;
+        block->address = tag->address;
+        block->quantity = tag->quantity;
+        block->first_tag = i;
+        block->tags_count = 1;
+    }
+
+    plan->tags = tags;
+    plan->tags_count = tags_count;
+    plan->blocks = blocks;
+    plan->blocks_count = blocks_count;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+uint16_t nmbs_read_plan_requests(const nmbs_read_plan* plan) {
+    return plan->blocks_count;
+}
+
+
+nmbs_error nmbs_read_plan_set_write(nmbs_read_plan* plan, uint8_t unit_id, uint16_t address, uint16_t quantity,
+                                    const uint16_t* registers) {
+    if (!registers || quantity < 1 || quantity > 0x0079)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    plan->write_registers = registers;
+    plan->write_address = address;
+    plan->write_quantity = quantity;
+    plan->write_unit_id = unit_id;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+// Copy the values read by a read plan request to its tags
+static void read_plan_scatter(const nmbs_read_plan* plan, const nmbs_read_block* block, const uint16_t* registers,
+                              const nmbs_bitfield coils, nmbs_error err) {
+    for (uint16_t i = block->first_tag; i < block->first_tag + block->tags_count; i++) {
+        nmbs_read_tag* tag = &plan->tags[i];
+        tag->err = err;
+        if (err != NMBS_ERROR_NONE || !tag->data_out)
+            continue;
+
+        const uint16_t offset = tag->address - block->address;
+        if (block->fc == NMBS_TABLE_HOLDING_REGISTERS || block->fc == NMBS_TABLE_INPUT_REGISTERS) {
+            memcpy(tag->data_out, registers + offset, tag->quantity * sizeof(uint16_t));
+        }
+        else {
+            nmbs_bitfield_copy(tag->data_out, 0, coils, offset, tag->quantity);
+        }
+    }
+}
+
+
+static bool read_block_registers(const nmbs_read_block* block) {
+    return block->fc == NMBS_TABLE_HOLDING_REGISTERS || block->fc == NMBS_TABLE_INPUT_REGISTERS;
+}
+
+
+// Words of the subscription image holding the values of a request
+static uint16_t subscription_block_words(const nmbs_read_block* block) {
+    return read_block_registers(block) ? block->quantity : (uint16_t) ((block->quantity + 15) / 16);
+}
+
+
+static void subscription_report(const nmbs_subscription* sub, const nmbs_read_block* block, uint16_t offset,
+                                uint16_t quantity, const void* old_values, const void* new_values) {
+    nmbs_change change;
+    change.unit_id = block->unit_id;
+    change.table = (nmbs_table) block->fc;
+    change.address = (uint16_t) (block->address + offset);
+    change.quantity = quantity;
+    change.offset = offset;
+    change.old_values = old_values;
+    change.new_values = new_values;
+
+    sub->on_change(&change, sub->arg);
+}
+
+
+// Report the ranges of registers that differ, skipping the unchanged ones 4 at a time
+static void subscription_diff_registers(const nmbs_subscription* sub, const nmbs_read_block* block,
+                                        const uint16_t* old_values, const uint16_t* new_values) {
+    const uint16_t quantity = block->quantity;
+    uint16_t i = 0;
+    while (i < quantity) {
+        while (i + 4 <= quantity && memcmp(old_values + i, new_values + i, 4 * sizeof(uint16_t)) == 0)
+            i += 4;
+
+        while (i < quantity && old_values[i] == new_values[i])
+            i++;
+
+        if (i == quantity)
+            break;
+
+        const uint16_t first = i;
+        while (i < quantity && old_values[i] != new_values[i])
+            i++;
+
+        subscription_report(sub, block, first, i - first, old_values, new_values);
+    }
+}
+
+
+// Report the ranges of bits that differ, skipping the unchanged ones 32 at a time
+static void subscription_diff_bits(const nmbs_subscription* sub, const nmbs_read_block* block,
+                                   const uint8_t* old_values, const uint8_t* new_values) {
+    const uint16_t quantity = block->quantity;
+    uint16_t i = 0;
+    while (i < quantity) {
+        const uint16_t first = i + nmbs_bitfield_compare(old_values, i, new_values, i, quantity - i);
+        if (first == quantity)
+            break;
+
+        i = first + bitfield_scan(old_values, first, new_values, first, quantity - first, false);
+        subscription_report(sub, block, first, i - first, old_values, new_values);
+    }
+}
+
+
+// Compare the values read by a request to the previous ones, then store them in the subscription image
+static void subscription_update(const nmbs_subscription* sub, uint16_t b, uint16_t* image, const uint16_t* registers,
+                                const nmbs_bitfield coils) {
+    const nmbs_read_block* block = &sub->plan->blocks[b];
+    uint8_t* valid = (uint8_t*) sub->image;
+    const void* new_values = read_block_registers(block) ? (const void*) registers : (const void*) coils;
+    const uint16_t bytes = read_block_registers(block) ? block->quantity * 2 : (block->quantity + 7) / 8;
+
+    if (!nmbs_bitfield_read(valid, b)) {
+        subscription_report(sub, block, 0, block->quantity, NULL, new_values);
+        nmbs_bitfield_set(valid, b);
+    }
+    else if (read_block_registers(block)) {
+        subscription_diff_registers(sub, block, image, registers);
+    }
+    else {
+        subscription_diff_bits(sub, block, (const uint8_t*) image, coils);
+    }
+
+    memcpy(image, new_values, bytes);
+}
+
+
+// Send a single request of a read plan, and the pending write along with it if it's for its holding registers.
+// image points to the values of the request in the image of the subscription, if any
+static nmbs_error read_plan_block(nmbs_t* nmbs, nmbs_read_plan* plan, const nmbs_subscription* sub, uint16_t b,
+                                  uint16_t* image) {
+    union {
+        uint16_t registers[125];
+        nmbs_bitfield coils;
+    } data;
+
+    const nmbs_read_block* block = &plan->blocks[b];
+    nmbs_set_destination_rtu_address(nmbs, block->unit_id);
+
+    nmbs_error err = NMBS_ERROR_INVALID_ARGUMENT;
+    switch (block->fc) {
+        case NMBS_TABLE_COILS:
+            err = nmbs_read_coils(nmbs, block->address, block->quantity, data.coils);
+            break;
+
+        case NMBS_TABLE_DISCRETE_INPUTS:
+            err = nmbs_read_discrete_inputs(nmbs, block->address, block->quantity, data.coils);
+            break;
+
+        case NMBS_TABLE_HOLDING_REGISTERS:
+            if (plan->write_registers && block->unit_id == plan->write_unit_id) {
+                const uint16_t* write_registers = plan->write_registers;
+                plan->write_registers = NULL;
+                err = nmbs_read_write_registers(nmbs, block->address, block->quantity, data.registers,
+                                                plan->write_address, plan->write_quantity, write_registers);
+            }
+            else {
+                err = nmbs_read_holding_registers(nmbs, block->address, block->quantity, data.registers);
+            }
+            break;
+
+        case NMBS_TABLE_INPUT_REGISTERS:
+            err = nmbs_read_input_registers(nmbs, block->address, block->quantity, data.registers);
+            break;
+
+        default:
+            break;
+    }
+
+    read_plan_scatter(plan, block, data.registers, data.coils, err);
+    if (sub && err == NMBS_ERROR_NONE)
+        subscription_update(sub, b, image, data.registers, data.coils);
+
+    return err;
+}
+
+
+// Send the pending write of a read plan on its own, if none of its requests carried it
+static nmbs_error read_plan_write(nmbs_t* nmbs, nmbs_read_plan* plan) {
+    const uint16_t* write_registers = plan->write_registers;
+    if (!write_registers)
+        return NMBS_ERROR_NONE;
+
+    plan->write_registers = NULL;
+    nmbs_set_destination_rtu_address(nmbs, plan->write_unit_id);
+    return nmbs_write_multiple_registers(nmbs, plan->write_address, plan->write_quantity, write_registers);
+}
+
+
+static nmbs_error read_plan_run(nmbs_t* nmbs, nmbs_read_plan* plan, const nmbs_subscription* sub) {
+    const uint8_t dest_address_rtu = nmbs->dest_address_rtu;
+    nmbs_error ret = NMBS_ERROR_NONE;
+
+    uint16_t* image = sub ? sub->image + (plan->blocks_count + 15) / 16 : NULL;
+
+    for (uint16_t b = 0; b < plan->blocks_count; b++) {
+        const nmbs_error err = read_plan_block(nmbs, plan, sub, b, image);
+        if (err != NMBS_ERROR_NONE && ret == NMBS_ERROR_NONE)
+            ret = err;
+
+        if (sub)
+            image += subscription_block_words(&plan->blocks[b]);
+    }
+
+    const nmbs_error err = read_plan_write(nmbs, plan);
+    if (err != NMBS_ERROR_NONE && ret == NMBS_ERROR_NONE)
+        ret = err;
+
+    nmbs_set_destination_rtu_address(nmbs, dest_address_rtu);
+
+    return ret;
+}
+
+
+nmbs_error nmbs_read_plan_execute(nmbs_t* nmbs, nmbs_read_plan* plan) {
+    return read_plan_run(nmbs, plan, NULL);
+}
+
+
+// The image starts with a bitfield of the requests read at least once, followed by the values of each request
+uint32_t nmbs_subscription_image_size(const nmbs_read_plan* plan) {
+    uint32_t size = (plan->blocks_count + 15) / 16;
+    for (uint16_t b = 0; b < plan->blocks_count; b++)
+        size += subscription_block_words(&plan->blocks[b]);
+
+    return size;
+}
+
+
+nmbs_error nmbs_subscription_create(nmbs_subscription* sub, nmbs_read_plan* plan, uint16_t* image,
+                                    uint32_t image_size, void (*on_change)(const nmbs_change* change, void* arg),
+                                    void* arg) {
+    if (!sub || !plan || !on_change)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    if (!image || image_size < nmbs_subscription_image_size(plan))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    sub->plan = plan;
+    sub->image = image;
+    sub->on_change = on_change;
+    sub->arg = arg;
+    nmbs_subscription_reset(sub);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error nmbs_subscription_execute(nmbs_t* nmbs, nmbs_subscription* sub) {
+    return read_plan_run(nmbs, sub->plan, sub);
+}
+
+
+void nmbs_subscription_reset(nmbs_subscription* sub) {
+    memset(sub->image, 0, ((sub->plan->blocks_count + 15) / 16) * sizeof(uint16_t));
+}
+
+
+nmbs_error nmbs_async_init(nmbs_t* nmbs, nmbs_async_window* window, nmbs_async_req* reqs, uint16_t reqs_count) {
+    if (!window || !reqs || reqs_count == 0 || !nmbs->platform.time_ms)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    memset(window, 0, sizeof(nmbs_async_window));
+    memset(reqs, 0, reqs_count * sizeof(nmbs_async_req));
+    window->reqs = reqs;
+    window->reqs_count = reqs_count;
+    nmbs->async = window;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error async_req_get(nmbs_t* nmbs, nmbs_async_callback callback, nmbs_async_req** req_out) {
+    nmbs_async_window* window = nmbs->async;
+    if (!window || !callback)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    // RTU responses carry no transaction ID, they can only be matched to a single request in flight
+    if (NMBS_IS_RTU(nmbs) && window->in_flight > 0)
+        return NMBS_ERROR_WINDOW_FULL;
+
+    for (uint16_t i = 0; i < window->reqs_count; i++) {
+        if (!window->reqs[i].in_flight) {
+            *req_out = &window->reqs[i];
+            memset(*req_out, 0, sizeof(nmbs_async_req));
+            return NMBS_ERROR_NONE;
+        }
+    }
+
+    return NMBS_ERROR_WINDOW_FULL;
+}
+
+
+static void async_req_complete(nmbs_t* nmbs, nmbs_async_req* req, nmbs_error err) {
+    // Free the slot first, so the callback can send another request
+    req->in_flight = false;
+    nmbs->async->in_flight--;
+    stats_result(nmbs, err);
+    req->callback(nmbs, err, req->arg);
+}
+
+
+static nmbs_error async_req_submit(nmbs_t* nmbs, nmbs_async_req* req, uint8_t fc, nmbs_async_callback callback,
+                                   void* arg) {
+    req->callback = callback;
+    req->arg = arg;
+    req->tid = nmbs->msg.transaction_id;
+    req->unit_id = nmbs->msg.unit_id;
+    req->fc = fc;
+    req->expires = nmbs->read_timeout_ms >= 0;
+    if (req->expires)
+        req->deadline_ms = nmbs->platform.time_ms(nmbs->platform.arg) + (uint32_t) nmbs->read_timeout_ms;
+
+    stats_detach(nmbs);
+
+    req->in_flight = true;
+    nmbs->async->in_flight++;
+
+    // Broadcast requests get no response
+    if (nmbs->msg.broadcast)
+        async_req_complete(nmbs, req, NMBS_ERROR_NONE);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error async_read_discrete(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity,
+                                      nmbs_bitfield values, nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = send_read_discrete_req(nmbs, fc, address, quantity);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->data_out = values;
+    return async_req_submit(nmbs, req, fc, callback, arg);
+}
+
+
+nmbs_error nmbs_async_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out,
+                                 nmbs_async_callback callback, void* arg) {
+    return async_read_discrete(nmbs, 1, address, quantity, coils_out, callback, arg);
+}
+
+
+nmbs_error nmbs_async_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield inputs_out,
+                                           nmbs_async_callback callback, void* arg) {
+    return async_read_discrete(nmbs, 2, address, quantity, inputs_out, callback, arg);
+}
+
+
+static nmbs_error async_read_registers(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity,
+                                       uint16_t* registers, nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = send_read_registers_req(nmbs, fc, address, quantity);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->data_out = registers;
+    req->quantity = quantity;
+    return async_req_submit(nmbs, req, fc, callback, arg);
+}
+
+
+nmbs_error nmbs_async_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                             uint16_t* registers_out, nmbs_async_callback callback, void* arg) {
+    return async_read_registers(nmbs, 3, address, quantity, registers_out, callback, arg);
+}
+
+
+nmbs_error nmbs_async_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out,
+                                           nmbs_async_callback callback, void* arg) {
+    return async_read_registers(nmbs, 4, address, quantity, registers_out, callback, arg);
+}
+
+
+nmbs_error nmbs_async_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value, nmbs_async_callback callback,
+                                        void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    const uint16_t value_req = value ? 0xFF00 : 0;
+
+    err = send_write_single_coil_req(nmbs, address, value_req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->address = address;
+    req->value = value_req;
+    return async_req_submit(nmbs, req, 5, callback, arg);
+}
+
+
+nmbs_error nmbs_async_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value,
+                                            nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = send_write_single_register_req(nmbs, address, value);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->address = address;
+    req->value = value;
+    return async_req_submit(nmbs, req, 6, callback, arg);
+}
+
+
+nmbs_error nmbs_async_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                           const nmbs_bitfield coils, nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = send_write_multiple_coils_req(nmbs, address, quantity, coils);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->address = address;
+    req->quantity = quantity;
+    return async_req_submit(nmbs, req, 15, callback, arg);
+}
+
+
+nmbs_error nmbs_async_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                               const uint16_t* registers, nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = send_write_multiple_registers_req(nmbs, address, quantity, registers);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->address = address;
+    req->quantity = quantity;
+    return async_req_submit(nmbs, req, 16, callback, arg);
+}
+
+
+nmbs_error nmbs_async_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len, uint8_t* data_out,
+                                   uint8_t data_out_len, nmbs_async_callback callback, void* arg) {
+    nmbs_async_req* req = NULL;
+    nmbs_error err = async_req_get(nmbs, callback, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    err = nmbs_send_raw_pdu(nmbs, fc, data, data_len);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
+    req->data_out = data_out;
+    req->quantity = data_out_len;
+    req->raw = true;
+    return async_req_submit(nmbs, req, fc, callback, arg);
+}
+
+
+static nmbs_async_req* async_req_find(const nmbs_t* nmbs) {
+    const nmbs_async_window* window = nmbs->async;
+    for (uint16_t i = 0; i < window->reqs_count; i++) {
+        nmbs_async_req* req = &window->reqs[i];
+        if (!req->in_flight)
+            continue;
+
+        if (NMBS_IS_RTU(nmbs))
+            return req;
+
+        if (window->rx_len >= 2 && req->tid == ((uint16_t) (window->rx[0] << 8) | (uint16_t) window->rx[1]))
+            return req;
+    }
+
+    return NULL;
+}
 
-            if (!nmbs->msg.broadcast) {
-                put_res_header(nmbs, 4);
 
-                put_2(nmbs, address);
-                put_2(nmbs, quantity);
-                NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+// Length of the response to req being received in rx, or the number of bytes needed to infer it.
+// rx is either the message buffer or the async window buffer, of the same size
+static nmbs_error res_frame_len(const nmbs_t* nmbs, const nmbs_async_req* req, const uint8_t* rx, uint16_t rx_len,
+                                uint16_t* len_out) {
+    uint16_t len = 6;
 
-                err = send_msg(nmbs);
-                if (err != NMBS_ERROR_NONE)
-                    return err;
-            }
-        }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-        }
+    if (NMBS_IS_RTU(nmbs)) {
+        if (!req->raw || req->forward)
+            len = nmbs_rtu_frame_length(rx, rx_len, true);
+        else if (rx_len < 2)
+            len = 2;
+        else
+            len = (rx[1] & 0x80) ? 5 : 4 + req->quantity;
+
+        if (len == 0 || len > sizeof(nmbs->msg.buf))
+            return NMBS_ERROR_INVALID_RESPONSE;
     }
-    else {
-        return recv_write_multiple_registers_res(nmbs, address, quantity);
+    else if (rx_len >= 6) {
+        const uint16_t mbap_length = (uint16_t) (rx[4] << 8) | (uint16_t) rx[5];
+        if (mbap_length < 2 || mbap_length > sizeof(nmbs->msg.buf) - 6)
+            return NMBS_ERROR_INVALID_TCP_MBAP;
+
+        len = 6 + mbap_length;
     }
 
+    *len_out = len;
     return NMBS_ERROR_NONE;
 }
-#endif
 
-#ifndef NMBS_SERVER_READ_FILE_RECORD_DISABLED
-static nmbs_error handle_read_file_record(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 1);
+
+// Copy the data of a response whose length was inferred from the frame itself
+static nmbs_error recv_forward_res(nmbs_t* nmbs, const nmbs_async_req* req) {
+    nmbs_error err = recv_res_header(nmbs);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    const uint8_t request_size = get_1(nmbs);
-    if (request_size > 245)
-        return NMBS_ERROR_INVALID_REQUEST;
+    const uint16_t footer_len = NMBS_IS_RTU(nmbs) ? 2 : 0;
+    if (nmbs->msg.frame_len < nmbs->msg.buf_idx + footer_len)
+        return NMBS_ERROR_INVALID_RESPONSE;
 
-    err = recv(nmbs, request_size);
+    const uint16_t data_len = nmbs->msg.frame_len - nmbs->msg.buf_idx - footer_len;
+    if (data_len > req->quantity)
+        return NMBS_ERROR_INVALID_RESPONSE;
+
+    uint8_t* data_out = req->data_out;
+    for (uint16_t i = 0; i < data_len; i++)
+        data_out[i] = get_1(nmbs);
+
+    err = recv_msg_footer(nmbs);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    const uint8_t subreq_header_size = 7;
-    const uint8_t subreq_count = request_size / subreq_header_size;
+    *req->data_out_len = (uint8_t) data_len;
+    return NMBS_ERROR_NONE;
+}
 
-    struct {
-        uint8_t reference_type;
-        uint16_t file_number;
-        uint16_t record_number;
-        uint16_t record_length;
-    }
-#if defined(__STDC_NO_VLA__) || defined(_MSC_VER)
-    subreq[35];    // 245 / subreq_header_size
-#else
-    subreq[subreq_count];
-#endif
 
-    uint8_t response_data_size = 0;
+// Parse the response to req, already received in the message buffer
+static nmbs_error recv_preloaded_res(nmbs_t* nmbs, const nmbs_async_req* req, uint16_t length) {
+    msg_state_reset(nmbs);
+    nmbs->msg.transaction_id = req->tid;
+    nmbs->msg.unit_id = req->unit_id;
+    nmbs->msg.fc = req->fc;
+    nmbs->msg.frame_len = length;
+    nmbs->msg.preloaded = true;
 
-    for (uint8_t i = 0; i < subreq_count; i++) {
-        subreq[i].reference_type = get_1(nmbs);
-        subreq[i].file_number = get_2(nmbs);
-        subreq[i].record_number = get_2(nmbs);
-        subreq[i].record_length = get_2(nmbs);
+    if (req->forward)
+        return recv_forward_res(nmbs, req);
 
-        response_data_size += 2 + subreq[i].record_length * 2;
-    }
+    if (req->raw)
+        return nmbs_receive_raw_pdu_response(nmbs, req->data_out, (uint8_t) req->quantity);
 
-    discard_n(nmbs, request_size % subreq_header_size);
+    if (req->fc == 1 || req->fc == 2)
+        return recv_read_discrete_res(nmbs, req->data_out);
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (req->fc == 3 || req->fc == 4)
+        return recv_read_registers_res(nmbs, req->quantity, req->data_out);
 
-    if (!nmbs->msg.ignored) {
-        if (request_size % subreq_header_size)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    if (req->fc == 5)
+        return recv_write_single_coil_res(nmbs, req->address, req->value);
 
-        if (request_size < 0x07 || request_size > 0xF5)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    if (req->fc == 6)
+        return recv_write_single_register_res(nmbs, req->address, req->value);
 
-        for (uint8_t i = 0; i < subreq_count; i++) {
-            if (subreq[i].reference_type != 0x06)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    if (req->fc == 15)
+        return recv_write_multiple_coils_res(nmbs, req->address, req->quantity);
 
-            if (subreq[i].file_number == 0x0000)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    if (req->fc == 16)
+        return recv_write_multiple_registers_res(nmbs, req->address, req->quantity);
 
-            if (subreq[i].record_number > 0x270F)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+#ifdef NMBS_FILE_STREAM
+    if (req->fc == 20 || req->fc == 21)
+        return recv_file_records_res(nmbs, req->fc, req->address, req->value, req->data_out, req->data_in,
+                                     req->quantity);
+#endif
 
-            if (subreq[i].record_length > 124)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    return NMBS_ERROR_INVALID_RESPONSE;
+}
 
-            NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fread ", subreq[i].file_number, subreq[i].record_number,
-                             subreq[i].record_length);
-        }
 
-        put_res_header(nmbs, 1 + response_data_size);
-        put_1(nmbs, response_data_size);
+static void async_handle_res(nmbs_t* nmbs, uint16_t length) {
+    nmbs_async_window* window = nmbs->async;
 
-        if (nmbs->callbacks.read_file_record) {
-            for (uint8_t i = 0; i < subreq_count; i++) {
-                uint16_t subreq_data_size = subreq[i].record_length * 2;
-                put_1(nmbs, subreq_data_size + 1);
-                put_1(nmbs, 0x06);    // add Reference Type const
-                uint16_t* subreq_data = (uint16_t*) get_n(nmbs, subreq_data_size);
+    // Responses to expired requests are discarded
+    nmbs_async_req* req = async_req_find(nmbs);
+    window->rx_len = 0;
+    if (!req)
+        return;
 
-                err = nmbs->callbacks.read_file_record(subreq[i].file_number, subreq[i].record_number, subreq_data,
-                                                       subreq[i].record_length, nmbs->msg.unit_id, nmbs->callbacks.arg);
-                if (err != NMBS_ERROR_NONE) {
-                    if (nmbs_error_is_exception(err))
-                        return send_exception_msg(nmbs, err);
+    memcpy(nmbs->msg.buf, window->rx, length);
+    async_req_complete(nmbs, req, recv_preloaded_res(nmbs, req, length));
+}
 
-                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-                }
 
-                swap_regs(subreq_data, subreq[i].record_length);
-            }
+static void async_expire(nmbs_t* nmbs) {
+    nmbs_async_window* window = nmbs->async;
+    const uint32_t now = nmbs->platform.time_ms(nmbs->platform.arg);
+
+    for (uint16_t i = 0; i < window->reqs_count; i++) {
+        nmbs_async_req* req = &window->reqs[i];
+        if (req->in_flight && req->expires && (int32_t) (now - req->deadline_ms) >= 0) {
+            // The rest of a partially received RTU response can't be told apart from the next one
+            if (NMBS_IS_RTU(nmbs))
+                window->rx_len = 0;
+
+            async_req_complete(nmbs, req, NMBS_ERROR_TIMEOUT);
         }
-        else {
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+    }
+}
+
+
+nmbs_error nmbs_async_poll(nmbs_t* nmbs) {
+    nmbs_async_window* window = nmbs->async;
+    if (!window)
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    nmbs_error err = NMBS_ERROR_NONE;
+    while (window->in_flight > 0) {
+        if (nmbs->platform.read_frame) {
+            const int32_t ret = nmbs->platform.read_frame(window->rx, sizeof(window->rx), 0, nmbs->platform.arg);
+            stats_bytes_in(nmbs, ret);
+            if (ret == 0)
+                break;
+
+            if (ret < 0 || ret > (int32_t) sizeof(window->rx)) {
+                err = NMBS_ERROR_TRANSPORT;
+                break;
+            }
+
+            window->rx_len = (uint16_t) ret;
+            async_handle_res(nmbs, (uint16_t) ret);
+            continue;
         }
 
-        if (!nmbs->msg.broadcast) {
-            err = send_msg(nmbs);
-            if (err != NMBS_ERROR_NONE)
-                return err;
+        uint16_t len = 0;
+        err = res_frame_len(nmbs, async_req_find(nmbs), window->rx, window->rx_len, &len);
+        if (err != NMBS_ERROR_NONE)
+            break;
+
+        if (window->rx_len < len) {
+            const uint16_t count = len - window->rx_len;
+            const int32_t ret = NMBS_READ(nmbs, window->rx + window->rx_len, count, 0);
+            stats_bytes_in(nmbs, ret);
+            if (ret < 0 || ret > count) {
+                err = NMBS_ERROR_TRANSPORT;
+                break;
+            }
+
+            window->rx_len += (uint16_t) ret;
+            if (ret < count)
+                break;
+
+            continue;
         }
+
+        async_handle_res(nmbs, len);
     }
-    else {
-        return recv_read_file_record_res(nmbs, NULL, 0);
+
+    if (err != NMBS_ERROR_NONE) {
+        nmbs_async_cancel(nmbs, err);
+        return err;
     }
 
+    async_expire(nmbs);
+
     return NMBS_ERROR_NONE;
 }
-#endif
 
-#ifndef NMBS_SERVER_WRITE_FILE_RECORD_DISABLED
-static nmbs_error handle_write_file_record(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 1);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    const uint8_t request_size = get_1(nmbs);
-    if (request_size > 251) {
-        return NMBS_ERROR_INVALID_REQUEST;
+uint16_t nmbs_async_in_flight(const nmbs_t* nmbs) {
+    if (!nmbs->async)
+        return 0;
+
+    return nmbs->async->in_flight;
+}
+
+
+void nmbs_async_cancel(nmbs_t* nmbs, nmbs_error err) {
+    nmbs_async_window* window = nmbs->async;
+    if (!window)
+        return;
+
+    window->rx_len = 0;
+    for (uint16_t i = 0; i < window->reqs_count; i++) {
+        if (window->reqs[i].in_flight)
+            async_req_complete(nmbs, &window->reqs[i], err);
     }
+}
 
-    err = recv(nmbs, request_size);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    // We can save msg.buf index and use it later for context recovery.
-    const uint16_t msg_buf_idx = nmbs->msg.buf_idx;
-    discard_n(nmbs, request_size);
+static nmbs_error step_req_get(nmbs_t* nmbs, nmbs_async_req** req_out) {
+    if (!nmbs->platform.time_ms)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (nmbs->step.in_flight)
+        return NMBS_ERROR_WINDOW_FULL;
 
-    if (!nmbs->msg.ignored) {
-        const uint8_t subreq_header_size = 7;
-        uint16_t size = request_size;
-        nmbs->msg.buf_idx = msg_buf_idx;    // restore context
+    memset(&nmbs->step, 0, sizeof(nmbs_async_req));
+    *req_out = &nmbs->step;
+    return NMBS_ERROR_NONE;
+}
 
-        if (request_size < 7)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
 
-        do {
-            const uint8_t subreq_reference_type = get_1(nmbs);
-            const uint16_t subreq_file_number_c = get_2(nmbs);
-            const uint16_t subreq_record_number_c = get_2(nmbs);
-            const uint16_t subreq_record_length_c = get_2(nmbs);
-            discard_n(nmbs, subreq_record_length_c * 2);
+// The transaction stays open until nmbs_client_step() completes it, so its latency is measured
+static nmbs_error step_req_submit(nmbs_t* nmbs, nmbs_async_req* req, uint8_t fc, nmbs_error err) {
+    if (err != NMBS_ERROR_NONE)
+        return stats_done(nmbs, err);
 
-            if (subreq_reference_type != 0x06)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    req->tid = nmbs->msg.transaction_id;
+    req->unit_id = nmbs->msg.unit_id;
+    req->fc = fc;
+    req->expires = nmbs->read_timeout_ms >= 0;
+    if (req->expires)
+        req->deadline_ms = nmbs->platform.time_ms(nmbs->platform.arg) + (uint32_t) nmbs->read_timeout_ms;
 
-            if (subreq_file_number_c == 0x0000)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    req->in_flight = true;
+    nmbs->step_rx_len = 0;
 
-            if (subreq_record_number_c > 0x270F)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    return NMBS_ERROR_NONE;
+}
 
-            if (subreq_record_length_c > 122)
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
 
-            NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", subreq_file_number_c, subreq_record_number_c,
-                             subreq_record_length_c);
-            size -= (subreq_header_size + subreq_record_length_c * 2);
-        } while (size >= subreq_header_size);
+static nmbs_error step_read_discrete(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity,
+                                     nmbs_bitfield values) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-        if (size)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    req->data_out = values;
+    return step_req_submit(nmbs, req, fc, send_read_discrete_req(nmbs, fc, address, quantity));
+}
 
-        // checks completed
 
-        size = request_size;
-        nmbs->msg.buf_idx = msg_buf_idx;    // restore context
+nmbs_error nmbs_client_begin_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out) {
+    return step_read_discrete(nmbs, 1, address, quantity, coils_out);
+}
 
-        do {
-            discard_1(nmbs);
-            const uint16_t subreq_file_number = get_2(nmbs);
-            const uint16_t subreq_record_number = get_2(nmbs);
-            const uint16_t subreq_record_length = get_2(nmbs);
-            uint16_t* subreq_data = get_regs(nmbs, subreq_record_length);
 
-            if (nmbs->callbacks.write_file_record) {
-                err = nmbs->callbacks.write_file_record(subreq_file_number, subreq_record_number, subreq_data,
-                                                        subreq_record_length, nmbs->msg.unit_id, nmbs->callbacks.arg);
-                if (err != NMBS_ERROR_NONE) {
-                    if (nmbs_error_is_exception(err))
-                        return send_exception_msg(nmbs, err);
+nmbs_error nmbs_client_begin_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  nmbs_bitfield inputs_out) {
+    return step_read_discrete(nmbs, 2, address, quantity, inputs_out);
+}
 
-                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-                }
 
-                swap_regs(subreq_data, subreq_record_length);    // restore swapping
-            }
-            else {
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
-            }
+static nmbs_error step_read_registers(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity,
+                                      uint16_t* registers) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-            size -= (subreq_header_size + subreq_record_length * 2);
-        } while (size >= subreq_header_size);
+    req->data_out = registers;
+    req->quantity = quantity;
+    return step_req_submit(nmbs, req, fc, send_read_registers_req(nmbs, fc, address, quantity));
+}
 
-        if (!nmbs->msg.broadcast) {
-            // The normal response to 'Write File' is an echo of the request.
-            // We can restore buffer index and response msg.
-            nmbs->msg.buf_idx = msg_buf_idx;
-            discard_n(nmbs, request_size);
 
-            err = send_msg(nmbs);
-            if (err != NMBS_ERROR_NONE)
-                return err;
-        }
-    }
-    else {
-        return recv_write_file_record_res(nmbs, 0, 0, NULL, 0);
-    }
+nmbs_error nmbs_client_begin_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                    uint16_t* registers_out) {
+    return step_read_registers(nmbs, 3, address, quantity, registers_out);
+}
 
-    return NMBS_ERROR_NONE;
+
+nmbs_error nmbs_client_begin_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  uint16_t* registers_out) {
+    return step_read_registers(nmbs, 4, address, quantity, registers_out);
 }
-#endif
 
-#ifndef NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED
-static nmbs_error handle_read_write_registers(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 9);
+
+nmbs_error nmbs_client_begin_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    const uint16_t read_address = get_2(nmbs);
-    const uint16_t read_quantity = get_2(nmbs);
-    const uint16_t write_address = get_2(nmbs);
-    const uint16_t write_quantity = get_2(nmbs);
+    req->address = address;
+    req->value = value ? 0xFF00 : 0;
+    return step_req_submit(nmbs, req, 5, send_write_single_coil_req(nmbs, address, req->value));
+}
 
-    const uint8_t byte_count_write = get_1(nmbs);
 
-    NMBS_DEBUG_PRINT("ra %d\trq %d\t wa %d\t wq %d\t b %d\tregs ", read_address, read_quantity, write_address,
-                     write_quantity, byte_count_write);
+nmbs_error nmbs_client_begin_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-    if (byte_count_write > 242)
-        return NMBS_ERROR_INVALID_REQUEST;
+    req->address = address;
+    req->value = value;
+    return step_req_submit(nmbs, req, 6, send_write_single_register_req(nmbs, address, value));
+}
 
-    err = recv(nmbs, byte_count_write);
+
+nmbs_error nmbs_client_begin_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  const nmbs_bitfield coils) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-#if defined(__STDC_NO_VLA__) || defined(_MSC_VER)
-    uint16_t registers[0x007B];
-#else
-    uint16_t registers[byte_count_write / 2];
-#endif
-    for (int i = 0; i < byte_count_write / 2; i++) {
-        registers[i] = get_2(nmbs);
-        NMBS_DEBUG_PRINT("%d ", registers[i]);
-    }
+    req->address = address;
+    req->quantity = quantity;
+    return step_req_submit(nmbs, req, 15, send_write_multiple_coils_req(nmbs, address, quantity, coils));
+}
+
 
-    err = recv_msg_footer(nmbs);
+nmbs_error nmbs_client_begin_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                      const uint16_t* registers) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    if (!nmbs->msg.ignored) {
-        if (read_quantity < 1 || read_quantity > 0x007D)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    req->address = address;
+    req->quantity = quantity;
+    return step_req_submit(nmbs, req, 16, send_write_multiple_registers_req(nmbs, address, quantity, registers));
+}
 
-        if (write_quantity < 1 || write_quantity > 0x007B)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
 
-        if (byte_count_write != write_quantity * 2)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+nmbs_error nmbs_client_begin_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len,
+                                          uint8_t* data_out, uint8_t data_out_len) {
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-        if ((uint32_t) read_address + (uint32_t) read_quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    req->data_out = data_out;
+    req->quantity = data_out_len;
+    req->raw = true;
+    return step_req_submit(nmbs, req, fc, nmbs_send_raw_pdu(nmbs, fc, data, data_len));
+}
 
-        if ((uint32_t) write_address + (uint32_t) write_quantity > ((uint32_t) 0xFFFF) + 1)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
 
-        if (!nmbs->callbacks.write_multiple_registers || !nmbs->callbacks.read_holding_registers)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+nmbs_error nmbs_client_begin_forward_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len,
+                                         uint8_t* data_out, uint8_t data_out_size, uint8_t* data_out_len) {
+    if (!data_out || !data_out_len)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-        err = nmbs->callbacks.write_multiple_registers(write_address, write_quantity, registers, nmbs->msg.unit_id,
-                                                       nmbs->callbacks.arg);
-        if (err != NMBS_ERROR_NONE) {
-            if (nmbs_error_is_exception(err))
-                return send_exception_msg(nmbs, err);
+    if (NMBS_IS_RTU(nmbs) && nmbs_rtu_frame_length((const uint8_t[]) {0, fc, 0, 0}, 4, true) == 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-        }
+    nmbs_async_req* req = NULL;
+    const nmbs_error err = step_req_get(nmbs, &req);
+    if (err != NMBS_ERROR_NONE)
+        return err;
 
-        if (!nmbs->msg.broadcast) {
-#if defined(__STDC_NO_VLA__) || defined(_MSC_VER)
-            uint16_t regs[125];
-#else
-            uint16_t regs[read_quantity];
-#endif
-            err = nmbs->callbacks.read_holding_registers(read_address, read_quantity, regs, nmbs->msg.unit_id,
-                                                         nmbs->callbacks.arg);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+    req->data_out = data_out;
+    req->data_out_len = data_out_len;
+    req->quantity = data_out_size;
+    req->raw = true;
+    req->forward = true;
+    return step_req_submit(nmbs, req, fc, nmbs_send_raw_pdu(nmbs, fc, data, data_len));
+}
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
 
-            const uint8_t regs_bytes = read_quantity * 2;
-            put_res_header(nmbs, 1 + regs_bytes);
+// Receive the available bytes of the response in the message buffer. Its length is set once it's complete
+static nmbs_error step_recv(nmbs_t* nmbs, uint16_t* length_out) {
+    const nmbs_async_req* req = &nmbs->step;
+    *length_out = 0;
 
-            put_1(nmbs, regs_bytes);
+    if (nmbs->platform.read_frame) {
+        const int32_t ret = nmbs->platform.read_frame(nmbs->msg.buf, sizeof(nmbs->msg.buf), 0, nmbs->platform.arg);
+        stats_bytes_in(nmbs, ret);
+        if (ret < 0 || ret > (int32_t) sizeof(nmbs->msg.buf))
+            return NMBS_ERROR_TRANSPORT;
 
-            NMBS_DEBUG_PRINT("b %d\t", regs_bytes);
+        *length_out = (uint16_t) ret;
+        return NMBS_ERROR_NONE;
+    }
 
-            NMBS_DEBUG_PRINT("regs ");
-            for (int i = 0; i < read_quantity; i++) {
-                put_2(nmbs, regs[i]);
-                NMBS_DEBUG_PRINT("%d ", regs[i]);
-            }
+    while (true) {
+        uint16_t len = 0;
+        const nmbs_error err = res_frame_len(nmbs, req, nmbs->msg.buf, nmbs->step_rx_len, &len);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-            err = send_msg(nmbs);
-            if (err != NMBS_ERROR_NONE)
-                return err;
+        if (nmbs->step_rx_len >= len) {
+            *length_out = len;
+            return NMBS_ERROR_NONE;
         }
-    }
-    else {
-        return recv_write_multiple_registers_res(nmbs, write_address, write_quantity);
-    }
 
-    return NMBS_ERROR_NONE;
-}
-#endif
+        const uint16_t count = len - nmbs->step_rx_len;
+        const int32_t ret = NMBS_READ(nmbs, nmbs->msg.buf + nmbs->step_rx_len, count, 0);
+        stats_bytes_in(nmbs, ret);
+        if (ret < 0 || ret > count)
+            return NMBS_ERROR_TRANSPORT;
 
-#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
-static nmbs_error handle_read_device_identification(nmbs_t* nmbs) {
-    nmbs_error err = recv(nmbs, 3);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        nmbs->step_rx_len += (uint16_t) ret;
+        if (ret < count)
+            return NMBS_ERROR_NONE;
+    }
+}
 
-    const uint8_t mei_type = get_1(nmbs);
-    const uint8_t read_device_id_code = get_1(nmbs);
-    const uint8_t object_id = get_1(nmbs);
 
-    NMBS_DEBUG_PRINT("c %d\to %d", read_device_id_code, object_id);
+nmbs_client_status nmbs_client_step(nmbs_t* nmbs, nmbs_error* error_out) {
+    nmbs_async_req* req = &nmbs->step;
+    if (!req->in_flight)
+        return NMBS_CLIENT_IDLE;
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    nmbs_error err = NMBS_ERROR_NONE;
 
-    if (!nmbs->msg.ignored) {
-        if (!nmbs->callbacks.read_device_identification_map || !nmbs->callbacks.read_device_identification)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+    // Broadcast requests get no response
+    if (!nmbs->msg.broadcast) {
+        uint16_t length = 0;
+        err = step_recv(nmbs, &length);
+        if (err == NMBS_ERROR_NONE && length > 0) {
+            err = recv_preloaded_res(nmbs, req, length);
+        }
+        else if (err == NMBS_ERROR_NONE) {
+            if (!req->expires || (int32_t) (nmbs->platform.time_ms(nmbs->platform.arg) - req->deadline_ms) < 0)
+                return NMBS_CLIENT_IN_PROGRESS;
 
-        if (mei_type != 0x0E)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+            err = NMBS_ERROR_TIMEOUT;
+        }
+    }
 
-        if (read_device_id_code < 1 || read_device_id_code > 4)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+    req->in_flight = false;
+    err = stats_done(nmbs, err);
+    if (error_out)
+        *error_out = err;
 
-        if (object_id > 6 && object_id < 0x80)
-            return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    return NMBS_CLIENT_DONE;
+}
+#endif
 
-        if (!nmbs->msg.broadcast) {
-            char str[NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH];
 
-            nmbs_bitfield_256 map;
-            nmbs_bitfield_reset(map);
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_FILE_STREAM)
+static void file_stream_done(nmbs_t* nmbs, nmbs_error err, void* arg) {
+    nmbs_file_stream_chunk* chunk = arg;
+    nmbs_file_stream* stream = chunk->stream;
+    if (--stream->in_flight == 0)
+        stream->end_ms = nmbs->platform.time_ms(nmbs->platform.arg);
 
-            err = nmbs->callbacks.read_device_identification_map(map);
-            if (err != NMBS_ERROR_NONE) {
-                if (nmbs_error_is_exception(err))
-                    return send_exception_msg(nmbs, err);
+    if (err != NMBS_ERROR_NONE) {
+        if (stream->err == NMBS_ERROR_NONE)
+            stream->err = err;
 
-                return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-            }
+        return;
+    }
 
-            put_res_header(nmbs, 0);    // Length will be set later
-            put_1(nmbs, 0x0E);
-            put_1(nmbs, read_device_id_code);
-            put_1(nmbs, 0x83);
+    // Responses can arrive out of order, only the records up to the first chunk not completed are acknowledged
+    chunk->done = true;
+    while (stream->seq_acked != stream->seq_next) {
+        nmbs_file_stream_chunk* first = &stream->chunks[stream->seq_acked % NMBS_FILE_STREAM_WINDOW_MAX];
+        if (!first->done)
+            break;
 
-            if (read_device_id_code == 4) {
-                if (!nmbs_bitfield_read(map, object_id))
-                    return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+        stream->acked = first->offset + first->count;
+        first->done = false;
+        stream->seq_acked++;
+    }
+}
 
-                put_1(nmbs, 0);    // More follows
-                put_1(nmbs, 0);    // Next Object Id
-                put_1(nmbs, 1);    // Number of objects
 
-                str[0] = 0;
-                err = nmbs->callbacks.read_device_identification(object_id, str);
-                if (err != NMBS_ERROR_NONE) {
-                    if (nmbs_error_is_exception(err))
-                        return send_exception_msg(nmbs, err);
+static nmbs_error file_stream_send(nmbs_t* nmbs, nmbs_file_stream* stream) {
+    while (stream->err == NMBS_ERROR_NONE && stream->next < stream->count &&
+           (uint16_t) (stream->seq_next - stream->seq_acked) < NMBS_FILE_STREAM_WINDOW_MAX) {
+        const uint32_t record = stream->record_number + stream->next;
+        const uint16_t file_number = (uint16_t) (stream->file_number + record / 10000);
+        const uint16_t record_number = (uint16_t) (record % 10000);
+        const uint16_t count = file_records_length(stream->fc, record_number, stream->count - stream->next);
 
-                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-                }
+        nmbs_async_req* req = NULL;
+        nmbs_error err = async_req_get(nmbs, file_stream_done, &req);
+        if (err == NMBS_ERROR_WINDOW_FULL)
+            return NMBS_ERROR_NONE;
 
-                const size_t str_len = strlen(str);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-                put_1(nmbs, object_id);    // Object id
-                put_1(nmbs, str_len);      // Object length
-                put_n(nmbs, (uint8_t*) str, str_len);
+        const uint16_t* registers = stream->registers ? stream->registers + stream->next : NULL;
+        err = send_file_records_req(nmbs, stream->fc, file_number, record_number, registers, count);
+        if (err != NMBS_ERROR_NONE)
+            return err;
 
-                set_msg_header_size(nmbs, 6 + 2 + str_len);
+        nmbs_file_stream_chunk* chunk = &stream->chunks[stream->seq_next % NMBS_FILE_STREAM_WINDOW_MAX];
+        chunk->stream = stream;
+        chunk->offset = stream->next;
+        chunk->count = count;
+        chunk->done = false;
+        stream->seq_next++;
+        stream->next += count;
+        stream->in_flight++;
+
+        req->address = file_number;
+        req->value = record_number;
+        req->quantity = count;
+        req->data_out = stream->registers_out ? stream->registers_out + chunk->offset : NULL;
+        req->data_in = registers;
+        async_req_submit(nmbs, req, stream->fc, file_stream_done, chunk);
+    }
 
-                return send_msg(nmbs);
-            }
+    return NMBS_ERROR_NONE;
+}
 
-            const uint8_t more_follows_idx = nmbs->msg.buf_idx;
-            put_1(nmbs, 0);
-            const uint8_t next_object_id_idx = nmbs->msg.buf_idx;
-            put_1(nmbs, 0);
-            const uint8_t number_of_objects_idx = nmbs->msg.buf_idx;
-            put_1(nmbs, 0);
 
-            int16_t res_size_left = 253 - 7;
+static nmbs_error file_stream_start(nmbs_t* nmbs, nmbs_file_stream* stream, uint8_t fc, uint16_t file_number,
+                                    uint16_t record_number, uint32_t count) {
+    if (!nmbs->async || file_number == 0x0000 || record_number > 0x270F)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-            uint8_t last_id = 0;
-            uint8_t msg_size = 6;
-            uint8_t res_more_follows = 0;
-            uint8_t res_next_object_id = 0;
-            uint8_t res_number_of_objects = 0;
+    if (count > 0 && file_number + ((uint32_t) record_number + count - 1) / 10000 > 0xFFFF)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-            switch (read_device_id_code) {
-                case 1:
-                    if (object_id > 0x02)
-                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-                    last_id = 0x02;
-                    break;
-                case 2:
-                    if (object_id < 0x03 || object_id > 0x06)
-                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-                    last_id = 0x06;
-                    break;
-                case 3:
-                    if (object_id < 0x80)
-                        return send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-                    last_id = 0xFF;
-                    break;
-                default:
-                    // Unreachable
-                    break;
-            }
+    stream->count = count;
+    stream->next = 0;
+    stream->acked = 0;
+    stream->file_number = file_number;
+    stream->record_number = record_number;
+    stream->seq_acked = 0;
+    stream->seq_next = 0;
+    stream->in_flight = 0;
+    stream->err = NMBS_ERROR_NONE;
+    stream->fc = fc;
+    stream->start_ms = nmbs->platform.time_ms(nmbs->platform.arg);
+    stream->end_ms = stream->start_ms;
+
+    return file_stream_send(nmbs, stream);
+}
 
-            for (uint16_t id = object_id; id <= last_id; id++) {
-                if (!nmbs_bitfield_read(map, id)) {
-                    if (id < 0x03)
-                        return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-                    continue;
-                }
 
-                str[0] = 0;
-                err = nmbs->callbacks.read_device_identification((uint8_t) id, str);
-                if (err != NMBS_ERROR_NONE) {
-                    if (nmbs_error_is_exception(err))
-                        return send_exception_msg(nmbs, err);
+nmbs_error nmbs_file_read_stream(nmbs_t* nmbs, nmbs_file_stream* stream, uint16_t file_number, uint16_t record_number,
+                                 uint16_t* registers_out, uint32_t count) {
+    if (!registers_out)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-                    return send_exception_msg(nmbs, NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
-                }
+    stream->registers_out = registers_out;
+    stream->registers = NULL;
+    return file_stream_start(nmbs, stream, 20, file_number, record_number, count);
+}
 
-                const int16_t str_len = (int16_t) strlen(str);
 
-                res_size_left = (int16_t) (res_size_left - 2 - str_len);
-                if (res_size_left < 0) {
-                    res_more_follows = 0xFF;
-                    res_next_object_id = id;
-                    break;
-                }
+nmbs_error nmbs_file_write_stream(nmbs_t* nmbs, nmbs_file_stream* stream, uint16_t file_number, uint16_t record_number,
+                                  const uint16_t* registers, uint32_t count) {
+    if (!registers)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-                put_1(nmbs, (uint8_t) id);    // Object id
-                put_1(nmbs, str_len);         // Object length
-                put_n(nmbs, (uint8_t*) str, str_len);
+    stream->registers_out = NULL;
+    stream->registers = registers;
+    return file_stream_start(nmbs, stream, 21, file_number, record_number, count);
+}
 
-                msg_size += (2 + str_len);
 
-                res_number_of_objects++;
-            }
+nmbs_client_status nmbs_file_stream_poll(nmbs_t* nmbs, nmbs_file_stream* stream, nmbs_error* error_out) {
+    // Errors of the requests in flight are passed to their callbacks
+    nmbs_async_poll(nmbs);
 
-            set_1(nmbs, res_more_follows, more_follows_idx);
-            set_1(nmbs, res_next_object_id, next_object_id_idx);
-            set_1(nmbs, res_number_of_objects, number_of_objects_idx);
+    const nmbs_error err = file_stream_send(nmbs, stream);
+    if (err != NMBS_ERROR_NONE && stream->err == NMBS_ERROR_NONE)
+        stream->err = err;
 
-            set_msg_header_size(nmbs, msg_size);
+    if (stream->in_flight > 0 || (stream->err == NMBS_ERROR_NONE && stream->acked < stream->count))
+        return NMBS_CLIENT_IN_PROGRESS;
 
-            return send_msg(nmbs);
-        }
-    }
-    else {
-        return recv_read_device_identification_res(nmbs, 0, NULL, 0, NULL, NULL, NULL, NULL);
-    }
+    if (error_out)
+        *error_out = stream->err;
 
-    return NMBS_ERROR_NONE;
+    return NMBS_CLIENT_DONE;
 }
-#endif
 
 
-static nmbs_error handle_req_fc(nmbs_t* nmbs) {
-    NMBS_DEBUG_PRINT("fc %d\t", nmbs->msg.fc);
+nmbs_error nmbs_file_stream_resume(nmbs_t* nmbs, nmbs_file_stream* stream) {
+    if (stream->in_flight > 0)
+        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    nmbs_error err = NMBS_ERROR_NONE;
-    switch (nmbs->msg.fc) {
-#ifndef NMBS_SERVER_READ_COILS_DISABLED
-        case 1:
-            err = handle_read_coils(nmbs);
-            break;
-#endif
+    for (uint16_t i = 0; i < NMBS_FILE_STREAM_WINDOW_MAX; i++)
+        stream->chunks[i].done = false;
 
-#ifndef NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED
-        case 2:
-            err = handle_read_discrete_inputs(nmbs);
-            break;
-#endif
+    stream->next = stream->acked;
+    stream->seq_next = stream->seq_acked;
+    stream->err = NMBS_ERROR_NONE;
 
-#ifndef NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED
-        case 3:
-            err = handle_read_holding_registers(nmbs);
-            break;
-#endif
+    return file_stream_send(nmbs, stream);
+}
 
-#ifndef NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED
-        case 4:
-            err = handle_read_input_registers(nmbs);
-            break;
-#endif
 
-#ifndef NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED
-        case 5:
-            err = handle_write_single_coil(nmbs);
-            break;
-#endif
+uint32_t nmbs_file_stream_acked(const nmbs_file_stream* stream) {
+    return stream->acked;
+}
 
-#ifndef NMBS_SERVER_WRITE_SINGLE_REGISTER_DISABLED
-        case 6:
-            err = handle_write_single_register(nmbs);
-            break;
-#endif
 
-#ifndef NMBS_SERVER_WRITE_MULTIPLE_COILS_DISABLED
-        case 15:
-            err = handle_write_multiple_coils(nmbs);
-            break;
+uint32_t nmbs_file_stream_throughput(const nmbs_t* nmbs, const nmbs_file_stream* stream) {
+    const bool done = stream->in_flight == 0 && (stream->err != NMBS_ERROR_NONE || stream->acked == stream->count);
+    const uint32_t end_ms = done ? stream->end_ms : nmbs->platform.time_ms(nmbs->platform.arg);
+    const uint32_t elapsed_ms = end_ms - stream->start_ms;
+
+    return (uint32_t) ((uint64_t) stream->acked * 2 * 1000 / (elapsed_ms ? elapsed_ms : 1));
+}
 #endif
 
-#ifndef NMBS_SERVER_WRITE_MULTIPLE_REGISTERS_DISABLED
-        case 16:
-            err = handle_write_multiple_registers(nmbs);
-            break;
-#endif
 
-#ifndef NMBS_SERVER_READ_FILE_RECORD_DISABLED
-        case 20:
-            err = handle_read_file_record(nmbs);
-            break;
-#endif
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_SCHEDULER)
+static nmbs_read_plan* sched_job_plan(const nmbs_sched_job* job) {
+    return job->sub ? job->sub->plan : job->plan;
+}
 
-#ifndef NMBS_SERVER_WRITE_FILE_RECORD_DISABLED
-        case 21:
-            err = handle_write_file_record(nmbs);
-            break;
-#endif
 
-#ifndef NMBS_SERVER_READ_WRITE_REGISTERS_DISABLED
-        case 23:
-            err = handle_read_write_registers(nmbs);
-            break;
-#endif
+static void sched_job_release(nmbs_sched_job* job, uint32_t release_ms) {
+    job->release_ms = release_ms;
+    job->due_ms = release_ms + (job->deadline_ms ? job->deadline_ms : job->period_ms);
+    job->started = false;
+}
 
-#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
-        case 43:
-            err = handle_read_device_identification(nmbs);
-            break;
-#endif
-        default:
-            flush(nmbs);
-            if (!nmbs->msg.ignored)
-                err = send_exception_msg(nmbs, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+
+static void sched_reset_job_stats(nmbs_sched_job* job) {
+    job->runs = 0;
+    job->misses = 0;
+    job->skipped = 0;
+    job->delay_min_ms = UINT32_MAX;
+    job->delay_max_ms = 0;
+    job->response_max_ms = 0;
+}
+
+
+nmbs_error nmbs_sched_create(nmbs_sched* sched, nmbs_t* nmbs, nmbs_sched_job* jobs, uint16_t jobs_count) {
+    if (!sched || !nmbs || !nmbs->platform.time_ms || (!jobs && jobs_count > 0))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    for (uint16_t j = 0; j < jobs_count; j++) {
+        if (!sched_job_plan(&jobs[j]) || jobs[j].period_ms == 0)
+            return NMBS_ERROR_INVALID_ARGUMENT;
     }
 
-    return err;
+    memset(sched, 0, sizeof(nmbs_sched));
+    sched->nmbs = nmbs;
+    sched->jobs = jobs;
+    sched->jobs_count = jobs_count;
+
+    const uint32_t now = nmbs->platform.time_ms(nmbs->platform.arg);
+    for (uint16_t j = 0; j < jobs_count; j++)
+        sched_job_release(&jobs[j], now + jobs[j].offset_ms);
+
+    nmbs_sched_reset_stats(sched);
+
+    return NMBS_ERROR_NONE;
 }
 
 
-void nmbs_callbacks_create(nmbs_callbacks* callbacks) {
-    memset(callbacks, 0, sizeof(nmbs_callbacks));
-    callbacks->initialized = 0xFFFFDEBE;
+void nmbs_sched_set_broadcast(nmbs_sched* sched, const nmbs_bitfield_256 line_units, uint32_t turnaround_ms) {
+    sched->line_units = line_units;
+    sched->turnaround_ms = turnaround_ms;
 }
 
 
-nmbs_error nmbs_server_create(nmbs_t* nmbs, uint8_t address_rtu, const nmbs_platform_conf* platform_conf,
-                              const nmbs_callbacks* callbacks) {
-    if (platform_conf->transport == NMBS_TRANSPORT_RTU && address_rtu == 0)
+nmbs_error nmbs_sched_submit(nmbs_sched* sched, nmbs_sched_write* write) {
+    if (!write || !write->values || write->quantity == 0)
         return NMBS_ERROR_INVALID_ARGUMENT;
 
-    if (!callbacks || callbacks->initialized != 0xFFFFDEBE)
+    if (write->table == NMBS_TABLE_COILS) {
+        if (write->quantity > 0x07B0)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (write->table == NMBS_TABLE_HOLDING_REGISTERS) {
+        if (write->quantity > 0x007B)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
+    else {
         return NMBS_ERROR_INVALID_ARGUMENT;
+    }
 
-    nmbs_error ret = nmbs_create(nmbs, platform_conf);
-    if (ret != NMBS_ERROR_NONE)
-        return ret;
+    write->next = NULL;
+    write->due_ms = sched->nmbs->platform.time_ms(sched->nmbs->platform.arg) + write->deadline_ms;
+    write->next_unit = 0;
+    write->err = NMBS_ERROR_NONE;
 
-    nmbs->address_rtu = address_rtu;
-    nmbs->callbacks = *callbacks;
+    // Appended, so that writes with the same deadline and priority are sent in order
+    nmbs_sched_write** tail = &sched->writes;
+    while (*tail)
+        tail = &(*tail)->next;
+
+    *tail = write;
 
     return NMBS_ERROR_NONE;
 }
 
 
-nmbs_error nmbs_server_poll(nmbs_t* nmbs) {
-    msg_state_reset(nmbs);
+// Whether a request due at a_due with priority a_prio goes before one due at b_due with priority b_prio
+static bool sched_before(uint32_t a_due, uint8_t a_prio, uint32_t b_due, uint8_t b_prio, uint32_t now) {
+    const bool a_late = (int32_t) (now - a_due) > 0;
+    const bool b_late = (int32_t) (now - b_due) > 0;
+    if (a_late && b_late && a_prio != b_prio)
+        return a_prio < b_prio;
 
-    bool first_byte_received = false;
-    nmbs_error err = recv_req_header(nmbs, &first_byte_received);
-    if (err != NMBS_ERROR_NONE) {
-        if (!first_byte_received && err == NMBS_ERROR_TIMEOUT)
-            return NMBS_ERROR_NONE;
+    if (a_due != b_due)
+        return (int32_t) (a_due - b_due) < 0;
 
-        return err;
-    }
+    return a_prio < b_prio;
+}
 
-#ifdef NMBS_DEBUG
-    printf("%d ", nmbs->address_rtu);
-    printf("NMBS req <- ");
-    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU) {
-        if (nmbs->msg.broadcast)
-            printf("broadcast\t");
-        else
-            printf("address_rtu %d\t", nmbs->msg.unit_id);
-    }
-#endif
 
-    err = handle_req_fc(nmbs);
-    if (err != NMBS_ERROR_NONE) {
-        if (err != NMBS_ERROR_TIMEOUT)
-            flush(nmbs);
+// Whether a fan-out write can be sent as broadcast, reaching all its units and no other
+static bool sched_write_broadcast(const nmbs_sched* sched, const nmbs_sched_write* write) {
+    if (!write->units || !sched->line_units || !NMBS_IS_RTU(sched->nmbs))
+        return false;
 
-        return err;
+    for (uint16_t b = 0; b < sizeof(nmbs_bitfield_256); b++) {
+        if ((sched->line_units[b] & ~write->units[b]) != 0)
+            return false;
     }
 
-    return NMBS_ERROR_NONE;
+    return true;
 }
 
-void nmbs_set_callbacks_arg(nmbs_t* nmbs, void* arg) {
-    nmbs->callbacks.arg = arg;
-}
-#endif
 
+static nmbs_error sched_write_send(nmbs_t* nmbs, const nmbs_sched_write* write) {
+    if (write->table == NMBS_TABLE_COILS) {
+        const uint8_t* coils = write->values;
+        if (write->quantity == 1)
+            return nmbs_write_single_coil(nmbs, write->address, nmbs_bitfield_read(coils, 0));
 
-#ifndef NMBS_CLIENT_DISABLED
-nmbs_error nmbs_client_create(nmbs_t* nmbs, const nmbs_platform_conf* platform_conf) {
-    return nmbs_create(nmbs, platform_conf);
+        return nmbs_write_multiple_coils(nmbs, write->address, write->quantity, coils);
+    }
+
+    const uint16_t* registers = write->values;
+    if (write->quantity == 1)
+        return nmbs_write_single_register(nmbs, write->address, registers[0]);
+
+    return nmbs_write_multiple_registers(nmbs, write->address, write->quantity, registers);
 }
 
 
-static nmbs_error read_discrete(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity, nmbs_bitfield values) {
-    if (quantity < 1 || quantity > NMBS_BITFIELD_MAX)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+// Send the next request of a write, return true once it's done
+static bool sched_write_step(nmbs_sched* sched, nmbs_sched_write* write) {
+    nmbs_t* nmbs = sched->nmbs;
+    nmbs_error err = NMBS_ERROR_NONE;
+    bool done = true;
 
-    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    if (sched_write_broadcast(sched, write)) {
+        nmbs_set_destination_rtu_address(nmbs, NMBS_BROADCAST_ADDRESS);
+        err = sched_write_send(nmbs, write);
+    }
+    else if (write->units) {
+        uint16_t unit = write->next_unit;
+        while (unit < 256 && !nmbs_bitfield_read(write->units, unit))
+            unit++;
 
-    msg_state_req(nmbs, fc);
-    put_req_header(nmbs, 4);
+        if (unit < 256) {
+            nmbs_set_destination_rtu_address(nmbs, (uint8_t) unit);
+            err = sched_write_send(nmbs, write);
 
-    put_2(nmbs, address);
-    put_2(nmbs, quantity);
+            write->next_unit = unit + 1;
+            while (write->next_unit < 256 && !nmbs_bitfield_read(write->units, write->next_unit))
+                write->next_unit++;
 
-    NMBS_DEBUG_PRINT("a %d\tq %d", address, quantity);
+            done = write->next_unit >= 256;
+        }
+    }
+    else {
+        nmbs_set_destination_rtu_address(nmbs, write->unit_id);
+        err = sched_write_send(nmbs, write);
+    }
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (err != NMBS_ERROR_NONE && write->err == NMBS_ERROR_NONE)
+        write->err = err;
 
-    return recv_read_discrete_res(nmbs, values);
+    return done;
 }
 
 
-nmbs_error nmbs_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out) {
-    return read_discrete(nmbs, 1, address, quantity, coils_out);
-}
+// Send the next request of a job, return true once its execution is complete
+static bool sched_job_step(nmbs_sched* sched, nmbs_sched_job* job, uint32_t now) {
+    nmbs_read_plan* plan = sched_job_plan(job);
 
+    if (!job->started) {
+        const uint32_t delay = now - job->release_ms;
+        if (delay < job->delay_min_ms)
+            job->delay_min_ms = delay;
 
-nmbs_error nmbs_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield inputs_out) {
-    return read_discrete(nmbs, 2, address, quantity, inputs_out);
+        if (delay > job->delay_max_ms)
+            job->delay_max_ms = delay;
+
+        job->started = true;
+        job->block = 0;
+        job->image_offset = job->sub ? (plan->blocks_count + 15) / 16 : 0;
+        job->err = NMBS_ERROR_NONE;
+    }
+
+    nmbs_error err;
+    if (job->block < plan->blocks_count) {
+        uint16_t* image = job->sub ? job->sub->image + job->image_offset : NULL;
+        err = read_plan_block(sched->nmbs, plan, job->sub, job->block, image);
+        if (job->sub)
+            job->image_offset += subscription_block_words(&plan->blocks[job->block]);
+
+        job->block++;
+    }
+    else {
+        err = read_plan_write(sched->nmbs, plan);
+    }
+
+    if (err != NMBS_ERROR_NONE && job->err == NMBS_ERROR_NONE)
+        job->err = err;
+
+    return job->block == plan->blocks_count && !plan->write_registers;
 }
 
-static nmbs_error read_registers(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint16_t quantity, uint16_t* registers) {
-    if (quantity < 1 || quantity > 125)
-        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+static void sched_job_complete(nmbs_sched_job* job, uint32_t now) {
+    const uint32_t response = now - job->release_ms;
+    if (response > job->response_max_ms)
+        job->response_max_ms = response;
 
-    msg_state_req(nmbs, fc);
-    put_req_header(nmbs, 4);
+    if ((int32_t) (now - job->due_ms) > 0)
+        job->misses++;
 
-    put_2(nmbs, address);
-    put_2(nmbs, quantity);
+    job->runs++;
 
-    NMBS_DEBUG_PRINT("a %d\tq %d ", address, quantity);
+    uint32_t release_ms = job->release_ms + job->period_ms;
+    while ((int32_t) (now - release_ms) >= (int32_t) job->period_ms) {
+        release_ms += job->period_ms;
+        job->skipped++;
+    }
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    sched_job_release(job, release_ms);
 
-    return recv_read_registers_res(nmbs, quantity, registers);
+    if (job->callback)
+        job->callback(job, job->err, job->arg);
 }
 
 
-nmbs_error nmbs_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out) {
-    return read_registers(nmbs, 3, address, quantity, registers_out);
-}
+// Time until the next request is due
+static uint32_t sched_wait(const nmbs_sched* sched, uint32_t now) {
+    if (sched->idle && (int32_t) (sched->idle_until_ms - now) > 0)
+        return sched->idle_until_ms - now;
 
+    if (sched->writes)
+        return 0;
 
-nmbs_error nmbs_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out) {
-    return read_registers(nmbs, 4, address, quantity, registers_out);
+    uint32_t wait = UINT32_MAX;
+    for (uint16_t j = 0; j < sched->jobs_count; j++) {
+        const nmbs_sched_job* job = &sched->jobs[j];
+        const int32_t until = (int32_t) (job->release_ms - now);
+        if (until <= 0)
+            return 0;
+
+        if ((uint32_t) until < wait)
+            wait = (uint32_t) until;
+    }
+
+    return wait;
 }
 
 
-nmbs_error nmbs_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value) {
-    msg_state_req(nmbs, 5);
-    put_req_header(nmbs, 4);
+uint32_t nmbs_sched_poll(nmbs_sched* sched) {
+    nmbs_t* nmbs = sched->nmbs;
+    uint32_t now = nmbs->platform.time_ms(nmbs->platform.arg);
 
-    const uint16_t value_req = value ? 0xFF00 : 0;
+    if (sched->idle) {
+        if ((int32_t) (sched->idle_until_ms - now) > 0)
+            return sched->idle_until_ms - now;
 
-    put_2(nmbs, address);
-    put_2(nmbs, value_req);
+        sched->idle = false;
+    }
 
-    NMBS_DEBUG_PRINT("a %d\tvalue %d ", address, value_req);
+    nmbs_sched_job* job = NULL;
+    for (uint16_t j = 0; j < sched->jobs_count; j++) {
+        nmbs_sched_job* candidate = &sched->jobs[j];
+        if ((int32_t) (now - candidate->release_ms) < 0)
+            continue;
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if (!job || sched_before(candidate->due_ms, candidate->priority, job->due_ms, job->priority, now))
+            job = candidate;
+    }
 
-    if (!nmbs->msg.broadcast)
-        return recv_write_single_coil_res(nmbs, address, value_req);
+    nmbs_sched_write** write = NULL;
+    for (nmbs_sched_write** w = &sched->writes; *w; w = &(*w)->next) {
+        if (!write || sched_before((*w)->due_ms, (*w)->priority, (*write)->due_ms, (*write)->priority, now))
+            write = w;
+    }
 
-    return NMBS_ERROR_NONE;
+    if (write && job && !sched_before((*write)->due_ms, (*write)->priority, job->due_ms, job->priority, now))
+        write = NULL;
+
+    if (!job && !write)
+        return sched_wait(sched, now);
+
+    const uint8_t dest_address_rtu = nmbs->dest_address_rtu;
+    const uint32_t start = now;
+
+    if (write) {
+        nmbs_sched_write* w = *write;
+        const bool broadcast =
+                sched_write_broadcast(sched, w) || (!w->units && w->unit_id == NMBS_BROADCAST_ADDRESS);
+        const bool done = sched_write_step(sched, w);
+        now = nmbs->platform.time_ms(nmbs->platform.arg);
+
+        if (broadcast && NMBS_IS_RTU(nmbs)) {
+            sched->idle = true;
+            sched->idle_until_ms = now + sched->turnaround_ms;
+        }
+
+        if (done) {
+            *write = w->next;
+            if (w->callback)
+                w->callback(w, w->err, w->arg);
+        }
+    }
+    else {
+        const bool done = sched_job_step(sched, job, now);
+        now = nmbs->platform.time_ms(nmbs->platform.arg);
+        if (done)
+            sched_job_complete(job, now);
+    }
+
+    nmbs_set_destination_rtu_address(nmbs, dest_address_rtu);
+    sched->busy_ms += now - start;
+
+    return sched_wait(sched, now);
 }
 
 
-nmbs_error nmbs_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value) {
-    msg_state_req(nmbs, 6);
-    put_req_header(nmbs, 4);
+uint16_t nmbs_sched_utilization(const nmbs_sched* sched) {
+    const uint32_t elapsed = sched->nmbs->platform.time_ms(sched->nmbs->platform.arg) - sched->stats_since_ms;
+    if (elapsed == 0)
+        return 0;
 
-    put_2(nmbs, address);
-    put_2(nmbs, value);
+    const uint64_t utilization = (uint64_t) sched->busy_ms * 1000 / elapsed;
+    return utilization > 1000 ? 1000 : (uint16_t) utilization;
+}
 
-    NMBS_DEBUG_PRINT("a %d\tvalue %d", address, value);
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_sched_reset_stats(nmbs_sched* sched) {
+    for (uint16_t j = 0; j < sched->jobs_count; j++)
+        sched_reset_job_stats(&sched->jobs[j]);
 
-    if (!nmbs->msg.broadcast)
-        return recv_write_single_register_res(nmbs, address, value);
+    sched->busy_ms = 0;
+    sched->stats_since_ms = sched->nmbs->platform.time_ms(sched->nmbs->platform.arg);
+}
+#endif
 
-    return NMBS_ERROR_NONE;
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_GATEWAY)
+void nmbs_gateway_line_create(nmbs_gateway_line* line, nmbs_t* client) {
+    memset(line, 0, sizeof(nmbs_gateway_line));
+    line->client = client;
 }
 
 
-nmbs_error nmbs_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, const nmbs_bitfield coils) {
-    if (quantity < 1 || quantity > 0x07B0)
+nmbs_error nmbs_gateway_create(nmbs_gateway* gw, nmbs_gateway_line* lines, uint8_t lines_count,
+                               const nmbs_gateway_route* routes, uint16_t routes_count, nmbs_gateway_req* reqs,
+                               uint16_t reqs_count, nmbs_gateway_callback callback, void* arg) {
+    if (!gw || !lines || lines_count == 0 || (!routes && routes_count > 0) || !reqs || reqs_count == 0 || !callback)
         return NMBS_ERROR_INVALID_ARGUMENT;
 
-    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    for (uint8_t i = 0; i < lines_count; i++) {
+        if (!lines[i].client || !NMBS_IS_RTU(lines[i].client) || !lines[i].client->platform.time_ms)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
 
-    uint8_t coils_bytes = (quantity + 7) / 8;
+    for (uint16_t i = 0; i < routes_count; i++) {
+        if (routes[i].line >= lines_count)
+            return NMBS_ERROR_INVALID_ARGUMENT;
+    }
 
-    msg_state_req(nmbs, 15);
-    put_req_header(nmbs, 5 + coils_bytes);
+    memset(gw, 0, sizeof(nmbs_gateway));
+    gw->lines = lines;
+    gw->lines_count = lines_count;
+    gw->routes = routes;
+    gw->routes_count = routes_count;
+    gw->callback = callback;
+    gw->arg = arg;
 
-    put_2(nmbs, address);
-    put_2(nmbs, quantity);
-    put_1(nmbs, coils_bytes);
-    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\t", address, quantity, coils_bytes);
+    for (uint16_t i = 0; i < reqs_count; i++)
+        reqs[i].next = i + 1 < reqs_count ? &reqs[i + 1] : NULL;
 
-    NMBS_DEBUG_PRINT("coils ");
-    for (int i = 0; i < coils_bytes; i++) {
-        put_1(nmbs, coils[i]);
-        NMBS_DEBUG_PRINT("%d ", coils[i]);
+    gw->free_list = &reqs[0];
+
+    return NMBS_ERROR_NONE;
+}
+
+
+#ifdef NMBS_GATEWAY_CACHE
+nmbs_error nmbs_gateway_set_cache(nmbs_gateway* gw, const nmbs_gateway_cache_range* ranges, uint16_t ranges_count,
+                                  nmbs_gateway_cache_entry* entries, uint16_t entries_count) {
+    if (!gw || (ranges_count > 0 && (!ranges || !entries || entries_count == 0)))
+        return NMBS_ERROR_INVALID_ARGUMENT;
+
+    for (uint16_t i = 0; i < ranges_count; i++) {
+        if (ranges[i].fc != 2 && ranges[i].fc != 4)
+            return NMBS_ERROR_INVALID_ARGUMENT;
     }
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (ranges_count == 0)
+        entries_count = 0;
 
-    if (!nmbs->msg.broadcast)
-        return recv_write_multiple_coils_res(nmbs, address, quantity);
+    for (uint16_t i = 0; i < entries_count; i++)
+        entries[i].valid = false;
+
+    gw->cache_ranges = ranges;
+    gw->cache_ranges_count = ranges_count;
+    gw->cache = entries_count > 0 ? entries : NULL;
+    gw->cache_count = entries_count;
 
     return NMBS_ERROR_NONE;
 }
+#endif
 
 
-nmbs_error nmbs_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, const uint16_t* registers) {
-    if (quantity < 1 || quantity > 0x007B)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+static uint16_t gateway_get_2(const uint8_t* data) {
+    return (uint16_t) (data[0] << 8) | (uint16_t) data[1];
+}
 
-    if ((uint32_t) address + (uint32_t) quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    const uint8_t registers_bytes = quantity * 2;
+static bool gateway_is_read(uint8_t fc) {
+    return fc >= 1 && fc <= 4;
+}
 
-    msg_state_req(nmbs, 16);
-    put_req_header(nmbs, 5 + registers_bytes);
 
-    put_2(nmbs, address);
-    put_2(nmbs, quantity);
-    put_1(nmbs, registers_bytes);
-    NMBS_DEBUG_PRINT("a %d\tq %d\tb %d\t", address, quantity, registers_bytes);
+static bool gateway_is_write(uint8_t fc) {
+    return fc == 5 || fc == 6 || fc == 15 || fc == 16 || fc == 23;
+}
 
-    NMBS_DEBUG_PRINT("regs ");
-    for (int i = 0; i < quantity; i++) {
-        put_2(nmbs, registers[i]);
-        NMBS_DEBUG_PRINT("%d ", registers[i]);
+
+// Addresses read or written by a request, quantity is 0 for other function codes
+static void gateway_req_range(nmbs_gateway_req* req) {
+    req->address = 0;
+    req->quantity = 0;
+
+    if (req->data_len < 4)
+        return;
+
+    if (gateway_is_read(req->fc) || req->fc == 15 || req->fc == 16) {
+        req->address = gateway_get_2(req->data);
+        req->quantity = gateway_get_2(req->data + 2);
+    }
+    else if (req->fc == 5 || req->fc == 6) {
+        req->address = gateway_get_2(req->data);
+        req->quantity = 1;
+    }
+    else if (req->fc == 23 && req->data_len >= 8) {
+        req->address = gateway_get_2(req->data + 4);
+        req->quantity = gateway_get_2(req->data + 6);
+    }
+}
+
+
+static bool gateway_overlap(const nmbs_gateway_req* req, uint16_t address, uint16_t quantity) {
+    return (uint32_t) req->address < (uint32_t) address + quantity &&
+           (uint32_t) address < (uint32_t) req->address + req->quantity;
+}
+
+
+#ifdef NMBS_GATEWAY_CACHE
+static void gateway_cache_invalidate(nmbs_gateway* gw, const nmbs_gateway_req* req) {
+    for (uint16_t i = 0; i < gw->cache_count; i++) {
+        nmbs_gateway_cache_entry* entry = &gw->cache[i];
+        if (entry->valid && entry->unit_id == req->unit_id && gateway_overlap(req, entry->address, entry->quantity))
+            entry->valid = false;
     }
+}
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    if (!nmbs->msg.broadcast)
-        return recv_write_multiple_registers_res(nmbs, address, quantity);
+static const nmbs_gateway_cache_range* gateway_cache_range(const nmbs_gateway* gw, const nmbs_gateway_req* req) {
+    if (req->fc != 2 && req->fc != 4)
+        return NULL;
 
-    return NMBS_ERROR_NONE;
+    for (uint16_t i = 0; i < gw->cache_ranges_count; i++) {
+        const nmbs_gateway_cache_range* range = &gw->cache_ranges[i];
+        if (range->unit_id == req->unit_id && range->fc == req->fc && req->address >= range->address &&
+            (uint32_t) req->address + req->quantity <= (uint32_t) range->address + range->quantity)
+            return range;
+    }
+
+    return NULL;
 }
 
 
-nmbs_error nmbs_read_file_record(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number, uint16_t* registers,
-                                 uint16_t count) {
-    if (file_number == 0x0000)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+static nmbs_gateway_cache_entry* gateway_cache_find(const nmbs_gateway* gw, const nmbs_gateway_req* req,
+                                                    uint32_t now) {
+    for (uint16_t i = 0; i < gw->cache_count; i++) {
+        nmbs_gateway_cache_entry* entry = &gw->cache[i];
+        if (entry->valid && entry->unit_id == req->unit_id && entry->fc == req->fc &&
+            entry->address == req->address && entry->quantity == req->quantity &&
+            (int32_t) (entry->expiry_ms - now) > 0)
+            return entry;
+    }
 
-    if (record_number > 0x270F)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    return NULL;
+}
 
-    // In expected response: max PDU length = 253, assuming a single file request, (253 - 1 - 1 - 1 - 1) / 2 = 124
-    if (count > 124)
-        return NMBS_ERROR_INVALID_ARGUMENT;
 
-    msg_state_req(nmbs, 20);
-    put_req_header(nmbs, 8);
+// Store the response of a completed read, replacing the entry closest to expiry if the cache is full
+static void gateway_cache_store(nmbs_gateway* gw, const nmbs_gateway_req* req, uint32_t now) {
+    const nmbs_gateway_cache_range* range = gateway_cache_range(gw, req);
+    if (!range || req->data_len > sizeof(gw->cache[0].data))
+        return;
 
-    put_1(nmbs, 7);    // add Byte Count
-    put_1(nmbs, 6);    // add Reference Type const
-    put_2(nmbs, file_number);
-    put_2(nmbs, record_number);
-    put_2(nmbs, count);
-    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fread ", file_number, record_number, count);
+    nmbs_gateway_cache_entry* entry = &gw->cache[0];
+    for (uint16_t i = 0; i < gw->cache_count; i++) {
+        nmbs_gateway_cache_entry* e = &gw->cache[i];
+        if (!e->valid || (int32_t) (e->expiry_ms - now) <= 0) {
+            entry = e;
+            break;
+        }
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        if ((int32_t) (e->expiry_ms - entry->expiry_ms) < 0)
+            entry = e;
+    }
 
-    return recv_read_file_record_res(nmbs, registers, count);
+    entry->valid = true;
+    entry->expiry_ms = now + range->ttl_ms;
+    entry->unit_id = req->unit_id;
+    entry->fc = req->fc;
+    entry->address = req->address;
+    entry->quantity = req->quantity;
+    entry->data_len = req->data_len;
+    memcpy(entry->data, req->data, req->data_len);
 }
+#endif
 
 
-nmbs_error nmbs_write_file_record(nmbs_t* nmbs, uint16_t file_number, uint16_t record_number, const uint16_t* registers,
-                                  uint16_t count) {
-    if (file_number == 0x0000)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+static void gateway_respond(const nmbs_gateway* gw, const nmbs_gateway_req* req, uint8_t fc, const uint8_t* data,
+                            uint8_t data_len) {
+    uint8_t frame[8 + 253];
+    const uint16_t mbap_length = 2 + data_len;
 
-    if (record_number > 0x270F)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    frame[0] = (uint8_t) (req->transaction_id >> 8);
+    frame[1] = (uint8_t) req->transaction_id;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = (uint8_t) (mbap_length >> 8);
+    frame[5] = (uint8_t) mbap_length;
+    frame[6] = req->unit_id;
+    frame[7] = fc;
+    memcpy(frame + 8, data, data_len);
 
-    if (count > 122)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    gw->callback(req->source, frame, 6 + mbap_length, gw->arg);
+}
 
-    const uint16_t data_size = count * 2;
 
-    msg_state_req(nmbs, 21);
-    put_req_header(nmbs, 8 + data_size);
+static void gateway_respond_exception(const nmbs_gateway* gw, const nmbs_gateway_req* req, nmbs_error exception) {
+    const uint8_t code = (uint8_t) exception;
+    gateway_respond(gw, req, req->fc | 0x80, &code, 1);
+}
 
-    put_1(nmbs, 7 + data_size);    // add Byte Count
-    put_1(nmbs, 6);                // add Reference Type const
-    put_2(nmbs, file_number);
-    put_2(nmbs, record_number);
-    put_2(nmbs, count);
-    put_regs(nmbs, registers, count);
-    NMBS_DEBUG_PRINT("a %d\tr %d\tl %d\t fwrite ", file_number, record_number, count);
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+// Answer req with the result of the transaction of forwarded, req itself or one of the requests sharing it
+static void gateway_answer(const nmbs_gateway* gw, const nmbs_gateway_req* req, const nmbs_gateway_req* forwarded,
+                           nmbs_error err) {
+    // Requests of cancelled sources get no response
+    if (!req->source)
+        return;
+
+    if (err == NMBS_ERROR_NONE && forwarded->address_rtu == NMBS_BROADCAST_ADDRESS)
+        gw->callback(req->source, NULL, 0, gw->arg);
+    else if (err == NMBS_ERROR_NONE)
+        gateway_respond(gw, req, forwarded->fc, forwarded->data, forwarded->data_len);
+    else if (nmbs_error_is_exception(err))
+        gateway_respond_exception(gw, req, err);
+    else if (err == NMBS_ERROR_TRANSPORT)
+        gateway_respond_exception(gw, req, NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+    else
+        gateway_respond_exception(gw, req, NMBS_EXCEPTION_GATEWAY_TARGET_FAILED);
+}
 
-    if (!nmbs->msg.broadcast)
-        return recv_write_file_record_res(nmbs, file_number, record_number, registers, count);
 
-    return NMBS_ERROR_NONE;
+static void gateway_req_free(nmbs_gateway* gw, nmbs_gateway_req* req) {
+    req->next = gw->free_list;
+    gw->free_list = req;
+    gw->pending--;
 }
 
 
-nmbs_error nmbs_read_write_registers(nmbs_t* nmbs, uint16_t read_address, uint16_t read_quantity,
-                                     uint16_t* registers_out, uint16_t write_address, uint16_t write_quantity,
-                                     const uint16_t* registers) {
-    if (read_quantity < 1 || read_quantity > 0x007D)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+static void gateway_complete(nmbs_gateway* gw, const nmbs_gateway_line* line, nmbs_gateway_req* req, nmbs_error err) {
+#ifdef NMBS_GATEWAY_CACHE
+    // Reads forwarded while the write was queued may have stored the old values
+    if (gateway_is_write(req->fc))
+        gateway_cache_invalidate(gw, req);
+    else if (err == NMBS_ERROR_NONE && gw->cache)
+        gateway_cache_store(gw, req, line->client->platform.time_ms(line->client->platform.arg));
+#else
+    NMBS_UNUSED_PARAM(line);
+#endif
 
-    if ((uint32_t) read_address + (uint32_t) read_quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    gateway_answer(gw, req, req, err);
 
-    if (write_quantity < 1 || write_quantity > 0x0079)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    nmbs_gateway_req* follower = req->followers;
+    while (follower) {
+        nmbs_gateway_req* next = follower->next;
+        gateway_answer(gw, follower, req, err);
+        gateway_req_free(gw, follower);
+        follower = next;
+    }
 
-    if ((uint32_t) write_address + (uint32_t) write_quantity > ((uint32_t) 0xFFFF) + 1)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    gateway_req_free(gw, req);
+}
 
-    const uint8_t registers_bytes = write_quantity * 2;
 
-    msg_state_req(nmbs, 23);
-    put_req_header(nmbs, 9 + registers_bytes);
+// Forward queued requests until one is waiting for its response
+static void gateway_line_start(nmbs_gateway* gw, nmbs_gateway_line* line) {
+    while (!line->active && line->queue) {
+        nmbs_gateway_req* req = line->queue;
+        line->queue = req->next;
+        line->round = req->round;
 
-    put_2(nmbs, read_address);
-    put_2(nmbs, read_quantity);
-    put_2(nmbs, write_address);
-    put_2(nmbs, write_quantity);
-    put_1(nmbs, registers_bytes);
+        nmbs_set_destination_rtu_address(line->client, req->address_rtu);
+        const nmbs_error err = nmbs_client_begin_forward_pdu(line->client, req->fc, req->data, req->data_len, req->data,
+                                                             sizeof(req->data), &req->data_len);
 
-    NMBS_DEBUG_PRINT("read a %d\tq %d ", read_address, read_quantity);
-    NMBS_DEBUG_PRINT("write a %d\tq %d\tb %d\t", write_address, write_quantity, registers_bytes);
+        // The request could not be sent on the line
+        if (err != NMBS_ERROR_NONE) {
+            gateway_complete(gw, line, req, NMBS_ERROR_TRANSPORT);
+            continue;
+        }
 
-    NMBS_DEBUG_PRINT("regs ");
-    for (int i = 0; i < write_quantity; i++) {
-        put_2(nmbs, registers[i]);
-        NMBS_DEBUG_PRINT("%d ", registers[i]);
+        // Broadcast requests get no response, they're completed right away
+        if (req->address_rtu == NMBS_BROADCAST_ADDRESS) {
+            nmbs_client_step(line->client, NULL);
+            gateway_complete(gw, line, req, NMBS_ERROR_NONE);
+            continue;
+        }
+
+        line->active = req;
     }
+}
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    return recv_read_registers_res(nmbs, read_quantity, registers_out);
-}
+// Each source gets one request forwarded per round, in order of arrival within the round
+static void gateway_enqueue(nmbs_gateway_line* line, nmbs_gateway_req* req) {
+    req->round = line->round;
+    if (line->active && line->active->source == req->source)
+        req->round = line->active->round + 1;
 
+    nmbs_gateway_req** next = &line->queue;
+    for (nmbs_gateway_req* r = line->queue; r; r = r->next) {
+        if (r->source == req->source)
+            req->round = r->round + 1;
+    }
 
-nmbs_error nmbs_read_device_identification_basic(nmbs_t* nmbs, char* vendor_name, char* product_code,
-                                                 char* major_minor_revision, uint8_t buffers_length) {
-    const uint8_t order[3] = {0, 1, 2};
-    char* buffers[3] = {vendor_name, product_code, major_minor_revision};
-    uint8_t total_received = 0;
-    uint8_t next_object_id = 0x00;
+    while (*next && (*next)->round <= req->round)
+        next = &(*next)->next;
 
-    while (next_object_id != 0x7F) {
-        msg_state_req(nmbs, 43);
-        put_msg_header(nmbs, 3);
-        put_1(nmbs, 0x0E);
-        put_1(nmbs, 1);
-        put_1(nmbs, next_object_id);
+    req->next = *next;
+    *next = req;
+}
 
-        nmbs_error err = send_msg(nmbs);
-        if (err != NMBS_ERROR_NONE)
-            return err;
 
-        uint8_t objects_received = 0;
-        err = recv_read_device_identification_res(nmbs, 3, buffers, buffers_length, order, NULL, &next_object_id,
-                                                  &objects_received);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+// Whether a write to the range of req is queued or in progress on the line. Reads submitted after it must see its
+// result, so they can't be served from the cache, or share a read that may be forwarded before it
+static bool gateway_writes_to(const nmbs_gateway_req* write, const nmbs_gateway_req* req) {
+    return gateway_is_write(write->fc) && write->unit_id == req->unit_id &&
+           gateway_overlap(write, req->address, req->quantity);
+}
 
-        total_received += objects_received;
-        if (total_received > 3)
-            return NMBS_ERROR_INVALID_RESPONSE;
 
-        if (objects_received == 0)
-            return NMBS_ERROR_INVALID_RESPONSE;
+static bool gateway_write_pending(const nmbs_gateway_line* line, const nmbs_gateway_req* req) {
+    if (line->active && gateway_writes_to(line->active, req))
+        return true;
+
+    for (const nmbs_gateway_req* r = line->queue; r; r = r->next) {
+        if (gateway_writes_to(r, req))
+            return true;
     }
 
-    return NMBS_ERROR_NONE;
+    return false;
 }
 
 
-nmbs_error nmbs_read_device_identification_regular(nmbs_t* nmbs, char* vendor_url, char* product_name, char* model_name,
-                                                   char* user_application_name, uint8_t buffers_length) {
-    const uint8_t order[7] = {0, 0, 0, 0, 1, 2, 3};
-    char* buffers[4] = {vendor_url, product_name, model_name, user_application_name};
-    uint8_t total_received = 0;
-    uint8_t next_object_id = 0x03;
+static bool gateway_can_share(const nmbs_gateway_req* forwarded, const nmbs_gateway_req* req) {
+    return forwarded->unit_id == req->unit_id && forwarded->fc == req->fc && forwarded->address == req->address &&
+           forwarded->quantity == req->quantity;
+}
 
-    while (next_object_id != 0x7F) {
-        msg_state_req(nmbs, 43);
-        put_req_header(nmbs, 3);
-        put_1(nmbs, 0x0E);
-        put_1(nmbs, 2);
-        put_1(nmbs, next_object_id);
 
-        nmbs_error err = send_msg(nmbs);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+// Add req to the followers of an identical read queued or in progress on the line
+static bool gateway_share(nmbs_gateway_line* line, nmbs_gateway_req* req) {
+    if (!gateway_is_read(req->fc) || req->quantity == 0 || req->data_len != 4 || gateway_write_pending(line, req))
+        return false;
 
-        uint8_t objects_received = 0;
-        err = recv_read_device_identification_res(nmbs, 4, buffers, buffers_length, order, NULL, &next_object_id,
-                                                  &objects_received);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    nmbs_gateway_req* forwarded = NULL;
+    if (line->active && gateway_can_share(line->active, req))
+        forwarded = line->active;
 
-        total_received += objects_received;
-        if (total_received > 4)
-            return NMBS_ERROR_INVALID_RESPONSE;
+    for (nmbs_gateway_req* r = line->queue; r && !forwarded; r = r->next) {
+        if (gateway_can_share(r, req))
+            forwarded = r;
+    }
 
-        if (objects_received == 0)
-            return NMBS_ERROR_INVALID_RESPONSE;
+    if (!forwarded)
+        return false;
+
+    nmbs_gateway_req** next = &forwarded->followers;
+    while (*next)
+        next = &(*next)->next;
+
+    req->next = NULL;
+    *next = req;
+    return true;
+}
+
+
+static const nmbs_gateway_route* gateway_route(const nmbs_gateway* gw, uint8_t unit_id) {
+    for (uint16_t i = 0; i < gw->routes_count; i++) {
+        if (gw->routes[i].unit_id == unit_id)
+            return &gw->routes[i];
     }
 
-    return NMBS_ERROR_NONE;
+    return NULL;
 }
 
 
-nmbs_error nmbs_read_device_identification_extended(nmbs_t* nmbs, uint8_t object_id_start, uint8_t* ids, char** buffers,
-                                                    uint8_t ids_length, uint8_t buffer_length,
-                                                    uint8_t* objects_count_out) {
-    if (object_id_start < 0x80)
+nmbs_error nmbs_gateway_submit(nmbs_gateway* gw, void* source, const uint8_t* frame, uint16_t length) {
+    if (!gw || !source || !frame)
         return NMBS_ERROR_INVALID_ARGUMENT;
 
-    uint8_t total_received = 0;
-    uint8_t next_object_id = object_id_start;
+    if (length < 8)
+        return NMBS_ERROR_INVALID_TCP_MBAP;
 
-    while (next_object_id != 0x7F) {
-        msg_state_req(nmbs, 43);
-        put_req_header(nmbs, 3);
-        put_1(nmbs, 0x0E);
-        put_1(nmbs, 3);
-        put_1(nmbs, next_object_id);
+    // Requests answered right away don't need a slot
+    nmbs_gateway_req local;
+    nmbs_gateway_req* req = gw->free_list ? gw->free_list : &local;
 
-        nmbs_error err = send_msg(nmbs);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    const uint16_t protocol_id = gateway_get_2(frame + 2);
+    const uint16_t mbap_length = gateway_get_2(frame + 4);
+    if (protocol_id != 0 || mbap_length < 2 || mbap_length > 2 + sizeof(local.data) || 6 + mbap_length > length)
+        return NMBS_ERROR_INVALID_TCP_MBAP;
 
-        uint8_t objects_received = 0;
-        err = recv_read_device_identification_res(nmbs, ids_length - total_received, &buffers[total_received],
-                                                  buffer_length, NULL, &ids[total_received], &next_object_id,
-                                                  &objects_received);
-        if (err != NMBS_ERROR_NONE)
-            return err;
+    req->source = source;
+    req->followers = NULL;
+    req->transaction_id = gateway_get_2(frame);
+    req->unit_id = frame[6];
+    req->fc = frame[7];
 
-        total_received += objects_received;
+    const nmbs_gateway_route* route = gateway_route(gw, req->unit_id);
+    if (!route) {
+        gateway_respond_exception(gw, req, NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+        return NMBS_ERROR_NONE;
     }
 
-    *objects_count_out = total_received;
+    if (nmbs_rtu_frame_length((const uint8_t[]) {0, req->fc, 0, 0}, 4, true) == 0) {
+        gateway_respond_exception(gw, req, NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+        return NMBS_ERROR_NONE;
+    }
 
-    return NMBS_ERROR_NONE;
-}
+    req->address_rtu = route->address_rtu;
+    req->data_len = (uint8_t) (mbap_length - 2);
+    memcpy(req->data, frame + 8, req->data_len);
+    gateway_req_range(req);
 
+    nmbs_gateway_line* line = &gw->lines[route->line];
+#ifdef NMBS_GATEWAY_CACHE
+    if (gateway_is_write(req->fc)) {
+        gateway_cache_invalidate(gw, req);
+    }
+    else if (gw->cache && !gateway_write_pending(line, req)) {
+        const nmbs_gateway_cache_entry* entry =
+                gateway_cache_find(gw, req, line->client->platform.time_ms(line->client->platform.arg));
+        if (entry) {
+            gateway_respond(gw, req, req->fc, entry->data, entry->data_len);
+            return NMBS_ERROR_NONE;
+        }
+    }
+#endif
 
-nmbs_error nmbs_read_device_identification(nmbs_t* nmbs, uint8_t object_id, char* buffer, uint8_t buffer_length) {
-    if (object_id > 0x06 && object_id < 0x80)
-        return NMBS_ERROR_INVALID_ARGUMENT;
+    if (req == &local)
+        return NMBS_ERROR_WINDOW_FULL;
 
-    msg_state_req(nmbs, 43);
-    put_req_header(nmbs, 3);
-    put_1(nmbs, 0x0E);
-    put_1(nmbs, 4);
-    put_1(nmbs, object_id);
+    gw->free_list = req->next;
+    gw->pending++;
 
-    const nmbs_error err = send_msg(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+    if (gateway_share(line, req))
+        return NMBS_ERROR_NONE;
 
-    char* buf[1] = {buffer};
-    return recv_read_device_identification_res(nmbs, 1, buf, buffer_length, NULL, NULL, NULL, NULL);
+    gateway_enqueue(line, req);
+    gateway_line_start(gw, line);
+
+    return NMBS_ERROR_NONE;
 }
 
 
-nmbs_error nmbs_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len) {
-    msg_state_req(nmbs, fc);
-    put_msg_header(nmbs, data_len);
+void nmbs_gateway_poll(nmbs_gateway* gw) {
+    for (uint8_t i = 0; i < gw->lines_count; i++) {
+        nmbs_gateway_line* line = &gw->lines[i];
+        if (!line->active)
+            continue;
 
-    NMBS_DEBUG_PRINT("raw ");
-    for (uint16_t i = 0; i < data_len; i++) {
-        put_1(nmbs, data[i]);
-        NMBS_DEBUG_PRINT("%d ", data[i]);
+        nmbs_error err = NMBS_ERROR_NONE;
+        if (nmbs_client_step(line->client, &err) != NMBS_CLIENT_DONE)
+            continue;
+
+        nmbs_gateway_req* req = line->active;
+        line->active = NULL;
+        gateway_complete(gw, line, req, err);
+
+        // Straight to the next request, the line doesn't wait for the next poll
+        gateway_line_start(gw, line);
     }
+}
 
-    return send_msg(nmbs);
+
+static void gateway_cancel_followers(nmbs_gateway* gw, nmbs_gateway_req* req, const void* source) {
+    nmbs_gateway_req** next = &req->followers;
+    while (*next) {
+        nmbs_gateway_req* follower = *next;
+        if (follower->source == source) {
+            *next = follower->next;
+            gateway_req_free(gw, follower);
+        }
+        else {
+            next = &follower->next;
+        }
+    }
 }
 
 
-nmbs_error nmbs_receive_raw_pdu_response(nmbs_t* nmbs, uint8_t* data_out, uint8_t data_out_len) {
-    nmbs_error err = recv_res_header(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+void nmbs_gateway_cancel(nmbs_gateway* gw, const void* source) {
+    for (uint8_t i = 0; i < gw->lines_count; i++) {
+        nmbs_gateway_line* line = &gw->lines[i];
+        if (line->active) {
+            gateway_cancel_followers(gw, line->active, source);
+            if (line->active->source == source)
+                line->active->source = NULL;
+        }
 
-    err = recv(nmbs, data_out_len);
-    if (err != NMBS_ERROR_NONE)
-        return err;
+        // Requests shared by other sources stay queued, with no source of their own
+        nmbs_gateway_req** next = &line->queue;
+        while (*next) {
+            nmbs_gateway_req* req = *next;
+            gateway_cancel_followers(gw, req, source);
 
-    if (data_out) {
-        for (uint16_t i = 0; i < data_out_len; i++)
-            data_out[i] = get_1(nmbs);
-    }
-    else {
-        for (uint16_t i = 0; i < data_out_len; i++)
-            get_1(nmbs);
+            if (req->source == source && !req->followers) {
+                *next = req->next;
+                gateway_req_free(gw, req);
+                continue;
+            }
+
+            if (req->source == source)
+                req->source = NULL;
+
+            next = &req->next;
+        }
     }
+}
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
 
-    return NMBS_ERROR_NONE;
+uint16_t nmbs_gateway_pending(const nmbs_gateway* gw) {
+    return gw->pending;
 }
 #endif
 
@@ -2418,6 +7068,12 @@ nmbs_error nmbs_receive_raw_pdu_response(nmbs_t* nmbs, uint8_t* data_out, uint8_
 #ifndef NMBS_STRERROR_DISABLED
 const char* nmbs_strerror(nmbs_error error) {
     switch (error) {
+        case NMBS_ERROR_WINDOW_FULL:
+            return "asynchronous requests window full";
+
+        case NMBS_ERROR_UNIT_BACKOFF:
+            return "unit in backoff";
+
         case NMBS_ERROR_INVALID_REQUEST:
             return "invalid request received";
 
@@ -2457,6 +7113,12 @@ const char* nmbs_strerror(nmbs_error error) {
         case NMBS_EXCEPTION_SERVER_DEVICE_FAILURE:
             return "modbus exception 4: server device failure";
 
+        case NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE:
+            return "modbus exception 10: gateway path unavailable";
+
+        case NMBS_EXCEPTION_GATEWAY_TARGET_FAILED:
+            return "modbus exception 11: gateway target device failed to respond";
+
         default:
             return "unknown error";
     }
@@ -54,6 +54,8 @@ extern "C" {
  */
 typedef enum nmbs_error {
     // Library errors
+    NMBS_ERROR_UNIT_BACKOFF = -10,    /**< Request not sent, the server unit is in backoff after repeated timeouts */
+    NMBS_ERROR_WINDOW_FULL = -9,      /**< No free slot in the asynchronous requests window */
     NMBS_ERROR_INVALID_REQUEST = -8,  /**< Received invalid request from client */
     NMBS_ERROR_INVALID_UNIT_ID = -7,  /**< Received invalid unit ID in response from server */
     NMBS_ERROR_INVALID_TCP_MBAP = -6, /**< Received invalid TCP MBAP */
@@ -65,10 +67,12 @@ typedef enum nmbs_error {
     NMBS_ERROR_NONE = 0,              /**< No error */
 
     // Modbus exceptions
-    NMBS_EXCEPTION_ILLEGAL_FUNCTION = 1,      /**< Modbus exception 1 */
-    NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS = 2,  /**< Modbus exception 2 */
-    NMBS_EXCEPTION_ILLEGAL_DATA_VALUE = 3,    /**< Modbus exception 3 */
-    NMBS_EXCEPTION_SERVER_DEVICE_FAILURE = 4, /**< Modbus exception 4 */
+    NMBS_EXCEPTION_ILLEGAL_FUNCTION = 1,          /**< Modbus exception 1 */
+    NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS = 2,      /**< Modbus exception 2 */
+    NMBS_EXCEPTION_ILLEGAL_DATA_VALUE = 3,        /**< Modbus exception 3 */
+    NMBS_EXCEPTION_SERVER_DEVICE_FAILURE = 4,     /**< Modbus exception 4 */
+    NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE = 10, /**< Modbus exception 10 */
+    NMBS_EXCEPTION_GATEWAY_TARGET_FAILED = 11,    /**< Modbus exception 11 */
 } nmbs_error;
 
 
@@ -76,7 +80,7 @@ typedef enum nmbs_error {
  * Return whether the nmbs_error is a modbus exception
  * @e nmbs_error to check
  */
-#define nmbs_error_is_exception(e) ((e) > 0 && (e) < 5)
+#define nmbs_error_is_exception(e) (((e) > 0 && (e) < 5) || (e) == 10 || (e) == 11)
 
 #ifndef NMBS_BITFIELD_MAX
 #define NMBS_BITFIELD_MAX 2000
@@ -123,8 +127,100 @@ typedef uint8_t nmbs_bitfield_256[32];
  */
 #define nmbs_bitfield_reset(bf) memset(bf, 0, sizeof(bf))
 
+/** Copy a range of bits between bitfields, 32 bits at a time.
+ * The source and destination offsets don't need to be aligned. The bits around the destination range are left as is.
+ * @param dst destination bitfield
+ * @param dst_offset position of the first destination bit
+ * @param src source bitfield. It must not overlap the destination range
+ * @param src_offset position of the first source bit
+ * @param count number of bits
+ */
+void nmbs_bitfield_copy(uint8_t* dst, uint16_t dst_offset, const uint8_t* src, uint16_t src_offset, uint16_t count);
+
+/** Set or reset a range of bits of a bitfield.
+ * @param bf bitfield
+ * @param offset position of the first bit
+ * @param count number of bits
+ * @param value value of the bits
+ */
+void nmbs_bitfield_fill(uint8_t* bf, uint16_t offset, uint16_t count, bool value);
+
+/** Compare ranges of bits of two bitfields, 32 bits at a time.
+ * @param a first bitfield
+ * @param a_offset position of the first bit of a
+ * @param b second bitfield
+ * @param b_offset position of the first bit of b
+ * @param count number of bits
+ *
+ * @return the index in the ranges of the first bit that differs, or count if the ranges are equal.
+ */
+uint16_t nmbs_bitfield_compare(const uint8_t* a, uint16_t a_offset, const uint8_t* b, uint16_t b_offset,
+                               uint16_t count);
+
+/** Pack an array of bools into a range of bits of a bitfield.
+ * @param bf destination bitfield
+ * @param offset position of the first destination bit
+ * @param values values of the bits
+ * @param count number of bits
+ */
+void nmbs_bitfield_from_bools(uint8_t* bf, uint16_t offset, const bool* values, uint16_t count);
+
+/** Unpack a range of bits of a bitfield to an array of bools.
+ * @param values_out values of the bits
+ * @param bf source bitfield
+ * @param offset position of the first source bit
+ * @param count number of bits
+ */
+void nmbs_bitfield_to_bools(bool* values_out, const uint8_t* bf, uint16_t offset, uint16_t count);
+
+/** Pack an array of bytes, one per bit, into a range of bits of a bitfield. Bits are set for non-zero bytes.
+ * See nmbs_bitfield_from_bools().
+ */
+void nmbs_bitfield_from_bytes(uint8_t* bf, uint16_t offset, const uint8_t* values, uint16_t count);
+
+/** Unpack a range of bits of a bitfield to an array of bytes, one per bit, set to 0 or 1.
+ * See nmbs_bitfield_to_bools().
+ */
+void nmbs_bitfield_to_bytes(uint8_t* values_out, const uint8_t* bf, uint16_t offset, uint16_t count);
+
+/**
+ * Read the register at position r from the big-endian registers buffer buf
+ */
+#define nmbs_be16_read(buf, r) ((uint16_t) (((uint16_t) (buf)[(r) * 2] << 8) | (uint16_t) (buf)[(r) * 2 + 1]))
+
+/**
+ * Write value v to the register at position r of the big-endian registers buffer buf
+ */
+#define nmbs_be16_write(buf, r, v) ((buf)[(r) * 2] = (uint8_t) ((v) >> 8), (buf)[(r) * 2 + 1] = (uint8_t) (v))
+
+/**
+ * Byte order of the 32 and 64-bit values spread over consecutive registers, see nmbs_regs_to_u32().
+ * Letters name the bytes of the value from the most significant one, in the order they are found in the registers.
+ * For 64-bit values, CDAB reverses the order of the 4 registers, BADC swaps the bytes of each register.
+ */
+typedef enum nmbs_word_order {
+    NMBS_WORD_ORDER_ABCD = 0,    // Big-endian, the Modbus default
+    NMBS_WORD_ORDER_CDAB = 1,    // Least significant register first
+    NMBS_WORD_ORDER_BADC = 2,    // Most significant register first, bytes swapped in each register
+    NMBS_WORD_ORDER_DCBA = 3,    // Little-endian
+} nmbs_word_order;
+
+/**
+ * Type of the values decoded by nmbs_read_holding_registers_typed() and nmbs_read_input_registers_typed().
+ * Floating point types are IEEE 754.
+ */
+typedef enum nmbs_value_type {
+    NMBS_VALUE_U32 = 0,
+    NMBS_VALUE_I32 = 1,
+    NMBS_VALUE_F32 = 2,
+    NMBS_VALUE_U64 = 3,
+    NMBS_VALUE_I64 = 4,
+    NMBS_VALUE_F64 = 5,
+} nmbs_value_type;
+
 /**
  * Modbus transport type.
+ * Define `NMBS_TRANSPORT_RTU_ONLY` or `NMBS_TRANSPORT_TCP_ONLY` to build the library for a single transport.
  */
 typedef enum nmbs_transport {
     NMBS_TRANSPORT_RTU = 1,
@@ -132,6 +228,25 @@ typedef enum nmbs_transport {
 } nmbs_transport;
 
 
+/**
+ * Result of passing received data to nmbs_server_feed().
+ */
+typedef enum nmbs_feed_status {
+    NMBS_FEED_ERROR = -1,         /**< Invalid or unexpected data was received */
+    NMBS_FEED_NEED_MORE = 0,      /**< All the data was consumed without completing a request */
+    NMBS_FEED_RESPONSE_READY = 1, /**< A request was handled and its response was passed to write() */
+} nmbs_feed_status;
+
+
+/**
+ * Buffer passed to the writev() platform function.
+ */
+typedef struct nmbs_iovec {
+    const uint8_t* data;
+    uint16_t length;
+} nmbs_iovec;
+
+
 /**
  * nanoMODBUS platform configuration struct.
  * Passed to nmbs_server_create() and nmbs_client_create().
@@ -151,6 +266,32 @@ typedef enum nmbs_transport {
  * values will be treated as transport errors.
  *
  * Additionally, an optional crc_calc() function can be defined to override the default nanoMODBUS CRC calculation function.
+ * With the default function, the CRC of received messages is updated as bytes arrive. A custom function is called once
+ * over the whole message.
+ *
+ * Transports that already delimit messages (e.g. a UART with DMA and idle-line detection) can define the optional
+ * read_frame() function. It should block until a whole frame (RTU ADU or TCP MBAP + PDU) is received and copied to `buf`,
+ * or until `timeout_ms` expires. Its return value should be the length of the frame, `0` on timeout, or `< 0` in case of
+ * error. When read_frame() is defined, every message is received with a single call and parsed in place, and read() is
+ * not used to receive messages. Stale data is still discarded with drain() or read() before sending a request.
+ *
+ * The optional time_ms() function should return a monotonic time in milliseconds. Its value is allowed to wrap
+ * around. It's required by the asynchronous client API to enforce request timeouts.
+ *
+ * Transports with vectored I/O can define the optional writev() function. It should write the `iov_count` buffers of
+ * `iov` in order, as a single message when possible (e.g. with sendmsg(), or with TCP_CORK / MSG_MORE), with the same
+ * timeout and return value semantics as write(). It is used to send user data, such as raw PDUs and coils, without
+ * copying it to the message buffer first, and the RTU CRC without appending it.
+ *
+ * Before sending a request, clients discard any stale data left on the line. The optional bytes_available() function
+ * should return the number of received bytes pending on the transport, or `< 0` if unknown: nothing is read when it
+ * returns 0. The optional drain() function should discard all the pending received data at once, and is called instead
+ * of a non-blocking read().
+ *
+ * read(), write() and crc_calc() can also be bound at compile time, so that they are called directly and can be
+ * inlined: define `NMBS_PLATFORM_READ`, `NMBS_PLATFORM_WRITE` and `NMBS_PLATFORM_CRC_CALC` as function-like macros with
+ * the same arguments, e.g. in a header named by `NMBS_PLATFORM_HEADER`. The corresponding members of this struct are
+ * then ignored. A bound crc_calc() is always called once over the whole message.
  *
  * These methods accept a pointer to arbitrary user-data, which is the arg member of this struct.
  * After the creation of an instance it can be changed with nmbs_set_platform_arg().
@@ -163,11 +304,90 @@ typedef struct nmbs_platform_conf {
                      void* arg); /*!< Bytes write transport function pointer */
     uint16_t (*crc_calc)(const uint8_t* data, uint32_t length,
                          void* arg); /*!< CRC calculation function pointer. Optional */
-    void* arg;                       /*!< User data, will be passed to functions above */
+    int32_t (*read_frame)(uint8_t* buf, uint16_t max_count, int32_t timeout_ms,
+                          void* arg); /*!< Whole frame read transport function pointer. Optional */
+    uint32_t (*time_ms)(void* arg);  /*!< Monotonic time function pointer. Optional */
+    int32_t (*writev)(const nmbs_iovec* iov, uint8_t iov_count, int32_t byte_timeout_ms,
+                      void* arg);           /*!< Gather write transport function pointer. Optional */
+    int32_t (*bytes_available)(void* arg); /*!< Pending received bytes query function pointer. Optional */
+    void (*drain)(void* arg);              /*!< Pending received data discard function pointer. Optional */
+    void* arg;                             /*!< User data, will be passed to functions above */
     uint32_t initialized; /*!< Reserved, workaround for older user code not calling nmbs_platform_conf_create() */
 } nmbs_platform_conf;
 
 
+/**
+ * Contiguous range of values of a register bank table.
+ */
+typedef struct nmbs_bank_table {
+    void* data;       /*!< nmbs_bitfield style bits for coils and discrete inputs, uint16_t array for registers */
+    uint16_t address; /*!< Address of the first value */
+    uint16_t count;   /*!< Number of values */
+} nmbs_bank_table;
+
+
+/**
+ * Memory-backed server data model, see nmbs_callbacks.
+ *
+ * Requests to tables with non-NULL data are served directly from memory, without calling the corresponding callbacks.
+ * Requests outside of a table range get a NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS exception.
+ *
+ * The optional write hooks are called after a write request changed some values, with the smallest range including
+ * all of them. `unit_id` and `arg` are the same as in nmbs_callbacks.
+ *
+ * The optional sync hooks make a bank safe to share between servers running on different threads, e.g. with a
+ * seqlock. Values are copied to a response between read_begin() and read_end(), and the copy is repeated until
+ * read_end() returns true for the token returned by read_begin(). Values are changed between write_begin() and
+ * write_end(), with no other writer in between. The read part of a FC 23 request happens in the same write section as
+ * its write part. The write hooks are called after write_end(). All the sync hooks are passed `sync_arg`.
+ */
+typedef struct nmbs_register_bank {
+    nmbs_bank_table coils;
+    nmbs_bank_table discrete_inputs;
+    nmbs_bank_table holding_registers;
+    nmbs_bank_table input_registers;
+
+    void (*coils_written)(uint16_t address, uint16_t quantity, uint8_t unit_id, void* arg);
+    void (*holding_registers_written)(uint16_t address, uint16_t quantity, uint8_t unit_id, void* arg);
+
+    uint32_t (*read_begin)(void* sync_arg);
+    bool (*read_end)(uint32_t token, void* sync_arg);
+    void (*write_begin)(void* sync_arg);
+    void (*write_end)(void* sync_arg);
+    void* sync_arg;
+} nmbs_register_bank;
+
+
+#if !defined(NMBS_SERVER_DISABLED) && !defined(NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED)
+#ifndef NMBS_DEVICE_ID_OBJECTS_MAX
+/**
+ * Max number of objects of a nmbs_device_id
+ */
+#define NMBS_DEVICE_ID_OBJECTS_MAX 32
+#endif
+
+/**
+ * Device identification object, see nmbs_device_id_create().
+ */
+typedef struct nmbs_device_id_object {
+    uint8_t id;        /*!< Object ID, 0x00 to 0x06 or 0x80 to 0xFF */
+    const char* value; /*!< NUL-terminated value, max 244 characters */
+} nmbs_device_id_object;
+
+/**
+ * Static device identification, with its FC 43 / 14 responses pre-serialized, see nmbs_device_id_create().
+ * All struct members are to be considered private.
+ */
+typedef struct nmbs_device_id {
+    const uint8_t* records;
+    uint16_t offsets[NMBS_DEVICE_ID_OBJECTS_MAX + 1];
+    uint8_t ids[NMBS_DEVICE_ID_OBJECTS_MAX];
+    uint8_t page_end[NMBS_DEVICE_ID_OBJECTS_MAX];
+    uint8_t count;
+} nmbs_device_id;
+#endif
+
+
 /**
  * Modbus server request callbacks. Passed to nmbs_server_create().
  *
@@ -175,6 +395,20 @@ typedef struct nmbs_platform_conf {
  * to nmbs_server_create together with this struct.
  *
  * `unit_id` is the RTU unit ID of the request sender. It is always 0 on TCP.
+ *
+ * The coils_out and inputs_out bitfields of the read callbacks point straight into the response being built.
+ *
+ * The read_holding_registers_be and read_input_registers_be callbacks are alternatives to read_holding_registers and
+ * read_input_registers, and take precedence over them for FC 03 and FC 04 requests. They store `quantity` registers in
+ * big-endian order to `registers_be_out`, which points straight into the response being built, so no intermediate
+ * copy is made. Registers can be stored one at a time with nmbs_be16_write(), or copied in bulk from a register image
+ * with nmbs_registers_to_be(). `registers_be_out` is not aligned, and every register must be written.
+ *
+ * The optional register_bank serves FC 01, 02, 03, 04, 05, 06, 15, 16 and 23 requests directly from memory, see
+ * nmbs_register_bank. It must outlive the server instance.
+ *
+ * The optional device_id answers FC 43 / 14 requests from pre-serialized responses, in place of the
+ * read_device_identification callbacks, see nmbs_device_id_create(). It must outlive the server instance.
  */
 typedef struct nmbs_callbacks {
 #ifndef NMBS_SERVER_DISABLED
@@ -192,9 +426,16 @@ typedef struct nmbs_callbacks {
                                          void* arg);
 #endif
 
+#ifndef NMBS_SERVER_READ_HOLDING_REGISTERS_DISABLED
+    nmbs_error (*read_holding_registers_be)(uint16_t address, uint16_t quantity, uint8_t* registers_be_out,
+                                            uint8_t unit_id, void* arg);
+#endif
+
 #ifndef NMBS_SERVER_READ_INPUT_REGISTERS_DISABLED
     nmbs_error (*read_input_registers)(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id,
                                        void* arg);
+    nmbs_error (*read_input_registers_be)(uint16_t address, uint16_t quantity, uint8_t* registers_be_out,
+                                          uint8_t unit_id, void* arg);
 #endif
 
 #ifndef NMBS_SERVER_WRITE_SINGLE_COIL_DISABLED
@@ -229,7 +470,10 @@ typedef struct nmbs_callbacks {
 #define NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH 128
     nmbs_error (*read_device_identification)(uint8_t object_id, char buffer[NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH]);
     nmbs_error (*read_device_identification_map)(nmbs_bitfield_256 map);
+    const nmbs_device_id* device_id;
 #endif
+
+    const nmbs_register_bank* register_bank;
 #endif
 
     void* arg;               // User data, will be passed to functions above
@@ -237,6 +481,260 @@ typedef struct nmbs_callbacks {
 } nmbs_callbacks;
 
 
+struct nmbs_t;
+
+/**
+ * Completion callback of an asynchronous client request.
+ * `err` is NMBS_ERROR_NONE if successful, a modbus exception, NMBS_ERROR_TIMEOUT if no response was received within
+ * the read timeout, or other errors.
+ */
+typedef void (*nmbs_async_callback)(struct nmbs_t* nmbs, nmbs_error err, void* arg);
+
+/**
+ * Slot of an asynchronous client requests window. All struct members are to be considered private.
+ */
+typedef struct nmbs_async_req {
+    nmbs_async_callback callback;
+    void* arg;
+    void* data_out;
+    const void* data_in;
+    uint8_t* data_out_len;
+    uint32_t deadline_ms;
+    uint16_t tid;
+    uint16_t address;
+    uint16_t quantity;
+    uint16_t value;
+    uint8_t unit_id;
+    uint8_t fc;
+    bool in_flight;
+    bool raw;
+    bool forward;
+    bool expires;
+} nmbs_async_req;
+
+/**
+ * Status of the request started by an nmbs_client_begin_*() function, returned by nmbs_client_step()
+ */
+typedef enum nmbs_client_status {
+    NMBS_CLIENT_IDLE = 0,           /**< No request in progress */
+    NMBS_CLIENT_IN_PROGRESS = 1,    /**< Waiting for the response */
+    NMBS_CLIENT_DONE = 2,           /**< The request is completed, its result is returned in error_out */
+} nmbs_client_status;
+
+/**
+ * Asynchronous client requests window. Passed to nmbs_async_init(). All struct members are to be considered private.
+ */
+typedef struct nmbs_async_window {
+    nmbs_async_req* reqs;
+    uint16_t reqs_count;
+    uint16_t in_flight;
+    uint8_t rx[260];
+    uint16_t rx_len;
+} nmbs_async_window;
+
+
+/**
+ * Modbus data tables, their values are the function codes used to read them
+ */
+typedef enum nmbs_table {
+    NMBS_TABLE_COILS = 1,
+    NMBS_TABLE_DISCRETE_INPUTS = 2,
+    NMBS_TABLE_HOLDING_REGISTERS = 3,
+    NMBS_TABLE_INPUT_REGISTERS = 4,
+} nmbs_table;
+
+
+/**
+ * Range of values read by a read plan, see nmbs_read_plan_create().
+ */
+typedef struct nmbs_read_tag {
+    uint8_t unit_id;   /*!< Server unit ID */
+    nmbs_table table;  /*!< Table to read from */
+    uint16_t address;  /*!< Starting address */
+    uint16_t quantity; /*!< Quantity of values */
+    void* data_out;    /*!< uint16_t array for registers, nmbs_bitfield for coils and discrete inputs. Can be NULL */
+    nmbs_error err;    /*!< Result of the last read of the tag, set by nmbs_read_plan_execute() */
+} nmbs_read_tag;
+
+
+/**
+ * Single read request of a read plan. All struct members are to be considered private.
+ */
+typedef struct nmbs_read_block {
+    uint8_t unit_id;
+    uint8_t fc;
+    uint16_t address;
+    uint16_t quantity;
+    uint16_t first_tag;
+    uint16_t tags_count;
+} nmbs_read_block;
+
+
+/**
+ * Read plan instance, see nmbs_read_plan_create(). All struct members are to be considered private.
+ */
+typedef struct nmbs_read_plan {
+    nmbs_read_tag* tags;
+    uint16_t tags_count;
+    nmbs_read_block* blocks;
+    uint16_t blocks_count;
+
+    const uint16_t* write_registers;
+    uint16_t write_address;
+    uint16_t write_quantity;
+    uint8_t write_unit_id;
+} nmbs_read_plan;
+
+
+/**
+ * Range of consecutive values changed between two executions of a subscription, see nmbs_subscription_create().
+ * The values are only valid during the change callback.
+ */
+typedef struct nmbs_change {
+    uint8_t unit_id;        /*!< Server unit ID */
+    nmbs_table table;       /*!< Table the values were read from */
+    uint16_t address;       /*!< Address of the first changed value */
+    uint16_t quantity;      /*!< Quantity of changed values */
+    uint16_t offset;        /*!< Index of the first changed value in old_values and new_values */
+    const void* old_values; /*!< Previous values of the whole request, NULL on the first successful read */
+    const void* new_values; /*!< New values of the whole request */
+} nmbs_change;
+
+
+/**
+ * Change detection over a read plan, see nmbs_subscription_create(). All struct members are to be considered private.
+ */
+typedef struct nmbs_subscription {
+    nmbs_read_plan* plan;
+    uint16_t* image;
+    void (*on_change)(const nmbs_change* change, void* arg);
+    void* arg;
+} nmbs_subscription;
+
+
+#ifdef NMBS_UNIT_TRACKING
+/**
+ * Response time estimate and backoff state of a server unit, see nmbs_set_unit_tracking().
+ * Response times are measured from the end of a request to the start of its response, in time_ms() units.
+ */
+typedef struct nmbs_unit_health {
+    uint32_t srtt8;         /*!< Smoothed response time, times 8 */
+    uint32_t rttvar4;       /*!< Mean deviation of the response time, times 4 */
+    uint32_t samples;       /*!< Response times measured */
+    uint32_t timeouts;      /*!< Requests timed out */
+    uint32_t skipped;       /*!< Requests not sent because the unit was in backoff */
+    uint32_t backoff_ms;    /*!< Probe interval, 0 if the unit is not in backoff */
+    uint32_t next_probe_ms; /*!< time_ms() value from which a unit in backoff is probed */
+    uint16_t lost;          /*!< Consecutive timeouts */
+} nmbs_unit_health;
+#endif
+
+
+#ifdef NMBS_LOW_STACK
+#ifndef NMBS_SCRATCH_SIZE
+/**
+ * Size of the nmbs_scratch arena used by servers built with NMBS_LOW_STACK. Must be at least 280 bytes, the size of the
+ * largest read file record request
+ */
+#define NMBS_SCRATCH_SIZE 280
+#endif
+
+/**
+ * Scratch arena of the server request handlers, see nmbs_set_scratch().
+ */
+typedef union nmbs_scratch {
+    uint16_t registers[125];
+    nmbs_bitfield bits;
+    uint8_t bytes[NMBS_SCRATCH_SIZE];
+} nmbs_scratch;
+#endif
+
+#ifdef NMBS_STATS
+/**
+ * Number of nmbs_stats counters indexed by nmbs_error or exception codes
+ */
+#define NMBS_STATS_CODES 16
+
+/**
+ * Number of nmbs_stats counters indexed by function code
+ */
+#define NMBS_STATS_FCS 44
+
+/**
+ * Number of buckets of the nmbs_stats latency histogram
+ */
+#define NMBS_STATS_LATENCY_BUCKETS 24
+
+/**
+ * Instance statistics, see nmbs_stats_enable().
+ * A client counts the requests it sends in fc_out and the responses it receives in fc_in, a server the other way around.
+ */
+typedef struct nmbs_stats {
+    uint32_t errors[NMBS_STATS_CODES];     /*!< Transaction results indexed by -nmbs_error, [0] counts successes */
+    uint32_t exceptions[NMBS_STATS_CODES]; /*!< Exceptions received by a client or sent by a server, by code */
+    uint32_t fc_in[NMBS_STATS_FCS];        /*!< Messages received by function code. [0] counts other codes */
+    uint32_t fc_out[NMBS_STATS_FCS];       /*!< Messages sent by function code. [0] counts other codes */
+    uint32_t ignored_frames;               /*!< RTU frames addressed to other servers */
+    uint32_t bytes_in;                     /*!< Bytes received */
+    uint32_t bytes_out;                    /*!< Bytes sent */
+    /** Transaction latency histogram. Bucket 0 counts latencies of 0 clock ticks, bucket i latencies in
+     * [2^(i-1), 2^i), the last bucket everything longer */
+    uint32_t latency[NMBS_STATS_LATENCY_BUCKETS];
+} nmbs_stats;
+
+/**
+ * Monotonic clock used to measure nmbs_stats latencies, called with the platform arg. Microseconds are a good unit.
+ */
+typedef uint32_t (*nmbs_stats_clock)(void* arg);
+#endif
+
+#ifdef NMBS_TRACE
+/**
+ * Number of ADU bytes stored in a nmbs_trace_record
+ */
+#define NMBS_TRACE_ADU_SLICE 18
+
+/**
+ * Direction of a traced message
+ */
+typedef enum nmbs_trace_direction {
+    NMBS_TRACE_RX = 0,
+    NMBS_TRACE_TX = 1,
+} nmbs_trace_direction;
+
+/**
+ * Trace record of a message received or sent, 32 bytes without padding.
+ * Records can be dumped as they are and decoded offline with tools/nmbs_trace_decode.c.
+ */
+typedef struct nmbs_trace_record {
+    uint32_t timestamp;                  /*!< Value of the trace clock, 0 without a clock */
+    uint8_t direction;                   /*!< nmbs_trace_direction */
+    uint8_t unit_id;                     /*!< Unit ID */
+    uint8_t fc;                          /*!< Function code, with the exception bit */
+    int8_t result;                       /*!< nmbs_error of the reception or transmission */
+    uint16_t address;                    /*!< First PDU field after the function code, e.g. a request address */
+    uint16_t quantity;                   /*!< Second PDU field after the function code, e.g. a request quantity */
+    uint16_t length;                     /*!< ADU length */
+    uint8_t adu[NMBS_TRACE_ADU_SLICE];  /*!< First bytes of the ADU */
+} nmbs_trace_record;
+
+/**
+ * Clock used to timestamp trace records, called with the platform arg
+ */
+typedef uint32_t (*nmbs_trace_clock)(void* arg);
+
+/**
+ * Lock-free trace ring buffer, see nmbs_trace_create(). All struct members are to be considered private.
+ */
+typedef struct nmbs_trace {
+    nmbs_trace_record* records;
+    uint32_t mask;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;
+} nmbs_trace;
+#endif
+
 /**
  * nanoMODBUS client/server instance type. All struct members are to be considered private,
  * it is not advisable to read/write them directly.
@@ -252,6 +750,13 @@ typedef struct nmbs_t {
         bool broadcast;
         bool ignored;
         bool complete;
+        bool framed;
+        bool external;
+        uint16_t frame_len;
+        uint16_t crc;
+        uint16_t feed_idx;
+        uint8_t feed_res_unit;
+        bool preloaded;
     } msg;
 
     nmbs_callbacks callbacks;
@@ -264,6 +769,43 @@ typedef struct nmbs_t {
     uint8_t address_rtu;
     uint8_t dest_address_rtu;
     uint16_t current_tid;
+    nmbs_bitfield_256 addresses_rtu;
+
+#ifndef NMBS_CLIENT_DISABLED
+    nmbs_async_window* async;
+    nmbs_async_req step;
+    uint16_t step_rx_len;
+#endif
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_UNIT_TRACKING)
+    uint32_t t35_us;
+    nmbs_unit_health* units;
+    uint16_t units_count;
+    uint16_t units_dead_after;
+    int32_t units_min_timeout_ms;
+    uint32_t units_backoff_min_ms;
+    uint32_t units_backoff_max_ms;
+    nmbs_unit_health* unit;
+    uint32_t unit_sent_ms;
+#endif
+
+#ifdef NMBS_LOW_STACK
+    nmbs_scratch* scratch;
+#endif
+
+#ifdef NMBS_STATS
+    nmbs_stats* stats;
+    nmbs_stats_clock stats_clock;
+    uint32_t stats_start;
+    bool stats_pending;
+    volatile uint32_t stats_seq;
+    volatile bool stats_reset;
+#endif
+
+#ifdef NMBS_TRACE
+    nmbs_trace* trace;
+    nmbs_trace_clock trace_clock;
+#endif
 } nmbs_t;
 
 /**
@@ -286,6 +828,24 @@ void nmbs_set_read_timeout(nmbs_t* nmbs, int32_t timeout_ms);
  */
 void nmbs_set_byte_timeout(nmbs_t* nmbs, int32_t timeout_ms);
 
+/** Compute the RTU character timings of a baud rate.
+ * Above 19200 baud, they are the fixed values recommended by the Modbus over serial line specification.
+ * @param baud_rate baud rate of the serial line, 11 bits per character
+ * @param t15_us max silent interval between two characters of a frame, in microseconds
+ * @param t35_us min silent interval between two frames, in microseconds
+ */
+void nmbs_rtu_char_timings(uint32_t baud_rate, uint32_t* t15_us, uint32_t* t35_us);
+
+/** Set the baud rate of the serial line of a RTU instance.
+ * The byte timeout is set to the 3.5 characters silent interval of the baud rate, rounded up to the millisecond.
+ * Platforms with a coarse timer or a buffering serial driver may need a larger byte timeout, set after this call.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param baud_rate baud rate of the serial line
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if the baud rate is 0.
+ */
+nmbs_error nmbs_set_baud_rate(nmbs_t* nmbs, uint32_t baud_rate);
+
 /** Create a new nmbs_platform_conf struct.
  * @param platform_conf pointer to the nmbs_platform_conf instance
  */
@@ -314,6 +874,46 @@ void nmbs_callbacks_create(nmbs_callbacks* callbacks);
 nmbs_error nmbs_server_create(nmbs_t* nmbs, uint8_t address_rtu, const nmbs_platform_conf* platform_conf,
                               const nmbs_callbacks* callbacks);
 
+/** Set the RTU addresses served by this server instance.
+ * A single instance can serve several virtual slaves on the same line: requests addressed to any of the addresses set
+ * in the bitmap are handled in one parsing pass, and the callbacks can tell them apart through their unit_id argument.
+ * Responses are sent with the address of the request. The address passed to nmbs_server_create() is replaced.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param addresses bitmap of the RTU addresses to serve. The broadcast address cannot be set.
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if no address or the broadcast address is set.
+ */
+nmbs_error nmbs_server_set_rtu_addresses(nmbs_t* nmbs, const nmbs_bitfield_256 addresses);
+
+#ifndef NMBS_SERVER_READ_DEVICE_IDENTIFICATION_DISABLED
+/** Serialize static device identification objects, to be served with the device_id member of nmbs_callbacks.
+ * The objects are stored as they are sent, sorted by ID, and the split of the basic, regular and extended streams in
+ * responses of at most 246 bytes of objects is computed once, so each FC 43 / 14 request is answered by copying a
+ * single range of the records.
+ * @param dev pointer to the nmbs_device_id instance
+ * @param objects objects, in any order. The basic objects 0x00 to 0x02 are mandatory
+ * @param objects_count number of objects, max NMBS_DEVICE_ID_OBJECTS_MAX
+ * @param buf storage of the serialized objects, 2 bytes plus the length of the value of each object. It must outlive
+ * the nmbs_device_id instance. The objects can be discarded after calling this method
+ * @param buf_size size of buf
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if an object is invalid, duplicated or missing, or
+ * if buf is too small.
+ */
+nmbs_error nmbs_device_id_create(nmbs_device_id* dev, const nmbs_device_id_object* objects, uint16_t objects_count,
+                                 uint8_t* buf, uint16_t buf_size);
+#endif
+
+#ifdef NMBS_LOW_STACK
+/** Set the scratch arena of a server built with NMBS_LOW_STACK.
+ * Request handlers decode and encode values in the arena instead of in arrays on the stack. The arena can be shared
+ * by all the instances polled from the same thread. Requests are not handled until an arena is set.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param scratch scratch arena
+ */
+void nmbs_set_scratch(nmbs_t* nmbs, nmbs_scratch* scratch);
+#endif
+
 /** Handle incoming requests to the server.
  * This function should be called in a loop in order to serve any incoming request. Its maximum duration, in case of no
  * received request, is the value set with nmbs_set_read_timeout() (unless set to < 0).
@@ -323,6 +923,46 @@ nmbs_error nmbs_server_create(nmbs_t* nmbs, uint8_t address_rtu, const nmbs_plat
  */
 nmbs_error nmbs_server_poll(nmbs_t* nmbs);
 
+/** Handle a whole request frame that was received outside of the library.
+ * Useful with transports that deliver complete frames, e.g. a UART with DMA and idle-line detection. The frame is
+ * parsed in place without calling the read() platform function, and the response is sent with write().
+ * Frames addressed to other RTU servers are discarded without being parsed.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param frame request frame (RTU ADU including CRC, or TCP MBAP + PDU)
+ * @param length length of the frame
+ *
+ * @return NMBS_ERROR_NONE if successful, other errors otherwise.
+ */
+nmbs_error nmbs_server_process_frame(nmbs_t* nmbs, const uint8_t* frame, uint16_t length);
+
+/** Pass received data to the server without blocking.
+ * Meant for event loops driving many connections, each one with its own nmbs_t instance. Data can be fed in chunks of
+ * any size: an incomplete frame is kept in the instance until the rest of it is received. As soon as a request is
+ * complete it is handled, its response is passed to write(), and the bytes following it are left to the next call.
+ * The read() platform function is never called.
+ * On RTU, the end of a frame is inferred from its function code. Frames addressed to other servers, and the responses
+ * to them, are consumed silently. A frame received in place of the expected response, failing its CRC check or coming
+ * from another unit, is handled as a request.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param data received data
+ * @param length length of the received data
+ * @param consumed_out the number of bytes of data consumed by this call. If NULL, any data following a handled request
+ * is discarded.
+ * @param error_out the error that occurred, if NMBS_FEED_ERROR is returned. Can be NULL.
+ *
+ * @return NMBS_FEED_RESPONSE_READY when a request was handled, NMBS_FEED_NEED_MORE when all the data was consumed,
+ * NMBS_FEED_ERROR otherwise. After an error, the partially received frame is discarded.
+ */
+nmbs_feed_status nmbs_server_feed(nmbs_t* nmbs, const uint8_t* data, uint16_t length, uint16_t* consumed_out,
+                                  nmbs_error* error_out);
+
+/** Discard any partially received frame passed to nmbs_server_feed().
+ * On RTU, this should be called when a silent interval of 3.5 characters is detected on the line. The response of
+ * another server to the last request is still expected after it.
+ * @param nmbs pointer to the nmbs_t instance
+ */
+void nmbs_server_feed_reset(nmbs_t* nmbs);
+
 /** Set the pointer to user data argument passed to server request callbacks.
  * @param nmbs pointer to the nmbs_t instance
  * @param arg user data argument
@@ -345,6 +985,42 @@ nmbs_error nmbs_client_create(nmbs_t* nmbs, const nmbs_platform_conf* platform_c
  */
 void nmbs_set_destination_rtu_address(nmbs_t* nmbs, uint8_t address);
 
+#ifdef NMBS_UNIT_TRACKING
+/** Track the response times of the server units, to derive adaptive response timeouts and back off from dead units.
+ * Each response updates an estimate of the response time of its unit, the mean and mean deviation of RFC 6298.
+ * Requests to a unit with an estimate wait for its response for the estimate plus 4 deviations and a 3.5 characters
+ * interval, within min_timeout_ms and the read timeout. Each timeout doubles the response timeout of the unit.
+ * After nmbs_set_unit_backoff() consecutive timeouts, the unit is in backoff: requests to it fail right away with
+ * NMBS_ERROR_UNIT_BACKOFF, except for a probe request after each backoff interval. The interval doubles with every
+ * failed probe, and the unit is out of backoff as soon as it responds.
+ * Only synchronous requests update the state of the units. The platform time_ms() function is required.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param units state of the units, indexed by unit ID. It is cleared, and must outlive the instance
+ * @param units_count number of units. Requests to higher unit IDs and broadcasts are not tracked
+ * @param min_timeout_ms min adaptive response timeout
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_set_unit_tracking(nmbs_t* nmbs, nmbs_unit_health* units, uint16_t units_count, int32_t min_timeout_ms);
+
+/** Set the backoff parameters of the units tracked with nmbs_set_unit_tracking().
+ * Defaults are 3 consecutive timeouts, and backoff intervals from 1 to 60 seconds.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param dead_after consecutive timeouts after which a unit is in backoff. 0 disables the backoff
+ * @param min_interval_ms first backoff interval
+ * @param max_interval_ms max backoff interval
+ */
+void nmbs_set_unit_backoff(nmbs_t* nmbs, uint16_t dead_after, uint32_t min_interval_ms, uint32_t max_interval_ms);
+
+/** Return the response timeout of the next request to a unit tracked with nmbs_set_unit_tracking().
+ * @param nmbs pointer to the nmbs_t instance
+ * @param unit_id server unit ID
+ *
+ * @return the response timeout in milliseconds, the read timeout if the unit has no estimate or is not tracked.
+ */
+int32_t nmbs_unit_timeout(const nmbs_t* nmbs, uint8_t unit_id);
+#endif
+
 /** Send a FC 01 (0x01) Read Coils request
  * @param nmbs pointer to the nmbs_t instance
  * @param address starting address
@@ -385,6 +1061,34 @@ nmbs_error nmbs_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t
  */
 nmbs_error nmbs_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out);
 
+/** Send a FC 03 (0x03) Read Holding Registers request for 32 or 64-bit values.
+ * The values are decoded straight from the response, without an intermediate registers array.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param address starting address
+ * @param count quantity of values. 2 registers are read for each 32-bit value, 4 for each 64-bit value
+ * @param type type of the values
+ * @param order byte order of the values in the registers
+ * @param values_out array of count values of the specified type, where the values will be stored
+ *
+ * @return NMBS_ERROR_NONE if successful, other errors otherwise.
+ */
+nmbs_error nmbs_read_holding_registers_typed(nmbs_t* nmbs, uint16_t address, uint16_t count, nmbs_value_type type,
+                                             nmbs_word_order order, void* values_out);
+
+/** Send a FC 04 (0x04) Read Input Registers request for 32 or 64-bit values.
+ * See nmbs_read_holding_registers_typed().
+ * @param nmbs pointer to the nmbs_t instance
+ * @param address starting address
+ * @param count quantity of values
+ * @param type type of the values
+ * @param order byte order of the values in the registers
+ * @param values_out array of count values of the specified type, where the values will be stored
+ *
+ * @return NMBS_ERROR_NONE if successful, other errors otherwise.
+ */
+nmbs_error nmbs_read_input_registers_typed(nmbs_t* nmbs, uint16_t address, uint16_t count, nmbs_value_type type,
+                                           nmbs_word_order order, void* values_out);
+
 /** Send a FC 05 (0x05) Write Single Coil request
  * @param nmbs pointer to the nmbs_t instance
  * @param address coil address
@@ -532,13 +1236,1125 @@ nmbs_error nmbs_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint
  * @return NMBS_ERROR_NONE if successful, other errors otherwise.
  */
 nmbs_error nmbs_receive_raw_pdu_response(nmbs_t* nmbs, uint8_t* data_out, uint8_t data_out_len);
-#endif
 
-/** Calculate the Modbus CRC of some data.
- * @param data Data
- * @param length Length of the data
+/** Create a read plan, merging the tags that can be read with the same request.
+ * Tags of the same unit ID and table are merged when the gap between them is no larger than the specified gap, as long
+ * as the merged range stays within the limits of a single request: 125 registers or 2000 coils/discrete inputs.
+ * Overlapping tags are allowed. The tags array is sorted in place by unit ID, table and address.
+ * @param plan pointer to the nmbs_read_plan instance
+ * @param tags tags to read. They must outlive the plan
+ * @param tags_count number of tags
+ * @param blocks requests of the plan. In the worst case, one for each tag
+ * @param blocks_max number of elements of the blocks array
+ * @param registers_gap max number of unused registers between merged tags
+ * @param coils_gap max number of unused coils or discrete inputs between merged tags
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if a tag is invalid or the blocks array is too
+ * small.
  */
-uint16_t nmbs_crc_calc(const uint8_t* data, uint32_t length, void* arg);
+nmbs_error nmbs_read_plan_create(nmbs_read_plan* plan, nmbs_read_tag* tags, uint16_t tags_count,
+                                 nmbs_read_block* blocks, uint16_t blocks_max, uint16_t registers_gap,
+                                 uint16_t coils_gap);
+
+/** Return the number of requests sent by each execution of a read plan, excluding a standalone pending write.
+ * @param plan pointer to the nmbs_read_plan instance
+ */
+uint16_t nmbs_read_plan_requests(const nmbs_read_plan* plan);
+
+/** Set a holding registers write to perform with the next execution of a read plan.
+ * The write is sent together with the first holding registers read of the same unit ID, using a FC 23 (0x17)
+ * Read/Write Multiple Registers request. Like every FC 23 request, the write is performed before the read.
+ * If the plan reads no holding registers from the unit ID, the write is sent as a separate FC 16 (0x10) request.
+ * @param plan pointer to the nmbs_read_plan instance
+ * @param unit_id server unit ID
+ * @param address starting address
+ * @param quantity quantity of registers, max 121
+ * @param registers registers to write. They must stay valid until the next execution of the plan
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_read_plan_set_write(nmbs_read_plan* plan, uint8_t unit_id, uint16_t address, uint16_t quantity,
+                                    const uint16_t* registers);
+
+/** Execute a read plan, reading all its tags.
+ * The result of each tag read is stored in its err member. A failed request doesn't stop the execution of the plan.
+ * The destination address of the client is restored after the execution.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param plan pointer to the nmbs_read_plan instance
+ *
+ * @return NMBS_ERROR_NONE if all the requests were successful, the error of the first failed request otherwise.
+ */
+nmbs_error nmbs_read_plan_execute(nmbs_t* nmbs, nmbs_read_plan* plan);
+
+/** Return the size of the image a subscription needs to keep the previous values of a read plan.
+ * That's one word per register and one word per 16 coils or discrete inputs of each request, plus one word per 16
+ * requests.
+ * @param plan pointer to the nmbs_read_plan instance
+ *
+ * @return the image size, in uint16_t words
+ */
+uint32_t nmbs_subscription_image_size(const nmbs_read_plan* plan);
+
+/** Create a subscription, reporting the values that change between executions of a read plan.
+ * The response of each request of the plan is compared to the previous one, and on_change is called with every
+ * range of consecutive values that differ, registers or bits. For register tables, old_values and new_values are
+ * uint16_t arrays, for coils and discrete inputs they are nmbs_bitfield. The first successful read of a request reports
+ * all its values, with a NULL old_values.
+ * @param sub pointer to the nmbs_subscription instance
+ * @param plan read plan. It must outlive the subscription
+ * @param image previous values, of at least nmbs_subscription_image_size() words
+ * @param image_size size of the image, in uint16_t words
+ * @param on_change change callback, called by nmbs_subscription_execute()
+ * @param arg user data passed to on_change
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if the image is too small.
+ */
+nmbs_error nmbs_subscription_create(nmbs_subscription* sub, nmbs_read_plan* plan, uint16_t* image,
+                                    uint32_t image_size, void (*on_change)(const nmbs_change* change, void* arg),
+                                    void* arg);
+
+/** Execute the read plan of a subscription, like nmbs_read_plan_execute(), and report the values that changed.
+ * Failed requests report nothing, and keep their previous values.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param sub pointer to the nmbs_subscription instance
+ *
+ * @return NMBS_ERROR_NONE if all the requests were successful, the error of the first failed request otherwise.
+ */
+nmbs_error nmbs_subscription_execute(nmbs_t* nmbs, nmbs_subscription* sub);
+
+/** Forget the previous values of a subscription, so that its next execution reports all of them.
+ * @param sub pointer to the nmbs_subscription instance
+ */
+void nmbs_subscription_reset(nmbs_subscription* sub);
+
+/** Enable the asynchronous client API on a client instance.
+ * Asynchronous requests are sent right away, without waiting for the responses of the ones still in flight. Their
+ * responses are matched by TCP transaction ID, so they can arrive in any order, and are received by nmbs_async_poll().
+ * On RTU, only one request can be in flight at a time.
+ * Every request occupies a slot of the window until its callback is called. Each request expires after the read
+ * timeout set at the moment it was sent, so nmbs_set_read_timeout() can be used to set per-request timeouts. If the
+ * read timeout is < 0, requests never expire.
+ * Once enabled, the blocking client methods should not be used on the same instance, since they would receive the
+ * responses to the asynchronous requests.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param window pointer to the nmbs_async_window instance. It must outlive the nmbs_t instance
+ * @param reqs requests slots. Their count is the max number of requests in flight
+ * @param reqs_count number of requests slots
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if the time_ms() platform function is not defined
+ * or no request slots are provided.
+ */
+nmbs_error nmbs_async_init(nmbs_t* nmbs, nmbs_async_window* window, nmbs_async_req* reqs, uint16_t reqs_count);
+
+/** Send a FC 01 (0x01) Read Coils request without waiting for its response.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param address starting address
+ * @param quantity quantity of coils
+ * @param coils_out nmbs_bitfield where the coils will be stored. It must stay valid until the callback is called
+ * @param callback function called when the request is completed
+ * @param arg user data argument passed to the callback
+ *
+ * @return NMBS_ERROR_NONE if the request was sent, NMBS_ERROR_WINDOW_FULL if all the window slots are in use, other
+ * errors otherwise. The callback is called only if the request was sent.
+ */
+nmbs_error nmbs_async_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out,
+                                 nmbs_async_callback callback, void* arg);
+
+/** Send a FC 02 (0x02) Read Discrete Inputs request without waiting for its response.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield inputs_out,
+                                           nmbs_async_callback callback, void* arg);
+
+/** Send a FC 03 (0x03) Read Holding Registers request without waiting for its response.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                             uint16_t* registers_out, nmbs_async_callback callback, void* arg);
+
+/** Send a FC 04 (0x04) Read Input Registers request without waiting for its response.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity, uint16_t* registers_out,
+                                           nmbs_async_callback callback, void* arg);
+
+/** Send a FC 05 (0x05) Write Single Coil request without waiting for its response.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value, nmbs_async_callback callback,
+                                        void* arg);
+
+/** Send a FC 06 (0x06) Write Single Register request without waiting for its response.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value,
+                                            nmbs_async_callback callback, void* arg);
+
+/** Send a FC 15 (0x0F) Write Multiple Coils request without waiting for its response.
+ * The coils are copied to the request before this function returns.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                           const nmbs_bitfield coils, nmbs_async_callback callback, void* arg);
+
+/** Send a FC 16 (0x10) Write Multiple Registers request without waiting for its response.
+ * The registers are copied to the request before this function returns.
+ * See nmbs_async_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_async_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                               const uint16_t* registers, nmbs_async_callback callback, void* arg);
+
+/** Send a raw Modbus PDU without waiting for its response.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param fc request function code
+ * @param data request data. It's up to the caller to convert this data to network byte order
+ * @param data_len length of the data parameter
+ * @param data_out response data, see nmbs_receive_raw_pdu_response(). It must stay valid until the callback is called.
+ * Can be NULL.
+ * @param data_out_len number of bytes to receive
+ * @param callback function called when the request is completed
+ * @param arg user data argument passed to the callback
+ *
+ * @return NMBS_ERROR_NONE if the request was sent, NMBS_ERROR_WINDOW_FULL if all the window slots are in use, other
+ * errors otherwise.
+ */
+nmbs_error nmbs_async_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len, uint8_t* data_out,
+                                   uint8_t data_out_len, nmbs_async_callback callback, void* arg);
+
+/** Receive the responses to asynchronous requests, without blocking.
+ * Reads the available data with a zero timeout, calls the callbacks of the completed and the expired requests, and
+ * returns. It should be called periodically, or when the transport has data available.
+ * Responses to expired requests are discarded.
+ * @param nmbs pointer to the nmbs_t instance
+ *
+ * @return NMBS_ERROR_NONE if successful, other errors otherwise. On transport or framing errors, all the requests in
+ * flight are completed with the same error.
+ */
+nmbs_error nmbs_async_poll(nmbs_t* nmbs);
+
+/** Return the number of asynchronous requests in flight.
+ * @param nmbs pointer to the nmbs_t instance
+ */
+uint16_t nmbs_async_in_flight(const nmbs_t* nmbs);
+
+/** Complete all the asynchronous requests in flight with the specified error, e.g. after a disconnection.
+ * Partially received responses are discarded.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param err error passed to the callbacks
+ */
+void nmbs_async_cancel(nmbs_t* nmbs, nmbs_error err);
+
+/** Start a FC 01 (0x01) Read Coils request, to be completed by nmbs_client_step().
+ * The request is sent right away. Its response is then received by nmbs_client_step() as bytes become available,
+ * without ever blocking, so that a bare-metal main loop can run other tasks in the meantime. The request context is
+ * kept in the nmbs_t instance, so only one request can be in progress at a time. The request expires after the read
+ * timeout, if >= 0. The time_ms() platform function is required.
+ * The blocking client methods and the asynchronous client API should not be used while a request is in progress.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param address starting address
+ * @param quantity quantity of coils
+ * @param coils_out nmbs_bitfield where the coils will be stored. It must stay valid until the request is completed
+ *
+ * @return NMBS_ERROR_NONE if the request was sent, NMBS_ERROR_WINDOW_FULL if a request is already in progress,
+ * NMBS_ERROR_INVALID_ARGUMENT if the time_ms() platform function is not defined, other errors otherwise.
+ */
+nmbs_error nmbs_client_begin_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out);
+
+/** Start a FC 02 (0x02) Read Discrete Inputs request, to be completed by nmbs_client_step().
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_read_discrete_inputs(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  nmbs_bitfield inputs_out);
+
+/** Start a FC 03 (0x03) Read Holding Registers request, to be completed by nmbs_client_step().
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_read_holding_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                    uint16_t* registers_out);
+
+/** Start a FC 04 (0x04) Read Input Registers request, to be completed by nmbs_client_step().
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_read_input_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  uint16_t* registers_out);
+
+/** Start a FC 05 (0x05) Write Single Coil request, to be completed by nmbs_client_step().
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value);
+
+/** Start a FC 06 (0x06) Write Single Register request, to be completed by nmbs_client_step().
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t value);
+
+/** Start a FC 15 (0x0F) Write Multiple Coils request, to be completed by nmbs_client_step().
+ * The coils are copied to the request before this function returns.
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                  const nmbs_bitfield coils);
+
+/** Start a FC 16 (0x10) Write Multiple Registers request, to be completed by nmbs_client_step().
+ * The registers are copied to the request before this function returns.
+ * See nmbs_client_begin_read_coils() for the meaning of the parameters and the return value.
+ */
+nmbs_error nmbs_client_begin_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_t quantity,
+                                                      const uint16_t* registers);
+
+/** Send a raw Modbus PDU, its response to be received by nmbs_client_step().
+ * @param nmbs pointer to the nmbs_t instance
+ * @param fc request function code
+ * @param data request data. It's up to the caller to convert this data to network byte order
+ * @param data_len length of the data parameter
+ * @param data_out response data, see nmbs_receive_raw_pdu_response(). It must stay valid until the request is
+ * completed. Can be NULL.
+ * @param data_out_len number of bytes to receive
+ *
+ * @return see nmbs_client_begin_read_coils()
+ */
+nmbs_error nmbs_client_begin_send_raw_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len,
+                                          uint8_t* data_out, uint8_t data_out_len);
+
+/** Forward a raw Modbus PDU, its response of any length to be received by nmbs_client_step().
+ * The length of the response is inferred from its function code with nmbs_rtu_frame_length() on RTU, and from the
+ * MBAP header on TCP. On RTU, function codes not known to nmbs_rtu_frame_length() are rejected.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param fc request function code
+ * @param data request data. It's up to the caller to convert this data to network byte order
+ * @param data_len length of the data parameter
+ * @param data_out response data, without the function code. It must stay valid until the request is completed. It
+ * can be the same buffer as data
+ * @param data_out_size size of data_out. Longer responses complete the request with NMBS_ERROR_INVALID_RESPONSE
+ * @param data_out_len length of the response data, set when the request is completed successfully
+ *
+ * @return see nmbs_client_begin_read_coils()
+ */
+nmbs_error nmbs_client_begin_forward_pdu(nmbs_t* nmbs, uint8_t fc, const uint8_t* data, uint16_t data_len,
+                                         uint8_t* data_out, uint8_t data_out_size, uint8_t* data_out_len);
+
+/** Advance the request started by an nmbs_client_begin_*() function, without blocking.
+ * Reads the available response bytes with a zero timeout and returns. It should be called periodically, e.g. from the
+ * main loop, or when the transport has data available.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param error_out result of the request when NMBS_CLIENT_DONE is returned: NMBS_ERROR_NONE if successful, a modbus
+ * exception, NMBS_ERROR_TIMEOUT if no response was received within the read timeout, or other errors. Can be NULL.
+ *
+ * @return NMBS_CLIENT_IN_PROGRESS while waiting for the response, then NMBS_CLIENT_DONE once, when the request is
+ * completed. NMBS_CLIENT_IDLE if no request is in progress.
+ */
+nmbs_client_status nmbs_client_step(nmbs_t* nmbs, nmbs_error* error_out);
+#endif
+
+/**
+ * Initial value of a running Modbus CRC. Pass it to the first nmbs_crc_update() call.
+ */
+static const uint16_t NMBS_CRC_INIT = 0xFFFF;
+
+/** Calculate the Modbus CRC of some data.
+ * The lookup method can be selected at compile time by defining `NMBS_CRC_TABLE` (256-entry table) or
+ * `NMBS_CRC_SLICE_BY_4` (4 tables, processing 4 bytes per iteration). The default is the bit-by-bit algorithm.
+ * @param data Data
+ * @param length Length of the data
+ *
+ * @return the CRC, with its bytes swapped so that it can be appended to a message in network byte order
+ */
+uint16_t nmbs_crc_calc(const uint8_t* data, uint32_t length, void* arg);
+
+/** Copy registers to a buffer in big-endian order, e.g. from a register image in a read_holding_registers_be callback.
+ * @param registers_be_out destination buffer, 2 * quantity bytes long. It doesn't need to be aligned
+ * @param registers registers in host byte order
+ * @param quantity quantity of registers
+ */
+void nmbs_registers_to_be(uint8_t* registers_be_out, const uint16_t* registers, uint16_t quantity);
+
+/** Convert registers to unsigned 32-bit values, e.g. after nmbs_read_holding_registers().
+ * Each value is made of 2 consecutive registers. The other nmbs_regs_to_*() functions work the same way, 64-bit values
+ * are made of 4 registers. The conversion is done in bulk, in loops meant to be vectorized by the compiler.
+ * @param values_out converted values
+ * @param registers registers in host byte order, 2 * count registers long
+ * @param count quantity of values
+ * @param order byte order of the values in the registers
+ */
+void nmbs_regs_to_u32(uint32_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert registers to signed 32-bit values.
+ * See nmbs_regs_to_u32().
+ */
+void nmbs_regs_to_i32(int32_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert registers to IEEE 754 single precision values.
+ * See nmbs_regs_to_u32().
+ */
+void nmbs_regs_to_f32(float* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert registers to unsigned 64-bit values.
+ * See nmbs_regs_to_u32().
+ */
+void nmbs_regs_to_u64(uint64_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert registers to signed 64-bit values.
+ * See nmbs_regs_to_u32().
+ */
+void nmbs_regs_to_i64(int64_t* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert registers to IEEE 754 double precision values.
+ * See nmbs_regs_to_u32().
+ */
+void nmbs_regs_to_f64(double* values_out, const uint16_t* registers, uint16_t count, nmbs_word_order order);
+
+/** Convert unsigned 32-bit values to registers, e.g. before nmbs_write_multiple_registers().
+ * Each value is stored in 2 consecutive registers. The other nmbs_*_to_regs() functions work the same way, 64-bit
+ * values are stored in 4 registers.
+ * @param registers_out registers in host byte order, 2 * count registers long
+ * @param values values to convert
+ * @param count quantity of values
+ * @param order byte order of the values in the registers
+ */
+void nmbs_u32_to_regs(uint16_t* registers_out, const uint32_t* values, uint16_t count, nmbs_word_order order);
+
+/** Convert signed 32-bit values to registers.
+ * See nmbs_u32_to_regs().
+ */
+void nmbs_i32_to_regs(uint16_t* registers_out, const int32_t* values, uint16_t count, nmbs_word_order order);
+
+/** Convert IEEE 754 single precision values to registers.
+ * See nmbs_u32_to_regs().
+ */
+void nmbs_f32_to_regs(uint16_t* registers_out, const float* values, uint16_t count, nmbs_word_order order);
+
+/** Convert unsigned 64-bit values to registers.
+ * See nmbs_u32_to_regs().
+ */
+void nmbs_u64_to_regs(uint16_t* registers_out, const uint64_t* values, uint16_t count, nmbs_word_order order);
+
+/** Convert signed 64-bit values to registers.
+ * See nmbs_u32_to_regs().
+ */
+void nmbs_i64_to_regs(uint16_t* registers_out, const int64_t* values, uint16_t count, nmbs_word_order order);
+
+/** Convert IEEE 754 double precision values to registers.
+ * See nmbs_u32_to_regs().
+ */
+void nmbs_f64_to_regs(uint16_t* registers_out, const double* values, uint16_t count, nmbs_word_order order);
+
+/** Update a running Modbus CRC with more data.
+ * Useful to compute the CRC as bytes arrive, e.g. in a receive interrupt. Start with NMBS_CRC_INIT.
+ * Feeding a whole RTU frame, CRC included, results in 0 if the CRC is valid.
+ * @param crc running CRC value
+ * @param data Data
+ * @param length Length of the data
+ *
+ * @return the updated running CRC. Unlike nmbs_crc_calc(), its bytes are not swapped
+ */
+uint16_t nmbs_crc_update(uint16_t crc, const uint8_t* data, uint32_t length);
+
+/** Predict the length of an RTU frame from its first bytes.
+ * Request and response lengths are inferred from the function code and, for variable-length messages, from their byte
+ * count fields. Call it again with more bytes as long as the returned value is greater than count.
+ * @param buf the first bytes of the frame, starting with the unit ID
+ * @param count number of bytes in buf
+ * @param response whether the frame is a response
+ *
+ * @return the frame length including the CRC, or the number of bytes needed to infer it if greater than count.
+ * 0 if the function code is not known.
+ */
+uint16_t nmbs_rtu_frame_length(const uint8_t* buf, uint16_t count, bool response);
+
+#ifdef NMBS_STATS
+/** Enable the collection of statistics on an instance.
+ * Counters are updated by nmbs_server_poll(), nmbs_server_process_frame(), nmbs_server_feed(), the client request
+ * functions and nmbs_async_poll(). A transaction starts when a server receives the first byte of a request, or when a
+ * client sends a request, and ends when the called function returns. Its result is counted in `errors` or
+ * `exceptions`, and its latency in the histogram. Asynchronous requests only count their results.
+ * Requests rejected by argument validation before anything is sent are not counted.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param stats statistics storage. It is cleared, and must stay valid for the lifetime of the instance
+ * @param clock monotonic clock to measure latencies. Can be NULL, in which case latencies are not measured
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise
+ */
+nmbs_error nmbs_stats_enable(nmbs_t* nmbs, nmbs_stats* stats, nmbs_stats_clock clock);
+
+/** Copy the current statistics of an instance.
+ * Can be called from another thread than the one using the instance. Counters are updated under a sequence counter,
+ * and the copy is retried until it is consistent.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param stats_out copy of the statistics
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT if statistics are not enabled
+ */
+nmbs_error nmbs_stats_snapshot(const nmbs_t* nmbs, nmbs_stats* stats_out);
+
+/** Reset the statistics of an instance.
+ * Can be called from another thread than the one using the instance. The counters are cleared by the thread using
+ * the instance before its next update, snapshots taken in the meantime are already cleared.
+ * @param nmbs pointer to the nmbs_t instance
+ */
+void nmbs_stats_reset(nmbs_t* nmbs);
+#endif
+
+#ifdef NMBS_TRACE
+/** Create a trace ring buffer.
+ * The ring has a single producer, the instance it is attached to with nmbs_trace_enable(), and a single consumer
+ * calling nmbs_trace_read(), which can run in another thread or in an interrupt. When the ring is full, new records are
+ * dropped and counted.
+ * @param trace pointer to the nmbs_trace instance
+ * @param records records storage
+ * @param count number of records, must be a power of 2
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise
+ */
+nmbs_error nmbs_trace_create(nmbs_trace* trace, nmbs_trace_record* records, uint32_t count);
+
+/** Record the messages received and sent by an instance in a trace ring buffer.
+ * A record is added for each message parsed, with the result of its CRC check, and for each message sent, with the
+ * result of the write.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param trace trace ring buffer, or NULL to stop tracing
+ * @param clock clock used to timestamp records. Can be NULL
+ */
+void nmbs_trace_enable(nmbs_t* nmbs, nmbs_trace* trace, nmbs_trace_clock clock);
+
+/** Take the oldest records out of a trace ring buffer.
+ * @param trace pointer to the nmbs_trace instance
+ * @param records_out records, oldest first
+ * @param count maximum number of records to take
+ *
+ * @return the number of records taken
+ */
+uint32_t nmbs_trace_read(nmbs_trace* trace, nmbs_trace_record* records_out, uint32_t count);
+
+/** Number of records dropped because the trace ring buffer was full.
+ * @param trace pointer to the nmbs_trace instance
+ */
+uint32_t nmbs_trace_dropped(const nmbs_trace* trace);
+#endif
+
+#ifdef NMBS_RING
+#ifndef NMBS_RING_CACHE_LINE
+/**
+ * Size of a cache line, or of the granule of the coherency protocol, used to keep the producer and consumer indexes of
+ * a nmbs_ring apart. 32 on Cortex-M7, 4 is enough on MCUs without a data cache
+ */
+#define NMBS_RING_CACHE_LINE 64
+#endif
+
+/**
+ * Lock-free single-producer, single-consumer byte ring buffer, see nmbs_ring_create(). The indexes written by the
+ * producer and the consumer are padded apart, so that they never share a cache line.
+ * All struct members are to be considered private.
+ */
+typedef struct nmbs_ring {
+    uint8_t* buf;
+    uint32_t mask;
+    bool (*wait)(int32_t timeout_ms, void* arg);
+    void (*notify)(void* arg);
+    void* arg;
+    uint8_t pad_conf[NMBS_RING_CACHE_LINE];
+
+    // Written by the producer
+    volatile uint32_t head;
+    volatile uint32_t dropped;
+    uint32_t tail_cached;
+    uint8_t pad_head[NMBS_RING_CACHE_LINE];
+
+    // Written by the consumer
+    volatile uint32_t tail;
+    uint32_t head_cached;
+    uint8_t pad_tail[NMBS_RING_CACHE_LINE];
+} nmbs_ring;
+
+/**
+ * Circular DMA reception into a nmbs_ring, see nmbs_ring_dma_create(). All struct members are to be considered private.
+ */
+typedef struct nmbs_ring_dma {
+    nmbs_ring* ring;
+    const uint8_t* buf;
+    uint32_t size;
+    uint32_t pos;
+} nmbs_ring_dma;
+
+/**
+ * Serial port made of a reception and a transmission nmbs_ring, passed as the platform arg of nmbs_ring_read() and
+ * nmbs_ring_write().
+ */
+typedef struct nmbs_ring_port {
+    nmbs_ring* rx;               /*!< Ring filled by the reception interrupt or DMA */
+    nmbs_ring* tx;               /*!< Ring drained by the transmission interrupt or DMA */
+    void (*tx_start)(void* arg); /*!< Called after bytes are added to tx, to start the transmission if idle */
+    void* arg;                   /*!< User data passed to tx_start */
+} nmbs_ring_port;
+
+/** Create a ring buffer.
+ * Bytes are added by a single producer, e.g. a reception interrupt, and taken by a single consumer, e.g. the thread
+ * running the nanoMODBUS instance, without locks. Each call to nmbs_ring_push() or nmbs_ring_pop() copies a whole
+ * chunk and updates the ring with a single index store.
+ * @param ring pointer to the nmbs_ring instance
+ * @param buf ring storage
+ * @param size size of the storage, must be a power of 2
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_ring_create(nmbs_ring* ring, uint8_t* buf, uint32_t size);
+
+/** Set the hooks used to wait for the other side of a ring buffer, e.g. a task notification or a semaphore.
+ * notify is called after bytes are added or taken, also from an interrupt. wait is called by the side that can't make
+ * progress, the consumer of an empty reception ring or the producer of a full transmission ring. It must return true as
+ * soon as notify is called, false once the timeout expires. A timeout < 0 means infinite. Notifications given before
+ * wait is called must not be lost, spurious ones are harmless.
+ * Without hooks, nmbs_ring_read() and nmbs_ring_write() don't block.
+ * @param ring pointer to the nmbs_ring instance
+ * @param wait wait hook. Can be NULL
+ * @param notify notify hook. Can be NULL
+ * @param arg user data passed to the hooks
+ */
+void nmbs_ring_set_hooks(nmbs_ring* ring, bool (*wait)(int32_t timeout_ms, void* arg), void (*notify)(void* arg),
+                         void* arg);
+
+/** Add bytes to a ring buffer. Called by the producer only.
+ * Bytes that don't fit are dropped and counted.
+ * @param ring pointer to the nmbs_ring instance
+ * @param data bytes to add
+ * @param count number of bytes
+ *
+ * @return the number of bytes added
+ */
+uint32_t nmbs_ring_push(nmbs_ring* ring, const uint8_t* data, uint32_t count);
+
+/** Take the oldest bytes out of a ring buffer. Called by the consumer only.
+ * @param ring pointer to the nmbs_ring instance
+ * @param buf destination of the bytes
+ * @param count max number of bytes to take
+ *
+ * @return the number of bytes taken
+ */
+uint32_t nmbs_ring_pop(nmbs_ring* ring, uint8_t* buf, uint32_t count);
+
+/** Return the number of bytes in a ring buffer.
+ * @param ring pointer to the nmbs_ring instance
+ */
+uint32_t nmbs_ring_count(const nmbs_ring* ring);
+
+/** Return the number of bytes dropped because the ring buffer was full.
+ * @param ring pointer to the nmbs_ring instance
+ */
+uint32_t nmbs_ring_dropped(const nmbs_ring* ring);
+
+/** Discard the bytes in a ring buffer. Called by the consumer only.
+ * @param ring pointer to the nmbs_ring instance
+ */
+void nmbs_ring_flush(nmbs_ring* ring);
+
+/** Platform read function reading from the rx ring of the nmbs_ring_port passed as platform arg.
+ * Waits for more bytes with the wait hook of the ring, for up to the byte timeout each time the ring is empty.
+ */
+int32_t nmbs_ring_read(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg);
+
+/** Platform write function writing to the tx ring of the nmbs_ring_port passed as platform arg.
+ * Calls tx_start after adding each chunk, and waits for room with the wait hook of the ring, for up to the byte timeout
+ * each time the ring is full. The wait hook of the tx ring should be notified by the transmission interrupt as it
+ * drains the ring.
+ */
+int32_t nmbs_ring_write(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg);
+
+/** Platform bytes_available function, returning the number of bytes in the rx ring of the nmbs_ring_port passed as
+ * platform arg.
+ */
+int32_t nmbs_ring_bytes_available(void* arg);
+
+/** Platform drain function, discarding the bytes in the rx ring of the nmbs_ring_port passed as platform arg.
+ */
+void nmbs_ring_drain(void* arg);
+
+/** Feed a ring buffer from a circular DMA reception buffer.
+ * The DMA events report how far the DMA has written into its buffer, and the bytes received since the previous event
+ * are added to the ring with a single nmbs_ring_push(), wrapping around the end of the DMA buffer with two copies.
+ * @param dma pointer to the nmbs_ring_dma instance
+ * @param ring ring to feed
+ * @param buf DMA buffer
+ * @param size size of the DMA buffer
+ */
+void nmbs_ring_dma_create(nmbs_ring_dma* dma, nmbs_ring* ring, const uint8_t* buf, uint32_t size);
+
+/** Add the bytes written by the DMA up to a position of its buffer, e.g. on an idle line event.
+ * To be called from the DMA or UART interrupt.
+ * @param dma pointer to the nmbs_ring_dma instance
+ * @param pos position of the DMA in its buffer, size minus the remaining transfer count
+ *
+ * @return the number of bytes added to the ring
+ */
+uint32_t nmbs_ring_dma_update(nmbs_ring_dma* dma, uint32_t pos);
+
+/** Add the first half of the DMA buffer, on a half transfer complete event.
+ * @param dma pointer to the nmbs_ring_dma instance
+ *
+ * @return the number of bytes added to the ring
+ */
+uint32_t nmbs_ring_dma_half_complete(nmbs_ring_dma* dma);
+
+/** Add the second half of the DMA buffer, on a transfer complete event.
+ * @param dma pointer to the nmbs_ring_dma instance
+ *
+ * @return the number of bytes added to the ring
+ */
+uint32_t nmbs_ring_dma_complete(nmbs_ring_dma* dma);
+#endif
+
+#ifdef NMBS_MONITOR
+/**
+ * Bus monitor frame callback, called with each whole frame seen on the line, CRC included.
+ */
+typedef void (*nmbs_monitor_callback)(const uint8_t* frame, uint16_t length, bool response, void* arg);
+
+/**
+ * Passive RTU bus monitor. All struct members are to be considered private, use nmbs_monitor_create().
+ */
+typedef struct nmbs_monitor {
+    uint8_t buf[260];
+    uint16_t buf_len;
+    bool response;
+    bool retried;
+    bool synced;
+    nmbs_monitor_callback callback;
+    void* arg;
+} nmbs_monitor;
+
+/** Create a passive RTU bus monitor.
+ * The monitor splits the bytes seen on a multi-drop line into frames with nmbs_rtu_frame_length(), without sending
+ * anything. Requests and responses are told apart by their order on the line.
+ * @param monitor pointer to the nmbs_monitor instance
+ * @param callback called with each frame with a valid CRC
+ * @param arg user data argument passed to the callback
+ */
+void nmbs_monitor_create(nmbs_monitor* monitor, nmbs_monitor_callback callback, void* arg);
+
+/** Pass bytes received on the line to the bus monitor.
+ * A frame failing its CRC check is first checked again as a frame of the other direction, in case a frame was missed.
+ * It is then dropped whole if the monitor was in sync with the line, i.e. right after a valid frame or a reset.
+ * Otherwise the monitor drops a byte at a time until it finds a valid frame.
+ * @param monitor pointer to the nmbs_monitor instance
+ * @param data received data
+ * @param length length of the received data
+ */
+void nmbs_monitor_feed(nmbs_monitor* monitor, const uint8_t* data, uint16_t length);
+
+/** Discard any partially received frame passed to nmbs_monitor_feed().
+ * Should be called when a silent interval of 3.5 characters is detected on the line.
+ * @param monitor pointer to the nmbs_monitor instance
+ */
+void nmbs_monitor_reset(nmbs_monitor* monitor);
+#endif
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_FILE_STREAM)
+// Max requests of a file stream in flight, must be a power of 2
+#ifndef NMBS_FILE_STREAM_WINDOW_MAX
+#define NMBS_FILE_STREAM_WINDOW_MAX 16
+#endif
+
+struct nmbs_file_stream;
+
+/**
+ * Request of a file stream in flight. All struct members are to be considered private.
+ */
+typedef struct nmbs_file_stream_chunk {
+    struct nmbs_file_stream* stream;
+    uint32_t offset;
+    uint16_t count;
+    bool done;
+} nmbs_file_stream_chunk;
+
+/**
+ * Transfer of a range of file records, streamed over an asynchronous client. Started by nmbs_file_read_stream() or
+ * nmbs_file_write_stream(). All struct members are to be considered private.
+ */
+typedef struct nmbs_file_stream {
+    uint16_t* registers_out;
+    const uint16_t* registers;
+    uint32_t count;
+    uint32_t next;
+    uint32_t acked;
+    uint32_t start_ms;
+    uint32_t end_ms;
+    uint16_t file_number;
+    uint16_t record_number;
+    uint16_t seq_acked;
+    uint16_t seq_next;
+    uint16_t in_flight;
+    nmbs_error err;
+    uint8_t fc;
+    nmbs_file_stream_chunk chunks[NMBS_FILE_STREAM_WINDOW_MAX];
+} nmbs_file_stream;
+
+/** Start reading a range of file records with FC 20 (0x14) Read File Record requests, on an asynchronous client.
+ * The range starts at record_number of file_number and continues from record 0 of the following files after record
+ * 9999. Each request packs as many records as fit in a PDU, split in a sub-request per file, and requests are sent
+ * without waiting for the previous responses, up to the free slots of the nmbs_async_init() window or
+ * NMBS_FILE_STREAM_WINDOW_MAX. Over RTU there's a single request in flight.
+ * The transfer continues in nmbs_file_stream_poll(), which should be called instead of nmbs_async_poll().
+ * @param nmbs pointer to the nmbs_t instance, with the asynchronous client API enabled
+ * @param stream pointer to the nmbs_file_stream instance
+ * @param file_number first file number (1 to 65535)
+ * @param record_number first record number (0000 to 9999)
+ * @param registers_out array where the records will be stored. It must stay valid until the transfer is completed
+ * @param count number of records
+ *
+ * @return NMBS_ERROR_NONE if the transfer was started, NMBS_ERROR_INVALID_ARGUMENT if the range exceeds file 65535 or
+ * the asynchronous client API is not enabled, other errors otherwise.
+ */
+nmbs_error nmbs_file_read_stream(nmbs_t* nmbs, nmbs_file_stream* stream, uint16_t file_number, uint16_t record_number,
+                                 uint16_t* registers_out, uint32_t count);
+
+/** Start writing a range of file records with FC 21 (0x15) Write File Record requests, on an asynchronous client.
+ * See nmbs_file_read_stream() for the meaning of the parameters and the return value.
+ * @param registers records to write. They must stay valid until the transfer is completed
+ */
+nmbs_error nmbs_file_write_stream(nmbs_t* nmbs, nmbs_file_stream* stream, uint16_t file_number, uint16_t record_number,
+                                  const uint16_t* registers, uint32_t count);
+
+/** Advance a file stream, without blocking.
+ * Receives the available responses with nmbs_async_poll() and sends the next requests in the free window slots.
+ * After a failed request, no more requests are sent, and the transfer is completed once the ones in flight are.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param stream pointer to the nmbs_file_stream instance
+ * @param error_out result of the transfer when NMBS_CLIENT_DONE is returned: NMBS_ERROR_NONE if all the records were
+ * transferred, the error of the first failed request otherwise. Can be NULL.
+ *
+ * @return NMBS_CLIENT_IN_PROGRESS while the transfer is in progress, NMBS_CLIENT_DONE when it's completed.
+ */
+nmbs_client_status nmbs_file_stream_poll(nmbs_t* nmbs, nmbs_file_stream* stream, nmbs_error* error_out);
+
+/** Restart a failed file stream from its first record not acknowledged, see nmbs_file_stream_acked().
+ * Can be called once nmbs_file_stream_poll() returned NMBS_CLIENT_DONE, e.g. after reconnecting.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param stream pointer to the nmbs_file_stream instance
+ *
+ * @return NMBS_ERROR_NONE if the transfer was restarted, NMBS_ERROR_INVALID_ARGUMENT if requests are still in flight,
+ * other errors otherwise.
+ */
+nmbs_error nmbs_file_stream_resume(nmbs_t* nmbs, nmbs_file_stream* stream);
+
+/** Return the number of records of a file stream acknowledged by the server, counted from the first one.
+ * Records after a failed request are not counted, even if their own requests succeeded.
+ * @param stream pointer to the nmbs_file_stream instance
+ */
+uint32_t nmbs_file_stream_acked(const nmbs_file_stream* stream);
+
+/** Return the throughput of a file stream, in bytes of acknowledged records per second since it was started.
+ * @param nmbs pointer to the nmbs_t instance
+ * @param stream pointer to the nmbs_file_stream instance
+ */
+uint32_t nmbs_file_stream_throughput(const nmbs_t* nmbs, const nmbs_file_stream* stream);
+#endif
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_SCHEDULER)
+/**
+ * Periodic read job of a bus scheduler, see nmbs_sched_create().
+ * The configuration members are set by the user before creating the scheduler. The statistics members are updated by
+ * the scheduler and reset by nmbs_sched_reset_stats(). All other struct members are to be considered private.
+ */
+typedef struct nmbs_sched_job {
+    nmbs_read_plan* plan;   /*!< Read plan to execute, ignored if sub is set */
+    nmbs_subscription* sub; /*!< Subscription to execute instead of a plain read plan. Can be NULL */
+    uint32_t period_ms;     /*!< Interval between the releases of the job, must be > 0 */
+    uint32_t deadline_ms;   /*!< Time after each release within which the job should complete, 0 for its period */
+    uint32_t offset_ms;     /*!< Time of the first release, after the creation of the scheduler */
+    uint8_t priority;       /*!< Priority class, 0 is the most urgent. Orders jobs with the same deadline, or late */
+    void (*callback)(struct nmbs_sched_job* job, nmbs_error err, void* arg); /*!< Called on completion. Can be NULL */
+    void* arg;                                                                 /*!< User data passed to callback */
+
+    uint32_t runs;            /*!< Completed executions */
+    uint32_t misses;          /*!< Executions completed after their deadline */
+    uint32_t skipped;         /*!< Releases skipped because an execution ran past them */
+    uint32_t delay_min_ms;    /*!< Min time from a release to its first request, UINT32_MAX until the first */
+    uint32_t delay_max_ms;    /*!< Max time from a release to its first request */
+    uint32_t response_max_ms; /*!< Max time from a release to the completion of its execution */
+
+    uint32_t release_ms;
+    uint32_t due_ms;
+    uint32_t image_offset;
+    uint16_t block;
+    bool started;
+    nmbs_error err;
+} nmbs_sched_job;
+
+/**
+ * Ad-hoc write of a bus scheduler, see nmbs_sched_submit(). The configuration members are set by the user before
+ * submitting the write. All other struct members are to be considered private.
+ */
+typedef struct nmbs_sched_write {
+    uint8_t unit_id;      /*!< Server unit ID, ignored if units is set */
+    const uint8_t* units; /*!< nmbs_bitfield_256 of the unit IDs to write to, fan-out style. Can be NULL */
+    nmbs_table table;     /*!< NMBS_TABLE_COILS or NMBS_TABLE_HOLDING_REGISTERS */
+    uint16_t address;     /*!< Starting address */
+    uint16_t quantity;    /*!< Quantity of values, max 1968 coils or 123 registers */
+    const void* values;   /*!< uint16_t array for registers, nmbs_bitfield for coils. Must stay valid until done */
+    uint32_t deadline_ms; /*!< Time after the submission within which the write should complete */
+    uint8_t priority;     /*!< Priority class, 0 is the most urgent */
+    void (*callback)(struct nmbs_sched_write* write, nmbs_error err, void* arg); /*!< Called once done. Can be NULL */
+    void* arg;                                                                     /*!< User data passed to callback */
+
+    struct nmbs_sched_write* next;
+    uint32_t due_ms;
+    uint16_t next_unit;
+    nmbs_error err;
+} nmbs_sched_write;
+
+/**
+ * Bus scheduler instance, see nmbs_sched_create(). All struct members are to be considered private.
+ */
+typedef struct nmbs_sched {
+    nmbs_t* nmbs;
+    nmbs_sched_job* jobs;
+    uint16_t jobs_count;
+    nmbs_sched_write* writes;
+    const uint8_t* line_units;
+    uint32_t turnaround_ms;
+    uint32_t idle_until_ms;
+    bool idle;
+    uint32_t busy_ms;
+    uint32_t stats_since_ms;
+} nmbs_sched;
+
+/** Create a bus scheduler, sharing a client instance between periodic read jobs and ad-hoc writes.
+ * Each call to nmbs_sched_poll() sends a single request: the pending job or write with the earliest deadline goes
+ * first, and jobs are executed one request of their read plan at a time, so a long plan doesn't hold the line while a
+ * more urgent job is due. Jobs and writes with the same deadline are ordered by priority class. Once their deadline has
+ * passed, the priority class goes first, so that the most urgent of the late jobs catch up first.
+ * Jobs are released every period, starting at their offset. A job whose execution runs past its next release is
+ * released again right away, and the releases further behind are skipped.
+ * @param sched pointer to the nmbs_sched instance
+ * @param nmbs pointer to the client instance, with the time_ms() platform function defined. It must not be used by
+ * anything else than the scheduler
+ * @param jobs periodic jobs. They must outlive the scheduler
+ * @param jobs_count number of jobs
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_sched_create(nmbs_sched* sched, nmbs_t* nmbs, nmbs_sched_job* jobs, uint16_t jobs_count);
+
+/** Send fan-out writes as a single broadcast request.
+ * A write whose units include all the units on the line is sent once to NMBS_BROADCAST_ADDRESS, instead of once to
+ * each unit. Servers don't respond to broadcast requests, so their result is not checked. After a broadcast, the line
+ * is kept idle for the turnaround delay, to let the servers process it. Only used on RTU.
+ * @param sched pointer to the nmbs_sched instance
+ * @param line_units all the unit IDs present on the line. Must stay valid for the lifetime of the scheduler. NULL
+ * disables broadcasts
+ * @param turnaround_ms idle time after each broadcast
+ */
+void nmbs_sched_set_broadcast(nmbs_sched* sched, const nmbs_bitfield_256 line_units, uint32_t turnaround_ms);
+
+/** Submit an ad-hoc write, sent along with the periodic jobs according to its deadline.
+ * Single values are written with FC 05 or 06, multiple values with FC 15 or 16. Fan-out writes are sent to each unit
+ * in turn, each request scheduled on its own, unless they can be sent as broadcast, see nmbs_sched_set_broadcast().
+ * The callback is called once all the requests are done, with the first error encountered.
+ * @param sched pointer to the nmbs_sched instance
+ * @param write pointer to the nmbs_sched_write instance. It must stay valid until its callback is called
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_sched_submit(nmbs_sched* sched, nmbs_sched_write* write);
+
+/** Send the next request of the most urgent job or write, if any is pending.
+ * Should be called in a loop, waiting for the returned time between calls.
+ * @param sched pointer to the nmbs_sched instance
+ *
+ * @return the time until the next request is due, in time_ms() units. 0 if one is due right away, UINT32_MAX if there
+ * are no jobs and no pending writes.
+ */
+uint32_t nmbs_sched_poll(nmbs_sched* sched);
+
+/** Return the utilization of the line, the share of the time spent in requests since the scheduler creation or the
+ * last call to nmbs_sched_reset_stats().
+ * @param sched pointer to the nmbs_sched instance
+ *
+ * @return the utilization of the line, in thousandths
+ */
+uint16_t nmbs_sched_utilization(const nmbs_sched* sched);
+
+/** Reset the statistics of the jobs and the utilization of the line.
+ * @param sched pointer to the nmbs_sched instance
+ */
+void nmbs_sched_reset_stats(nmbs_sched* sched);
+#endif
+
+#if !defined(NMBS_CLIENT_DISABLED) && defined(NMBS_GATEWAY)
+/**
+ * Gateway route, mapping the unit ID of Modbus TCP requests to a server on a serial line.
+ */
+typedef struct nmbs_gateway_route {
+    uint8_t unit_id;     /*!< Unit ID of the requests to forward */
+    uint8_t line;        /*!< Index of the serial line in the lines passed to nmbs_gateway_create() */
+    uint8_t address_rtu; /*!< Address of the RTU server. NMBS_BROADCAST_ADDRESS forwards without waiting a response */
+} nmbs_gateway_route;
+
+/**
+ * Gateway response callback, called with each whole Modbus TCP response frame to send to the request source.
+ * Requests forwarded as broadcast are completed with a NULL frame of length 0, there's nothing to send.
+ */
+typedef void (*nmbs_gateway_callback)(void* source, const uint8_t* frame, uint16_t length, void* arg);
+
+/**
+ * Slot of a gateway requests pool. All struct members are to be considered private.
+ */
+typedef struct nmbs_gateway_req {
+    struct nmbs_gateway_req* next;
+    struct nmbs_gateway_req* followers;
+    void* source;
+    uint32_t round;
+    uint16_t transaction_id;
+    uint16_t address;
+    uint16_t quantity;
+    uint8_t unit_id;
+    uint8_t address_rtu;
+    uint8_t fc;
+    uint8_t data_len;
+    uint8_t data[253];
+} nmbs_gateway_req;
+
+#ifdef NMBS_GATEWAY_CACHE
+/**
+ * Range of values whose reads are served from the gateway cache, see nmbs_gateway_set_cache().
+ */
+typedef struct nmbs_gateway_cache_range {
+    uint8_t unit_id;   /*!< Unit ID of the reads */
+    uint8_t fc;        /*!< Function code of the reads, 2 (Read Discrete Inputs) or 4 (Read Input Registers) */
+    uint16_t address;  /*!< First address of the range */
+    uint16_t quantity; /*!< Number of values in the range */
+    uint32_t ttl_ms;   /*!< Time a response stays in the cache */
+} nmbs_gateway_cache_range;
+
+/**
+ * Gateway cache entry. All struct members are to be considered private.
+ */
+typedef struct nmbs_gateway_cache_entry {
+    uint32_t expiry_ms;
+    uint16_t address;
+    uint16_t quantity;
+    uint8_t unit_id;
+    uint8_t fc;
+    uint8_t data_len;
+    uint8_t data[251];
+    bool valid;
+} nmbs_gateway_cache_entry;
+#endif
+
+/**
+ * Gateway serial line. All struct members are to be considered private, use nmbs_gateway_line_create().
+ */
+typedef struct nmbs_gateway_line {
+    nmbs_t* client;
+    nmbs_gateway_req* queue;
+    nmbs_gateway_req* active;
+    uint32_t round;
+} nmbs_gateway_line;
+
+/**
+ * Modbus TCP to RTU gateway. All struct members are to be considered private, use nmbs_gateway_create().
+ */
+typedef struct nmbs_gateway {
+    nmbs_gateway_line* lines;
+    uint8_t lines_count;
+    const nmbs_gateway_route* routes;
+    uint16_t routes_count;
+    nmbs_gateway_req* free_list;
+    uint16_t pending;
+#ifdef NMBS_GATEWAY_CACHE
+    const nmbs_gateway_cache_range* cache_ranges;
+    uint16_t cache_ranges_count;
+    nmbs_gateway_cache_entry* cache;
+    uint16_t cache_count;
+#endif
+    nmbs_gateway_callback callback;
+    void* arg;
+} nmbs_gateway;
+
+/** Create a gateway serial line.
+ * @param line pointer to the nmbs_gateway_line instance
+ * @param client RTU client instance of the serial line, with the time_ms() platform function defined. Its read
+ * timeout is the response timeout of the forwarded requests. It must not be used by anything else than the gateway
+ */
+void nmbs_gateway_line_create(nmbs_gateway_line* line, nmbs_t* client);
+
+/** Create a Modbus TCP to RTU gateway.
+ * Requests received from TCP clients are queued on the serial line of their route, and forwarded one at a time.
+ * Requests of different sources, e.g. TCP connections, are interleaved fairly: a source with many queued requests
+ * gets one forwarded each round, so it can't delay the others. The next request on a line is forwarded as soon as
+ * the previous one is completed, also from nmbs_gateway_submit(), so the line is kept busy as long as requests are
+ * queued.
+ * Reads (FC 01 to 04) identical to one queued or in progress on the line share its transaction, and its response,
+ * unless a write to an overlapping range of the same unit ID is queued or in progress.
+ * @param gw pointer to the nmbs_gateway instance
+ * @param lines serial lines, created with nmbs_gateway_line_create()
+ * @param lines_count number of serial lines
+ * @param routes unit ID routes. Must stay valid for the lifetime of the gateway
+ * @param routes_count number of routes
+ * @param reqs pool of request slots. Their count is the max number of requests queued on all the lines
+ * @param reqs_count number of request slots
+ * @param callback called once with the response to each request
+ * @param arg user data argument passed to the callback
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise
+ */
+nmbs_error nmbs_gateway_create(nmbs_gateway* gw, nmbs_gateway_line* lines, uint8_t lines_count,
+                               const nmbs_gateway_route* routes, uint16_t routes_count, nmbs_gateway_req* reqs,
+                               uint16_t reqs_count, nmbs_gateway_callback callback, void* arg);
+
+#ifdef NMBS_GATEWAY_CACHE
+/** Serve repeated reads of discrete inputs and input registers from memory.
+ * Responses to FC 02 and 04 reads contained in one of the ranges are stored in the cache, and identical reads are
+ * answered from it until the TTL of their range expires. Writes (FC 05, 06, 15, 16 and 23) to overlapping addresses
+ * of the same unit ID, regardless of their table, invalidate the stored responses when they are submitted and again
+ * when they are completed, and reads are not served from the cache while they are in progress. When the cache is
+ * full, the entry closest to expiry is replaced.
+ * @param gw pointer to the nmbs_gateway instance
+ * @param ranges cached ranges, and their TTL. Must stay valid for the lifetime of the gateway
+ * @param ranges_count number of ranges. 0 disables the cache
+ * @param entries cache storage. Its count is the max number of responses stored at once
+ * @param entries_count number of cache entries
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_INVALID_ARGUMENT otherwise
+ */
+nmbs_error nmbs_gateway_set_cache(nmbs_gateway* gw, const nmbs_gateway_cache_range* ranges, uint16_t ranges_count,
+                                  nmbs_gateway_cache_entry* entries, uint16_t entries_count);
+#endif
+
+/** Submit a Modbus TCP request frame to the gateway.
+ * Requests with no route are answered right away with exception NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE. Requests
+ * with a function code not known to nmbs_rtu_frame_length() are answered with NMBS_EXCEPTION_ILLEGAL_FUNCTION.
+ * Requests whose server doesn't respond within the read timeout of the line are answered with
+ * NMBS_EXCEPTION_GATEWAY_TARGET_FAILED. Exceptions returned by the server are forwarded as they are.
+ * @param gw pointer to the nmbs_gateway instance
+ * @param source source of the request, passed to the response callback
+ * @param frame whole Modbus TCP request frame. Anything after its end is ignored
+ * @param length length of the frame
+ *
+ * @return NMBS_ERROR_NONE if successful, NMBS_ERROR_WINDOW_FULL if no request slot is free, in which case the request
+ * should be submitted again after nmbs_gateway_poll(). NMBS_ERROR_INVALID_TCP_MBAP if the frame is not valid,
+ * NMBS_ERROR_INVALID_ARGUMENT otherwise.
+ */
+nmbs_error nmbs_gateway_submit(nmbs_gateway* gw, void* source, const uint8_t* frame, uint16_t length);
+
+/** Advance the requests in progress on all the lines, without blocking.
+ * Calls the response callback for each completed request, and forwards the next queued ones. It should be called
+ * periodically, e.g. from the main loop, or when a serial line has data available.
+ * @param gw pointer to the nmbs_gateway instance
+ */
+void nmbs_gateway_poll(nmbs_gateway* gw);
+
+/** Drop the requests of a source, e.g. when its connection is closed.
+ * Queued requests are discarded. Requests already forwarded, or shared by requests of other sources, are completed,
+ * but their response is not passed to the callback.
+ * @param gw pointer to the nmbs_gateway instance
+ * @param source source of the requests
+ */
+void nmbs_gateway_cancel(nmbs_gateway* gw, const void* source);
+
+/** Return the number of requests queued or in progress on all the lines.
+ * @param gw pointer to the nmbs_gateway instance
+ */
+uint16_t nmbs_gateway_pending(const nmbs_gateway* gw);
+#endif
 
 #ifndef NMBS_STRERROR_DISABLED
 /** Convert a nmbs_error to string
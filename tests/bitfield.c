@@ -0,0 +1,106 @@
+#include "nanomodbus.h"
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+#define BITS 600
+
+
+static uint32_t seed = 12345;
+
+static uint8_t next_random(void) {
+    seed = seed * 1103515245 + 12345;
+    return (uint8_t) (seed >> 16);
+}
+
+
+static void fill_random(uint8_t* buf, uint16_t size) {
+    for (uint16_t i = 0; i < size; i++)
+        buf[i] = next_random();
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    uint8_t src[BITS / 8];
+    uint8_t dst[BITS / 8];
+    uint8_t expected[BITS / 8];
+    bool bools[BITS];
+    uint8_t bytes[BITS];
+
+    // Every combination of source and destination alignment, with lengths around the word and byte boundaries
+    for (uint16_t src_offset = 0; src_offset < 40; src_offset++) {
+        for (uint16_t dst_offset = 0; dst_offset < 40; dst_offset++) {
+            for (uint16_t count = 0; count < 300; count += count < 70 ? 1 : 37) {
+                fill_random(src, sizeof(src));
+                fill_random(dst, sizeof(dst));
+                memcpy(expected, dst, sizeof(dst));
+
+                for (uint16_t i = 0; i < count; i++)
+                    nmbs_bitfield_write(expected, dst_offset + i, nmbs_bitfield_read(src, src_offset + i));
+
+                nmbs_bitfield_copy(dst, dst_offset, src, src_offset, count);
+                assert(memcmp(dst, expected, sizeof(dst)) == 0);
+                assert(nmbs_bitfield_compare(dst, dst_offset, src, src_offset, count) == count);
+
+                if (count > 0) {
+                    const uint16_t flipped = (uint16_t) (next_random() % count);
+                    nmbs_bitfield_write(dst, dst_offset + flipped, !nmbs_bitfield_read(dst, dst_offset + flipped));
+                    assert(nmbs_bitfield_compare(dst, dst_offset, src, src_offset, count) == flipped);
+                    assert(nmbs_bitfield_compare(src, src_offset, dst, dst_offset, count) == flipped);
+                }
+            }
+        }
+    }
+
+    // Set and reset ranges
+    for (uint16_t offset = 0; offset < 40; offset++) {
+        for (uint16_t count = 0; count < 200; count++) {
+            const bool value = count & 1;
+            fill_random(dst, sizeof(dst));
+            memcpy(expected, dst, sizeof(dst));
+
+            for (uint16_t i = 0; i < count; i++)
+                nmbs_bitfield_write(expected, offset + i, value);
+
+            nmbs_bitfield_fill(dst, offset, count, value);
+            assert(memcmp(dst, expected, sizeof(dst)) == 0);
+        }
+    }
+
+    // Pack and unpack arrays, bytes are set for any non-zero value
+    for (uint16_t offset = 0; offset < 40; offset++) {
+        const uint16_t count = (uint16_t) (BITS - 40 - offset);
+        fill_random(src, sizeof(src));
+        nmbs_bitfield_to_bools(bools, src, offset, count);
+        nmbs_bitfield_to_bytes(bytes, src, offset, count);
+        for (uint16_t i = 0; i < count; i++) {
+            assert(bools[i] == nmbs_bitfield_read(src, offset + i));
+            assert(bytes[i] == (uint8_t) nmbs_bitfield_read(src, offset + i));
+            bytes[i] *= (uint8_t) (next_random() | 1);
+        }
+
+        fill_random(dst, sizeof(dst));
+        memcpy(expected, dst, sizeof(dst));
+        nmbs_bitfield_copy(expected, offset, src, offset, count);
+
+        nmbs_bitfield_from_bools(dst, offset, bools, count);
+        assert(memcmp(dst, expected, sizeof(dst)) == 0);
+
+        fill_random(dst, sizeof(dst));
+        memcpy(expected, dst, sizeof(dst));
+        nmbs_bitfield_copy(expected, offset, src, offset, count);
+
+        nmbs_bitfield_from_bytes(dst, offset, bytes, count);
+        assert(memcmp(dst, expected, sizeof(dst)) == 0);
+    }
+
+    printf("Bitfield range operations match the bit-by-bit ones\n");
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "nanomodbus.h"
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+
+static uint16_t crc_reference(const uint8_t* data, uint32_t length) {
+    uint16_t crc = 0xFFFF;
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+
+    return crc;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    assert(nmbs_crc_update(NMBS_CRC_INIT, check, sizeof(check)) == 0x4B37);
+    assert(nmbs_crc_calc(check, sizeof(check), NULL) == 0x374B);
+
+    uint8_t data[300];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t) (i * 131 + 7);
+
+    for (uint32_t len = 0; len < sizeof(data) - 2; len++) {
+        const uint16_t expected = crc_reference(data, len);
+        assert(nmbs_crc_update(NMBS_CRC_INIT, data, len) == expected);
+
+        // Chunked updates must match a single pass
+        uint16_t crc = NMBS_CRC_INIT;
+        uint32_t done = 0;
+        uint32_t chunk = 1;
+        while (done < len) {
+            uint32_t n = len - done < chunk ? len - done : chunk;
+            crc = nmbs_crc_update(crc, data + done, n);
+            done += n;
+            chunk = chunk % 7 + 1;
+        }
+        assert(crc == expected);
+
+        // A frame with its CRC appended has a zero residue
+        uint8_t frame[300];
+        memcpy(frame, data, len);
+        frame[len] = (uint8_t) (expected & 0xFF);
+        frame[len + 1] = (uint8_t) (expected >> 8);
+        assert(nmbs_crc_update(NMBS_CRC_INIT, frame, len + 2) == 0);
+    }
+
+    printf("CRC checks passed\n");
+
+    return 0;
+}
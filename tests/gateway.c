@@ -0,0 +1,463 @@
+#include "nanomodbus_tests.h"
+
+#define LINES_COUNT 2
+#define REQS_COUNT 8
+#define READ_TIMEOUT_MS 100
+
+// Serial line with a single RTU server, answering each request as soon as it is written
+typedef struct fake_line {
+    nmbs_t client;
+    nmbs_t server;
+    uint8_t rx[1024];
+    uint16_t rx_len;
+    uint16_t rx_idx;
+    uint16_t requests;
+    uint16_t addresses[32];
+    bool mute;
+} fake_line;
+
+typedef struct response {
+    void* source;
+    uint8_t frame[260];
+    uint16_t length;
+} response;
+
+fake_line lines[LINES_COUNT];
+nmbs_gateway_line gw_lines[LINES_COUNT];
+nmbs_gateway_req gw_reqs[REQS_COUNT];
+nmbs_gateway gw;
+nmbs_gateway_cache_entry cache[2];
+
+response responses[32];
+uint16_t responses_count = 0;
+
+uint32_t now = 0;
+
+int source_a;
+int source_b;
+
+const nmbs_gateway_route routes[] = {
+        {1, 0, 5},
+        {2, 1, 7},
+        {9, 1, NMBS_BROADCAST_ADDRESS},
+};
+
+const nmbs_gateway_cache_range cache_ranges[] = {
+        {1, 4, 0, 100, 250},
+        {1, 2, 0, 100, 250},
+};
+
+uint16_t registers[0x100];
+
+
+uint32_t time_fake(void* arg) {
+    UNUSED_PARAM(arg);
+    return now;
+}
+
+
+int32_t line_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    fake_line* line = arg;
+
+    uint16_t available = line->rx_len - line->rx_idx;
+    if (count > available)
+        count = available;
+
+    memcpy(buf, line->rx + line->rx_idx, count);
+    line->rx_idx += count;
+    return count;
+}
+
+
+int32_t line_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    fake_line* line = arg;
+
+    line->addresses[line->requests % 32] = (uint16_t) (buf[2] << 8) | (uint16_t) buf[3];
+    line->requests++;
+    line->rx_len = line->rx_idx = 0;
+
+    if (!line->mute)
+        expect(nmbs_server_process_frame(&line->server, buf, count) == NMBS_ERROR_NONE);
+
+    return count;
+}
+
+
+int32_t server_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return 0;
+}
+
+
+int32_t server_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    fake_line* line = arg;
+
+    memcpy(line->rx + line->rx_len, buf, count);
+    line->rx_len += count;
+    return count;
+}
+
+
+nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address + quantity > 0x100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(registers_out, registers + address, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_inputs(uint16_t address, uint16_t quantity, nmbs_bitfield inputs_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    for (uint16_t i = 0; i < quantity; i++)
+        nmbs_bitfield_write(inputs_out, i, registers[(address + i) & 0xFF] & 1);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_single_register(uint16_t address, uint16_t value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address >= 0x100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    registers[address] = value;
+    return NMBS_ERROR_NONE;
+}
+
+
+void on_response(void* source, const uint8_t* frame, uint16_t length, void* arg) {
+    UNUSED_PARAM(arg);
+    expect(responses_count < 32);
+
+    response* r = &responses[responses_count++];
+    r->source = source;
+    r->length = length;
+    if (length > 0)
+        memcpy(r->frame, frame, length);
+}
+
+
+void create_line(fake_line* line, uint8_t address_rtu) {
+    memset(line, 0, sizeof(fake_line));
+
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_RTU;
+    conf.read = line_read;
+    conf.write = line_write;
+    conf.time_ms = time_fake;
+    conf.arg = line;
+    check(nmbs_client_create(&line->client, &conf));
+    nmbs_set_read_timeout(&line->client, READ_TIMEOUT_MS);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.read_input_registers = read_registers;
+    callbacks.read_discrete_inputs = read_inputs;
+    callbacks.write_single_register = write_single_register;
+
+    conf.read = server_read;
+    conf.write = server_write;
+    check(nmbs_server_create(&line->server, address_rtu, &conf, &callbacks));
+}
+
+
+uint16_t put_request(uint8_t* buf, uint16_t tid, uint8_t unit_id, uint8_t fc, uint16_t address, uint16_t value) {
+    const uint8_t req[] = {tid >> 8, tid & 0xFF, 0, 0, 0, 6, unit_id, fc, address >> 8, address & 0xFF, value >> 8,
+                           value & 0xFF};
+    memcpy(buf, req, sizeof(req));
+    return sizeof(req);
+}
+
+
+nmbs_error submit(void* source, uint16_t tid, uint8_t unit_id, uint8_t fc, uint16_t address, uint16_t value) {
+    uint8_t frame[12];
+    const uint16_t length = put_request(frame, tid, unit_id, fc, address, value);
+    return nmbs_gateway_submit(&gw, source, frame, length);
+}
+
+
+bool is_exception(const response* r, uint8_t fc, uint8_t exception) {
+    return r->length == 9 && r->frame[5] == 3 && r->frame[7] == (fc | 0x80) && r->frame[8] == exception;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    for (int i = 0; i < 0x100; i++)
+        registers[i] = (uint16_t) (i * 3);
+
+    create_line(&lines[0], 5);
+    create_line(&lines[1], 7);
+    for (int i = 0; i < LINES_COUNT; i++)
+        nmbs_gateway_line_create(&gw_lines[i], &lines[i].client);
+
+    should("reject routes to missing lines and lines without time function");
+    const nmbs_gateway_route bad_route = {1, LINES_COUNT, 1};
+    expect(nmbs_gateway_create(&gw, gw_lines, LINES_COUNT, &bad_route, 1, gw_reqs, REQS_COUNT, on_response, NULL) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+
+    lines[1].client.platform.time_ms = NULL;
+    expect(nmbs_gateway_create(&gw, gw_lines, LINES_COUNT, routes, 3, gw_reqs, REQS_COUNT, on_response, NULL) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    lines[1].client.platform.time_ms = time_fake;
+
+    check(nmbs_gateway_create(&gw, gw_lines, LINES_COUNT, routes, 3, gw_reqs, REQS_COUNT, on_response, NULL));
+
+    should("reject invalid MBAP headers");
+    uint8_t frame[12];
+    uint16_t length = put_request(frame, 1, 1, 3, 0, 1);
+    frame[3] = 1;
+    expect(nmbs_gateway_submit(&gw, &source_a, frame, length) == NMBS_ERROR_INVALID_TCP_MBAP);
+    frame[3] = 0;
+    expect(nmbs_gateway_submit(&gw, &source_a, frame, length - 1) == NMBS_ERROR_INVALID_TCP_MBAP);
+    expect(responses_count == 0);
+
+    should("forward requests to the RTU address of their route, on every line at once");
+    check(submit(&source_a, 0x1234, 1, 3, 10, 2));
+    check(submit(&source_b, 0x4321, 2, 3, 20, 1));
+    expect(lines[0].requests == 1 && lines[1].requests == 1);
+    expect(nmbs_gateway_pending(&gw) == 2);
+
+    nmbs_gateway_poll(&gw);
+    expect(responses_count == 2);
+    expect(nmbs_gateway_pending(&gw) == 0);
+
+    const response* r = &responses[0];
+    const uint8_t res_a[] = {0x12, 0x34, 0, 0, 0, 7, 1, 3, 4, 0, 30, 0, 33};
+    expect(r->source == &source_a && r->length == sizeof(res_a) && memcmp(r->frame, res_a, sizeof(res_a)) == 0);
+
+    r = &responses[1];
+    const uint8_t res_b[] = {0x43, 0x21, 0, 0, 0, 5, 2, 3, 2, 0, 60};
+    expect(r->source == &source_b && r->length == sizeof(res_b) && memcmp(r->frame, res_b, sizeof(res_b)) == 0);
+
+    should("forward the exceptions of the RTU servers");
+    responses_count = 0;
+    check(submit(&source_a, 2, 1, 6, 0x200, 1));
+    nmbs_gateway_poll(&gw);
+    expect(responses_count == 1 && is_exception(&responses[0], 6, NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS));
+
+    should("answer requests with no route with exception 0x0A");
+    responses_count = 0;
+    check(submit(&source_a, 3, 42, 3, 0, 1));
+    expect(responses_count == 1 && is_exception(&responses[0], 3, NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE));
+    expect(responses[0].frame[6] == 42);
+    expect(nmbs_gateway_pending(&gw) == 0);
+
+    should("answer requests with a function code of unknown response length with exception 0x01");
+    responses_count = 0;
+    check(submit(&source_a, 4, 1, 0x41, 0, 1));
+    expect(responses_count == 1 && is_exception(&responses[0], 0x41, NMBS_EXCEPTION_ILLEGAL_FUNCTION));
+    expect(lines[0].requests == 2);
+
+    should("answer requests with exception 0x0B when the RTU server does not respond");
+    responses_count = 0;
+    lines[0].mute = true;
+    check(submit(&source_a, 5, 1, 3, 0, 1));
+    now += READ_TIMEOUT_MS - 1;
+    nmbs_gateway_poll(&gw);
+    expect(responses_count == 0);
+    now += 1;
+    nmbs_gateway_poll(&gw);
+    expect(responses_count == 1 && is_exception(&responses[0], 3, NMBS_EXCEPTION_GATEWAY_TARGET_FAILED));
+    lines[0].mute = false;
+
+    should("forward broadcast requests without waiting for a response");
+    responses_count = 0;
+    const uint16_t line_1_requests = lines[1].requests;
+    check(submit(&source_a, 6, 9, 6, 0xF0, 0xABCD));
+    expect(lines[1].requests == line_1_requests + 1);
+    expect(registers[0xF0] == 0xABCD);
+    expect(nmbs_gateway_pending(&gw) == 0);
+    expect(responses_count == 1 && responses[0].source == &source_a && responses[0].length == 0);
+
+    should("interleave the queued requests of different sources");
+    responses_count = 0;
+    lines[0].requests = 0;
+    for (uint16_t i = 0; i < 4; i++)
+        check(submit(&source_a, i, 1, 3, i, 1));
+
+    for (uint16_t i = 0; i < 2; i++)
+        check(submit(&source_b, 100 + i, 1, 3, 100 + i, 1));
+
+    expect(lines[0].requests == 1);
+
+    // The next request is forwarded as soon as a response is received
+    for (uint16_t i = 1; i < 6; i++) {
+        nmbs_gateway_poll(&gw);
+        expect(lines[0].requests == i + 1);
+        expect(responses_count == i);
+    }
+
+    nmbs_gateway_poll(&gw);
+    expect(responses_count == 6);
+
+    const uint16_t expected[] = {0, 100, 1, 101, 2, 3};
+    for (uint16_t i = 0; i < 6; i++) {
+        expect(lines[0].addresses[i] == expected[i]);
+        void* source = expected[i] < 100 ? (void*) &source_a : (void*) &source_b;
+        expect(responses[i].source == source);
+        expect(responses[i].frame[1] == expected[i]);
+        expect(((responses[i].frame[9] << 8) | responses[i].frame[10]) == expected[i] * 3);
+    }
+
+    should("return NMBS_ERROR_WINDOW_FULL when the requests pool is exhausted");
+    responses_count = 0;
+    for (uint16_t i = 0; i < REQS_COUNT; i++)
+        check(submit(&source_a, i, (uint8_t) (1 + i % 2), 3, i, 1));
+
+    expect(submit(&source_b, 0, 1, 3, 0, 1) == NMBS_ERROR_WINDOW_FULL);
+    nmbs_gateway_poll(&gw);
+    check(submit(&source_b, 0, 1, 3, 0, 1));
+
+    while (nmbs_gateway_pending(&gw) > 0)
+        nmbs_gateway_poll(&gw);
+
+    expect(responses_count == REQS_COUNT + 1);
+
+    should("drop the requests of cancelled sources");
+    responses_count = 0;
+    for (uint16_t i = 0; i < 3; i++)
+        check(submit(&source_a, i, 1, 3, i, 1));
+
+    check(submit(&source_b, 10, 1, 3, 10, 1));
+    nmbs_gateway_cancel(&gw, &source_a);
+    expect(nmbs_gateway_pending(&gw) == 2);
+
+    while (nmbs_gateway_pending(&gw) > 0)
+        nmbs_gateway_poll(&gw);
+
+    expect(responses_count == 1 && responses[0].source == &source_b);
+
+    should("share one transaction between identical reads");
+    responses_count = 0;
+    lines[0].requests = 0;
+    check(submit(&source_a, 1, 1, 4, 10, 2));
+    check(submit(&source_b, 2, 1, 4, 10, 2));
+    check(submit(&source_b, 3, 1, 4, 10, 1));
+    check(submit(&source_a, 4, 1, 4, 10, 1));
+    expect(nmbs_gateway_pending(&gw) == 4);
+
+    while (nmbs_gateway_pending(&gw) > 0)
+        nmbs_gateway_poll(&gw);
+
+    expect(lines[0].requests == 2);
+    expect(responses_count == 4);
+
+    const void* shared_sources[] = {&source_a, &source_b, &source_b, &source_a};
+    for (uint16_t i = 0; i < 4; i++) {
+        expect(responses[i].frame[1] == i + 1);
+        expect(responses[i].source == shared_sources[i]);
+        expect(responses[i].length == (i < 2 ? 13 : 11));
+        expect(responses[i].frame[7] == 4 && responses[i].frame[10] == 30);
+    }
+
+    should("not share a read queued before an overlapping write");
+    responses_count = 0;
+    lines[0].requests = 0;
+    lines[0].mute = true;
+    check(submit(&source_a, 1, 1, 3, 200, 1));
+    lines[0].mute = false;
+    check(submit(&source_a, 2, 1, 4, 10, 1));
+    check(submit(&source_b, 3, 1, 6, 10, 0x55));
+    check(submit(&source_b, 4, 1, 4, 10, 1));
+
+    while (nmbs_gateway_pending(&gw) > 0) {
+        now += READ_TIMEOUT_MS;
+        nmbs_gateway_poll(&gw);
+    }
+
+    expect(lines[0].requests == 4);
+    expect(responses[3].frame[1] == 4 && responses[3].frame[10] == 0x55);
+    registers[10] = 30;
+
+    should("deliver shared responses to the remaining sources when the first one is cancelled");
+    responses_count = 0;
+    lines[0].mute = true;
+    check(submit(&source_a, 1, 1, 3, 200, 1));
+    lines[0].mute = false;
+    check(submit(&source_a, 2, 1, 3, 20, 1));
+    check(submit(&source_b, 3, 1, 3, 20, 1));
+    nmbs_gateway_cancel(&gw, &source_a);
+
+    while (nmbs_gateway_pending(&gw) > 0) {
+        now += READ_TIMEOUT_MS;
+        nmbs_gateway_poll(&gw);
+    }
+
+    expect(responses_count == 1 && responses[0].source == &source_b && responses[0].frame[1] == 3);
+
+    should("serve repeated input reads from the cache until their TTL expires");
+    expect(nmbs_gateway_set_cache(&gw, (const nmbs_gateway_cache_range[]) {{1, 3, 0, 1, 1}}, 1, cache, 2) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    check(nmbs_gateway_set_cache(&gw, cache_ranges, 2, cache, 2));
+
+    responses_count = 0;
+    lines[0].requests = 0;
+    check(submit(&source_a, 1, 1, 4, 20, 2));
+    nmbs_gateway_poll(&gw);
+    expect(lines[0].requests == 1 && responses_count == 1);
+
+    now += 249;
+    check(submit(&source_b, 2, 1, 4, 20, 2));
+    expect(lines[0].requests == 1 && responses_count == 2);
+    expect(nmbs_gateway_pending(&gw) == 0);
+    expect(responses[1].source == &source_b && responses[1].frame[1] == 2);
+    expect(responses[1].length == 13 && memcmp(responses[0].frame + 2, responses[1].frame + 2, 11) == 0);
+
+    now += 1;
+    check(submit(&source_b, 3, 1, 4, 20, 2));
+    expect(lines[0].requests == 2);
+    nmbs_gateway_poll(&gw);
+
+    should("not cache reads outside of the cached ranges");
+    check(submit(&source_a, 4, 1, 4, 99, 2));
+    nmbs_gateway_poll(&gw);
+    check(submit(&source_a, 5, 1, 4, 99, 2));
+    nmbs_gateway_poll(&gw);
+    expect(lines[0].requests == 4);
+
+    should("cache discrete inputs reads");
+    check(submit(&source_a, 6, 1, 2, 0, 16));
+    nmbs_gateway_poll(&gw);
+    check(submit(&source_a, 7, 1, 2, 0, 16));
+    expect(lines[0].requests == 5);
+
+    should("invalidate cached reads overlapping a write");
+    check(submit(&source_a, 8, 1, 4, 20, 2));
+    expect(lines[0].requests == 5);
+
+    check(submit(&source_b, 9, 1, 6, 40, 1));
+    nmbs_gateway_poll(&gw);
+    check(submit(&source_a, 10, 1, 4, 20, 2));
+    expect(lines[0].requests == 6);
+
+    check(submit(&source_b, 11, 1, 6, 21, 7));
+    nmbs_gateway_poll(&gw);
+    check(submit(&source_a, 12, 1, 4, 20, 2));
+    expect(lines[0].requests == 8);
+    nmbs_gateway_poll(&gw);
+    expect(responses[responses_count - 1].frame[1] == 12 && responses[responses_count - 1].frame[12] == 7);
+
+    check(submit(&source_a, 13, 1, 4, 20, 2));
+    expect(lines[0].requests == 8);
+
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 
 static int64_t callbacks_user_data = -64;
 
@@ -1458,6 +1459,2066 @@ void test_fc43_14(nmbs_transport transport) {
     stop_client_and_server();
 }
 
+void test_fc43_14_static(nmbs_transport transport) {
+    const uint8_t buf_size = 128;
+
+    char mem[7 * buf_size];
+    char* buffers[7];
+    for (int i = 0; i < 7; i++) {
+        buffers[i] = &mem[i * buf_size];
+    }
+
+    // Same objects as the callbacks, passed out of order
+    const uint8_t object_ids[] = {0x91, 0x06, 0x00, 0x80, 0x05, 0x01, 0xB3, 0x04, 0x02, 0xA2, 0x03};
+    char values[11][NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH];
+    nmbs_device_id_object objects[11];
+    for (int i = 0; i < 11; i++) {
+        check(read_device_identification(object_ids[i], values[i]));
+        objects[i].id = object_ids[i];
+        objects[i].value = values[i];
+    }
+
+    uint8_t records[1024];
+    nmbs_device_id dev;
+
+    should("reject device ID objects that can't be served");
+    expect(nmbs_device_id_create(&dev, objects, 2, records, sizeof(records)) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_device_id_create(&dev, objects, 11, records, 500) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    objects[0].id = 0x07;
+    expect(nmbs_device_id_create(&dev, objects, 11, records, sizeof(records)) == NMBS_ERROR_INVALID_ARGUMENT);
+    objects[0].id = 0x06;
+    expect(nmbs_device_id_create(&dev, objects, 11, records, sizeof(records)) == NMBS_ERROR_INVALID_ARGUMENT);
+    objects[0].id = 0x91;
+
+    check(nmbs_device_id_create(&dev, objects, 11, records, sizeof(records)));
+    expect(dev.count == 11 && dev.ids[0] == 0x00 && dev.ids[10] == 0xB3);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.device_id = &dev;
+    start_client_and_server(transport, &callbacks);
+
+    should("read basic object ids from pre-serialized objects");
+    check(nmbs_read_device_identification_basic(&CLIENT, buffers[0], buffers[1], buffers[2], buf_size));
+    expect(strcmp(buffers[0], "VendorName") == 0);
+    expect(strcmp(buffers[1], "ProductCode") == 0);
+    expect(strcmp(buffers[2], "MajorMinorRevision") == 0);
+
+    should("read regular object ids from pre-serialized objects, over more than one response");
+    check(nmbs_read_device_identification_regular(&CLIENT, buffers[0], buffers[1], buffers[2], buffers[3], buf_size));
+    expect(strcmp(buffers[0], values[10]) == 0);
+    expect(strcmp(buffers[1], values[7]) == 0);
+    expect(strcmp(buffers[2], values[4]) == 0);
+    expect(strcmp(buffers[3], "UserApplicationName") == 0);
+
+    should("read extended object ids from pre-serialized objects");
+    uint8_t objects_count = 0;
+    uint8_t ids[7];
+    check(nmbs_read_device_identification_extended(&CLIENT, 0x80, ids, buffers, 7, buf_size, &objects_count));
+    expect(objects_count == 4);
+    expect(ids[0] == 0x80 && ids[1] == 0x91 && ids[2] == 0xA2 && ids[3] == 0xB3);
+    for (int i = 0; i < 4; i++)
+        expect(strcmp(buffers[i], values[3]) == 0);
+
+    should("read extended object ids starting from an absent object id");
+    check(nmbs_read_device_identification_extended(&CLIENT, 0x92, ids, buffers, 7, buf_size, &objects_count));
+    expect(objects_count == 2 && ids[0] == 0xA2 && ids[1] == 0xB3);
+
+    should("read a single pre-serialized object");
+    check(nmbs_read_device_identification(&CLIENT, 0x06, buffers[0], buf_size));
+    expect(strcmp(buffers[0], "UserApplicationName") == 0);
+
+    should("return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS when reading a single absent object");
+    expect(nmbs_read_device_identification(&CLIENT, 0x81, buffers[0], buf_size) ==
+           NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    stop_client_and_server();
+}
+
+uint8_t frame_res[260];
+int32_t frame_res_len = 0;
+
+int32_t write_frame_res(const uint8_t* buf, uint16_t count, int32_t timeout, void* arg) {
+    UNUSED_PARAM(timeout);
+    UNUSED_PARAM(arg);
+    memcpy(frame_res, buf, count);
+    frame_res_len = count;
+    return count;
+}
+
+
+// Wraps the PDU into an RTU or TCP ADU
+uint16_t build_frame(nmbs_transport transport, uint8_t unit_id, const uint8_t* pdu, uint16_t pdu_len, uint8_t* out) {
+    uint16_t len = 0;
+    if (transport == NMBS_TRANSPORT_TCP) {
+        out[len++] = 0x12;
+        out[len++] = 0x34;
+        out[len++] = 0;
+        out[len++] = 0;
+        out[len++] = (uint8_t) ((pdu_len + 1) >> 8);
+        out[len++] = (uint8_t) (pdu_len + 1);
+    }
+
+    out[len++] = unit_id;
+    memcpy(out + len, pdu, pdu_len);
+    len += pdu_len;
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        const uint16_t crc = nmbs_crc_calc(out, len, NULL);
+        out[len++] = (uint8_t) (crc >> 8);
+        out[len++] = (uint8_t) crc;
+    }
+
+    return len;
+}
+
+
+// Answers the next request received on the server side of the sockets with registers 7, 8 and 9
+void* respond_late_frames(void* arg) {
+    UNUSED_PARAM(arg);
+
+    uint8_t frame[260];
+    expect(read_frame_fd(sockets[0], frame, sizeof(frame), 1000) > 0);
+
+    const uint16_t len = build_frame(NMBS_TRANSPORT_RTU, TEST_SERVER_ADDR, (uint8_t[]) {3, 6, 0, 7, 0, 8, 0, 9}, 8,
+                                     frame);
+    expect(write_fd(sockets[0], frame, len, 0) == len);
+    return NULL;
+}
+
+
+void test_frames(nmbs_transport transport) {
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_registers = write_registers;
+
+    start_client_and_server_frames(transport, &callbacks);
+    nmbs_set_callbacks_arg(&SERVER, (void*) &callbacks_user_data);
+
+    should("read with no error when messages are received as whole frames");
+    uint16_t regs[3];
+    check(nmbs_read_holding_registers(&CLIENT, 10, 3, regs));
+    expect(regs[0] == 100);
+    expect(regs[1] == 0);
+    expect(regs[2] == 200);
+
+    should("write with no error when messages are received as whole frames");
+    check(nmbs_write_multiple_registers(&CLIENT, 7, 1, (uint16_t[]) {1}));
+
+    should("receive exceptions when messages are received as whole frames");
+    expect(nmbs_read_holding_registers(&CLIENT, 2, 1, regs) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("discard whole frames addressed to another server");
+        nmbs_set_destination_rtu_address(&CLIENT, TEST_SERVER_ADDR + 1);
+        expect(nmbs_read_holding_registers(&CLIENT, 10, 3, regs) == NMBS_ERROR_TIMEOUT);
+
+        nmbs_set_destination_rtu_address(&CLIENT, TEST_SERVER_ADDR);
+        check(nmbs_read_holding_registers(&CLIENT, 10, 3, regs));
+        expect(regs[2] == 200);
+    }
+
+    stop_client_and_server();
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("discard a response received after the timeout before sending the next request");
+        uint8_t frame[260];
+        nmbs_set_read_timeout(&CLIENT, 100);
+        expect(nmbs_read_holding_registers(&CLIENT, 10, 3, regs) == NMBS_ERROR_TIMEOUT);
+        expect(read_frame_fd(sockets[0], frame, sizeof(frame), 0) > 0);
+
+        const uint16_t late_len = build_frame(transport, TEST_SERVER_ADDR, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8,
+                                              frame);
+        expect(write_fd(sockets[0], frame, late_len, 0) == late_len);
+
+        pthread_t responder;
+        expect(pthread_create(&responder, NULL, respond_late_frames, NULL) == 0);
+        check(nmbs_read_holding_registers(&CLIENT, 10, 3, regs));
+        expect(pthread_join(responder, NULL) == 0);
+        expect(regs[0] == 7 && regs[1] == 8 && regs[2] == 9);
+    }
+
+    nmbs_t server;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = transport;
+    platform_conf.read = read_empty;
+    platform_conf.write = write_frame_res;
+
+    reset(server);
+    check(nmbs_server_create(&server, TEST_SERVER_ADDR, &platform_conf, &callbacks));
+    nmbs_set_callbacks_arg(&server, (void*) &callbacks_user_data);
+
+    uint8_t req[12];
+    uint16_t req_len = build_frame(transport, TEST_SERVER_ADDR, (uint8_t[]) {3, 0, 10, 0, 3}, 5, req);
+
+    should("process a request frame passed by the caller");
+    frame_res_len = 0;
+    check(nmbs_server_process_frame(&server, req, req_len));
+    if (transport == NMBS_TRANSPORT_RTU) {
+        expect(frame_res_len == 11);
+        expect(frame_res[0] == TEST_SERVER_ADDR);
+        expect(nmbs_crc_update(NMBS_CRC_INIT, frame_res, frame_res_len) == 0);
+    }
+    else {
+        expect(frame_res_len == 15);
+        expect(frame_res[0] == 0x12 && frame_res[1] == 0x34);
+    }
+    const int32_t pdu_end = transport == NMBS_TRANSPORT_RTU ? frame_res_len - 2 : frame_res_len;
+    expect(frame_res[pdu_end - 4] == 0 && frame_res[pdu_end - 3] == 0);
+    expect(frame_res[pdu_end - 2] == 0 && frame_res[pdu_end - 1] == 200);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when passing an invalid frame");
+    expect(nmbs_server_process_frame(&server, NULL, req_len) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_server_process_frame(&server, req, 261) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("return NMBS_ERROR_TIMEOUT when processing a truncated frame");
+    frame_res_len = 0;
+    expect(nmbs_server_process_frame(&server, req, 3) == NMBS_ERROR_TIMEOUT);
+    expect(nmbs_server_process_frame(&server, req, req_len - 1) == NMBS_ERROR_TIMEOUT);
+    expect(frame_res_len == 0);
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("return NMBS_ERROR_CRC when processing a frame with invalid CRC");
+        req[req_len - 1] ^= 0xFF;
+        expect(nmbs_server_process_frame(&server, req, req_len) == NMBS_ERROR_CRC);
+        req[req_len - 1] ^= 0xFF;
+
+        should("not respond to a frame addressed to another server");
+        req_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5, req);
+        check(nmbs_server_process_frame(&server, req, req_len));
+        expect(frame_res_len == 0);
+    }
+    else {
+        should("return NMBS_ERROR_INVALID_TCP_MBAP when processing a frame with invalid protocol id");
+        req[3] = 1;
+        expect(nmbs_server_process_frame(&server, req, req_len) == NMBS_ERROR_INVALID_TCP_MBAP);
+    }
+}
+
+int32_t read_fail(uint8_t* buf, uint16_t count, int32_t timeout, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout);
+    UNUSED_PARAM(arg);
+    expect(false);
+    return -1;
+}
+
+
+nmbs_error read_registers_unit_id(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id,
+                                  void* arg) {
+    UNUSED_PARAM(address);
+    expect(check_user_data(arg) == 1);
+
+    for (uint16_t i = 0; i < quantity; i++)
+        registers_out[i] = unit_id;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+void test_rtu_addresses(nmbs_transport transport) {
+    nmbs_t server;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = transport;
+    platform_conf.read = read_fail;
+    platform_conf.write = write_frame_res;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers_unit_id;
+
+    reset(server);
+    check(nmbs_server_create(&server, TEST_SERVER_ADDR, &platform_conf, &callbacks));
+    nmbs_set_callbacks_arg(&server, (void*) &callbacks_user_data);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when setting no address or the broadcast address");
+    nmbs_bitfield_256 addresses = {0};
+    expect(nmbs_server_set_rtu_addresses(&server, addresses) == NMBS_ERROR_INVALID_ARGUMENT);
+    nmbs_bitfield_set(addresses, NMBS_BROADCAST_ADDRESS);
+    nmbs_bitfield_set(addresses, 5);
+    expect(nmbs_server_set_rtu_addresses(&server, addresses) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_server_set_rtu_addresses(&server, NULL) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    nmbs_bitfield_unset(addresses, NMBS_BROADCAST_ADDRESS);
+    nmbs_bitfield_set(addresses, 6);
+    nmbs_bitfield_set(addresses, 200);
+    nmbs_bitfield_set(addresses, 247);
+    check(nmbs_server_set_rtu_addresses(&server, addresses));
+
+    const int32_t res_len = transport == NMBS_TRANSPORT_RTU ? 7 : 11;
+    const int32_t pdu_end = transport == NMBS_TRANSPORT_RTU ? res_len - 2 : res_len;
+    uint8_t req[16];
+
+    should("respond to requests addressed to any of the server addresses");
+    const uint8_t units[] = {5, 6, 200, 247};
+    for (uint8_t i = 0; i < sizeof(units); i++) {
+        const uint16_t req_len = build_frame(transport, units[i], (uint8_t[]) {3, 0, 1, 0, 1}, 5, req);
+        frame_res_len = 0;
+        check(nmbs_server_process_frame(&server, req, req_len));
+        expect(frame_res_len == res_len);
+        expect(frame_res[transport == NMBS_TRANSPORT_RTU ? 0 : 6] == units[i]);
+        expect(frame_res[pdu_end - 1] == units[i]);
+        if (transport == NMBS_TRANSPORT_RTU)
+            expect(nmbs_crc_update(NMBS_CRC_INIT, frame_res, frame_res_len) == 0);
+    }
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("not respond to requests addressed to other servers, including the replaced address");
+        const uint8_t others[] = {TEST_SERVER_ADDR, 4, 7, 201, 255};
+        for (uint8_t i = 0; i < sizeof(others); i++) {
+            const uint16_t req_len = build_frame(transport, others[i], (uint8_t[]) {3, 0, 1, 0, 1}, 5, req);
+            frame_res_len = 0;
+            check(nmbs_server_process_frame(&server, req, req_len));
+            expect(frame_res_len == 0);
+        }
+
+        should("handle requests to all the server addresses in a single fed stream");
+        uint8_t stream[64];
+        uint16_t stream_len = build_frame(transport, 7, (uint8_t[]) {3, 0, 1, 0, 1}, 5, stream);
+        stream_len += build_frame(transport, 7, (uint8_t[]) {3, 2, 0, 7}, 4, stream + stream_len);
+        stream_len += build_frame(transport, 200, (uint8_t[]) {3, 0, 1, 0, 1}, 5, stream + stream_len);
+        stream_len += build_frame(transport, 6, (uint8_t[]) {3, 0, 1, 0, 1}, 5, stream + stream_len);
+
+        uint16_t consumed = 0;
+        nmbs_error err = NMBS_ERROR_NONE;
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(frame_res[0] == 200);
+
+        uint16_t fed = consumed;
+        expect(nmbs_server_feed(&server, stream + fed, stream_len - fed, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(frame_res[0] == 6);
+        expect(fed + consumed == stream_len);
+    }
+}
+
+
+void test_server_feed(nmbs_transport transport) {
+    nmbs_t server;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = transport;
+    platform_conf.read = read_fail;
+    platform_conf.write = write_frame_res;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_registers = write_registers;
+
+    reset(server);
+    check(nmbs_server_create(&server, TEST_SERVER_ADDR, &platform_conf, &callbacks));
+    nmbs_set_callbacks_arg(&server, (void*) &callbacks_user_data);
+
+    const uint16_t res_len = transport == NMBS_TRANSPORT_RTU ? 11 : 15;
+    uint8_t req[32];
+    const uint16_t req_len = build_frame(transport, TEST_SERVER_ADDR, (uint8_t[]) {3, 0, 10, 0, 3}, 5, req);
+
+    nmbs_error err = NMBS_ERROR_NONE;
+    uint16_t consumed = 0;
+
+    should("handle a request fed one byte at a time");
+    frame_res_len = 0;
+    for (uint16_t i = 0; i < req_len - 1; i++) {
+        expect(nmbs_server_feed(&server, req + i, 1, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        expect(consumed == 1);
+        expect(frame_res_len == 0);
+    }
+
+    expect(nmbs_server_feed(&server, req + req_len - 1, 1, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+    check(err);
+    expect(consumed == 1);
+    expect(frame_res_len == res_len);
+
+    should("handle consecutive requests fed at once, one per call");
+    uint8_t stream[96];
+    uint16_t stream_len = 0;
+    memcpy(stream + stream_len, req, req_len);
+    stream_len += req_len;
+    stream_len += build_frame(transport, TEST_SERVER_ADDR, (uint8_t[]) {16, 0, 7, 0, 1, 2, 0, 1}, 8,
+                              stream + stream_len);
+    memcpy(stream + stream_len, req, 3);
+    stream_len += 3;
+
+    frame_res_len = 0;
+    expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+    expect(consumed == req_len);
+    expect(frame_res_len == res_len);
+
+    uint16_t fed = consumed;
+    expect(nmbs_server_feed(&server, stream + fed, stream_len - fed, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+    expect(frame_res[transport == NMBS_TRANSPORT_RTU ? 1 : 7] == 16);
+    fed += consumed;
+    expect(fed == stream_len - 3);
+
+    frame_res_len = 0;
+    expect(nmbs_server_feed(&server, stream + fed, 3, &consumed, &err) == NMBS_FEED_NEED_MORE);
+    expect(consumed == 3);
+    expect(nmbs_server_feed(&server, req + 3, req_len - 3, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+    expect(frame_res_len == res_len);
+
+    should("return NMBS_FEED_ERROR when passing invalid arguments");
+    expect(nmbs_server_feed(&server, NULL, 1, NULL, &err) == NMBS_FEED_ERROR);
+    expect(err == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_server_feed(&server, NULL, 0, &consumed, NULL) == NMBS_FEED_NEED_MORE);
+    expect(consumed == 0);
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("skip requests to other servers together with their responses");
+        stream_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {16, 0, 7, 0, 1, 2, 0, 1}, 8, stream);
+        stream_len +=
+                build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {16, 0, 7, 0, 1}, 5, stream + stream_len);
+        stream_len += build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5,
+                                  stream + stream_len);
+        stream_len += build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8,
+                                  stream + stream_len);
+        stream_len += build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5,
+                                  stream + stream_len);
+        stream_len += build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {0x83, 2}, 2, stream + stream_len);
+        memcpy(stream + stream_len, req, req_len);
+        stream_len += req_len;
+
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(consumed == stream_len);
+        expect(frame_res_len == res_len);
+
+        should("handle broadcast requests without responding");
+        frame_res_len = 0;
+        stream_len = build_frame(transport, NMBS_BROADCAST_ADDRESS, (uint8_t[]) {16, 0, 7, 0, 1, 2, 0, 1}, 8, stream);
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        expect(consumed == stream_len);
+        expect(frame_res_len == 0);
+
+        should("return NMBS_FEED_ERROR with NMBS_ERROR_CRC when feeding a frame with invalid CRC");
+        memcpy(stream, req, req_len);
+        stream[req_len - 1] ^= 0xFF;
+        expect(nmbs_server_feed(&server, stream, req_len, &consumed, &err) == NMBS_FEED_ERROR);
+        expect(err == NMBS_ERROR_CRC);
+
+        should("discard a partial frame on reset");
+        expect(nmbs_server_feed(&server, req, 5, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        nmbs_server_feed_reset(&server);
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, req, req_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(frame_res_len == res_len);
+
+        should("skip the response of another server received after a reset");
+        stream_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5, stream);
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        nmbs_server_feed_reset(&server);
+        stream_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8, stream);
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        expect(consumed == stream_len);
+        nmbs_server_feed_reset(&server);
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, req, req_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(frame_res_len == res_len);
+
+        should("handle a request received after a request to another server with no response");
+        stream_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5, stream);
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_NEED_MORE);
+        nmbs_server_feed_reset(&server);
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, req, req_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(frame_res_len == res_len);
+
+        should("handle a frame failing the CRC check of the expected response as a request");
+        stream_len = build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 0, 10, 0, 3}, 5, stream);
+        stream_len += build_frame(transport, TEST_SERVER_ADDR + 1, (uint8_t[]) {3, 4, 0, 0, 1}, 5, stream + stream_len);
+        memcpy(stream + stream_len, req, req_len);
+        stream_len += req_len;
+        frame_res_len = 0;
+        expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+        expect(consumed == stream_len);
+        expect(frame_res_len == res_len);
+    }
+    else {
+        should("return NMBS_FEED_ERROR with NMBS_ERROR_INVALID_TCP_MBAP when feeding an invalid MBAP");
+        memcpy(stream, req, req_len);
+        stream[5] = 1;
+        expect(nmbs_server_feed(&server, stream, req_len, &consumed, &err) == NMBS_FEED_ERROR);
+        expect(err == NMBS_ERROR_INVALID_TCP_MBAP);
+
+        stream[5] = req[5];
+        stream[2] = 1;
+        expect(nmbs_server_feed(&server, stream, req_len, &consumed, &err) == NMBS_FEED_ERROR);
+        expect(err == NMBS_ERROR_INVALID_TCP_MBAP);
+    }
+
+    should("respond with an exception to requests with unsupported function code");
+    frame_res_len = 0;
+    stream_len = build_frame(transport, TEST_SERVER_ADDR, (uint8_t[]) {0x41, 1, 2}, 3, stream);
+    expect(nmbs_server_feed(&server, stream, stream_len, &consumed, &err) == NMBS_FEED_RESPONSE_READY);
+    expect(frame_res[transport == NMBS_TRANSPORT_RTU ? 1 : 7] == 0xC1);
+    expect(frame_res[transport == NMBS_TRANSPORT_RTU ? 2 : 8] == NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+}
+
+uint32_t time_real(void* arg) {
+    UNUSED_PARAM(arg);
+    return (uint32_t) now_ms();
+}
+
+
+uint32_t fake_now = 0;
+
+uint32_t time_fake(void* arg) {
+    UNUSED_PARAM(arg);
+    return fake_now;
+}
+
+
+// Responses returned by read_script(), as they arrive on the line
+uint8_t script[512];
+uint16_t script_len = 0;
+uint16_t script_idx = 0;
+bool script_fail = false;
+
+int32_t read_script(uint8_t* buf, uint16_t count, int32_t timeout, void* arg) {
+    UNUSED_PARAM(timeout);
+    UNUSED_PARAM(arg);
+
+    if (script_fail)
+        return -1;
+
+    uint16_t n = script_len - script_idx;
+    if (n > count)
+        n = count;
+
+    memcpy(buf, script + script_idx, n);
+    script_idx += n;
+    return n;
+}
+
+
+void script_res(nmbs_transport transport, uint16_t tid, const uint8_t* pdu, uint16_t pdu_len) {
+    const uint16_t len = build_frame(transport, TEST_SERVER_ADDR, pdu, pdu_len, script + script_len);
+    if (transport == NMBS_TRANSPORT_TCP) {
+        script[script_len] = (uint8_t) (tid >> 8);
+        script[script_len + 1] = (uint8_t) tid;
+    }
+
+    script_len += len;
+}
+
+
+int async_done = 0;
+
+void async_done_cb(nmbs_t* nmbs, nmbs_error err, void* arg) {
+    UNUSED_PARAM(nmbs);
+    *(nmbs_error*) arg = err;
+    async_done++;
+}
+
+
+void test_async_client(nmbs_transport transport) {
+    const nmbs_error pending = (nmbs_error) 100;
+    const uint16_t window_max = transport == NMBS_TRANSPORT_RTU ? 1 : 4;
+    nmbs_async_window window;
+    nmbs_async_req reqs[4];
+    nmbs_error errs[5];
+    uint16_t regs[5][3];
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_registers = write_registers;
+
+    reset_sockets();
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(transport);
+    client_conf->time_ms = time_real;
+    start_client_and_server_conf(platform_conf_socket_server(transport), client_conf, &callbacks);
+    nmbs_set_callbacks_arg(&SERVER, (void*) &callbacks_user_data);
+
+    should("immediately return NMBS_ERROR_INVALID_ARGUMENT when the asynchronous API is not enabled");
+    expect(nmbs_async_read_holding_registers(&CLIENT, 10, 3, regs[0], async_done_cb, &errs[0]) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_async_poll(&CLIENT) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_async_init(&CLIENT, &window, reqs, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    check(nmbs_async_init(&CLIENT, &window, reqs, 4));
+
+    should("send requests without waiting for the responses, up to the window size");
+    async_done = 0;
+    for (uint16_t i = 0; i < window_max; i++) {
+        errs[i] = pending;
+        check(nmbs_async_read_holding_registers(&CLIENT, 10, 3, regs[i], async_done_cb, &errs[i]));
+    }
+
+    expect(nmbs_async_in_flight(&CLIENT) == window_max);
+    expect(nmbs_async_read_holding_registers(&CLIENT, 10, 3, regs[4], async_done_cb, &errs[4]) ==
+           NMBS_ERROR_WINDOW_FULL);
+
+    should("receive the responses of the requests in flight");
+    const uint64_t start = now_ms();
+    while (nmbs_async_in_flight(&CLIENT) > 0 && now_ms() - start < 2000)
+        check(nmbs_async_poll(&CLIENT));
+
+    expect(async_done == window_max);
+    for (uint16_t i = 0; i < window_max; i++) {
+        check(errs[i]);
+        expect(regs[i][0] == 100 && regs[i][1] == 0 && regs[i][2] == 200);
+    }
+
+    should("complete asynchronous requests with exceptions and writes");
+    async_done = 0;
+    errs[0] = errs[1] = pending;
+    check(nmbs_async_read_holding_registers(&CLIENT, 2, 1, regs[0], async_done_cb, &errs[0]));
+    while (nmbs_async_in_flight(&CLIENT) > 0 && now_ms() - start < 4000)
+        check(nmbs_async_poll(&CLIENT));
+
+    check(nmbs_async_write_multiple_registers(&CLIENT, 7, 1, (uint16_t[]) {1}, async_done_cb, &errs[1]));
+    while (nmbs_async_in_flight(&CLIENT) > 0 && now_ms() - start < 4000)
+        check(nmbs_async_poll(&CLIENT));
+
+    expect(async_done == 2);
+    expect(errs[0] == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    check(errs[1]);
+
+    stop_client_and_server();
+
+    nmbs_t client;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = transport;
+    platform_conf.read = read_script;
+    platform_conf.write = write_frame_res;
+
+    reset(client);
+    check(nmbs_client_create(&client, &platform_conf));
+    nmbs_set_destination_rtu_address(&client, TEST_SERVER_ADDR);
+    nmbs_set_read_timeout(&client, 100);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when enabling the asynchronous API without time function");
+    expect(nmbs_async_init(&client, &window, reqs, 4) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    client.platform.time_ms = time_fake;
+    check(nmbs_async_init(&client, &window, reqs, 4));
+    script_len = script_idx = 0;
+    script_fail = false;
+    fake_now = UINT32_MAX - 50;
+
+    if (transport == NMBS_TRANSPORT_TCP) {
+        should("match responses received out of order by transaction ID");
+        async_done = 0;
+        for (uint16_t i = 0; i < 3; i++) {
+            errs[i] = pending;
+            check(nmbs_async_read_holding_registers(&client, 0, i + 1, regs[i], async_done_cb, &errs[i]));
+        }
+
+        script_res(transport, 3, (uint8_t[]) {3, 6, 0, 7, 0, 8, 0, 9}, 8);
+        script_res(transport, 1, (uint8_t[]) {3, 2, 0, 1}, 4);
+        script_res(transport, 2, (uint8_t[]) {3, 4, 0, 4, 0, 5}, 6);
+        check(nmbs_async_poll(&client));
+        expect(async_done == 3);
+        check(errs[0]);
+        check(errs[1]);
+        check(errs[2]);
+        expect(regs[0][0] == 1);
+        expect(regs[1][0] == 4 && regs[1][1] == 5);
+        expect(regs[2][0] == 7 && regs[2][1] == 8 && regs[2][2] == 9);
+    }
+
+    should("receive a response split across polls");
+    async_done = 0;
+    errs[0] = pending;
+    check(nmbs_async_read_holding_registers(&client, 0, 1, regs[0], async_done_cb, &errs[0]));
+    const uint16_t tid = client.current_tid;
+    script_res(transport, tid, (uint8_t[]) {3, 2, 0x12, 0x34}, 4);
+    script_len -= 3;
+    check(nmbs_async_poll(&client));
+    expect(async_done == 0);
+    script_len += 3;
+    check(nmbs_async_poll(&client));
+    expect(async_done == 1);
+    check(errs[0]);
+    expect(regs[0][0] == 0x1234);
+
+    should("complete requests with NMBS_ERROR_TIMEOUT after the read timeout, across clock wrap-around");
+    async_done = 0;
+    errs[0] = pending;
+    check(nmbs_async_write_single_register(&client, 5, 6, async_done_cb, &errs[0]));
+    fake_now += 99;
+    check(nmbs_async_poll(&client));
+    expect(async_done == 0);
+    fake_now += 1;
+    check(nmbs_async_poll(&client));
+    expect(async_done == 1);
+    expect(errs[0] == NMBS_ERROR_TIMEOUT);
+    expect(nmbs_async_in_flight(&client) == 0);
+
+    should("discard late responses to expired requests");
+    const uint16_t late_tid = client.current_tid;
+    async_done = 0;
+    errs[0] = pending;
+    check(nmbs_async_write_single_coil(&client, 3, true, async_done_cb, &errs[0]));
+    if (transport == NMBS_TRANSPORT_TCP)
+        script_res(transport, late_tid, (uint8_t[]) {6, 0, 5, 0, 6}, 5);
+    script_res(transport, client.current_tid, (uint8_t[]) {5, 0, 3, 0xFF, 0}, 5);
+    check(nmbs_async_poll(&client));
+    expect(async_done == 1);
+    check(errs[0]);
+
+    should("complete requests with modbus exceptions");
+    async_done = 0;
+    errs[0] = pending;
+    uint8_t raw_res[4];
+    check(nmbs_async_send_raw_pdu(&client, 4, (uint8_t[]) {0, 1, 0, 2}, 4, raw_res, 4, async_done_cb, &errs[0]));
+    script_res(transport, client.current_tid, (uint8_t[]) {0x84, 2}, 2);
+    check(nmbs_async_poll(&client));
+    expect(async_done == 1);
+    expect(errs[0] == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("complete all requests in flight on transport errors");
+    async_done = 0;
+    for (uint16_t i = 0; i < window_max; i++) {
+        errs[i] = pending;
+        check(nmbs_async_read_coils(&client, 0, 8, NULL, async_done_cb, &errs[i]));
+    }
+
+    script_fail = true;
+    expect(nmbs_async_poll(&client) == NMBS_ERROR_TRANSPORT);
+    expect(async_done == window_max);
+    for (uint16_t i = 0; i < window_max; i++)
+        expect(errs[i] == NMBS_ERROR_TRANSPORT);
+
+    expect(nmbs_async_in_flight(&client) == 0);
+    script_fail = false;
+
+    should("cancel the requests in flight");
+    async_done = 0;
+    errs[0] = pending;
+    check(nmbs_async_read_discrete_inputs(&client, 0, 8, NULL, async_done_cb, &errs[0]));
+    nmbs_async_cancel(&client, NMBS_ERROR_TRANSPORT);
+    expect(async_done == 1);
+    expect(errs[0] == NMBS_ERROR_TRANSPORT);
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("complete broadcast requests right away");
+        nmbs_set_destination_rtu_address(&client, NMBS_BROADCAST_ADDRESS);
+        async_done = 0;
+        errs[0] = pending;
+        nmbs_bitfield coils = {0xFF};
+        check(nmbs_async_write_multiple_coils(&client, 0, 8, coils, async_done_cb, &errs[0]));
+        expect(async_done == 1);
+        check(errs[0]);
+        expect(nmbs_async_in_flight(&client) == 0);
+    }
+}
+
+
+uint16_t file_store[4][10000];
+bool file_store_last_online = true;
+
+// File records storage, files 1 to 4 with records 0 to 9999
+nmbs_error file_store_range(uint16_t file_number, uint16_t record_number, uint16_t count) {
+    if (file_number < 1 || file_number > 4 || record_number + count > 10000)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    if (file_number == 4 && !file_store_last_online)
+        return NMBS_EXCEPTION_SERVER_DEVICE_FAILURE;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_file_store(uint16_t file_number, uint16_t record_number, uint16_t* registers, uint16_t count,
+                           uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    const nmbs_error err = file_store_range(file_number, record_number, count);
+    if (err == NMBS_ERROR_NONE)
+        memcpy(registers, &file_store[file_number - 1][record_number], count * sizeof(uint16_t));
+
+    return err;
+}
+
+
+nmbs_error write_file_store(uint16_t file_number, uint16_t record_number, const uint16_t* registers, uint16_t count,
+                            uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    const nmbs_error err = file_store_range(file_number, record_number, count);
+    if (err == NMBS_ERROR_NONE)
+        memcpy(&file_store[file_number - 1][record_number], registers, count * sizeof(uint16_t));
+
+    return err;
+}
+
+
+nmbs_client_status file_stream_run(nmbs_file_stream* stream, nmbs_error* err) {
+    const uint64_t start = now_ms();
+    nmbs_client_status status = NMBS_CLIENT_IN_PROGRESS;
+    while (status == NMBS_CLIENT_IN_PROGRESS && now_ms() - start < 10000)
+        status = nmbs_file_stream_poll(&CLIENT, stream, err);
+
+    return status;
+}
+
+
+void test_file_stream(nmbs_transport transport) {
+    nmbs_async_window window;
+    nmbs_async_req reqs[4];
+    nmbs_file_stream stream;
+    nmbs_error err = NMBS_ERROR_NONE;
+
+    static uint16_t image[30000];
+    static uint16_t image_read[30000];
+    for (uint32_t i = 0; i < 30000; i++)
+        image[i] = (uint16_t) (i * 7 + 3);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_file_record = read_file_store;
+    callbacks.write_file_record = write_file_store;
+
+    reset_sockets();
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(transport);
+    client_conf->time_ms = time_real;
+    start_client_and_server_conf(platform_conf_socket_server(transport), client_conf, &callbacks);
+
+    should("immediately return NMBS_ERROR_INVALID_ARGUMENT when the asynchronous API is not enabled");
+    expect(nmbs_file_write_stream(&CLIENT, &stream, 1, 0, image, 10) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("return NMBS_EXCEPTION_ILLEGAL_DATA_VALUE when the read sub-responses don't fit in a PDU");
+    nmbs_send_raw_pdu(&CLIENT, 20, (uint8_t[]) {14, 6, 0, 1, 0, 0, 0, 124, 6, 0, 2, 0, 0, 0, 124}, 15);
+    expect(nmbs_receive_raw_pdu_response(&CLIENT, NULL, 2) == NMBS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+    check(nmbs_async_init(&CLIENT, &window, reqs, 4));
+
+    should("immediately return NMBS_ERROR_INVALID_ARGUMENT with ranges outside of the files");
+    expect(nmbs_file_write_stream(&CLIENT, &stream, 0, 0, image, 10) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_file_write_stream(&CLIENT, &stream, 1, 10000, image, 10) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_file_read_stream(&CLIENT, &stream, 0xFFFF, 9999, image_read, 2) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("write records across file boundaries with pipelined requests");
+    memset(file_store, 0, sizeof(file_store));
+    check(nmbs_file_write_stream(&CLIENT, &stream, 1, 5000, image, 30000));
+    expect(transport == NMBS_TRANSPORT_RTU ? nmbs_async_in_flight(&CLIENT) == 1 : nmbs_async_in_flight(&CLIENT) == 4);
+    expect(file_stream_run(&stream, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(nmbs_file_stream_acked(&stream) == 30000);
+    expect(memcmp(&file_store[0][5000], image, 5000 * sizeof(uint16_t)) == 0);
+    expect(memcmp(file_store[1], image + 5000, 10000 * sizeof(uint16_t)) == 0);
+    expect(memcmp(file_store[2], image + 15000, 10000 * sizeof(uint16_t)) == 0);
+    expect(memcmp(file_store[3], image + 25000, 5000 * sizeof(uint16_t)) == 0);
+    expect(nmbs_file_stream_throughput(&CLIENT, &stream) > 0);
+
+    should("read records across file boundaries with pipelined requests");
+    check(nmbs_file_read_stream(&CLIENT, &stream, 1, 5000, image_read, 30000));
+    expect(file_stream_run(&stream, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(memcmp(image_read, image, sizeof(image)) == 0);
+
+    should("stop at the first failed request and only acknowledge the records before it");
+    file_store_last_online = false;
+    check(nmbs_file_write_stream(&CLIENT, &stream, 3, 9000, image, 2000));
+    expect(file_stream_run(&stream, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+
+    // Requests of 122 records, the 9th one has the last 24 records of file 3 and the first 98 of file 4
+    expect(nmbs_file_stream_acked(&stream) == 8 * 122);
+
+    should("resume a failed stream from the first record not acknowledged");
+    file_store_last_online = true;
+    check(nmbs_file_stream_resume(&CLIENT, &stream));
+    expect(file_stream_run(&stream, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(nmbs_file_stream_acked(&stream) == 2000);
+    expect(memcmp(&file_store[2][9000], image, 1000 * sizeof(uint16_t)) == 0);
+    expect(memcmp(file_store[3], image + 1000, 1000 * sizeof(uint16_t)) == 0);
+
+    stop_client_and_server();
+}
+
+
+void test_client_step(nmbs_transport transport) {
+    nmbs_t client;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = transport;
+    platform_conf.read = read_script;
+    platform_conf.write = write_frame_res;
+
+    reset(client);
+    check(nmbs_client_create(&client, &platform_conf));
+    nmbs_set_destination_rtu_address(&client, TEST_SERVER_ADDR);
+    nmbs_set_read_timeout(&client, 100);
+    script_len = script_idx = 0;
+    script_fail = false;
+    fake_now = UINT32_MAX - 50;
+
+    uint16_t regs[3];
+    nmbs_error err = NMBS_ERROR_NONE;
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when starting a request without time function");
+    expect(nmbs_client_begin_read_holding_registers(&client, 0, 3, regs) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IDLE);
+
+    client.platform.time_ms = time_fake;
+
+    should("immediately return NMBS_ERROR_INVALID_ARGUMENT when starting a request with invalid arguments");
+    expect(nmbs_client_begin_read_holding_registers(&client, 0, 0, regs) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IDLE);
+
+    should("advance a request as the bytes of its response arrive");
+    check(nmbs_client_begin_read_holding_registers(&client, 0, 3, regs));
+    expect(frame_res_len > 0);
+    expect(nmbs_client_begin_write_single_register(&client, 0, 1) == NMBS_ERROR_WINDOW_FULL);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IN_PROGRESS);
+
+    script_res(transport, client.current_tid, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8);
+    const uint16_t res_len = script_len;
+    for (script_len = 1; script_len < res_len; script_len++)
+        expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IN_PROGRESS);
+
+    err = (nmbs_error) 100;
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(regs[0] == 1 && regs[1] == 2 && regs[2] == 3);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IDLE);
+
+    should("complete requests with modbus exceptions");
+    check(nmbs_client_begin_write_multiple_registers(&client, 7, 2, (uint16_t[]) {1, 2}));
+    script_res(transport, client.current_tid, (uint8_t[]) {0x90, 2}, 2);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("complete raw PDU requests");
+    uint8_t raw_res[4];
+    check(nmbs_client_begin_send_raw_pdu(&client, 4, (uint8_t[]) {0, 1, 0, 2}, 4, raw_res, 4));
+    script_res(transport, client.current_tid, (uint8_t[]) {4, 4, 0xAA, 0xBB, 0xCC}, 5);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(raw_res[0] == 4 && raw_res[3] == 0xCC);
+
+    should("complete forwarded PDU requests with responses of any length");
+    uint8_t fwd_res[8];
+    uint8_t fwd_len = 0;
+    check(nmbs_client_begin_forward_pdu(&client, 3, (uint8_t[]) {0, 1, 0, 2}, 4, fwd_res, sizeof(fwd_res), &fwd_len));
+    script_res(transport, client.current_tid, (uint8_t[]) {3, 4, 0xAA, 0xBB, 0xCC, 0xDD}, 6);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(fwd_len == 5 && fwd_res[0] == 4 && fwd_res[4] == 0xDD);
+
+    check(nmbs_client_begin_forward_pdu(&client, 3, (uint8_t[]) {0, 1, 0, 8}, 4, fwd_res, sizeof(fwd_res), &fwd_len));
+    script_res(transport, client.current_tid, (uint8_t[]) {3, 16, 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7, 0, 8}, 18);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_ERROR_INVALID_RESPONSE);
+
+    should("complete requests with gateway exceptions");
+    check(nmbs_client_begin_forward_pdu(&client, 3, (uint8_t[]) {0, 1, 0, 2}, 4, fwd_res, sizeof(fwd_res), &fwd_len));
+    script_res(transport, client.current_tid, (uint8_t[]) {0x83, 0x0B}, 2);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_EXCEPTION_GATEWAY_TARGET_FAILED);
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("reject forwarded PDUs with a function code of unknown response length");
+        expect(nmbs_client_begin_forward_pdu(&client, 0x41, NULL, 0, fwd_res, sizeof(fwd_res), &fwd_len) ==
+               NMBS_ERROR_INVALID_ARGUMENT);
+    }
+
+    should("complete requests with NMBS_ERROR_TIMEOUT after the read timeout, across clock wrap-around");
+    check(nmbs_client_begin_write_single_coil(&client, 3, true));
+    fake_now += 99;
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_IN_PROGRESS);
+    fake_now += 1;
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_ERROR_TIMEOUT);
+
+    should("complete requests with transport errors");
+    nmbs_bitfield coils;
+    check(nmbs_client_begin_read_discrete_inputs(&client, 0, 8, coils));
+    script_fail = true;
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    expect(err == NMBS_ERROR_TRANSPORT);
+    script_fail = false;
+
+    should("complete a read coils request");
+    check(nmbs_client_begin_read_coils(&client, 0, 8, coils));
+    script_res(transport, client.current_tid, (uint8_t[]) {1, 1, 0x81}, 3);
+    expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+    check(err);
+    expect(nmbs_bitfield_read(coils, 0) && !nmbs_bitfield_read(coils, 1) && nmbs_bitfield_read(coils, 7));
+
+    if (transport == NMBS_TRANSPORT_RTU) {
+        should("complete broadcast requests right away");
+        nmbs_set_destination_rtu_address(&client, NMBS_BROADCAST_ADDRESS);
+        check(nmbs_client_begin_write_single_register(&client, 1, 2));
+        expect(nmbs_client_step(&client, &err) == NMBS_CLIENT_DONE);
+        check(err);
+    }
+}
+
+
+uint16_t plan_registers[0x200];
+int plan_reads = 0;
+int plan_writes = 0;
+int plan_frames = 0;
+nmbs_bitfield plan_coils_flipped = {0};
+
+nmbs_error plan_read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id,
+                               void* arg) {
+    UNUSED_PARAM(arg);
+    plan_reads++;
+
+    if (address + quantity > 0x200)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    for (uint16_t i = 0; i < quantity; i++)
+        registers_out[i] = (uint16_t) (plan_registers[address + i] + unit_id * 1000);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error plan_write_registers(uint16_t address, uint16_t quantity, const uint16_t* registers, uint8_t unit_id,
+                                void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    plan_writes++;
+
+    if (address + quantity > 0x200)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(plan_registers + address, registers, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error plan_read_coils(uint16_t address, uint16_t quantity, nmbs_bitfield coils_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    plan_reads++;
+
+    for (uint16_t i = 0; i < quantity; i++)
+        nmbs_bitfield_write(coils_out, i,
+                            ((address + i) % 3 == 0) != nmbs_bitfield_read(plan_coils_flipped, address + i));
+
+    return NMBS_ERROR_NONE;
+}
+
+
+int32_t write_socket_client_counted(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    plan_frames++;
+    return write_socket_client(buf, count, timeout_ms, arg);
+}
+
+
+void test_read_plan(nmbs_transport transport) {
+    for (uint16_t i = 0; i < 0x200; i++)
+        plan_registers[i] = i;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = plan_read_registers;
+    callbacks.write_multiple_registers = plan_write_registers;
+    callbacks.read_coils = plan_read_coils;
+
+    reset_sockets();
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(transport);
+    client_conf->write = write_socket_client_counted;
+    start_client_and_server_conf(platform_conf_socket_server(transport), client_conf, &callbacks);
+
+    uint16_t r10[2], r14[3], r11, r100, r200[100], r300[30], r_other[2];
+    nmbs_bitfield c0, c8;
+    nmbs_read_tag tags[] = {
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 300, 30, r300, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 14, 3, r14, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_COILS, 8, 4, c8, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 10, 2, r10, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 100, 1, &r100, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_COILS, 0, 5, c0, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 11, 1, &r11, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 200, 100, r200, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR + 1, NMBS_TABLE_HOLDING_REGISTERS, 10, 2, r_other, NMBS_ERROR_NONE},
+    };
+
+    // RTU requests to other unit IDs wouldn't be answered by the test server
+    const uint16_t tags_count = transport == NMBS_TRANSPORT_TCP ? 9 : 8;
+    const uint16_t requests = transport == NMBS_TRANSPORT_TCP ? 6 : 5;
+    nmbs_read_block blocks[9];
+    nmbs_read_plan plan;
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when creating a plan with invalid tags");
+    nmbs_read_tag invalid = {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 0, 0, NULL, NMBS_ERROR_NONE};
+    expect(nmbs_read_plan_create(&plan, &invalid, 1, blocks, 9, 0, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    invalid.quantity = 126;
+    expect(nmbs_read_plan_create(&plan, &invalid, 1, blocks, 9, 0, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    invalid.table = NMBS_TABLE_DISCRETE_INPUTS;
+    invalid.quantity = 2001;
+    expect(nmbs_read_plan_create(&plan, &invalid, 1, blocks, 9, 0, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    invalid.quantity = 2;
+    invalid.address = 0xFFFF;
+    expect(nmbs_read_plan_create(&plan, &invalid, 1, blocks, 9, 0, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    invalid.table = (nmbs_table) 5;
+    invalid.address = 0;
+    expect(nmbs_read_plan_create(&plan, &invalid, 1, blocks, 9, 0, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when the plan needs more requests than the available blocks");
+    expect(nmbs_read_plan_create(&plan, tags, tags_count, blocks, requests - 1, 4, 4) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("merge close tags of the same unit ID and table within the request limits");
+    check(nmbs_read_plan_create(&plan, tags, tags_count, blocks, 9, 4, 4));
+    expect(nmbs_read_plan_requests(&plan) == requests);
+
+    should("not merge tags farther apart than the gap tolerance");
+    check(nmbs_read_plan_create(&plan, tags, tags_count, blocks, 9, 1, 2));
+    expect(nmbs_read_plan_requests(&plan) == requests + 2);
+
+    should("execute the plan and scatter the results to the tags");
+    check(nmbs_read_plan_create(&plan, tags, tags_count, blocks, 9, 4, 4));
+    plan_reads = 0;
+    plan_frames = 0;
+    check(nmbs_read_plan_execute(&CLIENT, &plan));
+    expect(plan_reads == requests);
+    expect(plan_frames == requests);
+    expect(CLIENT.dest_address_rtu == TEST_SERVER_ADDR);
+
+    const uint16_t unit = TEST_SERVER_ADDR * 1000;
+    expect(r10[0] == unit + 10 && r10[1] == unit + 11);
+    expect(r11 == unit + 11);
+    expect(r14[0] == unit + 14 && r14[2] == unit + 16);
+    expect(r100 == unit + 100);
+    expect(r200[0] == unit + 200 && r200[99] == unit + 299);
+    expect(r300[0] == unit + 300 && r300[29] == unit + 329);
+    for (uint16_t i = 0; i < 5; i++)
+        expect(nmbs_bitfield_read(c0, i) == (i % 3 == 0));
+    for (uint16_t i = 0; i < 4; i++)
+        expect(nmbs_bitfield_read(c8, i) == ((8 + i) % 3 == 0));
+
+    for (uint16_t i = 0; i < tags_count; i++)
+        check(tags[i].err);
+
+    if (transport == NMBS_TRANSPORT_TCP)
+        expect(r_other[0] == (TEST_SERVER_ADDR + 1) * 1000 + 10);
+
+    should("send a pending write together with a holding registers read");
+    check(nmbs_read_plan_set_write(&plan, TEST_SERVER_ADDR, 12, 2, (uint16_t[]) {7, 8}));
+    plan_reads = 0;
+    plan_writes = 0;
+    plan_frames = 0;
+    check(nmbs_read_plan_execute(&CLIENT, &plan));
+    expect(plan_writes == 1);
+    expect(plan_frames == requests);
+    expect(plan_registers[12] == 7 && plan_registers[13] == 8);
+    expect(r10[0] == unit + 10 && r11 == unit + 11);
+
+    plan_writes = 0;
+    check(nmbs_read_plan_execute(&CLIENT, &plan));
+    expect(plan_writes == 0);
+
+    if (transport == NMBS_TRANSPORT_TCP) {
+        should("send a pending write separately when the plan doesn't read holding registers from its unit ID");
+        check(nmbs_read_plan_set_write(&plan, TEST_SERVER_ADDR + 2, 20, 1, (uint16_t[]) {9}));
+        plan_frames = 0;
+        check(nmbs_read_plan_execute(&CLIENT, &plan));
+        expect(plan_frames == requests + 1);
+        expect(plan_registers[20] == 9);
+    }
+
+    should("store the errors of failed requests in their tags and continue the execution");
+    nmbs_read_tag failing[] = {
+            {TEST_SERVER_ADDR, NMBS_TABLE_INPUT_REGISTERS, 0, 1, r10, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 0x1FF, 2, r10, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 0, 1, &r11, NMBS_ERROR_NONE},
+    };
+
+    check(nmbs_read_plan_create(&plan, failing, 3, blocks, 9, 0, 0));
+    expect(nmbs_read_plan_requests(&plan) == 3);
+    expect(nmbs_read_plan_execute(&CLIENT, &plan) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    // Tags were sorted by table and address
+    check(failing[0].err);
+    expect(r11 == unit);
+    expect(failing[1].err == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    expect(failing[2].err == NMBS_EXCEPTION_ILLEGAL_FUNCTION);
+
+    stop_client_and_server();
+}
+
+
+nmbs_change changes[8];
+uint16_t changes_old[8];
+uint16_t changes_new[8];
+int changes_count = 0;
+
+// The values are only valid during the callback, the first changed ones are kept
+void record_change(const nmbs_change* change, void* arg) {
+    expect(check_user_data(arg) == 1);
+    expect(changes_count < 8);
+
+    const bool registers = change->table == NMBS_TABLE_HOLDING_REGISTERS || change->table == NMBS_TABLE_INPUT_REGISTERS;
+    const uint16_t* old_registers = change->old_values;
+    const uint16_t* new_registers = change->new_values;
+    const uint8_t* old_bits = change->old_values;
+    const uint8_t* new_bits = change->new_values;
+
+    changes_old[changes_count] = 0;
+    if (change->old_values)
+        changes_old[changes_count] =
+                registers ? old_registers[change->offset] : nmbs_bitfield_read(old_bits, change->offset);
+
+    changes_new[changes_count] = registers ? new_registers[change->offset] : nmbs_bitfield_read(new_bits, change->offset);
+    changes[changes_count++] = *change;
+}
+
+
+void test_subscription(nmbs_transport transport) {
+    for (uint16_t i = 0; i < 0x200; i++)
+        plan_registers[i] = i;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = plan_read_registers;
+    callbacks.read_coils = plan_read_coils;
+
+    start_client_and_server(transport, &callbacks);
+
+    uint16_t r0[10], r100[100];
+    nmbs_bitfield c0;
+    nmbs_read_tag tags[] = {
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 0, 10, r0, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_HOLDING_REGISTERS, 100, 100, r100, NMBS_ERROR_NONE},
+            {TEST_SERVER_ADDR, NMBS_TABLE_COILS, 0, 100, c0, NMBS_ERROR_NONE},
+    };
+
+    nmbs_read_block blocks[3];
+    nmbs_read_plan plan;
+    check(nmbs_read_plan_create(&plan, tags, 3, blocks, 3, 0, 0));
+    expect(nmbs_read_plan_requests(&plan) == 3);
+
+    should("return the size of the image of a subscription");
+    expect(nmbs_subscription_image_size(&plan) == 1 + 10 + 100 + 7);
+
+    uint16_t image[118];
+    nmbs_subscription sub;
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when creating a subscription with a small image");
+    expect(nmbs_subscription_create(&sub, &plan, image, 117, record_change, (void*) &callbacks_user_data) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    check(nmbs_subscription_create(&sub, &plan, image, 118, record_change, (void*) &callbacks_user_data));
+
+    should("report all the values on the first execution of a subscription");
+    changes_count = 0;
+    check(nmbs_subscription_execute(&CLIENT, &sub));
+    expect(changes_count == 3);
+    for (int i = 0; i < 3; i++)
+        expect(changes[i].old_values == NULL && changes[i].offset == 0);
+
+    expect(changes[0].table == NMBS_TABLE_COILS && changes[0].address == 0 && changes[0].quantity == 100);
+    expect(changes[1].table == NMBS_TABLE_HOLDING_REGISTERS && changes[1].address == 0 && changes[1].quantity == 10);
+    expect(changes[2].address == 100 && changes[2].quantity == 100);
+    expect(changes[2].unit_id == TEST_SERVER_ADDR);
+
+    // The tags are still read like with nmbs_read_plan_execute()
+    const uint16_t unit = TEST_SERVER_ADDR * 1000;
+    expect(r0[9] == unit + 9 && r100[99] == unit + 199);
+
+    should("report nothing when no value changed");
+    changes_count = 0;
+    check(nmbs_subscription_execute(&CLIENT, &sub));
+    expect(changes_count == 0);
+
+    should("report the ranges of changed registers and coils, with their old and new values");
+    plan_registers[3] = 0x33;
+    plan_registers[4] = 0x44;
+    plan_registers[150] = 0x55;
+    plan_registers[199] = 0x66;
+    nmbs_bitfield_set(plan_coils_flipped, 9);
+    for (uint16_t i = 64; i < 71; i++)
+        nmbs_bitfield_set(plan_coils_flipped, i);
+
+    changes_count = 0;
+    check(nmbs_subscription_execute(&CLIENT, &sub));
+    expect(changes_count == 5);
+
+    expect(changes[0].table == NMBS_TABLE_COILS && changes[0].address == 9 && changes[0].quantity == 1);
+    expect(changes_old[0] == 1 && changes_new[0] == 0);
+    expect(changes[1].address == 64 && changes[1].quantity == 7 && changes[1].offset == 64);
+    expect(changes_old[1] == 0 && changes_new[1] == 1);
+
+    expect(changes[2].table == NMBS_TABLE_HOLDING_REGISTERS && changes[2].address == 3 && changes[2].quantity == 2);
+    expect(changes_old[2] == unit + 3 && changes_new[2] == unit + 0x33);
+
+    expect(changes[3].address == 150 && changes[3].quantity == 1 && changes[3].offset == 50);
+    expect(changes[4].address == 199 && changes[4].quantity == 1 && changes[4].offset == 99);
+
+    changes_count = 0;
+    check(nmbs_subscription_execute(&CLIENT, &sub));
+    expect(changes_count == 0);
+
+    should("report all the values again after a reset");
+    nmbs_subscription_reset(&sub);
+    changes_count = 0;
+    check(nmbs_subscription_execute(&CLIENT, &sub));
+    expect(changes_count == 3);
+    expect(changes[1].old_values == NULL);
+
+    memset(plan_coils_flipped, 0, sizeof(plan_coils_flipped));
+    stop_client_and_server();
+}
+
+
+uint32_t units_clock_offset = 0;
+
+uint32_t units_clock(void* arg) {
+    UNUSED_PARAM(arg);
+    return (uint32_t) now_ms() + units_clock_offset;
+}
+
+
+void test_unit_tracking(void) {
+    uint32_t t15_us = 0;
+    uint32_t t35_us = 0;
+
+    should("compute the RTU character timings of a baud rate");
+    nmbs_rtu_char_timings(9600, &t15_us, &t35_us);
+    expect(t15_us == 1719 && t35_us == 4011);
+    nmbs_rtu_char_timings(115200, &t15_us, &t35_us);
+    expect(t15_us == 750 && t35_us == 1750);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = plan_read_registers;
+
+    reset_sockets();
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(NMBS_TRANSPORT_RTU);
+    start_client_and_server_conf(platform_conf_socket_server(NMBS_TRANSPORT_RTU), client_conf, &callbacks);
+
+    should("set the byte timeout from the baud rate");
+    expect(nmbs_set_baud_rate(&CLIENT, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    check(nmbs_set_baud_rate(&CLIENT, 9600));
+    expect(CLIENT.byte_timeout_ms == 5);
+    nmbs_set_byte_timeout(&CLIENT, 100);
+
+    nmbs_unit_health units[4];
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when tracking units without a clock");
+    expect(nmbs_set_unit_tracking(&CLIENT, units, 4, 50) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    CLIENT.platform.time_ms = units_clock;
+    check(nmbs_set_unit_tracking(&CLIENT, units, 4, 50));
+    nmbs_set_unit_backoff(&CLIENT, 3, 1000, 3000);
+
+    should("derive the response timeout of a unit from its response times");
+    expect(nmbs_unit_timeout(&CLIENT, TEST_SERVER_ADDR) == 1000);
+    uint16_t r = 0;
+    for (int i = 0; i < 4; i++)
+        check(nmbs_read_holding_registers(&CLIENT, 0, 1, &r));
+
+    expect(units[TEST_SERVER_ADDR].samples == 4);
+    expect(nmbs_unit_timeout(&CLIENT, TEST_SERVER_ADDR) >= 50 && nmbs_unit_timeout(&CLIENT, TEST_SERVER_ADDR) < 1000);
+    expect(nmbs_unit_timeout(&CLIENT, 4) == 1000);
+
+    should("back off from a unit after repeated timeouts");
+    // Nothing answers on the line
+    stop_client_and_server();
+    nmbs_set_read_timeout(&CLIENT, 100);
+    nmbs_set_destination_rtu_address(&CLIENT, 2);
+    for (int i = 0; i < 3; i++)
+        expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_TIMEOUT);
+
+    expect(units[2].lost == 3 && units[2].timeouts == 3 && units[2].backoff_ms == 1000);
+
+    uint64_t start = now_ms();
+    expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_UNIT_BACKOFF);
+    expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_UNIT_BACKOFF);
+    expect(now_ms() - start < 50);
+    expect(units[2].skipped == 2);
+
+    should("probe a unit in backoff at increasing intervals");
+    units_clock_offset += 1000;
+    expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_TIMEOUT);
+    expect(units[2].backoff_ms == 2000);
+    expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_UNIT_BACKOFF);
+
+    units_clock_offset += 2000;
+    expect(nmbs_read_holding_registers(&CLIENT, 0, 1, &r) == NMBS_ERROR_TIMEOUT);
+    expect(units[2].backoff_ms == 3000);
+
+    should("get a unit out of backoff as soon as it responds");
+    reset_sockets();
+    nmbs_bitfield_256 addresses = {0};
+    nmbs_bitfield_set(addresses, TEST_SERVER_ADDR);
+    nmbs_bitfield_set(addresses, 2);
+    check(nmbs_server_set_rtu_addresses(&SERVER, addresses));
+    expect(pthread_mutex_lock(&server_stopped_m) == 0);
+    server_stopped = false;
+    expect(pthread_mutex_unlock(&server_stopped_m) == 0);
+    expect(pthread_create(&server_thread, NULL, server_listen_thread, &SERVER) == 0);
+
+    units_clock_offset += 3000;
+    check(nmbs_read_holding_registers(&CLIENT, 0, 1, &r));
+    expect(units[2].backoff_ms == 0 && units[2].lost == 0 && units[2].samples == 1);
+    check(nmbs_read_holding_registers(&CLIENT, 0, 1, &r));
+
+    should("not track broadcasts");
+    nmbs_set_destination_rtu_address(&CLIENT, NMBS_BROADCAST_ADDRESS);
+    check(nmbs_write_single_register(&CLIENT, 0, 1));
+    expect(units[0].samples == 0 && units[0].timeouts == 0);
+
+    stop_client_and_server();
+}
+
+
+uint16_t registers_image[0x100];
+
+nmbs_error read_registers_be(uint16_t address, uint16_t quantity, uint8_t* registers_be_out, uint8_t unit_id,
+                             void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address + quantity > 0x100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    nmbs_registers_to_be(registers_be_out, registers_image + address, quantity);
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error read_input_registers_be(uint16_t address, uint16_t quantity, uint8_t* registers_be_out, uint8_t unit_id,
+                                   void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address == 1)
+        return -1;
+
+    for (uint16_t i = 0; i < quantity; i++)
+        nmbs_be16_write(registers_be_out, i, 0xA000 + address + i);
+
+    return NMBS_ERROR_NONE;
+}
+
+
+void test_registers_be(nmbs_transport transport) {
+    for (uint16_t i = 0; i < 0x100; i++)
+        registers_image[i] = (uint16_t) (i * 0x0101 + 1);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.read_holding_registers_be = read_registers_be;
+    callbacks.read_input_registers_be = read_input_registers_be;
+
+    start_client_and_server(transport, &callbacks);
+
+    should("read holding registers stored in big-endian order by the callback");
+    uint16_t regs[125];
+    check(nmbs_read_holding_registers(&CLIENT, 10, 3, regs));
+    expect(regs[0] == 10 * 0x0101 + 1);
+    expect(regs[2] == 12 * 0x0101 + 1);
+
+    check(nmbs_read_holding_registers(&CLIENT, 0x100 - 125, 125, regs));
+    for (uint16_t i = 0; i < 125; i++)
+        expect(regs[i] == registers_image[0x100 - 125 + i]);
+
+    should("return exceptions returned by the big-endian callback");
+    expect(nmbs_read_holding_registers(&CLIENT, 0xFF, 2, regs) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("read input registers stored one at a time by the callback");
+    check(nmbs_read_input_registers(&CLIENT, 7, 2, regs));
+    expect(regs[0] == 0xA007);
+    expect(regs[1] == 0xA008);
+
+    should("return NMBS_EXCEPTION_SERVER_DEVICE_FAILURE when the big-endian callback returns any non-exception error");
+    expect(nmbs_read_input_registers(&CLIENT, 1, 1, regs) == NMBS_EXCEPTION_SERVER_DEVICE_FAILURE);
+
+    should("convert registers to big-endian order");
+    uint8_t be[5] = {0};
+    nmbs_registers_to_be(be + 1, (uint16_t[]) {0x1234, 0xABCD}, 2);
+    expect(be[1] == 0x12 && be[2] == 0x34 && be[3] == 0xAB && be[4] == 0xCD);
+    expect(nmbs_be16_read(be + 1, 1) == 0xABCD);
+
+    stop_client_and_server();
+}
+
+
+void test_typed_values(nmbs_transport transport) {
+    should("convert registers to 32-bit values in every word order");
+    const uint16_t abcd[2] = {0xAABB, 0xCCDD};
+    const uint16_t cdab[2] = {0xCCDD, 0xAABB};
+    const uint16_t badc[2] = {0xBBAA, 0xDDCC};
+    const uint16_t dcba[2] = {0xDDCC, 0xBBAA};
+    uint32_t u32;
+    nmbs_regs_to_u32(&u32, abcd, 1, NMBS_WORD_ORDER_ABCD);
+    expect(u32 == 0xAABBCCDD);
+    nmbs_regs_to_u32(&u32, cdab, 1, NMBS_WORD_ORDER_CDAB);
+    expect(u32 == 0xAABBCCDD);
+    nmbs_regs_to_u32(&u32, badc, 1, NMBS_WORD_ORDER_BADC);
+    expect(u32 == 0xAABBCCDD);
+    nmbs_regs_to_u32(&u32, dcba, 1, NMBS_WORD_ORDER_DCBA);
+    expect(u32 == 0xAABBCCDD);
+
+    int32_t i32;
+    nmbs_regs_to_i32(&i32, (uint16_t[]) {0xFFFF, 0xFFFE}, 1, NMBS_WORD_ORDER_ABCD);
+    expect(i32 == -2);
+
+    float f32[3];
+    nmbs_regs_to_f32(f32, (uint16_t[]) {0x3F80, 0x0000, 0xC020, 0x0000, 0x4049, 0x0FDB}, 3, NMBS_WORD_ORDER_ABCD);
+    expect(f32[0] == 1.0f && f32[1] == -2.5f && f32[2] == 3.14159274f);
+    nmbs_regs_to_f32(f32, (uint16_t[]) {0x0000, 0xC020}, 1, NMBS_WORD_ORDER_CDAB);
+    expect(f32[0] == -2.5f);
+
+    should("convert registers to 64-bit values in every word order");
+    uint64_t u64;
+    nmbs_regs_to_u64(&u64, (uint16_t[]) {0x1122, 0x3344, 0x5566, 0x7788}, 1, NMBS_WORD_ORDER_ABCD);
+    expect(u64 == 0x1122334455667788ULL);
+    nmbs_regs_to_u64(&u64, (uint16_t[]) {0x7788, 0x5566, 0x3344, 0x1122}, 1, NMBS_WORD_ORDER_CDAB);
+    expect(u64 == 0x1122334455667788ULL);
+    nmbs_regs_to_u64(&u64, (uint16_t[]) {0x2211, 0x4433, 0x6655, 0x8877}, 1, NMBS_WORD_ORDER_BADC);
+    expect(u64 == 0x1122334455667788ULL);
+    nmbs_regs_to_u64(&u64, (uint16_t[]) {0x8877, 0x6655, 0x4433, 0x2211}, 1, NMBS_WORD_ORDER_DCBA);
+    expect(u64 == 0x1122334455667788ULL);
+
+    int64_t i64;
+    nmbs_regs_to_i64(&i64, (uint16_t[]) {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF}, 1, NMBS_WORD_ORDER_BADC);
+    expect(i64 == -1);
+
+    double f64;
+    nmbs_regs_to_f64(&f64, (uint16_t[]) {0x4009, 0x2000, 0x0000, 0x0000}, 1, NMBS_WORD_ORDER_ABCD);
+    expect(f64 == 3.140625);
+
+    should("convert values to registers and back");
+    for (int order = NMBS_WORD_ORDER_ABCD; order <= NMBS_WORD_ORDER_DCBA; order++) {
+        const float f32_in[2] = {-1.5f, 1e30f};
+        const double f64_in[2] = {-2.75, 1e300};
+        const int32_t i32_in[2] = {-123456, 7};
+        const int64_t i64_in[2] = {-1234567890123LL, 42};
+        const uint32_t u32_in = 0x01020304;
+        const uint64_t u64_in = 0x0102030405060708ULL;
+        uint16_t regs[8];
+
+        float f32_out[2];
+        nmbs_f32_to_regs(regs, f32_in, 2, (nmbs_word_order) order);
+        nmbs_regs_to_f32(f32_out, regs, 2, (nmbs_word_order) order);
+        expect(f32_out[0] == f32_in[0] && f32_out[1] == f32_in[1]);
+
+        double f64_out[2];
+        nmbs_f64_to_regs(regs, f64_in, 2, (nmbs_word_order) order);
+        nmbs_regs_to_f64(f64_out, regs, 2, (nmbs_word_order) order);
+        expect(f64_out[0] == f64_in[0] && f64_out[1] == f64_in[1]);
+
+        int32_t i32_out[2];
+        nmbs_i32_to_regs(regs, i32_in, 2, (nmbs_word_order) order);
+        nmbs_regs_to_i32(i32_out, regs, 2, (nmbs_word_order) order);
+        expect(i32_out[0] == i32_in[0] && i32_out[1] == i32_in[1]);
+
+        int64_t i64_out[2];
+        nmbs_i64_to_regs(regs, i64_in, 2, (nmbs_word_order) order);
+        nmbs_regs_to_i64(i64_out, regs, 2, (nmbs_word_order) order);
+        expect(i64_out[0] == i64_in[0] && i64_out[1] == i64_in[1]);
+
+        nmbs_u32_to_regs(regs, &u32_in, 1, (nmbs_word_order) order);
+        nmbs_regs_to_u32(&u32, regs, 1, (nmbs_word_order) order);
+        expect(u32 == u32_in);
+
+        nmbs_u64_to_regs(regs, &u64_in, 1, (nmbs_word_order) order);
+        nmbs_regs_to_u64(&u64, regs, 1, (nmbs_word_order) order);
+        expect(u64 == u64_in);
+    }
+
+    nmbs_u32_to_regs(registers_image, &u32, 1, NMBS_WORD_ORDER_CDAB);
+    expect(registers_image[0] == 0x0304 && registers_image[1] == 0x0102);
+
+    nmbs_u64_to_regs(registers_image, &u64, 1, NMBS_WORD_ORDER_BADC);
+    expect(registers_image[0] == 0x0201 && registers_image[3] == 0x0807);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers_be = read_registers_be;
+    callbacks.read_input_registers_be = read_input_registers_be;
+
+    start_client_and_server(transport, &callbacks);
+
+    should("decode typed values straight from the response of a read registers request");
+    for (int order = NMBS_WORD_ORDER_ABCD; order <= NMBS_WORD_ORDER_DCBA; order++) {
+        float values[62];
+        for (uint16_t i = 0; i < 62; i++)
+            values[i] = (float) i * 0.5f - 3.0f;
+
+        nmbs_f32_to_regs(registers_image + 10, values, 62, (nmbs_word_order) order);
+
+        float values_out[62];
+        check(nmbs_read_holding_registers_typed(&CLIENT, 10, 62, NMBS_VALUE_F32, (nmbs_word_order) order,
+                                               values_out));
+        for (uint16_t i = 0; i < 62; i++)
+            expect(values_out[i] == values[i]);
+
+        int64_t values_64[31];
+        for (uint16_t i = 0; i < 31; i++)
+            values_64[i] = (int64_t) i * -1000000007LL;
+
+        nmbs_i64_to_regs(registers_image + 3, values_64, 31, (nmbs_word_order) order);
+
+        int64_t values_64_out[31];
+        check(nmbs_read_holding_registers_typed(&CLIENT, 3, 31, NMBS_VALUE_I64, (nmbs_word_order) order,
+                                               values_64_out));
+        for (uint16_t i = 0; i < 31; i++)
+            expect(values_64_out[i] == values_64[i]);
+    }
+
+    uint32_t u32_out[2];
+    check(nmbs_read_input_registers_typed(&CLIENT, 0x10, 2, NMBS_VALUE_U32, NMBS_WORD_ORDER_CDAB, u32_out));
+    expect(u32_out[0] == 0xA011A010 && u32_out[1] == 0xA013A012);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when reading too many typed values");
+    float f32_out[63];
+    expect(nmbs_read_holding_registers_typed(&CLIENT, 0, 63, NMBS_VALUE_F32, NMBS_WORD_ORDER_ABCD, f32_out) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_read_holding_registers_typed(&CLIENT, 0, 32, NMBS_VALUE_F64, NMBS_WORD_ORDER_ABCD, f32_out) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_read_holding_registers_typed(&CLIENT, 0, 0, NMBS_VALUE_F32, NMBS_WORD_ORDER_ABCD, f32_out) ==
+           NMBS_ERROR_INVALID_ARGUMENT);
+
+    should("return exceptions when reading typed values");
+    expect(nmbs_read_holding_registers_typed(&CLIENT, 0xFE, 2, NMBS_VALUE_U32, NMBS_WORD_ORDER_ABCD, u32_out) ==
+           NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    stop_client_and_server();
+}
+
+
+int bank_writes = 0;
+uint16_t bank_written_address = 0;
+uint16_t bank_written_quantity = 0;
+
+// Sync hooks state of the register bank
+struct {
+    bool writing;
+    int reads;
+    int retries;
+    int writes;
+} bank_sync;
+
+uint32_t bank_read_begin(void* sync_arg) {
+    expect(sync_arg == &bank_sync);
+    expect(!bank_sync.writing);
+    bank_sync.reads++;
+    return (uint32_t) bank_sync.writes;
+}
+
+
+// Fails the first attempt of every other read
+bool bank_read_end(uint32_t token, void* sync_arg) {
+    expect(sync_arg == &bank_sync);
+    expect(token == (uint32_t) bank_sync.writes);
+    if (bank_sync.reads % 2 == 1) {
+        bank_sync.retries++;
+        return false;
+    }
+
+    return true;
+}
+
+
+void bank_write_begin(void* sync_arg) {
+    expect(sync_arg == &bank_sync);
+    expect(!bank_sync.writing);
+    bank_sync.writing = true;
+}
+
+
+void bank_write_end(void* sync_arg) {
+    expect(sync_arg == &bank_sync);
+    expect(bank_sync.writing);
+    bank_sync.writing = false;
+    bank_sync.writes++;
+}
+
+
+void bank_written(uint16_t address, uint16_t quantity, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    expect(check_user_data(arg) == 1);
+    expect(!bank_sync.writing);
+    bank_writes++;
+    bank_written_address = address;
+    bank_written_quantity = quantity;
+}
+
+
+void test_register_bank(nmbs_transport transport) {
+    uint8_t bank_coils[13] = {0};
+    uint8_t bank_inputs[2] = {0xA5, 0x0F};
+    uint16_t bank_registers[32];
+    for (uint16_t i = 0; i < 32; i++)
+        bank_registers[i] = (uint16_t) (0x100 + i);
+
+    for (uint16_t i = 0; i < 100; i++)
+        nmbs_bitfield_write(bank_coils, i, i % 3 == 0);
+
+    nmbs_register_bank bank;
+    memset(&bank, 0, sizeof(bank));
+    bank.coils = (nmbs_bank_table) {bank_coils, 10, 100};
+    bank.discrete_inputs = (nmbs_bank_table) {bank_inputs, 0, 16};
+    bank.holding_registers = (nmbs_bank_table) {bank_registers, 100, 32};
+    bank.coils_written = bank_written;
+    bank.holding_registers_written = bank_written;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.register_bank = &bank;
+    callbacks.read_input_registers_be = read_input_registers_be;
+
+    start_client_and_server(transport, &callbacks);
+    nmbs_set_callbacks_arg(&SERVER, (void*) &callbacks_user_data);
+
+    should("read coils from the register bank at any bit offset");
+    nmbs_bitfield coils = {0};
+    check(nmbs_read_coils(&CLIENT, 10, 100, coils));
+    for (uint16_t i = 0; i < 100; i++)
+        expect(nmbs_bitfield_read(coils, i) == (i % 3 == 0));
+
+    check(nmbs_read_coils(&CLIENT, 15, 13, coils));
+    for (uint16_t i = 0; i < 13; i++)
+        expect(nmbs_bitfield_read(coils, i) == ((i + 5) % 3 == 0));
+    for (uint16_t i = 13; i < 16; i++)
+        expect(!nmbs_bitfield_read(coils, i));
+
+    should("read discrete inputs from the register bank");
+    check(nmbs_read_discrete_inputs(&CLIENT, 4, 8, coils));
+    expect(coils[0] == 0xFA);
+
+    should("return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS when reading outside of the register bank");
+    expect(nmbs_read_coils(&CLIENT, 9, 2, coils) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    expect(nmbs_read_coils(&CLIENT, 100, 11, coils) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    uint16_t regs[32];
+    expect(nmbs_read_holding_registers(&CLIENT, 99, 1, regs) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    expect(nmbs_read_holding_registers(&CLIENT, 131, 2, regs) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("read holding registers from the register bank");
+    check(nmbs_read_holding_registers(&CLIENT, 100, 32, regs));
+    for (uint16_t i = 0; i < 32; i++)
+        expect(regs[i] == 0x100 + i);
+
+    should("fall back to the callbacks for tables without data");
+    check(nmbs_read_input_registers(&CLIENT, 7, 1, regs));
+    expect(regs[0] == 0xA007);
+
+    should("write coils to the register bank and call the write hook with the changed range");
+    bank_writes = 0;
+    nmbs_bitfield coils_write = {0};
+    for (uint16_t i = 0; i < 20; i++)
+        nmbs_bitfield_write(coils_write, i, (i + 2) % 3 == 0);
+    nmbs_bitfield_write(coils_write, 3, true);
+    nmbs_bitfield_write(coils_write, 10, false);
+
+    check(nmbs_write_multiple_coils(&CLIENT, 12, 20, coils_write));
+    expect(bank_writes == 1);
+    expect(bank_written_address == 15 && bank_written_quantity == 8);
+    expect(nmbs_bitfield_read(bank_coils, 5) && !nmbs_bitfield_read(bank_coils, 12));
+
+    check(nmbs_write_multiple_coils(&CLIENT, 12, 20, coils_write));
+    check(nmbs_write_single_coil(&CLIENT, 10, true));
+    expect(bank_writes == 1);
+
+    check(nmbs_write_single_coil(&CLIENT, 10, false));
+    expect(bank_writes == 2);
+    expect(bank_written_address == 10 && bank_written_quantity == 1);
+    expect(!nmbs_bitfield_read(bank_coils, 0));
+
+    expect(nmbs_write_single_coil(&CLIENT, 110, true) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("write holding registers to the register bank and call the write hook with the changed range");
+    bank_writes = 0;
+    check(nmbs_write_multiple_registers(&CLIENT, 104, 4, (uint16_t[]) {0x104, 7, 8, 0x107}));
+    expect(bank_writes == 1);
+    expect(bank_written_address == 105 && bank_written_quantity == 2);
+    expect(bank_registers[5] == 7 && bank_registers[6] == 8);
+
+    check(nmbs_write_single_register(&CLIENT, 105, 7));
+    expect(bank_writes == 1);
+    check(nmbs_write_single_register(&CLIENT, 131, 9));
+    expect(bank_writes == 2);
+    expect(bank_registers[31] == 9);
+
+    expect(nmbs_write_multiple_registers(&CLIENT, 130, 3, (uint16_t[]) {1, 2, 3}) ==
+           NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("read and write holding registers of the register bank with FC 23");
+    bank_writes = 0;
+    check(nmbs_read_write_registers(&CLIENT, 104, 3, regs, 106, 1, (uint16_t[]) {0x55}));
+    expect(bank_writes == 1);
+    expect(regs[0] == 0x104 && regs[1] == 7 && regs[2] == 0x55);
+
+    expect(nmbs_read_write_registers(&CLIENT, 130, 3, regs, 100, 1, (uint16_t[]) {0x66}) ==
+           NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    expect(bank_registers[0] == 0x100);
+    expect(bank_writes == 1);
+
+    should("repeat the reads failed by the register bank sync hooks");
+    memset(&bank_sync, 0, sizeof(bank_sync));
+    bank.read_begin = bank_read_begin;
+    bank.read_end = bank_read_end;
+    bank.write_begin = bank_write_begin;
+    bank.write_end = bank_write_end;
+    bank.sync_arg = &bank_sync;
+
+    check(nmbs_read_holding_registers(&CLIENT, 104, 3, regs));
+    expect(regs[0] == 0x104 && regs[1] == 7 && regs[2] == 0x55);
+    expect(bank_sync.reads == 2 && bank_sync.retries == 1);
+
+    check(nmbs_read_coils(&CLIENT, 10, 100, coils));
+    expect(bank_sync.reads == 4 && bank_sync.retries == 2);
+
+    should("change the register bank values between the write sync hooks");
+    check(nmbs_write_multiple_coils(&CLIENT, 10, 2, coils));
+    check(nmbs_write_single_register(&CLIENT, 131, 10));
+    check(nmbs_read_write_registers(&CLIENT, 131, 1, regs, 131, 1, (uint16_t[]) {11}));
+    expect(regs[0] == 11);
+    expect(bank_sync.writes == 3 && !bank_sync.writing);
+    expect(bank_sync.reads == 4);
+
+    stop_client_and_server();
+}
+
+
+uint8_t monitored_fc[16];
+uint8_t monitored_unit_id[16];
+bool monitored_response[16];
+int monitored_count = 0;
+
+void monitor_frame(const uint8_t* frame, uint16_t length, bool response, void* arg) {
+    expect(check_user_data(arg) == 1);
+    expect(nmbs_rtu_frame_length(frame, length, response) == length);
+    expect(monitored_count < 16);
+
+    monitored_unit_id[monitored_count] = frame[0];
+    monitored_fc[monitored_count] = frame[1];
+    monitored_response[monitored_count] = response;
+    monitored_count++;
+}
+
+
+void script_frame(uint8_t unit_id, const uint8_t* pdu, uint16_t pdu_len) {
+    script_len += build_frame(NMBS_TRANSPORT_RTU, unit_id, pdu, pdu_len, script + script_len);
+}
+
+
+void test_rtu_bus(void) {
+    should("predict the length of RTU frames");
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1}, 1, false) == 2);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 3}, 2, false) == 8);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 16, 0, 7}, 4, false) == 7);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 16, 0, 7, 0, 2, 4}, 7, false) == 13);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 23, 0, 0, 0, 1, 0, 0, 0, 1, 2}, 11, false) == 15);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 3}, 2, true) == 3);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 3, 6}, 3, true) == 11);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 6}, 2, true) == 8);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 0x83}, 2, true) == 5);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 22}, 2, false) == 10);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 17}, 2, false) == 4);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 7}, 2, true) == 5);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 24, 0}, 3, true) == 4);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 24, 0, 6}, 4, true) == 12);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 0x41}, 2, false) == 0);
+    expect(nmbs_rtu_frame_length((uint8_t[]) {1, 0x41}, 2, true) == 0);
+
+    nmbs_t server;
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = NMBS_TRANSPORT_RTU;
+    platform_conf.read = read_script;
+    platform_conf.write = write_frame_res;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_registers = write_registers;
+
+    reset(server);
+    check(nmbs_server_create(&server, TEST_SERVER_ADDR, &platform_conf, &callbacks));
+    nmbs_set_callbacks_arg(&server, (void*) &callbacks_user_data);
+
+    const uint8_t other = TEST_SERVER_ADDR + 1;
+    const uint8_t req[] = {3, 0, 10, 0, 3};
+
+    should("skip requests to other servers and their responses without checking their CRC");
+    script_len = script_idx = 0;
+    script_frame(other, (uint8_t[]) {16, 0, 7, 0, 2, 4, 0, 1, 0, 2}, 10);
+    script_frame(other, (uint8_t[]) {16, 0, 7, 0, 2}, 5);
+    script[script_len - 1] ^= 0xFF;
+    script_frame(other, req, sizeof(req));
+    script_frame(other, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8);
+    script_frame(TEST_SERVER_ADDR, req, sizeof(req));
+
+    frame_res_len = 0;
+    check(nmbs_server_poll(&server));
+    check(nmbs_server_poll(&server));
+    expect(frame_res_len == 0);
+    check(nmbs_server_poll(&server));
+    expect(frame_res_len == 11);
+    expect(script_idx == script_len);
+
+    should("handle a request following a request to another server that was not responded to");
+    script_len = script_idx = 0;
+    script_frame(other, req, sizeof(req));
+    script_frame(TEST_SERVER_ADDR, req, sizeof(req));
+
+    frame_res_len = 0;
+    check(nmbs_server_poll(&server));
+    expect(frame_res_len == 11);
+    expect(script_idx == script_len);
+
+    should("return NMBS_ERROR_TIMEOUT when a skipped frame is shorter than predicted");
+    script_len = script_idx = 0;
+    script_frame(other, req, sizeof(req));
+    script_frame(other, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8);
+    script_len -= 3;
+    expect(nmbs_server_poll(&server) == NMBS_ERROR_TIMEOUT);
+    expect(script_idx == script_len);
+
+    nmbs_monitor monitor;
+    nmbs_monitor_create(&monitor, monitor_frame, (void*) &callbacks_user_data);
+
+    script_len = script_idx = 0;
+    script[script_len++] = 0xFF;
+    script[script_len++] = 0x55;
+    script_frame(2, req, sizeof(req));
+    script_frame(2, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8);
+    script_frame(NMBS_BROADCAST_ADDRESS, (uint8_t[]) {16, 0, 7, 0, 1, 2, 0, 1}, 8);
+    script_frame(3, (uint8_t[]) {6, 0, 1, 0, 2}, 5);
+    script_frame(3, (uint8_t[]) {0x86, 2}, 2);
+    script_frame(4, req, sizeof(req));
+    script_frame(5, (uint8_t[]) {1, 0, 0, 0, 10}, 5);
+    script_frame(5, (uint8_t[]) {1, 2, 0xAA, 0x01}, 4);
+
+    should("split the bytes seen on the line into requests and responses");
+    monitored_count = 0;
+    for (uint16_t i = 0; i < script_len; i += 3)
+        nmbs_monitor_feed(&monitor, script + i, script_len - i < 3 ? script_len - i : 3);
+
+    const uint8_t units[] = {2, 2, 0, 3, 3, 4, 5, 5};
+    const uint8_t fcs[] = {3, 3, 16, 6, 0x86, 3, 1, 1};
+    const bool responses[] = {false, true, false, false, true, false, false, true};
+    expect(monitored_count == 8);
+    for (int i = 0; i < 8; i++) {
+        expect(monitored_unit_id[i] == units[i]);
+        expect(monitored_fc[i] == fcs[i]);
+        expect(monitored_response[i] == responses[i]);
+    }
+
+    should("resynchronize after a frame with invalid CRC");
+    script_len = script_idx = 0;
+    script_frame(2, req, sizeof(req));
+    script[script_len - 2] ^= 0xFF;
+    script_frame(2, (uint8_t[]) {3, 6, 0, 1, 0, 2, 0, 3}, 8);
+    script_frame(6, req, sizeof(req));
+
+    monitored_count = 0;
+    nmbs_monitor_feed(&monitor, script, script_len);
+    expect(monitored_count == 2);
+    expect(monitored_response[0] && monitored_unit_id[0] == 2);
+    expect(!monitored_response[1] && monitored_unit_id[1] == 6);
+
+    should("discard a partial frame on reset");
+    monitored_count = 0;
+    nmbs_monitor_feed(&monitor, script, 4);
+    nmbs_monitor_reset(&monitor);
+    nmbs_monitor_feed(&monitor, script + 8, script_len - 8);
+    expect(monitored_count == 2);
+}
+
+
+int writev_calls = 0;
+int drain_calls = 0;
+
+int32_t writev_socket_client(const nmbs_iovec* iov, uint8_t iov_count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(arg);
+    uint8_t buf[260];
+    uint16_t count = 0;
+    for (uint8_t i = 0; i < iov_count; i++) {
+        expect(count + iov[i].length <= sizeof(buf));
+        memcpy(buf + count, iov[i].data, iov[i].length);
+        count += iov[i].length;
+    }
+
+    writev_calls++;
+    return write_fd(sockets[1], buf, count, timeout_ms);
+}
+
+
+int32_t bytes_available_socket_client(void* arg) {
+    UNUSED_PARAM(arg);
+    int available = 0;
+    if (ioctl(sockets[1], FIONREAD, &available) != 0)
+        return -1;
+
+    return available;
+}
+
+
+void drain_socket_client(void* arg) {
+    UNUSED_PARAM(arg);
+    uint8_t buf[64];
+    drain_calls++;
+    while (read_fd(sockets[1], buf, sizeof(buf), 0) == sizeof(buf)) {
+    }
+}
+
+
+void test_platform_extensions(nmbs_transport transport) {
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_coils = write_coils;
+
+    reset_sockets();
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(transport);
+    client_conf->writev = writev_socket_client;
+    client_conf->bytes_available = bytes_available_socket_client;
+    client_conf->drain = drain_socket_client;
+
+    start_client_and_server_conf(platform_conf_socket_server(transport), client_conf, &callbacks);
+    nmbs_set_callbacks_arg(&SERVER, (void*) &callbacks_user_data);
+
+    writev_calls = 0;
+    drain_calls = 0;
+
+    should("send coils and raw PDUs with writev()");
+    nmbs_bitfield coils = {0};
+    nmbs_bitfield_write(coils, 0, 1);
+    nmbs_bitfield_write(coils, 2, 1);
+    check(nmbs_write_multiple_coils(&CLIENT, 4, 4, coils));
+    expect(writev_calls == 1);
+
+    check(nmbs_send_raw_pdu(&CLIENT, 3, (uint8_t[]) {0, 4, 0, 4}, 4));
+    uint8_t raw_res[9];
+    check(nmbs_receive_raw_pdu_response(&CLIENT, raw_res, 9));
+    expect(raw_res[0] == 8 && raw_res[2] == 255 && raw_res[8] == 3);
+    expect(writev_calls == 2);
+
+    should("send other requests with write()");
+    uint16_t regs[4];
+    check(nmbs_read_holding_registers(&CLIENT, 4, 4, regs));
+    expect(regs[0] == 255 && regs[3] == 3);
+    expect(writev_calls == 2);
+
+    should("return NMBS_ERROR_INVALID_ARGUMENT when a raw PDU doesn't fit in a message");
+    uint8_t big[258] = {0};
+    expect(nmbs_send_raw_pdu(&CLIENT, 3, big, sizeof(big)) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(writev_calls == 2);
+
+    should("not drain the line when no data is pending");
+    expect(drain_calls == 0);
+
+    should("drain stale data before sending a request");
+    expect(write_fd(sockets[0], (uint8_t[]) {1, 2, 3}, 3, 100) == 3);
+    check(nmbs_read_holding_registers(&CLIENT, 4, 4, regs));
+    expect(drain_calls == 1);
+    expect(regs[0] == 255 && regs[3] == 3);
+
+    stop_client_and_server();
+}
+
+
 nmbs_transport transports[2] = {NMBS_TRANSPORT_RTU, NMBS_TRANSPORT_TCP};
 const char* transports_str[2] = {"RTU", "TCP"};
 
@@ -1484,6 +3545,12 @@ int main(int argc, char* argv[]) {
 
     for_transports(test_fc4, "send and receive FC 04 (0x04) Read Input Registers");
 
+    for_transports(test_registers_be, "read registers stored in big-endian order by server callbacks");
+
+    for_transports(test_typed_values, "convert registers to and from 32 and 64-bit values");
+
+    for_transports(test_register_bank, "serve requests from a register bank");
+
     for_transports(test_fc5, "send and receive FC 05 (0x05) Write Single Coil");
 
     for_transports(test_fc6, "send and receive FC 06 (0x06) Write Single Register");
@@ -1499,6 +3566,30 @@ int main(int argc, char* argv[]) {
     for_transports(test_fc23, "send and receive FC 23 (0x17) Read/Write Multiple Registers");
 
     for_transports(test_fc43_14, "send and receive FC 43 / 14 (0x2B / 0x0E) Read Device Identification");
+    for_transports(test_fc43_14_static, "send and receive FC 43 / 14 (0x2B / 0x0E) from static device identification");
+
+    for_transports(test_frames, "receive and process whole frames");
+
+    for_transports(test_server_feed, "handle requests fed without blocking");
+
+    for_transports(test_rtu_addresses, "serve multiple RTU addresses with a single server");
+
+    printf("Should skip and monitor frames on an RTU bus:\n");
+    test(test_rtu_bus());
+
+    for_transports(test_platform_extensions, "use the optional vectored write and drain platform functions");
+
+    for_transports(test_async_client, "send pipelined asynchronous requests");
+    for_transports(test_file_stream, "stream file records over asynchronous requests");
+
+    for_transports(test_client_step, "advance client requests without blocking");
+
+    for_transports(test_read_plan, "read tags with a read plan");
+
+    for_transports(test_subscription, "report the values changed between executions of a read plan");
+
+    printf("Should adapt the response timeouts of the RTU units and back off from dead ones:\n");
+    test(test_unit_tracking());
 
     return 0;
 }
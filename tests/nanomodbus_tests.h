@@ -48,14 +48,19 @@ uint64_t now_ms(void) {
 }
 
 
-void reset_sockets(void) {
+void reset_sockets_type(int type) {
     if (sockets[0] != -1)
         close(sockets[0]);
 
     if (sockets[1] != -1)
         close(sockets[1]);
 
-    expect(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    expect(socketpair(AF_UNIX, type, 0, sockets) == 0);
+}
+
+
+void reset_sockets(void) {
+    reset_sockets_type(SOCK_STREAM);
 }
 
 
@@ -129,6 +134,47 @@ int32_t write_fd(int fd, const uint8_t* buf, uint16_t count, int32_t timeout_ms)
 }
 
 
+// Reads a whole packet from a SOCK_SEQPACKET socket
+int32_t read_frame_fd(int fd, uint8_t* buf, uint16_t count, int32_t timeout_ms) {
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+
+    struct timeval* tv_p = NULL;
+    struct timeval tv;
+    if (timeout_ms >= 0) {
+        tv_p = &tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = ((__suseconds_t) timeout_ms % 1000) * 1000;
+    }
+
+    int ret = select(fd + 1, &rfds, NULL, NULL, tv_p);
+    if (ret == 0)
+        return 0;
+
+    if (ret != 1)
+        return -1;
+
+    ssize_t r = read(fd, buf, count);
+    if (r <= 0)
+        return -1;
+
+    return (int32_t) r;
+}
+
+
+int32_t read_frame_socket_server(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(arg);
+    return read_frame_fd(sockets[0], buf, count, timeout_ms);
+}
+
+
+int32_t read_frame_socket_client(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(arg);
+    return read_frame_fd(sockets[1], buf, count, timeout_ms);
+}
+
+
 int32_t read_socket_server(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
     UNUSED_PARAM(arg);
     return read_fd(sockets[0], buf, count, timeout_ms);
@@ -204,17 +250,16 @@ void stop_client_and_server(void) {
 }
 
 
-void start_client_and_server(nmbs_transport transport, const nmbs_callbacks* server_callbacks) {
+void start_client_and_server_conf(const nmbs_platform_conf* server_conf, const nmbs_platform_conf* client_conf,
+                                  const nmbs_callbacks* server_callbacks) {
     expect(pthread_mutex_destroy(&server_stopped_m) == 0);
     expect(pthread_mutex_init(&server_stopped_m, NULL) == 0);
 
-    reset_sockets();
-
     reset(SERVER);
     reset(CLIENT);
 
-    check(nmbs_server_create(&SERVER, TEST_SERVER_ADDR, platform_conf_socket_server(transport), server_callbacks));
-    check(nmbs_client_create(&CLIENT, platform_conf_socket_client(transport)));
+    check(nmbs_server_create(&SERVER, TEST_SERVER_ADDR, server_conf, server_callbacks));
+    check(nmbs_client_create(&CLIENT, client_conf));
 
     nmbs_set_destination_rtu_address(&CLIENT, TEST_SERVER_ADDR);
     nmbs_set_read_timeout(&SERVER, 500);
@@ -228,3 +273,24 @@ void start_client_and_server(nmbs_transport transport, const nmbs_callbacks* ser
     expect(pthread_mutex_unlock(&server_stopped_m) == 0);
     expect(pthread_create(&server_thread, NULL, server_listen_thread, &SERVER) == 0);
 }
+
+
+void start_client_and_server(nmbs_transport transport, const nmbs_callbacks* server_callbacks) {
+    reset_sockets();
+    start_client_and_server_conf(platform_conf_socket_server(transport), platform_conf_socket_client(transport),
+                                 server_callbacks);
+}
+
+
+// Every message is exchanged as a single SOCK_SEQPACKET packet and received with read_frame()
+void start_client_and_server_frames(nmbs_transport transport, const nmbs_callbacks* server_callbacks) {
+    reset_sockets_type(SOCK_SEQPACKET);
+
+    nmbs_platform_conf* server_conf = platform_conf_socket_server(transport);
+    server_conf->read_frame = read_frame_socket_server;
+
+    nmbs_platform_conf* client_conf = platform_conf_socket_client(transport);
+    client_conf->read_frame = read_frame_socket_client;
+
+    start_client_and_server_conf(server_conf, client_conf, server_callbacks);
+}
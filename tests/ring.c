@@ -0,0 +1,278 @@
+#include "nanomodbus_tests.h"
+
+#include <errno.h>
+#include <sched.h>
+
+#define STREAM_BYTES 1000000
+
+// Wait hook of a ring, a binary semaphore made of a mutex and a condition variable
+typedef struct ring_event {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    bool signaled;
+    uint32_t notified;
+} ring_event;
+
+uint8_t stream_buf[64];
+nmbs_ring stream;
+ring_event stream_event = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0};
+
+uint8_t to_server_buf[256];
+uint8_t to_client_buf[256];
+nmbs_ring to_server;
+nmbs_ring to_client;
+ring_event to_server_event = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0};
+ring_event to_client_event = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0};
+uint32_t tx_starts = 0;
+
+uint16_t server_registers[16];
+volatile bool server_running = true;
+
+
+void ring_notify(void* arg) {
+    ring_event* e = arg;
+    pthread_mutex_lock(&e->m);
+    e->signaled = true;
+    e->notified++;
+    pthread_cond_signal(&e->c);
+    pthread_mutex_unlock(&e->m);
+}
+
+
+bool ring_wait(int32_t timeout_ms, void* arg) {
+    ring_event* e = arg;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (timeout_ms > 0) {
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&e->m);
+    int ret = 0;
+    while (!e->signaled && ret != ETIMEDOUT) {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&e->c, &e->m);
+        else
+            ret = pthread_cond_timedwait(&e->c, &e->m, &ts);
+    }
+
+    const bool signaled = e->signaled;
+    e->signaled = false;
+    pthread_mutex_unlock(&e->m);
+
+    return signaled;
+}
+
+
+// Pushes a sequence of bytes in chunks of varying sizes. Only the consumer waits on the ring hooks
+void* stream_producer(void* arg) {
+    UNUSED_PARAM(arg);
+
+    uint8_t chunk[37];
+    uint32_t sent = 0;
+    uint32_t size = 1;
+    while (sent < STREAM_BYTES) {
+        size = size % sizeof(chunk) + 1;
+        if (size > STREAM_BYTES - sent)
+            size = STREAM_BYTES - sent;
+
+        for (uint32_t i = 0; i < size; i++)
+            chunk[i] = (uint8_t) (sent + i);
+
+        uint32_t pushed = 0;
+        while (pushed < size) {
+            const uint32_t room = sizeof(stream_buf) - nmbs_ring_count(&stream);
+            const uint32_t n = size - pushed < room ? size - pushed : room;
+            if (n == 0) {
+                sched_yield();
+                continue;
+            }
+
+            expect(nmbs_ring_push(&stream, chunk + pushed, n) == n);
+            pushed += n;
+        }
+
+        sent += size;
+    }
+
+    return NULL;
+}
+
+
+nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address + quantity > 16)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(registers_out, server_registers + address, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+void* server_loop(void* arg) {
+    nmbs_t* server = arg;
+    while (server_running)
+        nmbs_server_poll(server);
+
+    return NULL;
+}
+
+
+void tx_start(void* arg) {
+    UNUSED_PARAM(arg);
+    tx_starts++;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    should("reject ring sizes that are not a power of 2");
+    expect(nmbs_ring_create(&stream, stream_buf, 48) == NMBS_ERROR_INVALID_ARGUMENT);
+    expect(nmbs_ring_create(&stream, stream_buf, 0) == NMBS_ERROR_INVALID_ARGUMENT);
+    check(nmbs_ring_create(&stream, stream_buf, sizeof(stream_buf)));
+
+    should("keep the producer and consumer indexes in different cache lines");
+    expect(offsetof(nmbs_ring, tail) - offsetof(nmbs_ring, head) >= NMBS_RING_CACHE_LINE);
+
+    should("push and pop chunks wrapping around the end of the ring");
+    uint8_t data[64];
+    uint8_t out[64];
+    for (uint8_t i = 0; i < 64; i++)
+        data[i] = i;
+
+    expect(nmbs_ring_push(&stream, data, 40) == 40);
+    expect(nmbs_ring_pop(&stream, out, 30) == 30 && memcmp(out, data, 30) == 0);
+    expect(nmbs_ring_push(&stream, data + 40, 24) == 24);
+    expect(nmbs_ring_count(&stream) == 34);
+    expect(nmbs_ring_pop(&stream, out, 64) == 34 && memcmp(out, data + 30, 34) == 0);
+    expect(nmbs_ring_pop(&stream, out, 64) == 0);
+
+    should("drop and count the bytes that don't fit");
+    expect(nmbs_ring_push(&stream, data, 50) == 50);
+    expect(nmbs_ring_push(&stream, data, 20) == 14);
+    expect(nmbs_ring_dropped(&stream) == 6 && nmbs_ring_count(&stream) == 64);
+    nmbs_ring_flush(&stream);
+    expect(nmbs_ring_count(&stream) == 0);
+
+    should("feed the ring from the half, full and idle events of a circular DMA buffer");
+    check(nmbs_ring_create(&stream, stream_buf, sizeof(stream_buf)));
+    uint8_t dma_buf[16];
+    nmbs_ring_dma dma;
+    nmbs_ring_dma_create(&dma, &stream, dma_buf, sizeof(dma_buf));
+
+    memcpy(dma_buf, data, 16);
+    expect(nmbs_ring_dma_update(&dma, 5) == 5);
+    expect(nmbs_ring_dma_half_complete(&dma) == 3);
+    expect(nmbs_ring_dma_complete(&dma) == 8);
+    expect(nmbs_ring_pop(&stream, out, 64) == 16 && memcmp(out, data, 16) == 0);
+
+    // Idle event after the DMA wrapped around
+    expect(nmbs_ring_dma_update(&dma, 12) == 12);
+    memcpy(dma_buf, data + 16, 4);
+    memcpy(dma_buf + 12, data + 32, 4);
+    expect(nmbs_ring_dma_update(&dma, 4) == 8);
+    expect(nmbs_ring_pop(&stream, out, 64) == 20);
+    expect(memcmp(out + 12, data + 32, 4) == 0 && memcmp(out + 16, data + 16, 4) == 0);
+    expect(nmbs_ring_dma_update(&dma, 4) == 0);
+
+    should("call the notify hook once per chunk");
+    nmbs_ring_set_hooks(&stream, ring_wait, ring_notify, &stream_event);
+    stream_event.notified = 0;
+    expect(nmbs_ring_dma_update(&dma, 2) == 14);
+    expect(stream_event.notified == 1);
+    nmbs_ring_flush(&stream);
+
+    should("pass a stream from a producer thread to a consumer in order");
+    check(nmbs_ring_create(&stream, stream_buf, sizeof(stream_buf)));
+    nmbs_ring_set_hooks(&stream, ring_wait, ring_notify, &stream_event);
+    pthread_t producer;
+    expect(pthread_create(&producer, NULL, stream_producer, NULL) == 0);
+
+    uint32_t received = 0;
+    while (received < STREAM_BYTES) {
+        uint8_t buf[50];
+        const uint32_t n = nmbs_ring_pop(&stream, buf, sizeof(buf));
+        for (uint32_t i = 0; i < n; i++)
+            expect(buf[i] == (uint8_t) (received + i));
+
+        received += n;
+        if (n == 0)
+            expect(ring_wait(1000, &stream_event));
+    }
+
+    expect(pthread_join(producer, NULL) == 0);
+    expect(nmbs_ring_dropped(&stream) == 0);
+
+    should("run a client and a server over the ring platform functions");
+    check(nmbs_ring_create(&to_server, to_server_buf, sizeof(to_server_buf)));
+    check(nmbs_ring_create(&to_client, to_client_buf, sizeof(to_client_buf)));
+    nmbs_ring_set_hooks(&to_server, ring_wait, ring_notify, &to_server_event);
+    nmbs_ring_set_hooks(&to_client, ring_wait, ring_notify, &to_client_event);
+
+    nmbs_ring_port client_port = {&to_client, &to_server, tx_start, NULL};
+    nmbs_ring_port server_port = {&to_server, &to_client, NULL, NULL};
+
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_RTU;
+    conf.read = nmbs_ring_read;
+    conf.write = nmbs_ring_write;
+    conf.bytes_available = nmbs_ring_bytes_available;
+    conf.drain = nmbs_ring_drain;
+
+    conf.arg = &client_port;
+    nmbs_t client;
+    check(nmbs_client_create(&client, &conf));
+    nmbs_set_destination_rtu_address(&client, 1);
+    nmbs_set_read_timeout(&client, 1000);
+    nmbs_set_byte_timeout(&client, 100);
+
+    conf.arg = &server_port;
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    nmbs_t server;
+    check(nmbs_server_create(&server, 1, &conf, &callbacks));
+    nmbs_set_read_timeout(&server, 100);
+    nmbs_set_byte_timeout(&server, 100);
+
+    pthread_t server_thread_id;
+    expect(pthread_create(&server_thread_id, NULL, server_loop, &server) == 0);
+
+    for (uint16_t i = 0; i < 16; i++)
+        server_registers[i] = (uint16_t) (0x100 + i);
+
+    uint16_t registers[16];
+    for (int i = 0; i < 100; i++) {
+        memset(registers, 0, sizeof(registers));
+        check(nmbs_read_holding_registers(&client, 0, 16, registers));
+        expect(memcmp(registers, server_registers, sizeof(registers)) == 0);
+    }
+
+    expect(tx_starts >= 100);
+    expect(nmbs_read_holding_registers(&client, 10, 10, registers) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    server_running = false;
+    expect(pthread_join(server_thread_id, NULL) == 0);
+
+    should("discard stale bytes before sending a request");
+    expect(nmbs_ring_push(&to_client, (const uint8_t*) "stale", 5) == 5);
+    expect(nmbs_ring_bytes_available(&client_port) == 5);
+    expect(nmbs_read_holding_registers(&client, 0, 1, registers) == NMBS_ERROR_TIMEOUT);
+    expect(nmbs_ring_bytes_available(&client_port) == 0);
+
+    should("time out when nothing is received");
+    expect(nmbs_read_holding_registers(&client, 0, 1, registers) == NMBS_ERROR_TIMEOUT);
+
+    return 0;
+}
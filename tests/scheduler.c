@@ -0,0 +1,393 @@
+#include "nanomodbus_tests.h"
+
+#define UNITS_COUNT 4
+#define READ_TIMEOUT_MS 100
+
+// Serial line with RTU servers answering each request as soon as it is written. Every byte on the line takes 1 ms
+nmbs_t client;
+nmbs_t server;
+uint8_t rx[260];
+uint16_t rx_len;
+uint16_t rx_idx;
+uint32_t requests;
+uint32_t broadcasts;
+
+uint32_t now = 0;
+
+uint16_t registers[UNITS_COUNT][0x200];
+
+nmbs_read_tag bulk_tags[10];
+nmbs_read_block bulk_blocks[10];
+nmbs_read_plan bulk_plan;
+uint16_t bulk_values[10][20];
+
+nmbs_read_tag alarm_tag;
+nmbs_read_block alarm_block;
+nmbs_read_plan alarm_plan;
+uint16_t alarm_value;
+
+nmbs_sched_job jobs[2];
+nmbs_sched sched;
+
+nmbs_sched_write* done[8];
+nmbs_error done_err[8];
+uint16_t done_count = 0;
+
+
+uint32_t time_fake(void* arg) {
+    UNUSED_PARAM(arg);
+    return now;
+}
+
+
+int32_t line_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    uint16_t available = rx_len - rx_idx;
+    if (count > available)
+        count = available;
+
+    memcpy(buf, rx + rx_idx, count);
+    rx_idx += count;
+    return count;
+}
+
+
+int32_t line_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    now += count;
+    requests++;
+    if (buf[0] == NMBS_BROADCAST_ADDRESS)
+        broadcasts++;
+
+    rx_len = rx_idx = 0;
+    expect(nmbs_server_process_frame(&server, buf, count) == NMBS_ERROR_NONE);
+
+    return count;
+}
+
+
+int32_t server_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return 0;
+}
+
+
+int32_t server_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    now += count;
+    memcpy(rx + rx_len, buf, count);
+    rx_len += count;
+    return count;
+}
+
+
+nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(arg);
+
+    if (unit_id >= UNITS_COUNT || address + quantity > 0x200)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(registers_out, registers[unit_id] + address, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_single_register(uint16_t address, uint16_t value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(arg);
+
+    if (unit_id >= UNITS_COUNT || address >= 0x200)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    registers[unit_id][address] = value;
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_multiple_registers(uint16_t address, uint16_t quantity, const uint16_t* values, uint8_t unit_id,
+                                    void* arg) {
+    UNUSED_PARAM(arg);
+
+    // Broadcasts are written to every unit
+    for (uint8_t u = 0; u < UNITS_COUNT; u++) {
+        if (unit_id != NMBS_BROADCAST_ADDRESS && u != unit_id)
+            continue;
+
+        if (address + quantity > 0x200)
+            return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+        memcpy(registers[u] + address, values, quantity * sizeof(uint16_t));
+    }
+
+    return NMBS_ERROR_NONE;
+}
+
+
+void on_write_done(nmbs_sched_write* write, nmbs_error err, void* arg) {
+    UNUSED_PARAM(arg);
+    expect(done_count < 8);
+
+    done[done_count] = write;
+    done_err[done_count] = err;
+    done_count++;
+}
+
+
+// Run the scheduler until the fake clock reaches the specified time, advancing it while the line is idle
+void run_until(uint32_t end) {
+    while ((int32_t) (end - now) > 0) {
+        uint32_t wait = nmbs_sched_poll(&sched);
+        if (wait > end - now)
+            wait = end - now;
+
+        now += wait;
+    }
+}
+
+
+void create_line(void) {
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_RTU;
+    conf.read = line_read;
+    conf.write = line_write;
+    conf.time_ms = time_fake;
+    check(nmbs_client_create(&client, &conf));
+    nmbs_set_read_timeout(&client, READ_TIMEOUT_MS);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_single_register = write_single_register;
+    callbacks.write_multiple_registers = write_multiple_registers;
+
+    conf.read = server_read;
+    conf.write = server_write;
+    check(nmbs_server_create(&server, 1, &conf, &callbacks));
+
+    nmbs_bitfield_256 addresses = {0};
+    for (uint8_t u = 1; u < UNITS_COUNT; u++)
+        nmbs_bitfield_set(addresses, u);
+
+    check(nmbs_server_set_rtu_addresses(&server, addresses));
+}
+
+
+void create_plans(void) {
+    // 10 requests of 20 registers, 53 ms each
+    for (uint16_t t = 0; t < 10; t++) {
+        nmbs_read_tag* tag = &bulk_tags[t];
+        tag->unit_id = 1;
+        tag->table = NMBS_TABLE_HOLDING_REGISTERS;
+        tag->address = t * 40;
+        tag->quantity = 20;
+        tag->data_out = bulk_values[t];
+    }
+
+    check(nmbs_read_plan_create(&bulk_plan, bulk_tags, 10, bulk_blocks, 10, 0, 0));
+    expect(nmbs_read_plan_requests(&bulk_plan) == 10);
+
+    // A single register, 15 ms
+    alarm_tag.unit_id = 2;
+    alarm_tag.table = NMBS_TABLE_HOLDING_REGISTERS;
+    alarm_tag.address = 7;
+    alarm_tag.quantity = 1;
+    alarm_tag.data_out = &alarm_value;
+    check(nmbs_read_plan_create(&alarm_plan, &alarm_tag, 1, &alarm_block, 1, 0, 0));
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    for (uint16_t u = 0; u < UNITS_COUNT; u++) {
+        for (uint16_t i = 0; i < 0x200; i++)
+            registers[u][i] = (uint16_t) (u * 1000 + i);
+    }
+
+    create_line();
+    create_plans();
+
+    memset(jobs, 0, sizeof(jobs));
+    jobs[0].plan = &bulk_plan;
+    jobs[0].period_ms = 2000;
+    jobs[0].priority = 1;
+    jobs[1].plan = &alarm_plan;
+    jobs[1].period_ms = 100;
+    jobs[1].offset_ms = 10;
+
+    should("reject jobs without a plan or a period, and clients without time function");
+    jobs[1].period_ms = 0;
+    expect(nmbs_sched_create(&sched, &client, jobs, 2) == NMBS_ERROR_INVALID_ARGUMENT);
+    jobs[1].period_ms = 100;
+
+    jobs[1].plan = NULL;
+    expect(nmbs_sched_create(&sched, &client, jobs, 2) == NMBS_ERROR_INVALID_ARGUMENT);
+    jobs[1].plan = &alarm_plan;
+
+    client.platform.time_ms = NULL;
+    expect(nmbs_sched_create(&sched, &client, jobs, 2) == NMBS_ERROR_INVALID_ARGUMENT);
+    client.platform.time_ms = time_fake;
+
+    check(nmbs_sched_create(&sched, &client, jobs, 2));
+
+    should("wait for the first release of the jobs");
+    expect(nmbs_sched_poll(&sched) == 0);
+    expect(requests == 1 && bulk_tags[0].err == NMBS_ERROR_NONE && bulk_values[0][0] == 1000);
+    expect(jobs[0].delay_max_ms == 0);
+
+    should("interleave the requests of a long read plan with the jobs due earlier");
+    run_until(10000);
+    expect(jobs[0].runs == 5 && jobs[0].misses == 0);
+    expect(jobs[1].runs == 100 && jobs[1].misses == 0 && jobs[1].skipped == 0);
+    expect(alarm_tag.err == NMBS_ERROR_NONE && alarm_value == 2007);
+    expect(bulk_tags[9].err == NMBS_ERROR_NONE && bulk_values[9][19] == 1000 + 9 * 40 + 19);
+
+    should("report the jitter of the jobs and the utilization of the line");
+    // An alarm release waits at most for a bulk request in progress
+    expect(jobs[1].delay_max_ms > 0 && jobs[1].delay_max_ms <= 53);
+    expect(jobs[1].response_max_ms <= 53 + 15);
+    expect(jobs[0].response_max_ms < 1000);
+
+    // 15 / 100 + 530 / 2000
+    uint16_t utilization = nmbs_sched_utilization(&sched);
+    expect(utilization >= 400 && utilization <= 430);
+
+    nmbs_sched_reset_stats(&sched);
+    expect(jobs[0].runs == 0 && jobs[1].runs == 0 && jobs[1].delay_max_ms == 0);
+    expect(nmbs_sched_utilization(&sched) == 0);
+
+    should("skip the releases of a job whose execution runs past them");
+    jobs[1].period_ms = 10;
+    run_until(12000);
+    expect(jobs[1].skipped > 0 && jobs[1].misses > 0);
+    expect(nmbs_sched_utilization(&sched) == 1000);
+    jobs[1].period_ms = 100;
+
+    should("reject writes to tables other than coils and holding registers");
+    check(nmbs_sched_create(&sched, &client, NULL, 0));
+    expect(nmbs_sched_poll(&sched) == UINT32_MAX);
+
+    const uint16_t value = 0xABCD;
+    nmbs_sched_write writes[4];
+    memset(writes, 0, sizeof(writes));
+    writes[0].unit_id = 3;
+    writes[0].table = NMBS_TABLE_INPUT_REGISTERS;
+    writes[0].address = 5;
+    writes[0].quantity = 1;
+    writes[0].values = &value;
+    writes[0].callback = on_write_done;
+    expect(nmbs_sched_submit(&sched, &writes[0]) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    writes[0].table = NMBS_TABLE_HOLDING_REGISTERS;
+    writes[0].quantity = 124;
+    expect(nmbs_sched_submit(&sched, &writes[0]) == NMBS_ERROR_INVALID_ARGUMENT);
+    writes[0].quantity = 1;
+
+    should("send the writes by deadline, and by priority class once late");
+    writes[1] = writes[0];
+    writes[2] = writes[0];
+    writes[0].deadline_ms = 100;
+    writes[1].deadline_ms = 50;
+    writes[1].priority = 2;
+    writes[2].deadline_ms = 50;
+    writes[2].priority = 1;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    check(nmbs_sched_submit(&sched, &writes[1]));
+    check(nmbs_sched_submit(&sched, &writes[2]));
+
+    expect(nmbs_sched_poll(&sched) == 0);
+    expect(nmbs_sched_poll(&sched) == 0);
+    expect(nmbs_sched_poll(&sched) == UINT32_MAX);
+    expect(done_count == 3 && done[0] == &writes[2] && done[1] == &writes[1] && done[2] == &writes[0]);
+    expect(done_err[0] == NMBS_ERROR_NONE && registers[3][5] == 0xABCD);
+
+    done_count = 0;
+    writes[0].deadline_ms = 0;
+    writes[0].priority = 2;
+    writes[1].deadline_ms = 10;
+    writes[1].priority = 0;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    check(nmbs_sched_submit(&sched, &writes[1]));
+    now += 20;
+    nmbs_sched_poll(&sched);
+    nmbs_sched_poll(&sched);
+    expect(done_count == 2 && done[0] == &writes[1] && done[1] == &writes[0]);
+
+    should("send fan-out writes to each unit, with the first error");
+    done_count = 0;
+    const uint16_t values[2] = {0x1111, 0x2222};
+    nmbs_bitfield_256 units = {0};
+    nmbs_bitfield_set(units, 1);
+    nmbs_bitfield_set(units, 2);
+    nmbs_bitfield_256 line_units = {0};
+    nmbs_bitfield_set(line_units, 1);
+    nmbs_bitfield_set(line_units, 2);
+    nmbs_bitfield_set(line_units, 3);
+
+    writes[0].units = units;
+    writes[0].address = 10;
+    writes[0].quantity = 2;
+    writes[0].values = values;
+    requests = 0;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    expect(nmbs_sched_poll(&sched) == 0);
+    expect(done_count == 0);
+    nmbs_sched_poll(&sched);
+    expect(done_count == 1 && done_err[0] == NMBS_ERROR_NONE && requests == 2 && broadcasts == 0);
+    expect(registers[1][10] == 0x1111 && registers[2][11] == 0x2222 && registers[3][10] != 0x1111);
+
+    done_count = 0;
+    writes[0].address = 0x1FF;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    nmbs_sched_poll(&sched);
+    nmbs_sched_poll(&sched);
+    expect(done_count == 1 && done_err[0] == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+    should("send fan-out writes to all the units of the line as broadcast, and wait for the turnaround delay");
+    nmbs_sched_set_broadcast(&sched, line_units, 100);
+
+    // Unit 3 is not written to, so no broadcast
+    done_count = 0;
+    requests = 0;
+    writes[0].address = 20;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    nmbs_sched_poll(&sched);
+    nmbs_sched_poll(&sched);
+    expect(done_count == 1 && requests == 2 && broadcasts == 0);
+
+    done_count = 0;
+    requests = 0;
+    nmbs_bitfield_set(units, 3);
+    writes[0].address = 30;
+    check(nmbs_sched_submit(&sched, &writes[0]));
+    check(nmbs_sched_submit(&sched, &writes[1]));
+    expect(nmbs_sched_poll(&sched) == 100);
+    expect(done_count == 1 && done[0] == &writes[0] && done_err[0] == NMBS_ERROR_NONE);
+    expect(requests == 1 && broadcasts == 1);
+    expect(registers[1][30] == 0x1111 && registers[2][30] == 0x1111 && registers[3][31] == 0x2222);
+
+    now += 60;
+    expect(nmbs_sched_poll(&sched) == 40);
+    expect(done_count == 1);
+    now += 40;
+    nmbs_sched_poll(&sched);
+    expect(done_count == 2 && done[1] == &writes[1]);
+
+    should("restore the destination address of the client");
+    nmbs_set_destination_rtu_address(&client, 42);
+    check(nmbs_sched_submit(&sched, &writes[1]));
+    nmbs_sched_poll(&sched);
+    expect(client.dest_address_rtu == 42);
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "nanomodbus.h"
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+#define STACK_SIZE (64 * 1024)
+#define STACK_PAINT 0xA5
+
+// Stack high-water mark of a server handling each function code, beyond the thread baseline. Built with
+// NMBS_LOW_STACK, it must stay under this bound, callbacks excluded
+#define LOW_STACK_BOUND 384
+
+static uint8_t stack[STACK_SIZE] __attribute__((aligned(64)));
+
+static nmbs_t server;
+static uint8_t frame[260];
+static uint16_t frame_len;
+static nmbs_error result;
+
+
+static int32_t read_none(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return 0;
+}
+
+
+static int32_t write_discard(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return count;
+}
+
+
+static nmbs_error read_bits(uint16_t address, uint16_t quantity, nmbs_bitfield out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(address);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    nmbs_bitfield_write(out, quantity - 1, 1);
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    out[quantity - 1] = address;
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error write_single_coil(uint16_t address, bool value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(address);
+    UNUSED_PARAM(value);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error write_single_register(uint16_t address, uint16_t value, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(address);
+    UNUSED_PARAM(value);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error write_coils(uint16_t address, uint16_t quantity, const nmbs_bitfield coils, uint8_t unit_id,
+                              void* arg) {
+    UNUSED_PARAM(address);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    return nmbs_bitfield_read(coils, quantity - 1) ? NMBS_ERROR_NONE : NMBS_EXCEPTION_SERVER_DEVICE_FAILURE;
+}
+
+
+static nmbs_error write_registers(uint16_t address, uint16_t quantity, const uint16_t* registers, uint8_t unit_id,
+                                  void* arg) {
+    UNUSED_PARAM(address);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    return registers[quantity - 1] == 0x0102 ? NMBS_ERROR_NONE : NMBS_EXCEPTION_SERVER_DEVICE_FAILURE;
+}
+
+
+static nmbs_error read_file(uint16_t file_number, uint16_t record_number, uint16_t* registers, uint16_t count,
+                            uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(file_number);
+    UNUSED_PARAM(record_number);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    if (count > 0)
+        registers[count - 1] = 1;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error write_file(uint16_t file_number, uint16_t record_number, const uint16_t* registers, uint16_t count,
+                             uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(file_number);
+    UNUSED_PARAM(record_number);
+    UNUSED_PARAM(registers);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error read_device_identification(uint8_t object_id, char buffer[NMBS_DEVICE_IDENTIFICATION_STRING_LENGTH]) {
+    memcpy(buffer, "object", 7);
+    buffer[5] = (char) ('0' + object_id);
+    return NMBS_ERROR_NONE;
+}
+
+
+static nmbs_error read_device_identification_map(nmbs_bitfield_256 map) {
+    nmbs_bitfield_write(map, 0x00, 1);
+    nmbs_bitfield_write(map, 0x01, 1);
+    nmbs_bitfield_write(map, 0x02, 1);
+    return NMBS_ERROR_NONE;
+}
+
+
+static void frame_start(const uint8_t* pdu, uint16_t len) {
+    frame[0] = 1;
+    memcpy(frame + 1, pdu, len);
+    frame_len = 1 + len;
+}
+
+
+static void frame_fill(uint8_t value, uint16_t count) {
+    memset(frame + frame_len, value, count);
+    frame_len += count;
+}
+
+
+static void* handle_frame(void* arg) {
+    UNUSED_PARAM(arg);
+    result = nmbs_server_process_frame(&server, frame, frame_len);
+    return NULL;
+}
+
+
+static void* idle(void* arg) {
+    UNUSED_PARAM(arg);
+    return NULL;
+}
+
+
+// Run a function in a thread with a painted stack and return how much of the stack it used
+static size_t stack_used(void* (*fn)(void*)) {
+    memset(stack, STACK_PAINT, sizeof(stack));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    assert(pthread_attr_setstack(&attr, stack, sizeof(stack)) == 0);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, &attr, fn, NULL) == 0);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    // The stack grows down
+    size_t untouched = 0;
+    while (untouched < sizeof(stack) && stack[untouched] == STACK_PAINT)
+        untouched++;
+
+    return sizeof(stack) - untouched;
+}
+
+
+static size_t measure(const char* name, size_t baseline) {
+    const uint16_t crc = nmbs_crc_calc(frame, frame_len, NULL);
+    frame[frame_len++] = (uint8_t) (crc >> 8);
+    frame[frame_len++] = (uint8_t) crc;
+
+    // Handled once before measuring, so that lazy binding of libc symbols is not counted
+    stack_used(handle_frame);
+    const size_t used = stack_used(handle_frame) - baseline;
+    assert(result == NMBS_ERROR_NONE);
+
+    printf("%-34s %5zu bytes\n", name, used);
+    return used;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = NMBS_TRANSPORT_RTU;
+    platform_conf.read = read_none;
+    platform_conf.write = write_discard;
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_coils = read_bits;
+    callbacks.read_discrete_inputs = read_bits;
+    callbacks.read_holding_registers = read_registers;
+    callbacks.read_input_registers = read_registers;
+    callbacks.write_single_coil = write_single_coil;
+    callbacks.write_single_register = write_single_register;
+    callbacks.write_multiple_coils = write_coils;
+    callbacks.write_multiple_registers = write_registers;
+    callbacks.read_file_record = read_file;
+    callbacks.write_file_record = write_file;
+    callbacks.read_device_identification = read_device_identification;
+    callbacks.read_device_identification_map = read_device_identification_map;
+
+    assert(nmbs_server_create(&server, 1, &platform_conf, &callbacks) == NMBS_ERROR_NONE);
+
+#ifdef NMBS_LOW_STACK
+    static nmbs_scratch scratch;
+
+    frame_start((const uint8_t[]){3, 0, 0, 0, 1}, 5);
+    frame[frame_len++] = 0;
+    frame[frame_len++] = 0;
+    assert(nmbs_server_process_frame(&server, frame, frame_len) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    nmbs_set_scratch(&server, &scratch);
+    printf("Stack usage per function code with NMBS_LOW_STACK:\n");
+#else
+    printf("Stack usage per function code:\n");
+#endif
+
+    const size_t baseline = stack_used(idle);
+    size_t max = 0;
+    size_t used;
+
+    frame_start((const uint8_t[]){1, 0, 0, 0x07, 0xD0}, 5);
+    used = measure("01 read coils", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){2, 0, 0, 0x07, 0xD0}, 5);
+    used = measure("02 read discrete inputs", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){3, 0, 0, 0, 125}, 5);
+    used = measure("03 read holding registers", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){4, 0, 0, 0, 125}, 5);
+    used = measure("04 read input registers", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){5, 0, 1, 0xFF, 0}, 5);
+    used = measure("05 write single coil", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){6, 0, 1, 0x12, 0x34}, 5);
+    used = measure("06 write single register", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){15, 0, 0, 0x07, 0xB0, 246}, 6);
+    frame_fill(0xFF, 246);
+    used = measure("15 write multiple coils", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){16, 0, 0, 0, 123, 246}, 6);
+    frame_fill(0x01, 246);
+    frame[frame_len - 1] = 0x02;
+    used = measure("16 write multiple registers", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){20, 245}, 2);
+    for (int i = 0; i < 35; i++) {
+        const uint8_t subreq[7] = {6, 0, 1, 0, (uint8_t) i, 0, 1};
+        memcpy(frame + frame_len, subreq, sizeof(subreq));
+        frame_len += sizeof(subreq);
+    }
+    used = measure("20 read file record", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){21, 247, 6, 0, 1, 0, 0, 0, 120}, 9);
+    frame_fill(0x01, 240);
+    used = measure("21 write file record", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){23, 0, 0, 0, 125, 0, 0, 0, 121, 242}, 10);
+    frame_fill(0x01, 242);
+    frame[frame_len - 1] = 0x02;
+    used = measure("23 read/write multiple registers", baseline);
+    max = used > max ? used : max;
+
+    frame_start((const uint8_t[]){43, 0x0E, 1, 0}, 4);
+    used = measure("43 read device identification", baseline);
+    max = used > max ? used : max;
+
+#ifdef NMBS_LOW_STACK
+    assert(max <= LOW_STACK_BOUND);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "nanomodbus.h"
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+#define QUEUE_SIZE 1024
+#define REQUESTS 2000
+
+typedef struct queue {
+    uint8_t data[QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} queue;
+
+typedef struct endpoint {
+    queue* rx;
+    queue* tx;
+    uint32_t ticks;
+} endpoint;
+
+static queue to_server;
+static queue to_client;
+static endpoint client_end = {&to_client, &to_server, 0};
+static endpoint server_end = {&to_server, &to_client, 0};
+
+static nmbs_t client;
+static nmbs_t server;
+static bool server_running = true;
+static volatile bool run = true;
+
+
+static int32_t read_queue(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    endpoint* end = arg;
+
+    // The server is polled in place of waiting for the response
+    if (end == &client_end && end->rx->head == end->rx->tail && server_running)
+        nmbs_server_poll(&server);
+
+    uint16_t read = 0;
+    while (read < count && end->rx->head != end->rx->tail) {
+        buf[read++] = end->rx->data[end->rx->tail];
+        end->rx->tail = (end->rx->tail + 1) % QUEUE_SIZE;
+    }
+
+    return read;
+}
+
+
+static int32_t write_queue(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    endpoint* end = arg;
+
+    for (uint16_t i = 0; i < count; i++) {
+        end->tx->data[end->tx->head] = buf[i];
+        end->tx->head = (end->tx->head + 1) % QUEUE_SIZE;
+    }
+
+    return count;
+}
+
+
+// Every call is one tick, so a transaction takes a single tick
+static uint32_t ticks(void* arg) {
+    endpoint* end = arg;
+    return end->ticks++;
+}
+
+
+static nmbs_error read_holding_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id,
+                                         void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address >= 100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    for (uint16_t i = 0; i < quantity; i++)
+        registers_out[i] = address + i;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+static uint32_t sum(const uint32_t* counters, uint32_t count) {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++)
+        total += counters[i];
+
+    return total;
+}
+
+
+// Snapshots taken while the client is running must always be consistent
+static void* snapshot_client(void* arg) {
+    UNUSED_PARAM(arg);
+
+    uint32_t last = 0;
+    while (run) {
+        nmbs_stats s;
+        assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+
+        const uint32_t sent = sum(s.fc_out, NMBS_STATS_FCS);
+        assert(s.bytes_out == sent * 12);
+        assert(s.errors[0] <= sent && s.errors[0] + 1 >= sent);
+        assert(sent >= last);
+        last = sent;
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = NMBS_TRANSPORT_TCP;
+    platform_conf.read = read_queue;
+    platform_conf.write = write_queue;
+
+    platform_conf.arg = &client_end;
+    assert(nmbs_client_create(&client, &platform_conf) == NMBS_ERROR_NONE);
+    nmbs_set_read_timeout(&client, 1000);
+    nmbs_set_byte_timeout(&client, 100);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_holding_registers;
+
+    platform_conf.arg = &server_end;
+    assert(nmbs_server_create(&server, 1, &platform_conf, &callbacks) == NMBS_ERROR_NONE);
+    nmbs_set_read_timeout(&server, 0);
+    nmbs_set_byte_timeout(&server, 100);
+
+    nmbs_stats client_stats;
+    nmbs_stats server_stats;
+    assert(nmbs_stats_enable(NULL, &client_stats, ticks) == NMBS_ERROR_INVALID_ARGUMENT);
+    assert(nmbs_stats_enable(&client, NULL, ticks) == NMBS_ERROR_INVALID_ARGUMENT);
+    assert(nmbs_stats_enable(&client, &client_stats, ticks) == NMBS_ERROR_NONE);
+    assert(nmbs_stats_enable(&server, &server_stats, ticks) == NMBS_ERROR_NONE);
+
+    uint16_t regs[8];
+    for (int i = 0; i < 100; i++) {
+        assert(nmbs_read_holding_registers(&client, 10, 8, regs) == NMBS_ERROR_NONE);
+        assert(regs[7] == 17);
+    }
+
+    nmbs_stats s;
+    assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+    assert(s.errors[0] == 100);
+    assert(s.fc_out[3] == 100 && sum(s.fc_out, NMBS_STATS_FCS) == 100);
+    assert(s.fc_in[3] == 100 && sum(s.fc_in, NMBS_STATS_FCS) == 100);
+    assert(s.bytes_out == 100 * 12);
+    assert(s.bytes_in == 100 * (9 + 16));
+    assert(s.latency[1] == 100 && sum(s.latency, NMBS_STATS_LATENCY_BUCKETS) == 100);
+
+    assert(nmbs_stats_snapshot(&server, &s) == NMBS_ERROR_NONE);
+    assert(s.errors[0] == 100);
+    assert(s.fc_in[3] == 100 && s.fc_out[3] == 100);
+    assert(s.bytes_in == 100 * 12);
+    assert(s.bytes_out == 100 * (9 + 16));
+    assert(sum(s.latency, NMBS_STATS_LATENCY_BUCKETS) == 100);
+
+    // Rejected before sending anything, not counted
+    assert(nmbs_read_holding_registers(&client, 10, 0, regs) == NMBS_ERROR_INVALID_ARGUMENT);
+
+    // Exceptions are counted by both sides
+    assert(nmbs_read_holding_registers(&client, 200, 1, regs) == NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+    assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+    assert(s.exceptions[NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS] == 1);
+    assert(sum(s.errors, NMBS_STATS_CODES) == 100);
+    assert(s.fc_out[3] == 101 && s.fc_in[3] == 101);
+
+    assert(nmbs_stats_snapshot(&server, &s) == NMBS_ERROR_NONE);
+    assert(s.exceptions[NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS] == 1);
+    assert(s.fc_out[3] == 101);
+
+    // No response
+    server_running = false;
+    assert(nmbs_read_holding_registers(&client, 10, 1, regs) == NMBS_ERROR_TIMEOUT);
+    assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+    assert(s.errors[-NMBS_ERROR_TIMEOUT] == 1);
+    assert(s.fc_out[3] == 102 && s.fc_in[3] == 101);
+
+    // Discard the unanswered request
+    to_server.tail = to_server.head;
+    server_running = true;
+
+    // A reset is visible right away
+    nmbs_stats_reset(&client);
+    nmbs_stats_reset(&server);
+    assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+    assert(sum(s.errors, NMBS_STATS_CODES) == 0 && s.bytes_out == 0 && s.bytes_in == 0);
+
+    pthread_t reader;
+    assert(pthread_create(&reader, NULL, snapshot_client, NULL) == 0);
+
+    for (int i = 0; i < REQUESTS; i++)
+        assert(nmbs_read_holding_registers(&client, 0, 1, regs) == NMBS_ERROR_NONE);
+
+    run = false;
+    pthread_join(reader, NULL);
+
+    assert(nmbs_stats_snapshot(&client, &s) == NMBS_ERROR_NONE);
+    assert(s.errors[0] == REQUESTS && s.fc_out[3] == REQUESTS);
+    assert(s.bytes_in == REQUESTS * 11);
+
+    assert(nmbs_stats_snapshot(&server, &s) == NMBS_ERROR_NONE);
+    assert(s.errors[0] == REQUESTS && s.fc_in[3] == REQUESTS);
+
+    // RTU frames addressed to other servers
+    nmbs_t rtu_server;
+    nmbs_stats rtu_stats;
+    platform_conf.transport = NMBS_TRANSPORT_RTU;
+    assert(nmbs_server_create(&rtu_server, 1, &platform_conf, &callbacks) == NMBS_ERROR_NONE);
+    assert(nmbs_stats_enable(&rtu_server, &rtu_stats, NULL) == NMBS_ERROR_NONE);
+
+    uint8_t frame[8] = {2, 3, 0, 0, 0, 1};
+    const uint16_t crc = nmbs_crc_calc(frame, 6, NULL);
+    frame[6] = (uint8_t) (crc >> 8);
+    frame[7] = (uint8_t) crc;
+    assert(nmbs_server_process_frame(&rtu_server, frame, sizeof(frame)) == NMBS_ERROR_NONE);
+
+    // Corrupted CRC
+    frame[0] = 1;
+    assert(nmbs_server_process_frame(&rtu_server, frame, sizeof(frame)) == NMBS_ERROR_CRC);
+
+    assert(nmbs_stats_snapshot(&rtu_server, &s) == NMBS_ERROR_NONE);
+    assert(s.ignored_frames == 1);
+    assert(s.errors[-NMBS_ERROR_CRC] == 1 && sum(s.errors, NMBS_STATS_CODES) == 1);
+    assert(s.bytes_in == 16 && s.bytes_out == 0);
+    assert(sum(s.latency, NMBS_STATS_LATENCY_BUCKETS) == 0);
+
+    printf("Statistics tests passed\n");
+
+    return 0;
+}
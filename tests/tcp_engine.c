@@ -0,0 +1,376 @@
+#include "nanomodbus_tests.h"
+#include "tcp_engine.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define CONNS_MAX 256
+#define CLIENTS_COUNT 200
+#define IDLE_TIMEOUT_MS 300
+
+tcp_engine_t engine;
+tcp_engine_conn_t engine_conns[CONNS_MAX];
+
+bool engine_stopped = false;
+pthread_mutex_t engine_stopped_m = PTHREAD_MUTEX_INITIALIZER;
+pthread_t engine_thread;
+
+uint16_t registers[0x100];
+
+// Serial line of the gateway, with an RTU server answering each request as soon as it is written
+nmbs_t line_client;
+nmbs_t line_server;
+uint8_t line_rx[260];
+uint16_t line_rx_len;
+uint16_t line_rx_idx;
+
+nmbs_gateway gateway;
+nmbs_gateway_line gateway_line;
+nmbs_gateway_req gateway_reqs[4];
+const nmbs_gateway_route gateway_routes[] = {{1, 0, 5}};
+
+
+nmbs_error read_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address + quantity > 0x100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(registers_out, registers + address, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+nmbs_error write_registers(uint16_t address, uint16_t quantity, const uint16_t* regs, uint8_t unit_id, void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    if (address + quantity > 0x100)
+        return NMBS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+
+    memcpy(registers + address, regs, quantity * sizeof(uint16_t));
+    return NMBS_ERROR_NONE;
+}
+
+
+uint32_t line_time(void* arg) {
+    UNUSED_PARAM(arg);
+    return (uint32_t) now_ms();
+}
+
+
+int32_t line_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    if (count > line_rx_len - line_rx_idx)
+        count = line_rx_len - line_rx_idx;
+
+    memcpy(buf, line_rx + line_rx_idx, count);
+    line_rx_idx += count;
+    return count;
+}
+
+
+int32_t line_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    line_rx_len = line_rx_idx = 0;
+    expect(nmbs_server_process_frame(&line_server, buf, count) == NMBS_ERROR_NONE);
+    return count;
+}
+
+
+int32_t line_server_read(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(buf);
+    UNUSED_PARAM(count);
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+    return 0;
+}
+
+
+int32_t line_server_write(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    UNUSED_PARAM(arg);
+
+    memcpy(line_rx + line_rx_len, buf, count);
+    line_rx_len += count;
+    return count;
+}
+
+
+void* engine_run_thread(void* arg) {
+    UNUSED_PARAM(arg);
+    while (true) {
+        expect(pthread_mutex_lock(&engine_stopped_m) == 0);
+        bool stopped = engine_stopped;
+        expect(pthread_mutex_unlock(&engine_stopped_m) == 0);
+        if (stopped)
+            break;
+
+        expect(tcp_engine_run_once(&engine, 20) == 0);
+    }
+
+    return NULL;
+}
+
+
+void start_engine(uint32_t conns_count, int32_t idle_timeout_ms) {
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    callbacks.write_multiple_registers = write_registers;
+
+    expect(tcp_engine_create(&engine, "127.0.0.1", "0", engine_conns, conns_count, &callbacks, idle_timeout_ms) == 0);
+    expect(tcp_engine_port(&engine) != 0);
+
+    engine_stopped = false;
+    expect(pthread_create(&engine_thread, NULL, engine_run_thread, NULL) == 0);
+}
+
+
+void start_gateway_engine(uint32_t conns_count) {
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_RTU;
+    conf.read = line_read;
+    conf.write = line_write;
+    conf.time_ms = line_time;
+    check(nmbs_client_create(&line_client, &conf));
+    nmbs_set_read_timeout(&line_client, 100);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_registers;
+    conf.read = line_server_read;
+    conf.write = line_server_write;
+    check(nmbs_server_create(&line_server, 5, &conf, &callbacks));
+
+    expect(tcp_engine_create(&engine, "127.0.0.1", "0", engine_conns, conns_count, NULL, -1) == 0);
+
+    nmbs_gateway_line_create(&gateway_line, &line_client);
+    check(nmbs_gateway_create(&gateway, &gateway_line, 1, gateway_routes, 1, gateway_reqs, 4,
+                              tcp_engine_gateway_callback, &engine));
+    tcp_engine_set_gateway(&engine, &gateway);
+
+    engine_stopped = false;
+    expect(pthread_create(&engine_thread, NULL, engine_run_thread, NULL) == 0);
+}
+
+
+void stop_engine(void) {
+    expect(pthread_mutex_lock(&engine_stopped_m) == 0);
+    engine_stopped = true;
+    expect(pthread_mutex_unlock(&engine_stopped_m) == 0);
+    expect(pthread_join(engine_thread, NULL) == 0);
+
+    tcp_engine_destroy(&engine);
+}
+
+
+int connect_engine(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    expect(fd >= 0);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tcp_engine_port(&engine));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    expect(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+
+    return fd;
+}
+
+
+int32_t read_client(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    return read_fd(*(int*) arg, buf, count, timeout_ms);
+}
+
+
+int32_t write_client(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    return write_fd(*(int*) arg, buf, count, timeout_ms);
+}
+
+
+void create_client(nmbs_t* client, int* fd) {
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_TCP;
+    conf.read = read_client;
+    conf.write = write_client;
+    conf.arg = fd;
+
+    check(nmbs_client_create(client, &conf));
+    nmbs_set_read_timeout(client, 1000);
+    nmbs_set_byte_timeout(client, 100);
+}
+
+
+// Whether the server closed the connection
+bool is_closed(int fd, int32_t timeout_ms) {
+    uint8_t buf[16];
+    int32_t r = read_fd(fd, buf, sizeof(buf), timeout_ms);
+    return r < 0;
+}
+
+
+uint16_t put_read_request(uint8_t* buf, uint16_t tid, uint16_t address, uint16_t quantity) {
+    const uint8_t req[] = {tid >> 8, tid & 0xFF, 0, 0, 0, 6, 1, 3, address >> 8, address & 0xFF, 0, quantity};
+    memcpy(buf, req, sizeof(req));
+    return sizeof(req);
+}
+
+
+int fds[CONNS_MAX + 1];
+nmbs_t clients[CLIENTS_COUNT];
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    for (int i = 0; i < 0x100; i++)
+        registers[i] = (uint16_t) (i * 3);
+
+    start_engine(CONNS_MAX, -1);
+
+    should("serve many concurrent connections");
+    for (int i = 0; i < CLIENTS_COUNT; i++) {
+        fds[i] = connect_engine();
+        create_client(&clients[i], &fds[i]);
+    }
+
+    for (int i = 0; i < CLIENTS_COUNT; i++) {
+        uint16_t regs[2];
+        check(nmbs_read_holding_registers(&clients[i], (uint16_t) i, 2, regs));
+        expect(regs[0] == i * 3);
+        expect(regs[1] == (i + 1) * 3);
+    }
+
+    check(nmbs_write_multiple_registers(&clients[0], 0xF0, 1, (uint16_t[]) {7}));
+    for (int i = 0; i < CLIENTS_COUNT; i++) {
+        uint16_t reg = 0;
+        check(nmbs_read_holding_registers(&clients[i], 0xF0, 1, &reg));
+        expect(reg == 7);
+    }
+
+    should("not block other clients on a partial request");
+    uint8_t req[512];
+    uint16_t req_len = put_read_request(req, 0x1234, 10, 1);
+    expect(write_fd(fds[0], req, 3, 1000) == 3);
+
+    uint64_t start = now_ms();
+    uint16_t reg = 0;
+    check(nmbs_read_holding_registers(&clients[1], 10, 1, &reg));
+    expect(reg == 30);
+    expect(now_ms() - start < 500);
+
+    expect(write_fd(fds[0], req + 3, req_len - 3, 1000) == req_len - 3);
+    uint8_t res[16 * 259];
+    expect(read_fd(fds[0], res, 11, 1000) == 11);
+    expect(res[0] == 0x12 && res[1] == 0x34);
+    expect(res[9] == 0 && res[10] == 30);
+
+    should("respond to pipelined requests in order");
+    req_len = 0;
+    for (uint16_t i = 0; i < 16; i++)
+        req_len += put_read_request(req + req_len, i, 0, 125);
+
+    expect(write_fd(fds[0], req, req_len, 1000) == req_len);
+    expect(read_fd(fds[0], res, sizeof(res), 1000) == sizeof(res));
+    for (uint16_t i = 0; i < 16; i++) {
+        const uint8_t* r = res + i * 259;
+        expect(r[0] == 0 && r[1] == i);
+        expect(r[8] == 250);
+        expect(r[257] == 0x01 && r[258] == 0x74);    // 124 * 3
+    }
+
+    should("reject connections over the pool size");
+    for (int i = CLIENTS_COUNT; i < CONNS_MAX; i++)
+        fds[i] = connect_engine();
+
+    fds[CONNS_MAX] = connect_engine();
+    expect(is_closed(fds[CONNS_MAX], 1000));
+    close(fds[CONNS_MAX]);
+
+    check(nmbs_read_holding_registers(&clients[2], 10, 1, &reg));
+
+    should("close connections receiving an invalid MBAP");
+    req_len = put_read_request(req, 1, 10, 1);
+    req[2] = 1;
+    expect(write_fd(fds[3], req, req_len, 1000) == req_len);
+    expect(is_closed(fds[3], 1000));
+
+    for (int i = 0; i < CONNS_MAX; i++)
+        close(fds[i]);
+
+    stop_engine();
+
+    should("close idle connections");
+    start_engine(2, IDLE_TIMEOUT_MS);
+    for (int i = 0; i < 2; i++) {
+        fds[i] = connect_engine();
+        create_client(&clients[i], &fds[i]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        usleep(IDLE_TIMEOUT_MS * 1000 / 4);
+        check(nmbs_read_holding_registers(&clients[0], 10, 1, &reg));
+    }
+
+    expect(is_closed(fds[1], IDLE_TIMEOUT_MS));
+    check(nmbs_read_holding_registers(&clients[0], 10, 1, &reg));
+
+    should("reuse the slots of closed connections");
+    close(fds[1]);
+    fds[1] = connect_engine();
+    check(nmbs_read_holding_registers(&clients[1], 10, 1, &reg));
+    expect(reg == 30);
+
+    close(fds[0]);
+    close(fds[1]);
+    stop_engine();
+
+    should("forward requests to a gateway");
+    start_gateway_engine(8);
+    for (int i = 0; i < 4; i++) {
+        fds[i] = connect_engine();
+        create_client(&clients[i], &fds[i]);
+        nmbs_set_destination_rtu_address(&clients[i], 1);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        check(nmbs_read_holding_registers(&clients[i], (uint16_t) i, 1, &reg));
+        expect(reg == i * 3);
+    }
+
+    nmbs_set_destination_rtu_address(&clients[0], 2);
+    expect(nmbs_read_holding_registers(&clients[0], 10, 1, &reg) == NMBS_EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+
+    should("answer requests pipelined on many connections through the gateway, in order");
+    req_len = 0;
+    for (uint16_t i = 0; i < 16; i++)
+        req_len += put_read_request(req + req_len, i, i, 1);
+
+    for (int i = 0; i < 4; i++)
+        expect(write_fd(fds[i], req, req_len, 1000) == req_len);
+
+    for (int i = 0; i < 4; i++) {
+        expect(read_fd(fds[i], res, 16 * 11, 1000) == 16 * 11);
+        for (uint16_t j = 0; j < 16; j++) {
+            const uint8_t* r = res + j * 11;
+            expect(r[0] == 0 && r[1] == j);
+            expect(r[7] == 3 && r[10] == j * 3);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+        close(fds[i]);
+
+    stop_engine();
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include "nanomodbus_tests.h"
+#include "bank_seqlock.h"
+#include "tcp_shards.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define SHARDS_COUNT 4
+#define CONNS_PER_SHARD 64
+#define VALUES_COUNT 64
+#define ITERATIONS 2000
+
+tcp_shards_t shards;
+tcp_shard_t shard_slots[SHARDS_COUNT];
+tcp_engine_conn_t shard_conns[SHARDS_COUNT * CONNS_PER_SHARD];
+
+uint16_t registers[VALUES_COUNT];
+nmbs_register_bank bank;
+bank_seqlock_t lock;
+
+typedef enum client_role {
+    ROLE_READER,
+    ROLE_WRITER,
+    ROLE_READ_WRITER,
+} client_role;
+
+typedef struct client_thread {
+    pthread_t thread;
+    client_role role;
+    uint16_t id;
+    int fd;
+    nmbs_t nmbs;
+} client_thread;
+
+
+int connect_shards(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    expect(fd >= 0);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tcp_shards_port(&shards));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    expect(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+
+    return fd;
+}
+
+
+int32_t read_client(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    return read_fd(*(int*) arg, buf, count, timeout_ms);
+}
+
+
+int32_t write_client(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    return write_fd(*(int*) arg, buf, count, timeout_ms);
+}
+
+
+void create_client(nmbs_t* client, int* fd) {
+    nmbs_platform_conf conf;
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_TCP;
+    conf.read = read_client;
+    conf.write = write_client;
+    conf.arg = fd;
+
+    check(nmbs_client_create(client, &conf));
+    nmbs_set_read_timeout(client, 2000);
+    nmbs_set_byte_timeout(client, 100);
+}
+
+
+// Every write sets all the values to the same one, so a torn read has different ones
+void expect_snapshot(const uint16_t* values) {
+    for (int i = 1; i < VALUES_COUNT; i++)
+        expect(values[i] == values[0]);
+}
+
+
+void* client_run(void* arg) {
+    client_thread* c = arg;
+    uint16_t values[VALUES_COUNT];
+    uint16_t read[VALUES_COUNT];
+
+    for (uint16_t k = 0; k < ITERATIONS; k++) {
+        for (int i = 0; i < VALUES_COUNT; i++)
+            values[i] = (uint16_t) (c->id << 12 | (k & 0xFFF));
+
+        switch (c->role) {
+            case ROLE_READER:
+                check(nmbs_read_holding_registers(&c->nmbs, 0, VALUES_COUNT, read));
+                expect_snapshot(read);
+                break;
+            case ROLE_WRITER:
+                check(nmbs_write_multiple_registers(&c->nmbs, 0, VALUES_COUNT, values));
+                break;
+            case ROLE_READ_WRITER:
+                // Reads the values it has just written, no other write in between
+                check(nmbs_read_write_registers(&c->nmbs, 0, VALUES_COUNT, read, 0, VALUES_COUNT, values));
+                expect(read[0] == values[0]);
+                expect_snapshot(read);
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    memset(&bank, 0, sizeof(bank));
+    bank.holding_registers = (nmbs_bank_table) {registers, 0, VALUES_COUNT};
+    bank_seqlock_attach(&lock, &bank);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.register_bank = &bank;
+
+    should("create the shards on the same port");
+    expect(tcp_shards_create(&shards, shard_slots, SHARDS_COUNT, "127.0.0.1", "0", shard_conns, CONNS_PER_SHARD,
+                             &callbacks, -1) == 0);
+    expect(tcp_shards_port(&shards) != 0);
+    for (int i = 0; i < SHARDS_COUNT; i++)
+        expect(tcp_engine_port(&shard_slots[i].engine) == tcp_shards_port(&shards));
+
+    should("spread the connections among the shards");
+    static int fds[CONNS_PER_SHARD];
+    static nmbs_t clients[CONNS_PER_SHARD];
+    for (int i = 0; i < CONNS_PER_SHARD; i++) {
+        fds[i] = connect_shards();
+        create_client(&clients[i], &fds[i]);
+    }
+
+    uint16_t value = 0;
+    for (int i = 0; i < CONNS_PER_SHARD; i++)
+        check(nmbs_read_holding_registers(&clients[i], 0, 1, &value));
+
+    // Every connection got its response, so they have all been accepted
+    uint32_t total = 0;
+    int serving = 0;
+    for (int i = 0; i < SHARDS_COUNT; i++) {
+        uint32_t n = __atomic_load_n(&shard_slots[i].engine.conns_active, __ATOMIC_ACQUIRE);
+        total += n;
+        if (n > 0)
+            serving++;
+    }
+    expect(total == CONNS_PER_SHARD);
+    expect(serving > 1);
+
+    for (int i = 0; i < CONNS_PER_SHARD; i++)
+        close(fds[i]);
+
+    should("serve consistent snapshots of the shared bank while other shards write it");
+    static client_thread threads[9];
+    const client_role roles[9] = {ROLE_READER, ROLE_READER, ROLE_READER,      ROLE_READER,     ROLE_WRITER,
+                                  ROLE_WRITER, ROLE_WRITER, ROLE_READ_WRITER, ROLE_READ_WRITER};
+    for (int i = 0; i < 9; i++) {
+        threads[i].role = roles[i];
+        threads[i].id = (uint16_t) (i + 1);
+        threads[i].fd = connect_shards();
+        create_client(&threads[i].nmbs, &threads[i].fd);
+        expect(pthread_create(&threads[i].thread, NULL, client_run, &threads[i]) == 0);
+    }
+
+    // The application writes through the seqlock too, until all the clients are done
+    for (int i = 0; i < 9; i++) {
+        for (uint16_t k = 0; pthread_tryjoin_np(threads[i].thread, NULL) != 0; k++) {
+            bank_seqlock_write_begin(&lock);
+            for (int r = 0; r < VALUES_COUNT; r++)
+                registers[r] = (uint16_t) (0xF000 | (k & 0xFFF));
+            bank_seqlock_write_end(&lock);
+        }
+
+        close(threads[i].fd);
+    }
+
+    expect(tcp_shards_error(&shards) == 0);
+    expect_snapshot(registers);
+
+    tcp_shards_destroy(&shards);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "nanomodbus.h"
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UNUSED_PARAM(x) ((x) = (x))
+
+typedef struct queue {
+    uint8_t data[512];
+    uint16_t head;
+    uint16_t tail;
+} queue;
+
+typedef struct endpoint {
+    queue* rx;
+    queue* tx;
+} endpoint;
+
+static queue to_server;
+static queue to_client;
+static endpoint client_end = {&to_client, &to_server};
+static endpoint server_end = {&to_server, &to_client};
+
+static nmbs_t client;
+static nmbs_t server;
+static uint32_t now = 1000;
+
+
+static int32_t read_queue(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    endpoint* end = arg;
+
+    // The server is polled in place of waiting for the response
+    if (end == &client_end && end->rx->head == end->rx->tail)
+        nmbs_server_poll(&server);
+
+    uint16_t read = 0;
+    while (read < count && end->rx->head != end->rx->tail) {
+        buf[read++] = end->rx->data[end->rx->tail];
+        end->rx->tail = (end->rx->tail + 1) % sizeof(end->rx->data);
+    }
+
+    return read;
+}
+
+
+static int32_t write_queue(const uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg) {
+    UNUSED_PARAM(timeout_ms);
+    endpoint* end = arg;
+
+    for (uint16_t i = 0; i < count; i++) {
+        end->tx->data[end->tx->head] = buf[i];
+        end->tx->head = (end->tx->head + 1) % sizeof(end->tx->data);
+    }
+
+    return count;
+}
+
+
+static uint32_t clock_ms(void* arg) {
+    UNUSED_PARAM(arg);
+    return now++;
+}
+
+
+static nmbs_error read_holding_registers(uint16_t address, uint16_t quantity, uint16_t* registers_out, uint8_t unit_id,
+                                         void* arg) {
+    UNUSED_PARAM(unit_id);
+    UNUSED_PARAM(arg);
+
+    for (uint16_t i = 0; i < quantity; i++)
+        registers_out[i] = address + i;
+
+    return NMBS_ERROR_NONE;
+}
+
+
+int main(int argc, char* argv[]) {
+    UNUSED_PARAM(argc);
+    UNUSED_PARAM(argv);
+
+    assert(sizeof(nmbs_trace_record) == 32);
+
+    nmbs_platform_conf platform_conf;
+    nmbs_platform_conf_create(&platform_conf);
+    platform_conf.transport = NMBS_TRANSPORT_RTU;
+    platform_conf.read = read_queue;
+    platform_conf.write = write_queue;
+
+    platform_conf.arg = &client_end;
+    assert(nmbs_client_create(&client, &platform_conf) == NMBS_ERROR_NONE);
+    nmbs_set_read_timeout(&client, 1000);
+    nmbs_set_byte_timeout(&client, 100);
+    nmbs_set_destination_rtu_address(&client, 7);
+
+    nmbs_callbacks callbacks;
+    nmbs_callbacks_create(&callbacks);
+    callbacks.read_holding_registers = read_holding_registers;
+
+    platform_conf.arg = &server_end;
+    assert(nmbs_server_create(&server, 7, &platform_conf, &callbacks) == NMBS_ERROR_NONE);
+    nmbs_set_read_timeout(&server, 0);
+    nmbs_set_byte_timeout(&server, 100);
+
+    nmbs_trace_record client_records[4];
+    nmbs_trace_record server_records[8];
+    nmbs_trace client_trace;
+    nmbs_trace server_trace;
+    assert(nmbs_trace_create(&client_trace, client_records, 3) == NMBS_ERROR_INVALID_ARGUMENT);
+    assert(nmbs_trace_create(&client_trace, client_records, 4) == NMBS_ERROR_NONE);
+    assert(nmbs_trace_create(&server_trace, server_records, 8) == NMBS_ERROR_NONE);
+    nmbs_trace_enable(&client, &client_trace, clock_ms);
+    nmbs_trace_enable(&server, &server_trace, NULL);
+
+    uint16_t regs[20];
+    assert(nmbs_read_holding_registers(&client, 300, 20, regs) == NMBS_ERROR_NONE);
+
+    nmbs_trace_record r[8];
+    assert(nmbs_trace_read(&client_trace, r, 8) == 2);
+
+    assert(r[0].direction == NMBS_TRACE_TX && r[0].unit_id == 7 && r[0].fc == 3);
+    assert(r[0].address == 300 && r[0].quantity == 20);
+    assert(r[0].length == 8 && r[0].result == NMBS_ERROR_NONE);
+    assert(r[0].adu[0] == 7 && r[0].adu[1] == 3);
+
+    assert(r[1].direction == NMBS_TRACE_RX && r[1].unit_id == 7 && r[1].fc == 3);
+    assert(r[1].length == 5 + 40 && r[1].result == NMBS_ERROR_NONE);
+    assert(r[1].adu[2] == 40);
+    assert(r[1].timestamp > r[0].timestamp);
+
+    assert(nmbs_trace_read(&server_trace, r, 8) == 2);
+    assert(r[0].direction == NMBS_TRACE_RX && r[0].address == 300 && r[0].quantity == 20 && r[0].timestamp == 0);
+    assert(r[1].direction == NMBS_TRACE_TX && r[1].length == 45);
+
+    // Corrupted CRC
+    uint8_t frame[8] = {7, 3, 0, 1, 0, 2, 0, 0};
+    assert(nmbs_server_process_frame(&server, frame, sizeof(frame)) == NMBS_ERROR_CRC);
+    assert(nmbs_trace_read(&server_trace, r, 8) == 1);
+    assert(r[0].direction == NMBS_TRACE_RX && r[0].result == NMBS_ERROR_CRC);
+    assert(r[0].address == 1 && r[0].quantity == 2 && r[0].length == 8);
+
+    // New records are dropped when the ring is full
+    for (int i = 0; i < 3; i++)
+        assert(nmbs_read_holding_registers(&client, (uint16_t) i, 1, regs) == NMBS_ERROR_NONE);
+
+    assert(nmbs_trace_dropped(&client_trace) == 2);
+    assert(nmbs_trace_read(&client_trace, r, 1) == 1);
+    assert(r[0].direction == NMBS_TRACE_TX && r[0].address == 0);
+    assert(nmbs_trace_read(&client_trace, r, 8) == 3);
+    assert(r[2].direction == NMBS_TRACE_RX && r[1].address == 1);
+    assert(nmbs_trace_read(&client_trace, r, 8) == 0);
+
+    printf("Trace tests passed\n");
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Offline decoder of nanoMODBUS trace records, see nmbs_trace_create().
+ *
+ * Reads a raw dump of nmbs_trace_record structs, as taken out of the ring with nmbs_trace_read() and sent to a host,
+ * and prints one record per line:
+ *
+ *     <timestamp> <rx|tx> unit <unit_id> fc <fc> a <address> q <quantity> len <length> <result> | <ADU bytes>
+ *
+ * Usage: nmbs_trace_decode [-b] [file]
+ *
+ * Multi-byte fields are decoded as little-endian, unless -b is passed for dumps of big-endian targets.
+ * Records are read from stdin when no file is given.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef NMBS_TRACE
+#define NMBS_TRACE
+#endif
+#include "nanomodbus.h"
+
+
+static uint32_t get(const uint8_t* p, int size, bool big_endian) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++) {
+        const int shift = big_endian ? (size - 1 - i) * 8 : i * 8;
+        value |= (uint32_t) p[i] << shift;
+    }
+
+    return value;
+}
+
+
+static void print_record(const uint8_t* raw, bool big_endian) {
+    const uint32_t timestamp = get(raw, 4, big_endian);
+    const uint8_t direction = raw[4];
+    const uint8_t unit_id = raw[5];
+    const uint8_t fc = raw[6];
+    const nmbs_error result = (nmbs_error) (int8_t) raw[7];
+    const uint16_t address = (uint16_t) get(raw + 8, 2, big_endian);
+    const uint16_t quantity = (uint16_t) get(raw + 10, 2, big_endian);
+    const uint16_t length = (uint16_t) get(raw + 12, 2, big_endian);
+    const uint8_t* adu = raw + 14;
+
+    printf("%10u %s unit %3u fc %3u a %5u q %5u len %3u %s |", timestamp, direction == NMBS_TRACE_TX ? "tx" : "rx",
+           unit_id, fc, address, quantity, length, result == NMBS_ERROR_NONE ? "ok" : nmbs_strerror(result));
+
+    const uint16_t n = length < NMBS_TRACE_ADU_SLICE ? length : NMBS_TRACE_ADU_SLICE;
+    for (uint16_t i = 0; i < n; i++)
+        printf(" %02X", adu[i]);
+
+    if (length > n)
+        printf(" ...");
+
+    printf("\n");
+}
+
+
+int main(int argc, char* argv[]) {
+    bool big_endian = false;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            big_endian = true;
+        }
+        else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: nmbs_trace_decode [-b] [file]\n");
+            return 1;
+        }
+    }
+
+    FILE* f = stdin;
+    if (path) {
+        f = fopen(path, "rb");
+        if (!f) {
+            fprintf(stderr, "Error opening %s\n", path);
+            return 1;
+        }
+    }
+
+    uint8_t raw[sizeof(nmbs_trace_record)];
+    size_t records = 0;
+    size_t n;
+    while ((n = fread(raw, 1, sizeof(raw), f)) == sizeof(raw)) {
+        print_record(raw, big_endian);
+        records++;
+    }
+
+    if (f != stdin)
+        fclose(f);
+
+    if (n != 0) {
+        fprintf(stderr, "Truncated record after %zu records\n", records);
+        return 1;
+    }
+
+    return 0;
+}